@@ -0,0 +1,411 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "benchmarks/graph_generators.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+namespace benchmarks {
+
+namespace {
+
+using Shape = std::vector<int64_t>;
+
+AttributeProto MakeAttribute(const std::string& name, int64_t value) {
+  AttributeProto attr;
+  attr.set_name(name);
+  attr.set_type(AttributeProto::INT);
+  attr.set_i(value);
+  return attr;
+}
+
+AttributeProto MakeAttribute(const std::string& name, float value) {
+  AttributeProto attr;
+  attr.set_name(name);
+  attr.set_type(AttributeProto::FLOAT);
+  attr.set_f(value);
+  return attr;
+}
+
+AttributeProto MakeAttribute(const std::string& name, const Shape& values) {
+  AttributeProto attr;
+  attr.set_name(name);
+  attr.set_type(AttributeProto::INTS);
+  for (const auto value : values) {
+    attr.add_ints(value);
+  }
+  return attr;
+}
+
+AttributeProto MakeAttribute(const std::string& name, GraphProto graph) {
+  AttributeProto attr;
+  attr.set_name(name);
+  attr.set_type(AttributeProto::GRAPH);
+  *attr.mutable_g() = std::move(graph);
+  return attr;
+}
+
+// Appends nodes, initializers and values with unique names to a graph, and
+// records the shape of every value it creates so that finish() can write the
+// value_info of the graph.
+class GraphBuilder {
+ public:
+  GraphBuilder(GraphProto* graph, std::mt19937* rng, int64_t* next_unique)
+      : graph_(graph), rng_(rng), next_unique_(next_unique) {}
+
+  // A builder for a subgraph of a node of this graph, which shares the names
+  // and the random weights of this one.
+  GraphBuilder subgraph(GraphProto* graph) const {
+    return GraphBuilder(graph, rng_, next_unique_);
+  }
+
+  std::string input(const Shape& shape,
+                    int32_t elem_type = TensorProto::FLOAT) {
+    const std::string name = uniqueName("input");
+    fillValueInfo(graph_->add_input(), name, shape, elem_type);
+    return name;
+  }
+
+  void output(const std::string& name) {
+    const auto& info = values_.at(name);
+    fillValueInfo(graph_->add_output(), name, info.first, info.second);
+    outputs_.insert(name);
+  }
+
+  // A float initializer of random values in [low, high).
+  std::string weight(const Shape& dims, float low = -1.0f, float high = 1.0f) {
+    int64_t num_elements = 1;
+    for (const auto dim : dims) {
+      num_elements *= dim;
+    }
+    std::uniform_real_distribution<float> distribution(low, high);
+    std::vector<float> data(static_cast<size_t>(num_elements));
+    for (auto& value : data) {
+      value = distribution(*rng_);
+    }
+    return initializer(dims, TensorProto::FLOAT, data.data(),
+                       data.size() * sizeof(float));
+  }
+
+  std::string scalar(float value) {
+    return initializer({}, TensorProto::FLOAT, &value, sizeof(value));
+  }
+
+  std::string scalar(int64_t value) {
+    return initializer({}, TensorProto::INT64, &value, sizeof(value));
+  }
+
+  std::string ints(const Shape& values) {
+    return initializer({static_cast<int64_t>(values.size())},
+                       TensorProto::INT64, values.data(),
+                       values.size() * sizeof(int64_t));
+  }
+
+  std::string op(const std::string& op_type,
+                 const std::vector<std::string>& inputs, const Shape& shape,
+                 std::vector<AttributeProto> attributes = {},
+                 int32_t elem_type = TensorProto::FLOAT) {
+    const std::string name = uniqueName(op_type);
+    NodeProto* node = graph_->add_node();
+    node->set_op_type(op_type);
+    node->set_name(name);
+    for (const auto& input : inputs) {
+      node->add_input(input);
+    }
+    node->add_output(name);
+    for (auto& attribute : attributes) {
+      *node->add_attribute() = std::move(attribute);
+    }
+    values_[name] = {shape, elem_type};
+    return name;
+  }
+
+  void finish() {
+    for (const auto& value : values_) {
+      if (outputs_.count(value.first) == 0) {
+        fillValueInfo(graph_->add_value_info(), value.first, value.second.first,
+                      value.second.second);
+      }
+    }
+  }
+
+ private:
+  std::string uniqueName(const std::string& prefix) {
+    return prefix + "_" + std::to_string((*next_unique_)++);
+  }
+
+  std::string initializer(const Shape& dims, int32_t data_type,
+                          const void* data, size_t num_bytes) {
+    const std::string name = uniqueName("weight");
+    TensorProto* tensor = graph_->add_initializer();
+    tensor->set_name(name);
+    tensor->set_data_type(data_type);
+    for (const auto dim : dims) {
+      tensor->add_dims(dim);
+    }
+    tensor->set_raw_data(std::string(static_cast<const char*>(data), num_bytes));
+    return name;
+  }
+
+  static void fillValueInfo(ValueInfoProto* info, const std::string& name,
+                            const Shape& shape, int32_t elem_type) {
+    info->set_name(name);
+    auto* tensor_type = info->mutable_type()->mutable_tensor_type();
+    tensor_type->set_elem_type(elem_type);
+    auto* tensor_shape = tensor_type->mutable_shape();
+    for (const auto dim : shape) {
+      tensor_shape->add_dim()->set_dim_value(dim);
+    }
+  }
+
+  GraphProto* graph_;
+  std::mt19937* rng_;
+  int64_t* next_unique_;
+  // name -> (shape, elem_type) of every value created by op()
+  std::map<std::string, std::pair<Shape, int32_t>> values_;
+  std::set<std::string> outputs_;
+};
+
+// Holds the model a generator fills in, and the state its builders share.
+struct ModelBuilder {
+  explicit ModelBuilder(const std::string& graph_name)
+      : graph(model.mutable_graph(), &rng, &next_unique) {
+    model.set_ir_version(7);
+    model.set_producer_name("onnx_optimizer_bench");
+    model.add_opset_import()->set_version(13);
+    model.mutable_graph()->set_name(graph_name);
+  }
+
+  ModelProto finish() {
+    graph.finish();
+    return std::move(model);
+  }
+
+  ModelProto model;
+  std::mt19937 rng{0};
+  int64_t next_unique = 0;
+  GraphBuilder graph;
+};
+
+}  // namespace
+
+ModelProto MakeMLP(int64_t size) {
+  constexpr int64_t kBatch = 8;
+  constexpr int64_t kWidth = 128;
+  const Shape shape = {kBatch, kWidth};
+
+  ModelBuilder builder("mlp");
+  auto& g = builder.graph;
+  std::string x = g.input(shape);
+  for (int64_t i = 0; i < size; ++i) {
+    x = g.op("MatMul", {x, g.weight({kWidth, kWidth})}, shape);
+    x = g.op("Add", {x, g.weight({kWidth})}, shape);
+    x = g.op("Relu", {x}, shape);
+    if (i % 4 == 1) {
+      x = g.op("Dropout", {x}, shape);
+    } else if (i % 4 == 3) {
+      x = g.op("Identity", {x}, shape);
+    }
+  }
+  g.output(x);
+  return builder.finish();
+}
+
+ModelProto MakeResNet(int64_t size) {
+  constexpr int64_t kChannels = 32;
+  constexpr int64_t kSpatial = 28;
+  constexpr int64_t kClasses = 10;
+  const Shape shape = {1, kChannels, kSpatial, kSpatial};
+
+  ModelBuilder builder("resnet");
+  auto& g = builder.graph;
+  auto conv_bn = [&g, &shape](const std::string& x, const Shape& weight_dims,
+                              bool padded) {
+    std::vector<AttributeProto> attributes = {
+        MakeAttribute("kernel_shape", Shape{3, 3})};
+    if (padded) {
+      attributes.push_back(MakeAttribute("pads", Shape{1, 1, 1, 1}));
+    }
+    const auto conv =
+        g.op("Conv", {x, g.weight(weight_dims)}, shape, std::move(attributes));
+    return g.op("BatchNormalization",
+                {conv, g.weight({kChannels}), g.weight({kChannels}),
+                 g.weight({kChannels}), g.weight({kChannels}, 0.5f, 1.5f)},
+                shape, {MakeAttribute("epsilon", 1e-5f)});
+  };
+
+  const auto input = g.input({1, 3, kSpatial, kSpatial});
+  const auto padded = g.op("Pad", {input, g.ints({0, 0, 1, 1, 0, 0, 1, 1})},
+                           {1, 3, kSpatial + 2, kSpatial + 2});
+  std::string x =
+      g.op("Relu", {conv_bn(padded, {kChannels, 3, 3, 3}, false)}, shape);
+  for (int64_t i = 0; i < size; ++i) {
+    const Shape weight_dims = {kChannels, kChannels, 3, 3};
+    auto y = g.op("Relu", {conv_bn(x, weight_dims, true)}, shape);
+    y = conv_bn(y, weight_dims, true);
+    x = g.op("Relu", {g.op("Add", {y, x}, shape)}, shape);
+  }
+  x = g.op("GlobalAveragePool", {x}, {1, kChannels, 1, 1});
+  x = g.op("Flatten", {x}, {1, kChannels});
+  x = g.op("Gemm", {x, g.weight({kChannels, kClasses}), g.weight({kClasses})},
+           {1, kClasses});
+  g.output(x);
+  return builder.finish();
+}
+
+ModelProto MakeTransformer(int64_t size) {
+  constexpr int64_t kSequence = 64;
+  constexpr int64_t kHidden = 128;
+  constexpr int64_t kHeads = 4;
+  constexpr int64_t kHeadSize = kHidden / kHeads;
+  constexpr int64_t kFeedForward = 4 * kHidden;
+  const Shape shape = {1, kSequence, kHidden};
+  const Shape heads_shape = {1, kSequence, kHeads, kHeadSize};
+
+  ModelBuilder builder("transformer");
+  auto& g = builder.graph;
+  auto dense = [&g](const std::string& x, int64_t in, int64_t out) {
+    const Shape out_shape = {1, kSequence, out};
+    const auto y = g.op("MatMul", {x, g.weight({in, out})}, out_shape);
+    return g.op("Add", {y, g.weight({out})}, out_shape);
+  };
+  auto layer_norm = [&g, &shape](const std::string& x) {
+    const Shape reduced_shape = {1, kSequence, 1};
+    const std::vector<AttributeProto> reduce_attributes = {
+        MakeAttribute("axes", Shape{-1})};
+    const auto mean = g.op("ReduceMean", {x}, reduced_shape, reduce_attributes);
+    const auto centered = g.op("Sub", {x, mean}, shape);
+    const auto squared = g.op("Pow", {centered, g.scalar(2.0f)}, shape);
+    auto variance =
+        g.op("ReduceMean", {squared}, reduced_shape, reduce_attributes);
+    variance = g.op("Add", {variance, g.scalar(1e-5f)}, reduced_shape);
+    const auto deviation = g.op("Sqrt", {variance}, reduced_shape);
+    auto y = g.op("Div", {centered, deviation}, shape);
+    y = g.op("Mul", {y, g.weight({kHidden})}, shape);
+    return g.op("Add", {y, g.weight({kHidden})}, shape);
+  };
+  auto split_heads = [&g, &heads_shape](const std::string& x,
+                                        const Shape& perm) {
+    const auto y = g.op("Reshape", {x, g.ints(heads_shape)}, heads_shape);
+    Shape transposed_shape;
+    for (const auto axis : perm) {
+      transposed_shape.push_back(heads_shape[static_cast<size_t>(axis)]);
+    }
+    return g.op("Transpose", {y}, transposed_shape,
+                {MakeAttribute("perm", perm)});
+  };
+
+  std::string x = g.op("Identity", {g.input(shape)}, shape);
+  for (int64_t i = 0; i < size; ++i) {
+    const auto q = split_heads(dense(x, kHidden, kHidden), {0, 2, 1, 3});
+    const auto k = split_heads(dense(x, kHidden, kHidden), {0, 2, 3, 1});
+    const auto v = split_heads(dense(x, kHidden, kHidden), {0, 2, 1, 3});
+    const Shape scores_shape = {1, kHeads, kSequence, kSequence};
+    auto scores = g.op("MatMul", {q, k}, scores_shape);
+    scores = g.op("Div",
+                  {scores, g.scalar(std::sqrt(static_cast<float>(kHeadSize)))},
+                  scores_shape);
+    scores = g.op("Softmax", {scores}, scores_shape,
+                  {MakeAttribute("axis", int64_t{-1})});
+    auto context =
+        g.op("MatMul", {scores, v}, {1, kHeads, kSequence, kHeadSize});
+    context = g.op("Transpose", {context}, heads_shape,
+                   {MakeAttribute("perm", Shape{0, 2, 1, 3})});
+    context = g.op("Reshape", {context, g.ints(shape)}, shape);
+    const auto attention = dense(context, kHidden, kHidden);
+    x = layer_norm(g.op("Add", {x, attention}, shape));
+
+    auto hidden = dense(x, kHidden, kFeedForward);
+    hidden = g.op("Relu", {hidden}, {1, kSequence, kFeedForward});
+    hidden = dense(hidden, kFeedForward, kHidden);
+    x = layer_norm(g.op("Add", {x, hidden}, shape));
+  }
+  g.output(x);
+  return builder.finish();
+}
+
+ModelProto MakeControlFlow(int64_t size) {
+  constexpr int64_t kBatch = 8;
+  constexpr int64_t kWidth = 64;
+  const Shape shape = {kBatch, kWidth};
+  const Shape transposed_shape = {kWidth, kBatch};
+  const std::vector<AttributeProto> transpose_attributes = {
+      MakeAttribute("perm", Shape{1, 0})};
+
+  ModelBuilder builder("control_flow");
+  auto& g = builder.graph;
+  // a pair of transposes that cancel out
+  auto round_trip = [&](GraphBuilder& body, const std::string& x) {
+    const auto y =
+        body.op("Transpose", {x}, transposed_shape, transpose_attributes);
+    return body.op("Transpose", {y}, shape, transpose_attributes);
+  };
+
+  std::string x = g.input(shape);
+  const auto cond = g.input({}, TensorProto::BOOL);
+  const auto trip_count = g.scalar(int64_t{2});
+  const auto bias = g.weight({kWidth});
+  for (int64_t i = 0; i < size; ++i) {
+    if (i % 2 == 0) {
+      GraphProto then_graph;
+      then_graph.set_name("then_" + std::to_string(i));
+      auto then_body = g.subgraph(&then_graph);
+      auto y = then_body.op("Identity", {round_trip(then_body, x)}, shape);
+      y = then_body.op("Relu", {y}, shape);
+      then_body.output(y);
+      then_body.finish();
+
+      GraphProto else_graph;
+      else_graph.set_name("else_" + std::to_string(i));
+      auto else_body = g.subgraph(&else_graph);
+      y = else_body.op("Relu", {else_body.op("Identity", {x}, shape)}, shape);
+      else_body.output(y);
+      else_body.finish();
+
+      x = g.op("If", {cond}, shape,
+               {MakeAttribute("then_branch", std::move(then_graph)),
+                MakeAttribute("else_branch", std::move(else_graph))});
+    } else {
+      GraphProto loop_graph;
+      loop_graph.set_name("loop_" + std::to_string(i));
+      auto loop_body = g.subgraph(&loop_graph);
+      loop_body.input({}, TensorProto::INT64);
+      const auto cond_in = loop_body.input({}, TensorProto::BOOL);
+      const auto carried = loop_body.input(shape);
+      const auto cond_out =
+          loop_body.op("Identity", {cond_in}, {}, {}, TensorProto::BOOL);
+      const auto y = loop_body.op("Add", {round_trip(loop_body, carried), bias},
+                                  shape);
+      loop_body.output(cond_out);
+      loop_body.output(y);
+      loop_body.finish();
+
+      x = g.op("Loop", {trip_count, cond, x}, shape,
+               {MakeAttribute("body", std::move(loop_graph))});
+    }
+  }
+  g.output(x);
+  return builder.finish();
+}
+
+const std::vector<ModelGenerator>& GetModelGenerators() {
+  static const std::vector<ModelGenerator> generators = {
+      {"mlp", MakeMLP, {8, 64, 256}},
+      {"resnet", MakeResNet, {4, 16, 64}},
+      {"transformer", MakeTransformer, {1, 4, 12}},
+      {"control_flow", MakeControlFlow, {8, 64, 256}},
+  };
+  return generators;
+}
+
+}  // namespace benchmarks
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,51 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <onnx/onnx_pb.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+namespace benchmarks {
+
+// Synthetic models for the benchmarks. They carry shapes for every value and
+// random weights, and contain the patterns the fuse and elimination passes
+// look for, so every pass has work to do. |size| scales the number of
+// repeated blocks; the same |size| always produces the same model.
+
+// MatMul + Add + Relu layers, with a Dropout and an Identity every few layers.
+ModelProto MakeMLP(int64_t size);
+
+// Conv + BatchNormalization + Relu residual blocks behind a padded stem.
+ModelProto MakeResNet(int64_t size);
+
+// Transformer encoder blocks: separate Q, K and V projections of the same
+// input, multi-head attention spelled out with Reshape, Transpose and Softmax,
+// a decomposed LayerNorm and a feed-forward network.
+ModelProto MakeTransformer(int64_t size);
+
+// A chain of If and Loop nodes whose bodies contain transposes that cancel
+// out, identities and captured values of the outer graph.
+ModelProto MakeControlFlow(int64_t size);
+
+struct ModelGenerator {
+  std::string name;
+  ModelProto (*make)(int64_t size);
+  // the sizes the benchmarks run the generator at
+  std::vector<int64_t> sizes;
+};
+
+const std::vector<ModelGenerator>& GetModelGenerators();
+
+}  // namespace benchmarks
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
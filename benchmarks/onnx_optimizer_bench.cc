@@ -0,0 +1,357 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Benchmarks of the optimizer on the synthetic models of graph_generators.h.
+// For every model and size, importing the model into the IR, running each of
+// the fuse and elimination passes, the whole optimization, exporting the IR
+// and serializing the model are measured separately, e.g.
+//
+//   onnx_optimizer_bench --benchmark_filter='^pass/fuse_bn_into_conv/'
+//
+// Every benchmark also reports its heap allocations and peak heap usage, which
+// show up in the JSON output (--benchmark_format=json). Those of a pass leave
+// out the import of the model it runs on.
+
+#include <benchmark/benchmark.h>
+#include <onnx/common/ir_pb_converter.h>
+#include <onnx/onnx_pb.h>
+#include <onnxoptimizer/optimize.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "benchmarks/graph_generators.h"
+
+namespace {
+
+// Heap usage, counted by the replacements of operator new and delete below
+// while a MemoryManager run is in progress.
+std::atomic<bool> tracking_heap{false};
+std::atomic<int64_t> num_allocs{0};
+std::atomic<int64_t> total_allocated_bytes{0};
+std::atomic<int64_t> heap_bytes_in_use{0};
+std::atomic<int64_t> max_heap_bytes_in_use{0};
+
+// Every block is preceded by a header, which remembers where the block
+// malloc returned starts, so that over-aligned blocks can be freed too.
+struct BlockHeader {
+  void* block;
+  size_t size;
+  // whether the allocation was counted, and its release must be too
+  bool tracked;
+};
+
+void* AllocateBlock(size_t size,
+                    size_t alignment = alignof(std::max_align_t)) noexcept {
+  if (alignment < alignof(std::max_align_t)) {
+    alignment = alignof(std::max_align_t);
+  }
+  void* block = std::malloc(size + sizeof(BlockHeader) + alignment - 1);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  const auto address =
+      (reinterpret_cast<uintptr_t>(block) + sizeof(BlockHeader) + alignment -
+       1) &
+      ~static_cast<uintptr_t>(alignment - 1);
+  void* ptr = reinterpret_cast<void*>(address);
+  auto* header = static_cast<BlockHeader*>(ptr) - 1;
+  header->block = block;
+  header->size = size;
+  header->tracked = tracking_heap.load(std::memory_order_relaxed);
+  if (header->tracked) {
+    const auto bytes = static_cast<int64_t>(size);
+    num_allocs.fetch_add(1, std::memory_order_relaxed);
+    total_allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    const int64_t in_use =
+        heap_bytes_in_use.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t max_in_use = max_heap_bytes_in_use.load(std::memory_order_relaxed);
+    while (in_use > max_in_use &&
+           !max_heap_bytes_in_use.compare_exchange_weak(
+               max_in_use, in_use, std::memory_order_relaxed)) {
+    }
+  }
+  return ptr;
+}
+
+void* AllocateBlockOrThrow(size_t size,
+                           size_t alignment = alignof(std::max_align_t)) {
+  void* ptr = AllocateBlock(size, alignment);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void FreeBlock(void* ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  const auto* header = static_cast<BlockHeader*>(ptr) - 1;
+  if (header->tracked) {
+    heap_bytes_in_use.fetch_sub(static_cast<int64_t>(header->size),
+                                std::memory_order_relaxed);
+  }
+  std::free(header->block);
+}
+
+// Stops counting the allocations of the scope, e.g. the setup of a benchmark
+// done while its timing is paused. The blocks allocated in the scope aren't
+// counted when they are released either.
+class PauseHeapTracking {
+ public:
+  PauseHeapTracking() : was_tracking_(tracking_heap.exchange(false)) {}
+  ~PauseHeapTracking() {
+    tracking_heap = was_tracking_;
+  }
+
+ private:
+  const bool was_tracking_;
+};
+
+class HeapMemoryManager : public benchmark::MemoryManager {
+ public:
+  void Start() override {
+    num_allocs = 0;
+    total_allocated_bytes = 0;
+    heap_bytes_in_use = 0;
+    max_heap_bytes_in_use = 0;
+    tracking_heap = true;
+  }
+
+  void Stop(Result& result) override {
+    tracking_heap = false;
+    result.num_allocs = num_allocs;
+    result.max_bytes_used = max_heap_bytes_in_use;
+    result.total_allocated_bytes = total_allocated_bytes;
+    result.net_heap_growth = heap_bytes_in_use;
+  }
+
+  // Still pure virtual in some releases of Google Benchmark.
+  void Stop(Result* result) {
+    Stop(*result);
+  }
+};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return AllocateBlockOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+  return AllocateBlockOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return AllocateBlock(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return AllocateBlock(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  FreeBlock(ptr);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  return AllocateBlockOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return AllocateBlockOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return AllocateBlock(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return AllocateBlock(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  FreeBlock(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  FreeBlock(ptr);
+}
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+namespace benchmarks {
+namespace {
+
+// Models are generated once per generator and size, outside of any benchmark.
+const ModelProto& GetModel(const ModelGenerator& generator, int64_t size) {
+  static std::map<std::pair<std::string, int64_t>, ModelProto> models;
+  auto key = std::make_pair(generator.name, size);
+  auto it = models.find(key);
+  if (it == models.end()) {
+    it = models.emplace(std::move(key), generator.make(size)).first;
+  }
+  return it->second;
+}
+
+void BM_Import(benchmark::State& state, const ModelGenerator& generator) {
+  const ModelProto& model = GetModel(generator, state.range(0));
+  for (auto _ : state) {
+    std::unique_ptr<Graph> graph(ImportModelProto(model));
+    benchmark::DoNotOptimize(graph.get());
+  }
+}
+
+void BM_Pass(benchmark::State& state, const ModelGenerator& generator,
+             const std::string& pass_name) {
+  const ModelProto& model = GetModel(generator, state.range(0));
+  const auto pass = Optimizer::passes.find(pass_name);
+  int64_t num_transforms = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::shared_ptr<Graph> graph;
+    {
+      // only the heap usage of the pass is reported
+      PauseHeapTracking pause;
+      graph = ImportModelProto(model);
+    }
+    state.ResumeTiming();
+    const auto analysis = pass->runPass(*graph);
+    state.PauseTiming();
+    {
+      PauseHeapTracking pause;
+      const auto count_analysis =
+          std::dynamic_pointer_cast<CountBasedPassAnalysis>(analysis);
+      if (count_analysis) {
+        num_transforms = count_analysis->num_positive_transforms;
+      }
+      graph.reset();
+    }
+    state.ResumeTiming();
+  }
+  state.counters["transforms"] = static_cast<double>(num_transforms);
+}
+
+void BM_Optimize(benchmark::State& state, const ModelGenerator& generator) {
+  const ModelProto& model = GetModel(generator, state.range(0));
+  const auto pass_names = GetFuseAndEliminationPass();
+  for (auto _ : state) {
+    auto optimized = Optimize(model, pass_names);
+    benchmark::DoNotOptimize(optimized);
+  }
+}
+
+void BM_Export(benchmark::State& state, const ModelGenerator& generator) {
+  const ModelProto& model = GetModel(generator, state.range(0));
+  const std::shared_ptr<Graph> graph(ImportModelProto(model));
+  for (auto _ : state) {
+    ModelProto exported;
+    ExportModelProto(&exported, graph);
+    benchmark::DoNotOptimize(exported);
+  }
+}
+
+void BM_Serialize(benchmark::State& state, const ModelGenerator& generator) {
+  const ModelProto& model = GetModel(generator, state.range(0));
+  for (auto _ : state) {
+    std::string bytes;
+    model.SerializeToString(&bytes);
+    benchmark::DoNotOptimize(bytes);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(model.ByteSizeLong()));
+}
+
+void RegisterBenchmarks() {
+  const auto pass_names = GetFuseAndEliminationPass();
+  for (const auto& generator : GetModelGenerators()) {
+    std::vector<benchmark::internal::Benchmark*> benchmarks = {
+        benchmark::RegisterBenchmark(("import/" + generator.name).c_str(),
+                                     BM_Import, generator),
+        benchmark::RegisterBenchmark(("optimize/" + generator.name).c_str(),
+                                     BM_Optimize, generator),
+        benchmark::RegisterBenchmark(("export/" + generator.name).c_str(),
+                                     BM_Export, generator),
+        benchmark::RegisterBenchmark(("serialize/" + generator.name).c_str(),
+                                     BM_Serialize, generator),
+    };
+    for (const auto& pass_name : pass_names) {
+      benchmarks.push_back(benchmark::RegisterBenchmark(
+          ("pass/" + pass_name + "/" + generator.name).c_str(), BM_Pass,
+          generator, pass_name));
+    }
+    for (auto* benchmark : benchmarks) {
+      benchmark->Unit(benchmark::kMicrosecond);
+      for (const auto size : generator.sizes) {
+        benchmark->Arg(size);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace benchmarks
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  ONNX_NAMESPACE::optimization::benchmarks::RegisterBenchmarks();
+  HeapMemoryManager memory_manager;
+  benchmark::RegisterMemoryManager(&memory_manager);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::RegisterMemoryManager(nullptr);
+  benchmark::Shutdown();
+  return 0;
+}
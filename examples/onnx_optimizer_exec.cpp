@@ -31,15 +31,18 @@ int main(int argc, char** argv) {
   }
 
   try {
+    onnx::optimization::TensorDataSources sources;
+    onnx::optimization::TensorDataSourcesScope scope(&sources);
     ONNX_NAMESPACE::ModelProto model;
-    onnx::optimization::loadModel(&model, model_in_path, true);
-    onnx::checker::check_model(model);
+    // the weights stay in their data files until they are needed
+    onnx::optimization::loadModelMapped(&model, model_in_path, &sources);
+    onnx::checker::check_model(model_in_path);
     auto new_model = onnx::optimization::Optimize(
         model, onnx::optimization::GetFuseAndEliminationPass());
-    onnx::checker::check_model(new_model);
     bool save_external_data = !model_data_path.empty();
     onnx::optimization::saveModel(&new_model, model_out_path,
                                   save_external_data, model_data_path);
+    onnx::checker::check_model(model_out_path);
 
   } catch (std::exception& e) {
     std::cout << e.what() << std::endl;
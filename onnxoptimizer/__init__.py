@@ -12,7 +12,7 @@ import onnx
 import onnxoptimizer.onnx_opt_cpp2py_export as C
 from .version import version as __version__  # noqa
 from onnx import ModelProto
-from typing import Text, Sequence, Optional
+from typing import Any, Callable, Dict, List, Text, Sequence, Optional, Tuple
 from onnxoptimizer.onnxoptimizer_main import main
 import tempfile
 import os
@@ -22,12 +22,25 @@ get_available_passes = C.get_available_passes
 get_fuse_and_elimination_passes = C.get_fuse_and_elimination_passes
 
 
-def optimize(model, passes=None, fixed_point=False):  # type: (ModelProto, Optional[Sequence[Text]], bool) -> ModelProto
+def optimize(model, passes=None, fixed_point=False, worklist=False, dispatch=False, scheduled=False, num_threads=1):  # type: (ModelProto, Optional[Sequence[Text]], bool, bool, bool, bool, int) -> ModelProto
     """Apply the optimization on the serialized ModelProto.
 
     Arguments:
         model (ModelProto): model
         passes (list of string): list of optimization names
+        fixed_point (bool): run the passes repeatedly until the model stops changing
+        worklist (bool): optimize to a fixed point, but only revisit the nodes
+            touched by rewrites after the first round
+        scheduled (bool): like fixed_point, but after a pass has changed the
+            model only rerun the passes that look at the op types it produced
+        dispatch (bool): like fixed_point, but run consecutive passes together
+            in a single walk over the graph, handing every node only to the
+            passes that can match it
+        num_threads (int): optimize the bodies of If/Loop/Scan nodes
+            concurrently on this many threads, 0 means one per CPU core.
+            Ignored if worklist, scheduled or dispatch is set
+
+    At most one of fixed_point, worklist, scheduled and dispatch can be set.
 
     Return:
         return (ModelProto) optimized model
@@ -38,33 +51,101 @@ def optimize(model, passes=None, fixed_point=False):  # type: (ModelProto, Optio
     if not isinstance(model, ModelProto):
         raise ValueError(
             'Optimizer only accepts ModelProto, incorrect type: {}'.format(type(model)))
+    _check_single_mode(fixed_point, worklist, dispatch, scheduled)
     try:
         model_str = model.SerializeToString()
-        if fixed_point:
+        if scheduled:
+            optimized_model_str = C.optimize_scheduled(model_str, passes)
+        elif dispatch:
+            optimized_model_str = C.optimize_dispatch(model_str, passes)
+        elif worklist:
+            optimized_model_str = C.optimize_worklist(model_str, passes)
+        elif num_threads != 1:
+            optimized_model_str = C.optimize_parallel(model_str, passes, fixed_point, num_threads)
+        elif fixed_point:
             optimized_model_str = C.optimize_fixedpoint(model_str, passes)
         else:
             optimized_model_str = C.optimize(model_str, passes)
 
         return onnx.load_from_string(optimized_model_str)
     except ValueError:
-        file_src = tempfile.NamedTemporaryFile(suffix=".onnx", delete=False)
-        file_dest = tempfile.NamedTemporaryFile(suffix=".onnx", delete=False)
-        data_file_src = tempfile.NamedTemporaryFile(delete=False)
-        data_file_dest = tempfile.NamedTemporaryFile(delete=False)
-        data_src_rel_filename = os.path.relpath(data_file_src.name, os.path.dirname(file_src.name))
-        data_dest_rel_filename = os.path.relpath(data_file_dest.name, os.path.dirname(file_dest.name))
-        try:
-            onnx.save(model, file_src.name, save_as_external_data=True, location=data_src_rel_filename, convert_attribute=True,)
-            if fixed_point:
-                C.optimize_fixedpoint_from_path(file_src.name, file_dest.name, passes, data_dest_rel_filename)
-            else:
-                C.optimize_from_path(file_src.name, file_dest.name, passes, data_dest_rel_filename)
-            return onnx.load(file_dest, load_external_data=True)
-        finally:
-            os.remove(file_src.name)
-            os.remove(file_dest.name)
-            os.remove(data_file_src.name)
-            os.remove(data_file_dest.name)
-
-
-__all__ = ['optimize', 'get_available_passes', 'get_fuse_and_elimination_passes', 'main']
+        if scheduled:
+            optimize_from_path = C.optimize_scheduled_from_path
+        elif dispatch:
+            optimize_from_path = C.optimize_dispatch_from_path
+        elif worklist:
+            optimize_from_path = C.optimize_worklist_from_path
+        elif num_threads != 1:
+            optimize_from_path = lambda *args: C.optimize_parallel_from_path(
+                *args, fixed_point, num_threads)
+        elif fixed_point:
+            optimize_from_path = C.optimize_fixedpoint_from_path
+        else:
+            optimize_from_path = C.optimize_from_path
+        optimized_model, _ = _optimize_through_files(model, passes, optimize_from_path)
+        return optimized_model
+
+
+def optimize_with_profile(model, passes=None, fixed_point=False, worklist=False, dispatch=False, scheduled=False, num_threads=1):  # type: (ModelProto, Optional[Sequence[Text]], bool, bool, bool, bool, int) -> Tuple[ModelProto, List[Dict[Text, Any]]]
+    """Apply the optimization like `optimize` and profile the passes.
+
+    Arguments:
+        model (ModelProto): model
+        passes (list of string): list of optimization names
+        fixed_point, worklist, dispatch, scheduled, num_threads: see `optimize`.
+            A dispatch run profiles every walk over the graph as a single run
+            named after all of the passes walking it
+
+    Return:
+        return (ModelProto, list of dict) optimized model and one dict per run
+            of a pass, in the order they ran, with the keys pass_name,
+            iteration, wall_time_ms, num_predicate_calls, num_transforms,
+            node_count_delta and initializer_count_delta
+    """
+
+    if passes is None:
+        passes = get_fuse_and_elimination_passes()
+    if not isinstance(model, ModelProto):
+        raise ValueError(
+            'Optimizer only accepts ModelProto, incorrect type: {}'.format(type(model)))
+    _check_single_mode(fixed_point, worklist, dispatch, scheduled)
+    try:
+        model_str = model.SerializeToString()
+        optimized_model_str, profile = C.optimize_profiled(
+            model_str, passes, fixed_point, worklist, dispatch, scheduled, num_threads)
+        return onnx.load_from_string(optimized_model_str), profile
+    except ValueError:
+        return _optimize_through_files(
+            model, passes,
+            lambda *args: C.optimize_profiled_from_path(
+                *args, fixed_point, worklist, dispatch, scheduled, num_threads))
+
+
+def _check_single_mode(fixed_point, worklist, dispatch, scheduled):  # type: (bool, bool, bool, bool) -> None
+    modes = [name for name, enabled in [("fixed_point", fixed_point), ("worklist", worklist),
+                                        ("dispatch", dispatch), ("scheduled", scheduled)] if enabled]
+    if len(modes) > 1:
+        raise ValueError(
+            'Only one of fixed_point, worklist, dispatch and scheduled can be set, got: {}'.format(
+                ', '.join(modes)))
+
+
+# Optimizes a model that is too large to be serialized into a single string by
+# saving it with external data. optimize_from_path is called with the paths of
+# the model files, the passes and the name of the data file to write, and its
+# result is returned along with the optimized model.
+def _optimize_through_files(model, passes, optimize_from_path):  # type: (ModelProto, Sequence[Text], Callable[..., Any]) -> Tuple[ModelProto, Any]
+    # onnx refuses to write external data into a file that already exists, so
+    # the data files are named inside a fresh directory rather than created
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        file_src = os.path.join(tmp_dir, "model.onnx")
+        file_dest = os.path.join(tmp_dir, "optimized_model.onnx")
+        onnx.save(model, file_src, save_as_external_data=True, location="model.data", convert_attribute=True,)
+        result = optimize_from_path(file_src, file_dest, passes, "optimized_model.data")
+        optimized_model = onnx.load(file_dest, load_external_data=True)
+        # onnx.save moved the weights of |model| to the data file
+        onnx.load_external_data_for_model(model, tmp_dir)
+        return optimized_model, result
+
+
+__all__ = ['optimize', 'optimize_with_profile', 'get_available_passes', 'get_fuse_and_elimination_passes', 'main']
@@ -70,24 +70,30 @@ static bool SerializeProtoAndCopy(const ONNX_NAMESPACE::ModelProto& p,
 }
 
 static std::pair<bool, ONNX_NAMESPACE::ModelProto> Optimize(
-    const ONNX_NAMESPACE::ModelProto& proto, const char** passes,
-    const bool fix_point) {
+    ONNX_NAMESPACE::ModelProto proto, const char** passes,
+    const bool fix_point,
+    std::vector<ONNX_NAMESPACE::optimization::PassRunProfile>* profile =
+        nullptr) {
   std::vector<std::string> names;
-  const char* p = passes[0];
-  while (p) {
-    names.push_back(std::string(p));
-    p++;
+  for (size_t i = 0; passes[i]; i++) {
+    names.push_back(std::string(passes[i]));
   }
   if (names.empty()) {
     return std::make_pair(false, ONNX_NAMESPACE::ModelProto());
   }
   try {
-    if (fix_point) {
-      auto result = ONNX_NAMESPACE::optimization::OptimizeFixed(proto, names);
-      return std::make_pair(true, result);
+    if (profile) {
+      auto result = ONNX_NAMESPACE::optimization::OptimizeProfiled(
+          std::move(proto), names, fix_point, *profile);
+      return std::make_pair(true, std::move(result));
+    } else if (fix_point) {
+      auto result = ONNX_NAMESPACE::optimization::OptimizeFixed(
+          std::move(proto), names);
+      return std::make_pair(true, std::move(result));
     } else {
-      auto result = ONNX_NAMESPACE::optimization::Optimize(proto, names);
-      return std::make_pair(true, result);
+      auto result =
+          ONNX_NAMESPACE::optimization::Optimize(std::move(proto), names);
+      return std::make_pair(true, std::move(result));
     }
   } catch (std::exception& e) {
     std::cerr << e.what();
@@ -109,13 +115,88 @@ bool C_API_Optimize(const char* mp_in_buffer, const size_t mp_in_size,
   }
   bool ok = false;
   ONNX_NAMESPACE::ModelProto result{};
-  std::tie(ok, result) = Optimize(proto, passes, fix_point);
+  std::tie(ok, result) = Optimize(std::move(proto), passes, fix_point);
   if (!ok) {
     return false;
   }
   return SerializeProtoAndCopy(result, mp_out_buffer, mp_out_size);
 }
 
+static C_API_PassRunProfile* CopyProfile(
+    const std::vector<ONNX_NAMESPACE::optimization::PassRunProfile>&
+        profile) {
+  // one spare entry, so that an empty profile is not mistaken for a failed
+  // allocation
+  auto* res_profile = static_cast<C_API_PassRunProfile*>(
+      calloc(profile.size() + 1, sizeof(C_API_PassRunProfile)));
+  if (!res_profile) {
+    return NULL;
+  }
+  for (size_t i = 0; i < profile.size(); i++) {
+    const auto& from = profile[i];
+    auto& to = res_profile[i];
+    char* pass_name = static_cast<char*>(malloc(from.pass_name.size() + 1));
+    if (pass_name) {
+      memcpy(pass_name, from.pass_name.c_str(), from.pass_name.size() + 1);
+    }
+    to.pass_name = pass_name;
+    to.iteration = from.iteration;
+    to.wall_time_ms = from.wall_time_ms;
+    to.num_predicate_calls = from.num_predicate_calls;
+    to.num_transforms = from.num_transforms;
+    to.node_count_delta = from.node_count_delta;
+    to.initializer_count_delta = from.initializer_count_delta;
+  }
+  return res_profile;
+}
+
+bool C_API_OptimizeWithProfile(const char* mp_in_buffer,
+                               const size_t mp_in_size, const char** passes,
+                               const bool fix_point, void** mp_out_buffer,
+                               size_t* mp_out_size,
+                               C_API_PassRunProfile** profile,
+                               size_t* profile_size) {
+  if (!mp_in_buffer || mp_in_size == 0 || !passes || !mp_out_buffer ||
+      !mp_out_size || !profile || !profile_size) {
+    return false;
+  }
+
+  ONNX_NAMESPACE::ModelProto proto{};
+  if (!ONNX_NAMESPACE::ParseProtoFromBytes(&proto, mp_in_buffer, mp_in_size)) {
+    return false;
+  }
+  bool ok = false;
+  ONNX_NAMESPACE::ModelProto result{};
+  std::vector<ONNX_NAMESPACE::optimization::PassRunProfile> pass_runs;
+  std::tie(ok, result) =
+      Optimize(std::move(proto), passes, fix_point, &pass_runs);
+  if (!ok) {
+    return false;
+  }
+  C_API_PassRunProfile* res_profile = CopyProfile(pass_runs);
+  if (!res_profile) {
+    return false;
+  }
+  if (!SerializeProtoAndCopy(result, mp_out_buffer, mp_out_size)) {
+    C_API_ReleaseProfile(res_profile, pass_runs.size());
+    return false;
+  }
+  *profile = res_profile;
+  *profile_size = pass_runs.size();
+  return true;
+}
+
+void C_API_ReleaseProfile(C_API_PassRunProfile* profile,
+                          const size_t profile_size) {
+  if (!profile) {
+    return;
+  }
+  for (size_t i = 0; i < profile_size; i++) {
+    free(const_cast<char*>(profile[i].pass_name));
+  }
+  free(profile);
+}
+
 bool C_API_OtimizeFromFile(const char* import_model_path,
                            const char* export_model_path, const char** passes,
                            const bool fix_point, const bool save_external_data,
@@ -125,12 +206,14 @@ bool C_API_OtimizeFromFile(const char* import_model_path,
     return false;
   }
   try {
+    ONNX_NAMESPACE::optimization::TensorDataSources sources;
+    ONNX_NAMESPACE::optimization::TensorDataSourcesScope scope(&sources);
     ONNX_NAMESPACE::ModelProto proto{};
-    ONNX_NAMESPACE::optimization::loadModel(
-        &proto, std::string(import_model_path), true);
+    ONNX_NAMESPACE::optimization::loadModelMapped(
+        &proto, std::string(import_model_path), &sources);
     bool ok = false;
     ONNX_NAMESPACE::ModelProto result{};
-    std::tie(ok, result) = Optimize(proto, passes, fix_point);
+    std::tie(ok, result) = Optimize(std::move(proto), passes, fix_point);
     if (!ok) {
       return false;
     }
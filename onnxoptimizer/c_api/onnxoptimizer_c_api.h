@@ -1,6 +1,9 @@
 #ifndef ONNXOPTIMIZER_C_API_H
 #define ONNXOPTIMIZER_C_API_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,10 +17,37 @@ const char** C_API_GetFuseAndEliminationPass();
 void C_API_ReleasePasses(const char*** passes);
 
 // caller must call free to release mp_out buffer
+// C_API_Optimize and C_API_OtimizeFromFile may be called from several threads
+// at the same time
 bool C_API_Optimize(const char* mp_in, const size_t mp_in_size,
                     const char** passes, const bool fix_point, void** mp_out,
                     size_t* mp_out_size);
 
+/// what C_API_OptimizeWithProfile records about a single run of a pass
+typedef struct {
+  const char* pass_name;
+  /// round of the pass manager, e.g. the fixed point iteration, from 0
+  size_t iteration;
+  double wall_time_ms;
+  /// only counted for predicate based passes
+  size_t num_predicate_calls;
+  size_t num_transforms;
+  /// changes of the number of nodes and initializers, subgraphs included
+  int64_t node_count_delta;
+  int64_t initializer_count_delta;
+} C_API_PassRunProfile;
+
+// same as C_API_Optimize, but also returns one profile per run of a pass in
+// profile, caller must call C_API_ReleaseProfile to free it
+bool C_API_OptimizeWithProfile(const char* mp_in, const size_t mp_in_size,
+                               const char** passes, const bool fix_point,
+                               void** mp_out, size_t* mp_out_size,
+                               C_API_PassRunProfile** profile,
+                               size_t* profile_size);
+
+void C_API_ReleaseProfile(C_API_PassRunProfile* profile,
+                          const size_t profile_size);
+
 bool C_API_OtimizeFromFile(const char* import_model_path,
                            const char* export_model_path, const char** passes,
                            const bool fix_point, const bool save_external_data,
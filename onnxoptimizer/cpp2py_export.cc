@@ -5,6 +5,8 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <stdexcept>
+
 #include "onnx/py_utils.h"
 #include "onnxoptimizer/model_util.h"
 #include "onnxoptimizer/optimize.h"
@@ -12,54 +14,154 @@
 namespace ONNX_NAMESPACE {
 namespace py = pybind11;
 using namespace pybind11::literals;
+
+static py::list ProfileToPyList(
+    const std::vector<optimization::PassRunProfile>& profile) {
+  py::list result;
+  for (const auto& run : profile) {
+    result.append(py::dict(
+        "pass_name"_a = run.pass_name, "iteration"_a = run.iteration,
+        "wall_time_ms"_a = run.wall_time_ms,
+        "num_predicate_calls"_a = run.num_predicate_calls,
+        "num_transforms"_a = run.num_transforms,
+        "node_count_delta"_a = run.node_count_delta,
+        "initializer_count_delta"_a = run.initializer_count_delta));
+  }
+  return result;
+}
+
+// The pass manager that runs the passes of optimize_with_profile, picked like
+// optimize() in __init__.py picks the function to call. At most one of the
+// modes can be set.
+static std::shared_ptr<optimization::PassManager> MakePassManager(
+    bool fixed_point, bool worklist, bool dispatch, bool scheduled,
+    size_t num_threads) {
+  if (fixed_point + worklist + dispatch + scheduled > 1) {
+    throw std::invalid_argument(
+        "Only one of fixed_point, worklist, dispatch and scheduled can be "
+        "set");
+  }
+  if (scheduled) {
+    return std::make_shared<optimization::ScheduledPassManager>();
+  }
+  if (dispatch) {
+    return std::make_shared<optimization::DispatchPassManager>();
+  }
+  if (worklist) {
+    return std::make_shared<optimization::WorklistPassManager>();
+  }
+  std::shared_ptr<optimization::GeneralPassManager> pass_manager;
+  if (fixed_point) {
+    pass_manager = std::make_shared<optimization::FixedPointPassManager>();
+  } else {
+    pass_manager = std::make_shared<optimization::GeneralPassManager>();
+  }
+  if (num_threads != 1) {
+    pass_manager->setSubgraphThreadPool(
+        std::make_shared<optimization::ThreadPool>(num_threads));
+  }
+  return pass_manager;
+}
+
+// Defines |name|, which optimizes a model given as bytes, and |name|_from_path,
+// which optimizes the model in a file and saves it with its weights in
+// |export_data_file_name|. Both call |optimize| with the model, the passes and
+// the arguments of types |Args| that follow them in Python.
+//
+// The optimization does not touch any Python object, so the GIL is released
+// while it runs and models can be optimized on several threads at once.
+template <typename... Args, typename OptimizeFn>
+static void DefOptimize(py::module& m, const std::string& name,
+                        OptimizeFn optimize) {
+  m.def(name.c_str(), [optimize](const py::bytes& bytes,
+                                 const std::vector<std::string>& names,
+                                 Args... args) {
+    ModelProto proto{};
+    ParseProtoFromPyBytes(&proto, bytes);
+    std::string out;
+    {
+      py::gil_scoped_release release;
+      auto result = optimize(std::move(proto), names, args...);
+      result.SerializeToString(&out);
+    }
+    return py::bytes(out);
+  });
+  m.def((name + "_from_path").c_str(),
+        [optimize](const std::string& import_model_path,
+                   const std::string& export_model_path,
+                   const std::vector<std::string>& names,
+                   const std::string& export_data_file_name, Args... args) {
+          py::gil_scoped_release release;
+          optimization::TensorDataSources sources;
+          optimization::TensorDataSourcesScope scope(&sources);
+          ModelProto proto{};
+          optimization::loadModelMapped(&proto, import_model_path, &sources);
+          auto result = optimize(std::move(proto), names, args...);
+          optimization::saveModel(&result, export_model_path, true,
+                                  export_data_file_name);
+        });
+}
+
 PYBIND11_MODULE(onnx_opt_cpp2py_export, onnx_opt_cpp2py_export) {
   onnx_opt_cpp2py_export.doc() = "ONNX Optimizer";
 
-  onnx_opt_cpp2py_export.def(
-      "optimize",
-      [](const py::bytes& bytes, const std::vector<std::string>& names) {
-        ModelProto proto{};
-        ParseProtoFromPyBytes(&proto, bytes);
-        auto const result = optimization::Optimize(proto, names);
-        std::string out;
-        result.SerializeToString(&out);
-        return py::bytes(out);
-      });
+  DefOptimize(onnx_opt_cpp2py_export, "optimize", &optimization::Optimize);
+  DefOptimize(onnx_opt_cpp2py_export, "optimize_fixedpoint",
+              &optimization::OptimizeFixed);
+  DefOptimize(onnx_opt_cpp2py_export, "optimize_worklist",
+              &optimization::OptimizeWorklist);
+  DefOptimize(onnx_opt_cpp2py_export, "optimize_scheduled",
+              &optimization::OptimizeScheduled);
+  DefOptimize(onnx_opt_cpp2py_export, "optimize_dispatch",
+              &optimization::OptimizeDispatch);
+  DefOptimize<bool, size_t>(onnx_opt_cpp2py_export, "optimize_parallel",
+                            &optimization::OptimizeParallel);
 
+  // The profile is a Python list, so it is only built once the GIL is held
+  // again.
   onnx_opt_cpp2py_export.def(
-      "optimize_fixedpoint",
-      [](const py::bytes& bytes, const std::vector<std::string>& names) {
+      "optimize_profiled",
+      [](const py::bytes& bytes, const std::vector<std::string>& names,
+         bool fixed_point, bool worklist, bool dispatch, bool scheduled,
+         size_t num_threads) {
         ModelProto proto{};
         ParseProtoFromPyBytes(&proto, bytes);
-        auto const result = optimization::OptimizeFixed(proto, names);
         std::string out;
-        result.SerializeToString(&out);
-        return py::bytes(out);
+        std::vector<optimization::PassRunProfile> profile;
+        {
+          py::gil_scoped_release release;
+          auto result = optimization::OptimizeProfiled(
+              std::move(proto), names,
+              MakePassManager(fixed_point, worklist, dispatch, scheduled,
+                              num_threads),
+              profile);
+          result.SerializeToString(&out);
+        }
+        return py::make_tuple(py::bytes(out), ProfileToPyList(profile));
       });
-
   onnx_opt_cpp2py_export.def(
-      "optimize_from_path", [](const std::string& import_model_path,
-                               const std::string& export_model_path,
-                               const std::vector<std::string>& names,
-                               const std::string& export_data_file_name) {
-        ModelProto proto{};
-        optimization::loadModel(&proto, import_model_path, true);
-        auto result = optimization::Optimize(proto, names);
-        optimization::saveModel(&result, export_model_path, true,
-                                export_data_file_name);
-      });
-
-  onnx_opt_cpp2py_export.def(
-      "optimize_fixedpoint_from_path",
+      "optimize_profiled_from_path",
       [](const std::string& import_model_path,
          const std::string& export_model_path,
          const std::vector<std::string>& names,
-         const std::string& export_data_file_name) {
-        ModelProto proto{};
-        optimization::loadModel(&proto, import_model_path, true);
-        auto result = optimization::OptimizeFixed(proto, names);
-        optimization::saveModel(&result, export_model_path, true,
-                                export_data_file_name);
+         const std::string& export_data_file_name, bool fixed_point,
+         bool worklist, bool dispatch, bool scheduled, size_t num_threads) {
+        std::vector<optimization::PassRunProfile> profile;
+        {
+          py::gil_scoped_release release;
+          optimization::TensorDataSources sources;
+          optimization::TensorDataSourcesScope scope(&sources);
+          ModelProto proto{};
+          optimization::loadModelMapped(&proto, import_model_path, &sources);
+          auto result = optimization::OptimizeProfiled(
+              std::move(proto), names,
+              MakePassManager(fixed_point, worklist, dispatch, scheduled,
+                              num_threads),
+              profile);
+          optimization::saveModel(&result, export_model_path, true,
+                                  export_data_file_name);
+        }
+        return ProfileToPyList(profile);
       });
   onnx_opt_cpp2py_export.def("get_available_passes",
                              &optimization::GetAvailablePasses);
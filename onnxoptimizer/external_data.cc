@@ -0,0 +1,353 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/external_data.h"
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "onnx/common/assertions.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) : path_(path) {
+  file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    throw std::runtime_error("open " + path + " failed!");
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size)) {
+    CloseHandle(file_);
+    throw std::runtime_error("stat " + path + " failed!");
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ == 0) {
+    return;
+  }
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ == nullptr) {
+    CloseHandle(file_);
+    throw std::runtime_error("mmap " + path + " failed!");
+  }
+  data_ = static_cast<const char*>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == nullptr) {
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+    throw std::runtime_error("mmap " + path + " failed!");
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != nullptr) {
+    CloseHandle(file_);
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) : path_(path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("open " + path + " failed!");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("stat " + path + " failed!");
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("mmap " + path + " failed!");
+    }
+    data_ = static_cast<const char*>(data);
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+#endif
+
+namespace {
+
+std::string DataFilePath(const std::string& base_dir,
+                         const std::string& location) {
+  return (std::filesystem::absolute(base_dir) / location)
+      .lexically_normal()
+      .string();
+}
+
+thread_local TensorDataSources* current_sources = nullptr;
+
+// The part of its source a tensor refers to.
+struct SourceSlice {
+  std::string key;
+  int64_t offset = 0;
+  int64_t length = -1;
+
+  template <typename KeyValuePairs>
+  explicit SourceSlice(const KeyValuePairs& external_data) {
+    for (const auto& entry : external_data) {
+      const std::string& key = entry.first;
+      if (key == kTensorDataSourceKey) {
+        this->key = entry.second;
+      } else if (key == "offset") {
+        offset = std::stoll(entry.second);
+      } else if (key == "length") {
+        length = std::stoll(entry.second);
+      }
+    }
+  }
+
+  TensorDataSlice bytes() const {
+    const auto* sources = TensorDataSources::current();
+    auto source = sources != nullptr ? sources->find(key) : nullptr;
+    if (!source) {
+      throw std::runtime_error("tensor data source " + key +
+                               " is not alive any more");
+    }
+    const auto all_bytes = source->bytes();
+    const auto size = static_cast<int64_t>(all_bytes.size());
+    const int64_t end = length < 0 ? size : offset + length;
+    if (offset < 0 || end > size || end < offset) {
+      throw std::runtime_error("tensor data is out of the bounds of " + key);
+    }
+    return TensorDataSlice(std::move(source),
+                           all_bytes.substr(static_cast<size_t>(offset),
+                                            static_cast<size_t>(end - offset)));
+  }
+};
+
+std::vector<std::pair<std::string, std::string>> ExternalDataEntries(
+    const TensorProto& tensor) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  for (const auto& entry : tensor.external_data()) {
+    entries.emplace_back(entry.key(), entry.value());
+  }
+  return entries;
+}
+
+template <typename KeyValuePairs>
+bool HasSourceKey(const KeyValuePairs& external_data) {
+  for (const auto& entry : external_data) {
+    if (entry.first == kTensorDataSourceKey) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SetExternalDataEntry(TensorProto* tensor, const std::string& key,
+                          const std::string& value) {
+  auto* entry = tensor->add_external_data();
+  entry->set_key(key);
+  entry->set_value(value);
+}
+
+// Calls |fn| on the initializers of |graph| and of its subgraphs and, if
+// |attributes| is set, on the tensors in the attributes of their nodes.
+template <typename Fn>
+void ForEachTensor(GraphProto* graph, bool attributes, const Fn& fn) {
+  for (auto& tensor : *graph->mutable_initializer()) {
+    fn(&tensor);
+  }
+  for (auto& node : *graph->mutable_node()) {
+    for (auto& attr : *node.mutable_attribute()) {
+      if (attributes && attr.has_t()) {
+        fn(attr.mutable_t());
+      }
+      if (attributes) {
+        for (auto& tensor : *attr.mutable_tensors()) {
+          fn(&tensor);
+        }
+      }
+      if (attr.has_g()) {
+        ForEachTensor(attr.mutable_g(), attributes, fn);
+      }
+      for (auto& subgraph : *attr.mutable_graphs()) {
+        ForEachTensor(&subgraph, attributes, fn);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void TensorDataSources::add(const std::string& key,
+                            std::shared_ptr<const TensorDataSource> source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sources_[key] = std::move(source);
+}
+
+void TensorDataSources::remove(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sources_.erase(key);
+}
+
+std::shared_ptr<const TensorDataSource> TensorDataSources::find(
+    const std::string& key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sources_.find(key);
+  return it == sources_.end() ? nullptr : it->second;
+}
+
+TensorDataSources* TensorDataSources::current() {
+  return current_sources;
+}
+
+TensorDataSourcesScope::TensorDataSourcesScope(TensorDataSources* sources)
+    : previous_(current_sources) {
+  current_sources = sources;
+}
+
+TensorDataSourcesScope::~TensorDataSourcesScope() {
+  current_sources = previous_;
+}
+
+void MapExternalDataFile(TensorDataSources* sources,
+                         const std::string& base_dir,
+                         const std::string& location) {
+  const auto path = DataFilePath(base_dir, location);
+  if (!sources->find(path)) {
+    sources->add(path, std::make_shared<const MappedFile>(path));
+  }
+}
+
+void ReferToMappedFile(TensorProto* tensor, const std::string& base_dir,
+                       const std::string& location) {
+  SetExternalDataEntry(tensor, kTensorDataSourceKey,
+                       DataFilePath(base_dir, location));
+}
+
+class DetachedTensorData::Buffer final : public TensorDataSource {
+ public:
+  explicit Buffer(std::string* data) {
+    data_.swap(*data);
+  }
+  std::string_view bytes() const override {
+    return data_;
+  }
+  std::string& data() {
+    return data_;
+  }
+
+ private:
+  std::string data_;
+};
+
+void DetachedTensorData::detach(GraphProto* graph, size_t min_bytes) {
+  ONNX_ASSERTM(TensorDataSources::current() != nullptr,
+               "tensor data can only be detached into current sources");
+  min_bytes_ = min_bytes;
+  ForEachTensor(graph, false,
+                [this](TensorProto* tensor) { detachTensor(tensor); });
+}
+
+void DetachedTensorData::detachTensor(TensorProto* tensor) {
+  if (!tensor->has_raw_data() || tensor->raw_data().size() < min_bytes_ ||
+      tensor->data_location() == TensorProto_DataLocation_EXTERNAL) {
+    return;
+  }
+  static std::atomic<uint64_t> next_id{0};
+  const std::string key = "#detached/" + std::to_string(next_id++);
+  auto buffer = std::make_shared<Buffer>(tensor->mutable_raw_data());
+  tensor->clear_raw_data();
+  tensor->set_data_location(TensorProto_DataLocation_EXTERNAL);
+  SetExternalDataEntry(tensor, "location", key);
+  SetExternalDataEntry(tensor, kTensorDataSourceKey, key);
+  TensorDataSources::current()->add(key, buffer);
+  buffers_.emplace(key, std::move(buffer));
+}
+
+void DetachedTensorData::attach(GraphProto* graph) {
+  std::map<std::string, const TensorProto*> attached;
+  ForEachTensor(graph, true, [this, &attached](TensorProto* tensor) {
+    attachTensor(tensor, &attached);
+  });
+  for (const auto& buffer : buffers_) {
+    TensorDataSources::current()->remove(buffer.first);
+  }
+  buffers_.clear();
+}
+
+void DetachedTensorData::attachTensor(
+    TensorProto* tensor, std::map<std::string, const TensorProto*>* attached) {
+  if (tensor->data_location() != TensorProto_DataLocation_EXTERNAL) {
+    return;
+  }
+  const SourceSlice slice(ExternalDataEntries(*tensor));
+  auto buffer = buffers_.find(slice.key);
+  if (buffer == buffers_.end()) {
+    return;
+  }
+  auto done = attached->find(slice.key);
+  if (done == attached->end()) {
+    tensor->mutable_raw_data()->swap(buffer->second->data());
+    attached->emplace(slice.key, tensor);
+  } else {
+    tensor->set_raw_data(done->second->raw_data());
+  }
+  tensor->clear_data_location();
+  tensor->clear_external_data();
+}
+
+bool HasTensorDataSource(const TensorProto& tensor) {
+  return tensor.data_location() == TensorProto_DataLocation_EXTERNAL &&
+         HasSourceKey(ExternalDataEntries(tensor));
+}
+
+bool HasTensorDataSource(const Tensor& tensor) {
+  return tensor.data_location() == TensorProto_DataLocation_EXTERNAL &&
+         HasSourceKey(tensor.external_data());
+}
+
+TensorDataSlice TensorDataFromSource(const TensorProto& tensor) {
+  return SourceSlice(ExternalDataEntries(tensor)).bytes();
+}
+
+TensorDataSlice TensorDataFromSource(const Tensor& tensor) {
+  return SourceSlice(tensor.external_data()).bytes();
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
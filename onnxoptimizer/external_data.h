@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "onnx/common/tensor.h"
+#include "onnx/onnx_pb.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Bytes that tensors refer to instead of holding them. Such tensors are marked
+// as stored in external data, and the kTensorDataSourceKey entry of their
+// external_data names the source, which is looked up in the current
+// TensorDataSources whenever their values are needed.
+class TensorDataSource {
+ public:
+  virtual ~TensorDataSource() = default;
+  virtual std::string_view bytes() const = 0;
+};
+
+constexpr const char* kTensorDataSourceKey = "onnx_optimizer_source";
+
+// A whole file mapped read-only into memory.
+class MappedFile final : public TensorDataSource {
+ public:
+  // Throws std::runtime_error if the file cannot be mapped.
+  explicit MappedFile(const std::string& path);
+  ~MappedFile() override;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const std::string& path() const {
+    return path_;
+  }
+  std::string_view bytes() const override {
+    return std::string_view(data_, size_);
+  }
+
+ private:
+  std::string path_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#endif
+};
+
+// The sources the tensors of the models of one optimization refer to, by key.
+// Every optimization has its own, which it makes current with a
+// TensorDataSourcesScope on the threads working on it, so that concurrent
+// optimizations never share sources. The sources are alive as long as this
+// is. Thread-safe.
+class TensorDataSources {
+ public:
+  TensorDataSources() = default;
+  TensorDataSources(const TensorDataSources&) = delete;
+  TensorDataSources& operator=(const TensorDataSources&) = delete;
+
+  void add(const std::string& key,
+           std::shared_ptr<const TensorDataSource> source);
+  void remove(const std::string& key);
+  // nullptr if there is no source |key|
+  std::shared_ptr<const TensorDataSource> find(const std::string& key) const;
+
+  // The sources current on the calling thread, or nullptr.
+  static TensorDataSources* current();
+
+ private:
+  mutable std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<const TensorDataSource>> sources_;
+};
+
+// Makes |sources| the current TensorDataSources of the calling thread until
+// it is destroyed.
+class TensorDataSourcesScope {
+ public:
+  explicit TensorDataSourcesScope(TensorDataSources* sources);
+  ~TensorDataSourcesScope();
+
+  TensorDataSourcesScope(const TensorDataSourcesScope&) = delete;
+  TensorDataSourcesScope& operator=(const TensorDataSourcesScope&) = delete;
+
+ private:
+  TensorDataSources* previous_;
+};
+
+// Maps the external data file |location| of the model in the directory
+// |base_dir| into |sources|, unless it is there already. A file is mapped
+// only once however many tensors of the optimization refer to it.
+void MapExternalDataFile(TensorDataSources* sources,
+                         const std::string& base_dir,
+                         const std::string& location);
+
+// Makes |tensor|, which is stored in the external data file |location| of the
+// model in |base_dir|, refer to the mapping of that file.
+void ReferToMappedFile(TensorProto* tensor, const std::string& base_dir,
+                       const std::string& location);
+
+// The raw_data of the initializers of a graph, moved out of them by detach()
+// into the current TensorDataSources so that importing the graph into the IR
+// does not copy it.
+class DetachedTensorData {
+ public:
+  DetachedTensorData() = default;
+  DetachedTensorData(const DetachedTensorData&) = delete;
+  DetachedTensorData& operator=(const DetachedTensorData&) = delete;
+
+  // Moves the raw_data of every initializer of |graph| and of its subgraphs
+  // that has at least |min_bytes| into this, and makes the initializers refer
+  // to it.
+  void detach(GraphProto* graph, size_t min_bytes = 1024);
+
+  // Moves the data back into the tensors of |graph| and of its subgraphs that
+  // refer to it. Tensors that refer to the same data get copies of it.
+  void attach(GraphProto* graph);
+
+ private:
+  class Buffer;
+
+  void detachTensor(TensorProto* tensor);
+  void attachTensor(TensorProto* tensor,
+                    std::map<std::string, const TensorProto*>* attached);
+
+  // by source key
+  std::map<std::string, std::shared_ptr<Buffer>> buffers_;
+  size_t min_bytes_ = 0;
+};
+
+// Bytes of a tensor, which keep the source they are in alive. Bytes that are
+// not in a source, e.g. the raw_data of a tensor, have no source.
+class TensorDataSlice {
+ public:
+  TensorDataSlice() = default;
+  explicit TensorDataSlice(std::string_view bytes) : bytes_(bytes) {}
+  TensorDataSlice(std::shared_ptr<const TensorDataSource> source,
+                  std::string_view bytes)
+      : source_(std::move(source)), bytes_(bytes) {}
+
+  std::string_view bytes() const {
+    return bytes_;
+  }
+
+ private:
+  std::shared_ptr<const TensorDataSource> source_;
+  std::string_view bytes_;
+};
+
+bool HasTensorDataSource(const TensorProto& tensor);
+bool HasTensorDataSource(const Tensor& tensor);
+
+// The bytes of a tensor for which HasTensorDataSource holds. Throws
+// std::runtime_error if its source is not alive any more or is too small.
+TensorDataSlice TensorDataFromSource(const TensorProto& tensor);
+TensorDataSlice TensorDataFromSource(const Tensor& tensor);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
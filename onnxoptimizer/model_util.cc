@@ -10,11 +10,14 @@
 #include <filesystem>
 #include <fstream>
 #include <limits>
+#include <map>
 #include <numeric>
 #include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
@@ -92,6 +95,11 @@ struct ExternalDataInfo {
     if (tensor->raw_data().size() < size_threshold) {
       return;
     }
+    referTo(tensor);
+  }
+
+  // Marks |tensor| as stored at this place.
+  void referTo(TensorProto* tensor) const {
     tensor->set_data_location(TensorProto_DataLocation_EXTERNAL);
     tensor->clear_external_data();
     std::unordered_map<std::string, std::string> entry_map;
@@ -111,10 +119,11 @@ struct ExternalDataInfo {
 };
 
 std::string genUUID() {
-  static std::random_device rd;
-  static std::mt19937 gen(rd());
-  static std::uniform_int_distribution<> dis(0, 15);
-  static std::uniform_int_distribution<> dis2(8, 11);
+  // one generator per thread, models may be saved on several threads at once
+  thread_local std::random_device rd;
+  thread_local std::mt19937 gen(rd());
+  thread_local std::uniform_int_distribution<> dis(0, 15);
+  thread_local std::uniform_int_distribution<> dis2(8, 11);
   std::stringstream ss;
   int i;
   ss << std::hex;
@@ -221,55 +230,150 @@ void loadExternalDataForModel(ModelProto* m,
   }
 }
 
-void saveExternalData(TensorProto* tensor,
-                      const std::filesystem::path& base_dir) {
-  ExternalDataInfo info(tensor);
-  auto external_data_file_path = base_dir;
-  external_data_file_path /= (info.location);
-  std::ofstream data_file(external_data_file_path.string(),
-                          std::ios_base::binary | std::ios_base::app);
-  if (!data_file) {
-    throw std::runtime_error("open " + external_data_file_path.string() +
-                             " failed!");
+void mapExternalDataForModel(ModelProto* m,
+                             const std::filesystem::path& base_dir,
+                             TensorDataSources* sources) {
+  const auto base_path = std::filesystem::absolute(base_dir).string();
+  for (auto& tensor : getAllTensors(m)) {
+    if (!usesExternalData(tensor)) {
+      continue;
+    }
+    ExternalDataInfo info(tensor);
+    MapExternalDataFile(sources, base_path, info.location);
+    ReferToMappedFile(tensor, base_path, info.location);
   }
-  data_file.seekp(0, data_file.end);
-  info.offset = data_file.tellp();
-  const auto& raw_data = tensor->raw_data();
-  data_file.write(raw_data.c_str(), raw_data.size());
-  info.length = data_file.tellp() - info.offset;
-  info.setExternalData(tensor);
-  data_file.close();
 }
 
-void convertModelToExternalData(ModelProto* m, const std::string& location = {},
-                                int32_t size_threshold = 1024,
-                                bool convert_attribute = true) {
-  std::vector<TensorProto*> tensors;
-  if (convert_attribute) {
-    tensors = getAllTensors(m);
-  } else {
-    tensors = getInitializerTensors(m);
+// Reads the bytes of a tensor that refers to a mapped file into raw_data.
+void materializeMappedExternalData(TensorProto* tensor) {
+  const auto slice = TensorDataFromSource(*tensor);
+  const auto bytes = slice.bytes();
+  tensor->set_raw_data(bytes.data(), bytes.size());
+  tensor->set_data_location(TensorProto_DataLocation_DEFAULT);
+  tensor->clear_external_data();
+}
+
+// Appends tensor data to one external data file. The file is opened once, and
+// small tensors are collected in a buffer so that it is written in large
+// chunks.
+class ExternalDataWriter {
+ public:
+  ExternalDataWriter(const std::filesystem::path& path,
+                     const ExternalDataLayout& layout)
+      : path_(path.string()), layout_(layout) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    end_ = ec ? 0 : static_cast<int64_t>(size);
+    file_.open(path_, std::ios_base::binary | std::ios_base::app);
+    if (!file_) {
+      throw std::runtime_error("open " + path_ + " failed!");
+    }
+    buffer_.reserve(kBufferSize);
   }
 
-  auto file_name = genUUID();
-  if (!location.empty()) {
-    file_name = location;
+  // Returns the offset |bytes| are written at.
+  int64_t write(std::string_view bytes) {
+    const auto alignment = static_cast<int64_t>(
+        bytes.size() >= layout_.page_alignment ? layout_.page_alignment
+                                               : layout_.alignment);
+    if (alignment > 1 && end_ % alignment != 0) {
+      const auto padding = alignment - end_ % alignment;
+      append(std::string(padding, '\0'));
+    }
+    const int64_t offset = end_;
+    append(bytes);
+    return offset;
   }
-  for (auto& tensor : tensors) {
-    ExternalDataInfo info(file_name);
-    info.setExternalData(tensor, size_threshold);
+
+  void close() {
+    flush();
+    file_.close();
+    if (file_.fail()) {
+      throw std::runtime_error("write " + path_ + " failed!");
+    }
   }
-}
 
+ private:
+  static constexpr size_t kBufferSize = 4 << 20;
+
+  void append(std::string_view bytes) {
+    if (buffer_.size() + bytes.size() > kBufferSize) {
+      flush();
+    }
+    if (bytes.size() >= kBufferSize) {
+      file_.write(bytes.data(), bytes.size());
+    } else {
+      buffer_.append(bytes.data(), bytes.size());
+    }
+    end_ += static_cast<int64_t>(bytes.size());
+  }
+
+  void flush() {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    if (!file_) {
+      throw std::runtime_error("write " + path_ + " failed!");
+    }
+  }
+
+  std::string path_;
+  ExternalDataLayout layout_;
+  std::ofstream file_;
+  std::string buffer_;
+  // the size of the file once the buffer is flushed
+  int64_t end_ = 0;
+};
+
+// Moves the tensors of at least |size_threshold| bytes to the external data
+// file |location| (a new file if empty) when |save_external_data| is set, and
+// writes the raw_data of every tensor in external data to its file. Data
+// that is mapped is written straight from the mapping; tensors that stay in
+// the model read it one at a time.
 void writeExternalDataTensors(ModelProto* m,
-                              const std::filesystem::path& base_dir) {
-  auto tensors = getAllTensors(m);
-  for (auto& tensor : tensors) {
+                              const std::filesystem::path& base_dir,
+                              bool save_external_data,
+                              const std::string& location,
+                              const ExternalDataLayout& layout,
+                              int32_t size_threshold = 1024) {
+  const auto file_name = location.empty() ? genUUID() : location;
+  std::map<std::string, ExternalDataWriter> writers;
+  const auto write = [&](const std::string& file, std::string_view bytes) {
+    auto it = writers.find(file);
+    if (it == writers.end()) {
+      it = writers
+               .emplace(std::piecewise_construct, std::forward_as_tuple(file),
+                        std::forward_as_tuple(base_dir / file, layout))
+               .first;
+    }
+    ExternalDataInfo info(file);
+    info.offset = it->second.write(bytes);
+    info.length = static_cast<int64_t>(bytes.size());
+    return info;
+  };
+  for (auto& tensor : getAllTensors(m)) {
+    if (HasTensorDataSource(*tensor)) {
+      const auto slice = TensorDataFromSource(*tensor);
+      const auto bytes = slice.bytes();
+      if (save_external_data && !bytes.empty() &&
+          bytes.size() >= static_cast<size_t>(size_threshold)) {
+        write(file_name, bytes).referTo(tensor);
+        continue;
+      }
+      materializeMappedExternalData(tensor);
+    }
+    if (save_external_data) {
+      ExternalDataInfo info(file_name);
+      info.setExternalData(tensor, size_threshold);
+    }
     if (usesExternalData(tensor) && tensor->has_raw_data()) {
-      saveExternalData(tensor, base_dir);
+      write(ExternalDataInfo(tensor).location, tensor->raw_data())
+          .referTo(tensor);
       tensor->clear_raw_data();
     }
   }
+  for (auto& writer : writers) {
+    writer.second.close();
+  }
 }
 
 }  // namespace
@@ -283,26 +387,34 @@ void loadModel(ModelProto* m, const std::string& model_path,
   }
 }
 
+void loadModelMapped(ModelProto* m, const std::string& model_path,
+                     TensorDataSources* sources) {
+  LoadProtoFromPath<ModelProto>(model_path, *m);
+  const auto parent_path = std::filesystem::path(model_path).parent_path();
+  mapExternalDataForModel(m, parent_path, sources);
+}
+
 void saveModel(ModelProto* m, const std::string& model_path,
                const bool save_external_data,
-               const std::string& data_file_name) {
-  if (save_external_data) {
-    convertModelToExternalData(m, data_file_name);
-  }
+               const std::string& data_file_name,
+               const ExternalDataLayout& layout) {
   const auto parent_path = std::filesystem::path(model_path).parent_path();
-  writeExternalDataTensors(m, parent_path);
-
-  std::string serialize;
-  m->SerializeToString(&serialize);
+  writeExternalDataTensors(m, parent_path, save_external_data, data_file_name,
+                           layout);
 
-  std::ofstream data_file(model_path, std::ios_base::out |
-                                          std::ios_base::trunc |
-                                          std::ios_base::binary);
-  if (!data_file) {
+  std::ofstream model_file(model_path, std::ios_base::out |
+                                           std::ios_base::trunc |
+                                           std::ios_base::binary);
+  if (!model_file) {
     throw std::runtime_error("open " + model_path + " failed!");
   }
-  data_file.write(serialize.c_str(), serialize.size());
-  data_file.close();
+  if (!m->SerializeToOstream(&model_file)) {
+    throw std::runtime_error("write " + model_path + " failed!");
+  }
+  model_file.close();
+  if (model_file.fail()) {
+    throw std::runtime_error("write " + model_path + " failed!");
+  }
 }
 
 }  // namespace optimization
@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <cstddef>
+#include <string>
+
 #include "onnx/onnx_pb.h"
+#include "onnxoptimizer/external_data.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -15,9 +19,35 @@ namespace optimization {
 void loadModel(ModelProto* m, const std::string& model_path,
                const bool load_external_data = false);
 
+// Loads the model like loadModel with load_external_data does, except that
+// the tensors stored in external data files are not read into memory. Every
+// data file is mapped into |sources| once instead, and the bytes of a tensor
+// are only read from it when a pass inspects its values or the model is
+// saved. The model may only be optimized and saved while |sources| is
+// current, see TensorDataSourcesScope.
+void loadModelMapped(ModelProto* m, const std::string& model_path,
+                     TensorDataSources* sources);
+
+// Where saveModel places tensor data in external data files. Every tensor
+// starts at a multiple of |alignment| bytes, and tensors of at least
+// |page_alignment| bytes at a multiple of |page_alignment|, so that runtimes
+// can map their weights directly. The gaps are filled with zeros; 1 packs the
+// tensors without gaps.
+struct ExternalDataLayout {
+  size_t alignment = 64;
+  size_t page_alignment = 4096;
+};
+
+// Writes the tensors in external data to their files in the directory of
+// |model_path|, each file through a single handle, then streams the model to
+// |model_path| without serializing it into memory first. With
+// |save_external_data|, tensors of at least 1 KiB are moved to the file
+// |data_file_name|, or to a new file if it is empty. Data is appended to
+// existing files.
 void saveModel(ModelProto* m, const std::string& model_path,
                const bool save_external_data = false,
-               const std::string& data_file_name = {});
+               const std::string& data_file_name = {},
+               const ExternalDataLayout& layout = {});
 
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
\ No newline at end of file
@@ -27,19 +27,86 @@ Optimizer::Optimizer(
     this->pass_manager->add(pass);
   }
 }
+Optimizer::Optimizer(
+    const std::vector<std::string>& names,
+    std::shared_ptr<PassManager> pass_manager)
+    : pass_manager(std::move(pass_manager)) {
+  for (const auto& name : names) {
+    auto pass = passes.find(name);
+    this->pass_manager->add(pass);
+  }
+}
 Optimizer::~Optimizer() {}
 
 ModelProto Optimize(
-    const ModelProto& mp_in,
+    ModelProto mp_in,
     const std::vector<std::string>& names) {
   Optimizer current_opt(names, false);
-  return current_opt.optimize(mp_in);
+  return current_opt.optimize(std::move(mp_in));
 }
 ModelProto OptimizeFixed(
-    const ModelProto& mp_in,
+    ModelProto mp_in,
     const std::vector<std::string>& names) {
   Optimizer current_opt(names, true);
-  return current_opt.optimize(mp_in);
+  return current_opt.optimize(std::move(mp_in));
+}
+ModelProto OptimizeWorklist(
+    ModelProto mp_in,
+    const std::vector<std::string>& names) {
+  Optimizer current_opt(
+      names,
+      std::shared_ptr<WorklistPassManager>(new WorklistPassManager()));
+  return current_opt.optimize(std::move(mp_in));
+}
+ModelProto OptimizeScheduled(
+    ModelProto mp_in,
+    const std::vector<std::string>& names) {
+  Optimizer current_opt(
+      names,
+      std::shared_ptr<ScheduledPassManager>(new ScheduledPassManager()));
+  return current_opt.optimize(std::move(mp_in));
+}
+ModelProto OptimizeDispatch(
+    ModelProto mp_in,
+    const std::vector<std::string>& names) {
+  Optimizer current_opt(
+      names,
+      std::shared_ptr<DispatchPassManager>(new DispatchPassManager()));
+  return current_opt.optimize(std::move(mp_in));
+}
+ModelProto OptimizeProfiled(
+    ModelProto mp_in,
+    const std::vector<std::string>& names,
+    const bool fixed_point,
+    std::vector<PassRunProfile>& profile) {
+  Optimizer current_opt(names, fixed_point);
+  return current_opt.optimize(std::move(mp_in), profile);
+}
+ModelProto OptimizeProfiled(
+    ModelProto mp_in,
+    const std::vector<std::string>& names,
+    std::shared_ptr<PassManager> pass_manager,
+    std::vector<PassRunProfile>& profile) {
+  Optimizer current_opt(names, std::move(pass_manager));
+  return current_opt.optimize(std::move(mp_in), profile);
+}
+ModelProto OptimizeParallel(
+    ModelProto mp_in,
+    const std::vector<std::string>& names,
+    const bool fixed_point,
+    const size_t num_threads) {
+  std::shared_ptr<GeneralPassManager> pass_manager;
+  if (fixed_point) {
+    pass_manager =
+        std::shared_ptr<FixedPointPassManager>(new FixedPointPassManager());
+  } else {
+    pass_manager =
+        std::shared_ptr<GeneralPassManager>(new GeneralPassManager());
+  }
+  pass_manager->setSubgraphThreadPool(
+      std::make_shared<ThreadPool>(num_threads));
+  Optimizer current_opt(names, pass_manager);
+  return current_opt.optimize(std::move(mp_in));
 }
 const std::vector<std::string> GetAvailablePasses() {
   return Optimizer::passes.GetAvailablePasses();
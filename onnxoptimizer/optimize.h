@@ -12,6 +12,7 @@
 #include "onnx/common/stl_backports.h"
 #include "onnx/proto_utils.h"
 
+#include "onnxoptimizer/external_data.h"
 #include "onnxoptimizer/pass_manager.h"
 #include "onnxoptimizer/pass_registry.h"
 
@@ -20,19 +21,63 @@
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
+// Every Optimizer creates instances of its passes of its own, so different
+// Optimizers can optimize models on different threads at the same time. A
+// single Optimizer must not be used by several threads at once.
 struct Optimizer {
   static GlobalPassRegistry passes;
 
  public:
   Optimizer(const std::vector<std::string> &names, const bool fixed_point);
+  Optimizer(const std::vector<std::string> &names,
+            std::shared_ptr<PassManager> pass_manager);
   ~Optimizer();
 
-  ModelProto optimize(const ModelProto &_mp_in) {
-    ModelProto mp_in = _mp_in;
+  // The model is taken by value so that callers which no longer need it can
+  // move it in, and then its weights are not copied at all: the raw_data of
+  // the initializers is detached from the model before it is imported into
+  // the IR, the IR refers to it only by handles that are resolved when a pass
+  // reads the values (see ParseTensorData), and it is moved into the
+  // optimized model at the end.
+  ModelProto optimize(ModelProto mp_in) {
+    std::shared_ptr<PassManagerAnalysis> analysis;
+    return runPasses(std::move(mp_in), analysis);
+  }
+
+  // Same as above, but the passes are profiled and |profile| receives a record
+  // of every run of a pass.
+  ModelProto optimize(ModelProto mp_in, std::vector<PassRunProfile> &profile) {
+    std::shared_ptr<PassManagerAnalysis> analysis;
+    this->pass_manager->setProfiling(true);
+    ModelProto mp_out = runPasses(std::move(mp_in), analysis);
+    this->pass_manager->setProfiling(false);
+    auto profile_analysis =
+        std::dynamic_pointer_cast<ProfilePassManagerAnalysis>(analysis);
+    if (profile_analysis) {
+      profile = std::move(profile_analysis->pass_runs);
+    } else {
+      profile.clear();
+    }
+    return mp_out;
+  }
+
+ private:
+  std::shared_ptr<PassManager> pass_manager;
+
+  ModelProto runPasses(ModelProto mp_in,
+                       std::shared_ptr<PassManagerAnalysis> &analysis) {
     if (mp_in.ir_version() == 3) {
       // Upgrade ir_version to 4 so that initializer can be not in input
       mp_in.set_ir_version(4);
     }
+    // the sources of the caller, e.g. the external data files the model was
+    // loaded with, or else sources of this optimization alone
+    TensorDataSources own_sources;
+    TensorDataSourcesScope scope(TensorDataSources::current() != nullptr
+                                     ? TensorDataSources::current()
+                                     : &own_sources);
+    DetachedTensorData detached;
+    detached.detach(mp_in.mutable_graph());
     std::shared_ptr<Graph> g(ImportModelProto(mp_in));
 
     if (g.get() == nullptr) {
@@ -40,18 +85,19 @@ struct Optimizer {
                 << "(The IR version of the ONNX model may be too old.)"
                 << std::endl;
       // If we can't parse the file, just return the input.
+      detached.attach(mp_in.mutable_graph());
       return mp_in;
     }
 
     ModelProto mp_out = PrepareOutput(mp_in);
-    this->pass_manager->run(*g);
+    mp_in.Clear();
+    analysis = this->pass_manager->run(*g);
     ExportModelProto(&mp_out, g);
+    g.reset();
+    detached.attach(mp_out.mutable_graph());
     return mp_out;
   }
 
- private:
-  std::shared_ptr<PassManager> pass_manager;
-
   ModelProto AddInitializerToInput(const ModelProto &original_model) {
     ModelProto model = original_model;
     std::vector<std::string> input_names;
@@ -81,10 +127,53 @@ const std::vector<std::string> GetAvailablePasses();
 
 const std::vector<std::string> GetFuseAndEliminationPass();
 
-ModelProto Optimize(const ModelProto &mp_in,
+// The Optimize* functions use an Optimizer of their own for every call, so they
+// can be called from several threads at the same time. Moving the model into
+// them saves a copy of its weights (see Optimizer::optimize).
+ModelProto Optimize(ModelProto mp_in,
                     const std::vector<std::string> &names);
 
-ModelProto OptimizeFixed(const ModelProto &mp_in,
+ModelProto OptimizeFixed(ModelProto mp_in,
                          const std::vector<std::string> &names);
+
+// Optimizes to a fixed point like OptimizeFixed, but after the first round only
+// the nodes touched by rewrites are matched again (see WorklistPassManager).
+ModelProto OptimizeWorklist(ModelProto mp_in,
+                            const std::vector<std::string> &names);
+
+// Optimizes to a fixed point like OptimizeFixed, but after a pass has changed
+// the graph only the passes affected by the node kinds it produces are run
+// again (see ScheduledPassManager).
+ModelProto OptimizeScheduled(ModelProto mp_in,
+                             const std::vector<std::string> &names);
+
+// Optimizes like OptimizeFixed, but consecutive predicate based passes run
+// together in one walk over the graph that hands every node only to the passes
+// that can match its kind (see DispatchPassManager).
+ModelProto OptimizeDispatch(ModelProto mp_in,
+                            const std::vector<std::string> &names);
+
+// Optimizes like Optimize, or like OptimizeFixed if |fixed_point| is set, and
+// fills |profile| with the wall time, predicate calls, transforms and changes of
+// the node and initializer counts of every run of a pass.
+ModelProto OptimizeProfiled(ModelProto mp_in,
+                            const std::vector<std::string> &names,
+                            const bool fixed_point,
+                            std::vector<PassRunProfile> &profile);
+
+// Same as above, but the passes are run by |pass_manager|, e.g. a
+// WorklistPassManager, and the profile records its runs of the passes.
+ModelProto OptimizeProfiled(ModelProto mp_in,
+                            const std::vector<std::string> &names,
+                            std::shared_ptr<PassManager> pass_manager,
+                            std::vector<PassRunProfile> &profile);
+
+// Optimizes like Optimize, or like OptimizeFixed if |fixed_point| is set, but
+// the subgraphs of control flow nodes (If/Loop/Scan bodies) are optimized
+// concurrently on |num_threads| threads, or on one thread per hardware thread
+// if it is zero (see PredicateBasedPass::runPassInParallel).
+ModelProto OptimizeParallel(ModelProto mp_in,
+                            const std::vector<std::string> &names,
+                            const bool fixed_point, const size_t num_threads);
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
@@ -2,8 +2,13 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
 #include "onnx/common/assertions.h"
 
+#include "onnxoptimizer/external_data.h"
 #include "onnxoptimizer/pass.h"
 
 namespace ONNX_NAMESPACE {
@@ -62,7 +67,7 @@ unsigned int PredicateBasedPass::_runPassInternal(Graph& graph) {
     auto* n = *it;
     num_changes += this->DescendOnGraphAttributesAndCount(
         n, [this](Graph& g) { return _runPassInternal(g); });
-    if (this->patternMatchPredicate(n)) {
+    if (this->_matches(n)) {
       NodeDestroyType destroy_type = NodeDestroyType::DestroyZero;
       num_changes += this->runTransform(n, graph, destroy_type);
 
@@ -74,6 +79,311 @@ unsigned int PredicateBasedPass::_runPassInternal(Graph& graph) {
   return num_changes;
 }
 
+unsigned int PredicateBasedPass::_runPassInternal(
+    Graph& graph,
+    ThreadPool& pool) {
+  // A graph can be held by several nodes, e.g. by clones of a node, but it
+  // must only be handed to one task.
+  std::vector<Graph*> subgraphs;
+  std::unordered_set<Graph*> seen;
+  for (auto* n : graph.nodes()) {
+    if (!n->hasAttributes()) {
+      continue;
+    }
+    this->DescendOnGraphAttributesUnconstrained(n, [&](Graph& g) {
+      if (seen.insert(&g).second) {
+        subgraphs.push_back(&g);
+      }
+    });
+  }
+  std::vector<unsigned int> subgraph_changes(subgraphs.size(), 0);
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(subgraphs.size());
+  // the tensors of the subgraphs refer to the sources of this thread
+  auto* sources = TensorDataSources::current();
+  for (size_t i = 0; i < subgraphs.size(); ++i) {
+    tasks.emplace_back(
+        [this, &pool, &subgraphs, &subgraph_changes, sources, i] {
+          TensorDataSourcesScope scope(sources);
+          subgraph_changes[i] = _runPassInternal(*subgraphs[i], pool);
+        });
+  }
+  pool.run(tasks);
+
+  unsigned int num_changes = 0;
+  for (const auto changes : subgraph_changes) {
+    num_changes += changes;
+  }
+  for (auto it = graph.begin(); it != graph.end(); ++it) {
+    auto* n = *it;
+    if (this->_matches(n)) {
+      NodeDestroyType destroy_type = NodeDestroyType::DestroyZero;
+      num_changes += this->runTransform(n, graph, destroy_type);
+
+      if (destroy_type == NodeDestroyType::DestroyOne) {
+        it.destroyCurrent();
+      }
+    }
+  }
+  return num_changes;
+}
+
+// Bookkeeping of a worklist driven run. The first round walks the graph in
+// topological order and matches the nodes of the given worklist; every further
+// round only matches the nodes queued by the transforms of the round before,
+// in the order they were queued.
+struct PredicateBasedPass::WorklistState {
+  // Nodes to match in a round. A node is removed from |alive| as soon as a
+  // transform may have destroyed it, so that |order| is only dereferenced for
+  // nodes that are still in the graph.
+  struct Round {
+    std::vector<Node*> order;
+    std::unordered_set<const Node*> alive;
+
+    void add(Node* n) {
+      if (alive.insert(n).second) {
+        order.push_back(n);
+      }
+    }
+  };
+
+  // Nodes to match in the current round, nullptr during the first one.
+  Round* current = nullptr;
+  // Nodes to match in the next round.
+  Round next;
+  // Every node touched by a transform during the whole run.
+  NodeWorklist* touched = nullptr;
+  // Stage of the nodes created by the last transform.
+  size_t stage = 0;
+};
+
+void PredicateBasedPass::_collectProducers(
+    Node* n,
+    NodeWorklist& nodes) const {
+  std::vector<Node*> frontier{n};
+  for (unsigned int hop = 0; hop < this->getPatternRadius() && !frontier.empty();
+       ++hop) {
+    std::vector<Node*> producers;
+    for (auto* node : frontier) {
+      for (auto* input : node->inputs()) {
+        auto* producer = input->node();
+        if (producer->kind() == kParam || producer->kind() == kCaptured) {
+          continue;
+        }
+        if (nodes.emplace(producer, producer->stage()).second) {
+          producers.push_back(producer);
+        }
+      }
+    }
+    frontier.swap(producers);
+  }
+}
+
+void PredicateBasedPass::_collectConsumers(
+    Node* n,
+    NodeWorklist& nodes) const {
+  std::vector<Node*> frontier{n};
+  for (unsigned int hop = 0; hop < this->getPatternRadius() && !frontier.empty();
+       ++hop) {
+    std::vector<Node*> consumers;
+    for (auto* node : frontier) {
+      for (auto* output : node->outputs()) {
+        for (const auto& use : output->uses()) {
+          if (use.user->kind() == kReturn) {
+            continue;
+          }
+          if (nodes.emplace(use.user, use.user->stage()).second) {
+            consumers.push_back(use.user);
+          }
+        }
+      }
+    }
+    frontier.swap(consumers);
+  }
+}
+
+void PredicateBasedPass::addTouchedNode(Node* node) {
+  if (touched_nodes) {
+    touched_nodes->push_back(node);
+  }
+}
+
+bool PredicateBasedPass::_runTransformOnWorklist(
+    Node* n,
+    Graph& graph,
+    WorklistState& state,
+    NodeDestroyType& destroy_type) {
+  destroy_type = NodeDestroyType::DestroyZero;
+  if (!this->_matches(n)) {
+    return false;
+  }
+  // The transform may destroy some of the producers, so they are collected
+  // before it runs and dropped from the rounds to come.
+  NodeWorklist producers;
+  _collectProducers(n, producers);
+  graph.setStage(++state.stage);
+  std::vector<Node*> rewritten;
+  touched_nodes = &rewritten;
+  const bool changed = this->runTransform(n, graph, destroy_type);
+  touched_nodes = nullptr;
+  if (!changed && destroy_type == NodeDestroyType::DestroyZero) {
+    return false;
+  }
+  for (const auto& producer : producers) {
+    (*state.touched)[producer.first] = producer.second;
+    state.next.alive.erase(producer.first);
+    if (state.current) {
+      state.current->alive.erase(producer.first);
+    }
+  }
+  // The node is still alive here even if it is going to be destroyed. The
+  // nodes created by the transform are among its neighbours, or among the
+  // other consumers of its inputs if they replace it, or else given to
+  // addTouchedNode.
+  NodeWorklist neighbourhood;
+  _collectProducers(n, neighbourhood);
+  _collectConsumers(n, neighbourhood);
+  for (auto* input : n->inputs()) {
+    for (const auto& use : input->uses()) {
+      if (use.user->kind() != kReturn) {
+        neighbourhood.emplace(use.user, use.user->stage());
+      }
+    }
+  }
+  for (auto* node : rewritten) {
+    neighbourhood.emplace(node, node->stage());
+    _collectProducers(node, neighbourhood);
+    _collectConsumers(node, neighbourhood);
+  }
+  if (destroy_type == NodeDestroyType::DestroyOne) {
+    neighbourhood.erase(n);
+    state.touched->erase(n);
+    state.next.alive.erase(n);
+    if (state.current) {
+      state.current->alive.erase(n);
+    }
+  } else {
+    neighbourhood.emplace(n, n->stage());
+  }
+  for (const auto& node : neighbourhood) {
+    (*state.touched)[node.first] = node.second;
+    state.next.add(const_cast<Node*>(node.first));
+  }
+  return changed;
+}
+
+unsigned int PredicateBasedPass::_runPassInternal(
+    Graph& graph,
+    const NodeWorklist* worklist,
+    WorklistState& state) {
+  unsigned int num_changes = 0;
+  for (auto it = graph.begin(); it != graph.end(); ++it) {
+    auto* n = *it;
+    if (n->hasAttributes()) {
+      num_changes += this->DescendOnGraphAttributesAndCount(
+          n, [this, worklist, &state](Graph& g) {
+            return _runPassInternal(g, worklist, state);
+          });
+    }
+    if (worklist) {
+      auto entry = worklist->find(n);
+      if (entry == worklist->end() || entry->second != n->stage()) {
+        continue;
+      }
+    }
+    NodeDestroyType destroy_type;
+    num_changes += _runTransformOnWorklist(n, graph, state, destroy_type);
+    if (destroy_type == NodeDestroyType::DestroyOne) {
+      it.destroyCurrent();
+    }
+  }
+  return num_changes;
+}
+
+unsigned int PredicateBasedPass::_runRound(WorklistState& state) {
+  WorklistState::Round current;
+  std::swap(current, state.next);
+  state.current = &current;
+  unsigned int num_changes = 0;
+  for (auto* n : current.order) {
+    // dropped, or visited already
+    if (current.alive.erase(n) == 0) {
+      continue;
+    }
+    NodeDestroyType destroy_type;
+    num_changes +=
+        _runTransformOnWorklist(n, *n->owningGraph(), state, destroy_type);
+    if (destroy_type == NodeDestroyType::DestroyOne) {
+      n->destroy();
+    }
+  }
+  state.current = nullptr;
+  return num_changes;
+}
+
+std::shared_ptr<PostPassAnalysis> PredicateBasedPass::runPassOnWorklist(
+    Graph& graph,
+    const NodeWorklist* worklist,
+    NodeWorklist& touched) {
+  bool initialized_pass = this->initializePass(graph);
+  WorklistState state;
+  state.touched = &touched;
+  // The transforms create their nodes at stages above the stage of any node
+  // that already exists.
+  graph.forSelfAndEachSubGraph([&state](Graph* g) {
+    state.stage = std::max(state.stage, g->stage());
+  });
+  unsigned int touched_optimizations =
+      this->_runPassInternal(graph, worklist, state);
+  // Running a completely efficient pass twice is the same as running it once,
+  // so it does not need to look at its own rewrites again. Some of these passes
+  // report a change every time they match, so this is also what makes them
+  // terminate.
+  if (this->getPassEfficiency() == PassEfficiency::Partial) {
+    while (!state.next.alive.empty()) {
+      touched_optimizations += this->_runRound(state);
+    }
+  }
+  // Nodes created after the run get a stage of their own too.
+  ++state.stage;
+  graph.forSelfAndEachSubGraph(
+      [&state](Graph* g) { g->setStage(state.stage); });
+  bool finalized_pass = this->finalizePass(graph);
+
+  return _makeAnalysis(
+      touched_optimizations, initialized_pass, finalized_pass);
+}
+
+std::shared_ptr<PostPassAnalysis> PredicateBasedPass::runPassInParallel(
+    Graph& graph,
+    ThreadPool& pool) {
+  ONNX_ASSERTM(
+      this->canOptimizeSubgraphsConcurrently(),
+      "%s can't optimize subgraphs concurrently",
+      this->getPassName().c_str());
+  bool initialized_pass = this->initializePass(graph);
+  unsigned int touched_optimizations = this->_runPassInternal(graph, pool);
+  bool finalized_pass = this->finalizePass(graph);
+
+  return _makeAnalysis(
+      touched_optimizations, initialized_pass, finalized_pass);
+}
+
+bool PredicateBasedPass::_matches(Node* n) {
+  num_predicate_calls.fetch_add(1, std::memory_order_relaxed);
+  return this->patternMatchPredicate(n);
+}
+
+std::shared_ptr<PostPassAnalysis> PredicateBasedPass::_makeAnalysis(
+    unsigned int touched_optimizations,
+    bool initialized_pass,
+    bool finalized_pass) {
+  auto* analysis = new CountBasedPassAnalysis(
+      this, touched_optimizations, initialized_pass, finalized_pass);
+  analysis->num_predicate_calls = num_predicate_calls.exchange(0);
+  return std::shared_ptr<PostPassAnalysis>(analysis);
+}
+
 PassAnalysisType PredicateBasedPass::getPassAnalysisType() const {
   return PassAnalysisType::CountBased;
 }
@@ -83,8 +393,8 @@ std::shared_ptr<PostPassAnalysis> PredicateBasedPass::runPass(Graph& graph) {
   unsigned int touched_optimizations = this->_runPassInternal(graph);
   bool finalized_pass = this->finalizePass(graph);
 
-  return std::shared_ptr<PostPassAnalysis>(new CountBasedPassAnalysis(
-      this, touched_optimizations, initialized_pass, finalized_pass));
+  return _makeAnalysis(
+      touched_optimizations, initialized_pass, finalized_pass);
 }
 
 CountBasedPassAnalysis::CountBasedPassAnalysis(
@@ -7,9 +7,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "onnx/common/ir.h"
 #include "onnx/onnx_pb.h"
+#include "onnxoptimizer/thread_pool.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -79,6 +83,15 @@ enum NodeDestroyType {
   // topological orders. So we remove it.
 };
 
+// Nodes that a predicate based pass has to look at again because their
+// neighbourhood was rewritten, each mapped to the stage it had when it was
+// added. Other passes may destroy some of them in the meantime, so a node is
+// only looked at once it has been found in the graph, and only if its stage
+// still matches: every transform run on a worklist creates its nodes at a stage
+// of their own, so a node allocated at the address of a destroyed one is not
+// mistaken for it.
+using NodeWorklist = std::unordered_map<const Node *, size_t>;
+
 // Base class for all optimizations within ONNX. A pass must contain the
 // annotations described above. Furthermore each pass is given the ability to
 // initialize and finalize it's pass. Each pass must have a unique name that
@@ -106,6 +119,21 @@ class Pass {
   virtual PassAnalysisType getPassAnalysisType() const = 0;
   virtual std::string getPassName() const = 0;
 
+  // The kinds of nodes this pass may create, remove, modify or give new inputs
+  // to when it changes the graph. The consumers of a value that is replaced by
+  // an output of such a node don't count, as long as the metadata of the value
+  // is kept. Empty means any kind, which is what a pass that hands the input
+  // of a removed node to its consumers has to declare.
+  virtual std::vector<NodeKind> getProducedKinds() const {
+    return {};
+  }
+  // The kinds of nodes whose creation, removal or modification may give this
+  // pass something new to do, i.e. every kind its pattern looks at. Empty means
+  // any kind.
+  virtual std::vector<NodeKind> getConsumedKinds() const {
+    return {};
+  }
+
   virtual bool initializePass(Graph &) {
     return false;
   }
@@ -144,6 +172,8 @@ struct CountBasedPassAnalysis : PostPassAnalysis {
   unsigned int num_positive_transforms;
   bool initialization_done;
   bool finalization_done;
+  // How many times patternMatchPredicate was called.
+  unsigned int num_predicate_calls = 0;
 
  public:
   explicit CountBasedPassAnalysis(Pass *pass,
@@ -180,6 +210,16 @@ class PredicateBasedPass : public Pass {
   ~PredicateBasedPass() override;
 
   virtual bool patternMatchPredicate(Node *node) = 0;
+  // The kinds of nodes patternMatchPredicate can possibly match. It lets a
+  // pass manager skip the predicate for nodes of any other kind. An empty list
+  // means that nodes of every kind have to be tried.
+  virtual std::vector<NodeKind> getRootKinds() const {
+    return {};
+  }
+  // Most predicates look at nothing but the matched node.
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return getRootKinds();
+  }
   // Run transform is given the current node in the iterator, a reference to the
   // current graph as well as a reference describing how to treat the current
   // node in the iterator post transform. Run transform is then responsible for
@@ -192,6 +232,48 @@ class PredicateBasedPass : public Pass {
   std::shared_ptr<PostPassAnalysis> runPass(Graph &graph) override;
   PassAnalysisType getPassAnalysisType() const override;
 
+  // Worklist driven version of runPass. Only the nodes in |worklist| (or all
+  // nodes if it is nullptr) are matched in the first round, which walks the
+  // graph to find them. If the pass is only partially efficient, the nodes
+  // around successful transforms, which include the nodes created by them, are
+  // matched again in further rounds that visit nothing else, until the pass
+  // does not change anything anymore. Every node touched by a transform is
+  // also added to |touched|, so that a pass manager can hand it over to the
+  // other passes.
+  std::shared_ptr<PostPassAnalysis> runPassOnWorklist(
+      Graph &graph, const NodeWorklist *worklist, NodeWorklist &touched);
+
+  // Same as runPass, but the subgraphs of the nodes of a graph are optimized
+  // concurrently on |pool| before the nodes of the graph itself are matched,
+  // instead of each one right before the node that holds it. Every task owns a
+  // subgraph together with the subgraphs nested in it, and runTransform is only
+  // given that subgraph, whose unique names are allocated and checked without
+  // looking at any other graph, so graph.getNextUnique() does not race. The
+  // result only matches the one of runPass if the pass supports it, see
+  // canOptimizeSubgraphsConcurrently, which is asserted.
+  std::shared_ptr<PostPassAnalysis> runPassInParallel(Graph &graph,
+                                                      ThreadPool &pool);
+
+  // Whether runPassInParallel gives the same result as runPass. It does as
+  // long as patternMatchPredicate and runTransform keep no state in the pass
+  // object, which is shared by the tasks, and only look at and rewrite the
+  // graph of the matched node and the subgraphs of the node itself, so that it
+  // makes no difference whether the subgraphs of the other nodes have been
+  // optimized yet. A pass that doesn't has to return false, and pass managers
+  // run it with runPass instead.
+  virtual bool canOptimizeSubgraphsConcurrently() const {
+    return true;
+  }
+
+  // How many producer/consumer hops away from the matched node
+  // patternMatchPredicate may look. A rewrite puts the nodes within this
+  // distance back onto the worklist. The rounds after the first one of
+  // runPassOnWorklist rely on a partially efficient pass destroying nothing
+  // but the matched node and its producers within this distance.
+  virtual unsigned int getPatternRadius() const {
+    return 2;
+  }
+
   static int getOpsetVersion(const Graph &g) {
     // this hack is due to `opset_versions_mutable` doesn't have a const version
     Graph &mut_g = const_cast<Graph &>(g);
@@ -203,8 +285,37 @@ class PredicateBasedPass : public Pass {
     return 0;
   }
 
+ protected:
+  // Has |node|, created or given new inputs by the running transform, matched
+  // again and handed to the other passes like the neighbours of the matched
+  // node when the pass runs on a worklist. A transform that removes the inputs
+  // of the matched node before it is destroyed has to, since the node is then
+  // cut off from what the transform rewrote.
+  void addTouchedNode(Node *node);
+
  private:
+  struct WorklistState;
+
   unsigned int _runPassInternal(Graph &graph);
+  unsigned int _runPassInternal(Graph &graph, const NodeWorklist *worklist,
+                                WorklistState &state);
+  unsigned int _runRound(WorklistState &state);
+  unsigned int _runPassInternal(Graph &graph, ThreadPool &pool);
+  bool _matches(Node *n);
+  std::shared_ptr<PostPassAnalysis> _makeAnalysis(
+      unsigned int touched_optimizations, bool initialized_pass,
+      bool finalized_pass);
+
+  // calls of patternMatchPredicate since the last analysis was made
+  std::atomic<unsigned int> num_predicate_calls{0};
+  // nodes given to addTouchedNode by the transform running on a worklist, or
+  // nullptr if there is none
+  std::vector<Node *> *touched_nodes = nullptr;
+  // Adds the producers and the consumers of |n| within getPatternRadius hops.
+  void _collectProducers(Node *n, NodeWorklist &nodes) const;
+  void _collectConsumers(Node *n, NodeWorklist &nodes) const;
+  bool _runTransformOnWorklist(Node *n, Graph &graph, WorklistState &state,
+                               NodeDestroyType &destroy_type);
 };
 
 // The most general pass which allows the user to run a pass given only a graph.
@@ -4,6 +4,12 @@
 
 #include "onnxoptimizer/pass_manager.h"
 
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
@@ -17,20 +23,147 @@ void GeneralPassManager::add(std::shared_ptr<Pass> pass) {
   this->passes.push_back(std::move(pass));
 }
 
+namespace {
+
+double currentTimeMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void countNodesAndInitializers(
+    Graph& graph,
+    int64_t& num_nodes,
+    int64_t& num_initializers) {
+  num_nodes = 0;
+  num_initializers = 0;
+  graph.forSelfAndEachSubGraph([&](Graph* g) {
+    num_nodes += std::distance(g->begin(), g->end());
+    num_initializers += g->initializers().size();
+  });
+}
+
+// Sets the stage of |graph| and of its subgraphs above the stage of every
+// existing node, so that the nodes created from now on can be told apart, and
+// returns it.
+size_t StartStage(Graph& graph) {
+  size_t stage = 0;
+  graph.forSelfAndEachSubGraph(
+      [&stage](Graph* g) { stage = std::max(stage, g->stage()); });
+  ++stage;
+  graph.forSelfAndEachSubGraph([stage](Graph* g) { g->setStage(stage); });
+  return stage;
+}
+
+} // namespace
+
+PassRunProfile GeneralPassManager::startProfile(
+    std::string pass_name,
+    Graph& graph) const {
+  PassRunProfile profile;
+  profile.pass_name = std::move(pass_name);
+  profile.iteration = this->iteration;
+  countNodesAndInitializers(
+      graph, profile.node_count_delta, profile.initializer_count_delta);
+  profile.wall_time_ms = currentTimeMs();
+  return profile;
+}
+
+void GeneralPassManager::finishProfile(PassRunProfile& profile, Graph& graph) {
+  profile.wall_time_ms = currentTimeMs() - profile.wall_time_ms;
+  int64_t num_nodes, num_initializers;
+  countNodesAndInitializers(graph, num_nodes, num_initializers);
+  profile.node_count_delta = num_nodes - profile.node_count_delta;
+  profile.initializer_count_delta =
+      num_initializers - profile.initializer_count_delta;
+  this->pass_runs.push_back(std::move(profile));
+}
+
+std::shared_ptr<PostPassAnalysis> GeneralPassManager::profileRun(
+    Pass& pass,
+    Graph& graph,
+    const std::function<std::shared_ptr<PostPassAnalysis>()>& run) {
+  const size_t stage = StartStage(graph);
+  if (!this->profiling) {
+    auto analysis = run();
+    inferShapesAfterRun(pass, analysis, graph, stage);
+    return analysis;
+  }
+  PassRunProfile profile = startProfile(pass.getPassName(), graph);
+  auto analysis = run();
+  inferShapesAfterRun(pass, analysis, graph, stage);
+  if (pass.getPassAnalysisType() == PassAnalysisType::CountBased) {
+    auto count_analysis =
+        std::static_pointer_cast<CountBasedPassAnalysis>(analysis);
+    profile.num_predicate_calls = count_analysis->num_predicate_calls;
+    profile.num_transforms = count_analysis->num_positive_transforms;
+  }
+  finishProfile(profile, graph);
+  return analysis;
+}
+
+void GeneralPassManager::startRun(Graph& graph) {
+  this->shape_inference.infer(graph);
+}
+
+void GeneralPassManager::inferShapesAfterRun(
+    const Pass& pass,
+    const std::shared_ptr<PostPassAnalysis>& analysis,
+    Graph& graph,
+    size_t since) {
+  if (pass.getPassAnalysisType() == PassAnalysisType::CountBased &&
+      !std::static_pointer_cast<CountBasedPassAnalysis>(analysis)
+           ->graphChanged()) {
+    return;
+  }
+  this->shape_inference.infer(graph, since);
+}
+
+std::shared_ptr<PassManagerAnalysis> GeneralPassManager::finishRun(
+    Graph& graph) {
+  this->shape_inference.revert(graph);
+  this->iteration = 0;
+  if (!this->profiling) {
+    this->pass_runs.clear();
+    return std::shared_ptr<PassManagerAnalysis>(new EmptyPassManagerAnalysis());
+  }
+  auto analysis = std::make_shared<ProfilePassManagerAnalysis>();
+  analysis->pass_runs.swap(this->pass_runs);
+  return analysis;
+}
+
+std::shared_ptr<PostPassAnalysis> GeneralPassManager::runPass(
+    Pass& pass,
+    Graph& graph) {
+  return profileRun(pass, graph, [this, &pass, &graph] {
+    if (this->subgraph_pool) {
+      auto* predicate_pass = dynamic_cast<PredicateBasedPass*>(&pass);
+      if (predicate_pass &&
+          predicate_pass->canOptimizeSubgraphsConcurrently()) {
+        return predicate_pass->runPassInParallel(graph, *this->subgraph_pool);
+      }
+    }
+    return pass.runPass(graph);
+  });
+}
+
 std::shared_ptr<PassManagerAnalysis> GeneralPassManager::run(Graph& graph) {
+  startRun(graph);
   for (const std::shared_ptr<Pass>& pass : this->passes) {
-    auto pass_analysis = pass->runPass(graph);
+    auto pass_analysis = this->runPass(*pass, graph);
   }
-  return std::shared_ptr<PassManagerAnalysis>(new EmptyPassManagerAnalysis());
+  return finishRun(graph);
 }
 
 std::shared_ptr<PassManagerAnalysis> FixedPointPassManager::run(Graph& graph) {
+  startRun(graph);
   bool fixed_point_optimization_done;
 
   do {
     fixed_point_optimization_done = false;
     for (const std::shared_ptr<Pass>& pass : this->passes) {
-      std::shared_ptr<PostPassAnalysis> analysis = pass->runPass(graph);
+      std::shared_ptr<PostPassAnalysis> analysis =
+          this->runPass(*pass, graph);
       if (pass->getPassAnalysisType() == PassAnalysisType::Empty) {
         continue;
       }
@@ -39,13 +172,346 @@ std::shared_ptr<PassManagerAnalysis> FixedPointPassManager::run(Graph& graph) {
 
       while (count_analysis->fixedPointOptimizationNeeded()) {
         count_analysis = std::static_pointer_cast<CountBasedPassAnalysis>(
-            pass->runPass(graph));
+            this->runPass(*pass, graph));
         fixed_point_optimization_done = true;
       }
     }
+    this->iteration++;
   } while (fixed_point_optimization_done);
 
-  return std::shared_ptr<PassManagerAnalysis>(new EmptyPassManagerAnalysis());
+  return finishRun(graph);
+}
+
+std::shared_ptr<PassManagerAnalysis> WorklistPassManager::run(Graph& graph) {
+  startRun(graph);
+  const size_t num_passes = this->passes.size();
+  // nodes touched since the i-th pass last ran
+  std::vector<NodeWorklist> pending(num_passes);
+  // whether the i-th pass has to look at the whole graph
+  std::vector<bool> full_run_needed(num_passes, true);
+  bool fixed_point_optimization_needed;
+
+  do {
+    fixed_point_optimization_needed = false;
+    for (size_t i = 0; i < num_passes; ++i) {
+      if (!full_run_needed[i] && pending[i].empty()) {
+        continue;
+      }
+      const std::shared_ptr<Pass>& pass = this->passes[i];
+      auto* predicate_pass = dynamic_cast<PredicateBasedPass*>(pass.get());
+      NodeWorklist touched;
+      std::shared_ptr<PostPassAnalysis> analysis;
+      if (predicate_pass) {
+        analysis = profileRun(*pass, graph, [&] {
+          return predicate_pass->runPassOnWorklist(
+              graph, full_run_needed[i] ? nullptr : &pending[i], touched);
+        });
+      } else {
+        analysis = profileRun(
+            *pass, graph, [&pass, &graph] { return pass->runPass(graph); });
+      }
+      full_run_needed[i] = false;
+      pending[i].clear();
+
+      if (pass->getPassAnalysisType() == PassAnalysisType::Empty) {
+        continue;
+      }
+      auto count_analysis =
+          std::static_pointer_cast<CountBasedPassAnalysis>(analysis);
+      if (!count_analysis->graphChanged()) {
+        continue;
+      }
+      // Like in FixedPointPassManager, only a partially efficient pass makes
+      // the passes run once more, the others just hand the nodes they touched
+      // to the passes after them.
+      if (pass->getPassEfficiency() == PassEfficiency::Partial) {
+        fixed_point_optimization_needed = true;
+      }
+      for (size_t j = 0; j < num_passes; ++j) {
+        if (j == i) {
+          // a predicate based pass has already converged on its own rewrites
+          full_run_needed[j] = !predicate_pass &&
+                               pass->getPassEfficiency() ==
+                                   PassEfficiency::Partial;
+          continue;
+        }
+        if (predicate_pass &&
+            dynamic_cast<PredicateBasedPass*>(passes[j].get())) {
+          // the stages in |touched| are the latest ones
+          for (const auto& node : touched) {
+            pending[j][node.first] = node.second;
+          }
+        } else {
+          full_run_needed[j] = true;
+        }
+      }
+    }
+    this->iteration++;
+  } while (fixed_point_optimization_needed);
+
+  return finishRun(graph);
+}
+
+namespace {
+
+// Whether a pass that produces |produced| may give a pass that consumes
+// |consumed| something new to do. Empty lists stand for every kind.
+bool mayTrigger(
+    const std::vector<NodeKind>& produced,
+    const std::unordered_set<NodeKind>& consumed) {
+  if (produced.empty() || consumed.empty()) {
+    return true;
+  }
+  return std::any_of(
+      produced.begin(), produced.end(), [&consumed](const NodeKind& kind) {
+        return consumed.count(kind) > 0;
+      });
+}
+
+} // namespace
+
+std::shared_ptr<PassManagerAnalysis> ScheduledPassManager::run(Graph& graph) {
+  startRun(graph);
+  const size_t num_passes = this->passes.size();
+  std::vector<std::unordered_set<NodeKind>> consumed(num_passes);
+  for (size_t i = 0; i < num_passes; ++i) {
+    const auto kinds = this->passes[i]->getConsumedKinds();
+    consumed[i].insert(kinds.begin(), kinds.end());
+  }
+  // whether the i-th pass has to run (again)
+  std::vector<bool> scheduled(num_passes, true);
+
+  do {
+    for (size_t i = 0; i < num_passes; ++i) {
+      if (!scheduled[i]) {
+        continue;
+      }
+      scheduled[i] = false;
+      const std::shared_ptr<Pass>& pass = this->passes[i];
+      std::shared_ptr<PostPassAnalysis> analysis =
+          this->runPass(*pass, graph);
+      if (pass->getPassAnalysisType() == PassAnalysisType::Empty) {
+        continue;
+      }
+      std::shared_ptr<CountBasedPassAnalysis> count_analysis =
+          std::static_pointer_cast<CountBasedPassAnalysis>(analysis);
+      if (!count_analysis->graphChanged()) {
+        continue;
+      }
+      while (count_analysis->fixedPointOptimizationNeeded()) {
+        count_analysis = std::static_pointer_cast<CountBasedPassAnalysis>(
+            this->runPass(*pass, graph));
+      }
+      const auto produced = pass->getProducedKinds();
+      for (size_t j = 0; j < num_passes; ++j) {
+        if (j != i && mayTrigger(produced, consumed[j])) {
+          scheduled[j] = true;
+        }
+      }
+    }
+    this->iteration++;
+  } while (std::find(scheduled.begin(), scheduled.end(), true) !=
+           scheduled.end());
+
+  return finishRun(graph);
+}
+
+namespace {
+
+// A group of predicate based passes indexed by the kinds of nodes they can
+// match.
+class PassDispatcher {
+ public:
+  explicit PassDispatcher(std::vector<PredicateBasedPass*> passes)
+      : passes_(std::move(passes)) {
+    for (size_t i = 0; i < passes_.size(); ++i) {
+      const auto kinds = passes_[i]->getRootKinds();
+      if (kinds.empty()) {
+        any_kind_.push_back(i);
+      }
+      for (const auto& kind : kinds) {
+        auto& indices = by_kind_[kind];
+        if (indices.empty() || indices.back() != i) {
+          indices.push_back(i);
+        }
+      }
+    }
+  }
+
+  void initialize(Graph& graph) {
+    for (auto* pass : passes_) {
+      pass->initializePass(graph);
+    }
+  }
+
+  void finalize(Graph& graph) {
+    for (auto* pass : passes_) {
+      pass->finalizePass(graph);
+    }
+  }
+
+  // Walks the graph once. If |created_since| is not zero, only the nodes
+  // created at that stage or later are handed to the passes. The nodes created
+  // by the walk get a stage above the stage of every existing node, which is
+  // returned.
+  size_t run(Graph& graph, size_t created_since) {
+    partial_pass_changed_ = false;
+    num_predicate_calls_ = 0;
+    num_transforms_ = 0;
+    const size_t stage = StartStage(graph);
+    created_since_ = created_since;
+    walk(graph);
+    return stage;
+  }
+
+  // Whether a partially efficient pass changed the graph in the last walk,
+  // in which case another walk over all nodes may find more to rewrite.
+  bool partialPassChanged() const {
+    return partial_pass_changed_;
+  }
+
+  // The names of the passes, separated by commas.
+  std::string name() const {
+    std::string name;
+    for (auto* pass : passes_) {
+      if (!name.empty()) {
+        name += ",";
+      }
+      name += pass->getPassName();
+    }
+    return name;
+  }
+
+  // Statistics of the last walk.
+  unsigned int numPredicateCalls() const {
+    return num_predicate_calls_;
+  }
+  unsigned int numTransforms() const {
+    return num_transforms_;
+  }
+
+ private:
+  void walk(Graph& graph) {
+    for (auto it = graph.begin(); it != graph.end(); ++it) {
+      auto* n = *it;
+      for (auto name : n->attributeNames()) {
+        auto kind = n->kindOf(name);
+        if (kind == AttributeKind::g) {
+          walk(*n->g(name));
+        }
+        if (kind == AttributeKind::gs) {
+          for (auto& g : n->gs(name)) {
+            walk(*g);
+          }
+        }
+      }
+      if (n->stage() < created_since_) {
+        continue;
+      }
+      for (auto* pass : candidates(n->kind())) {
+        num_predicate_calls_++;
+        if (!pass->patternMatchPredicate(n)) {
+          continue;
+        }
+        NodeDestroyType destroy_type = NodeDestroyType::DestroyZero;
+        if (pass->runTransform(n, graph, destroy_type)) {
+          num_transforms_++;
+          if (pass->getPassEfficiency() == PassEfficiency::Partial) {
+            partial_pass_changed_ = true;
+          }
+        }
+        if (destroy_type == NodeDestroyType::DestroyOne) {
+          it.destroyCurrent();
+          break;
+        }
+      }
+    }
+  }
+
+  // The passes that may match a node of the given kind, in the order they
+  // were added.
+  const std::vector<PredicateBasedPass*>& candidates(NodeKind kind) {
+    auto cached = candidates_.find(kind);
+    if (cached != candidates_.end()) {
+      return cached->second;
+    }
+    std::vector<size_t> indices = any_kind_;
+    auto it = by_kind_.find(kind);
+    if (it != by_kind_.end()) {
+      std::vector<size_t> merged;
+      std::merge(indices.begin(), indices.end(), it->second.begin(),
+                 it->second.end(), std::back_inserter(merged));
+      indices.swap(merged);
+    }
+    auto& passes = candidates_[kind];
+    for (auto i : indices) {
+      passes.push_back(passes_[i]);
+    }
+    return passes;
+  }
+
+  std::vector<PredicateBasedPass*> passes_;
+  std::vector<size_t> any_kind_;
+  std::unordered_map<NodeKind, std::vector<size_t>> by_kind_;
+  std::unordered_map<NodeKind, std::vector<PredicateBasedPass*>> candidates_;
+  bool partial_pass_changed_ = false;
+  size_t created_since_ = 0;
+  unsigned int num_predicate_calls_ = 0;
+  unsigned int num_transforms_ = 0;
+};
+
+} // namespace
+
+std::shared_ptr<PassManagerAnalysis> DispatchPassManager::run(Graph& graph) {
+  startRun(graph);
+  size_t i = 0;
+  while (i < this->passes.size()) {
+    std::vector<PredicateBasedPass*> group;
+    for (; i < this->passes.size(); ++i) {
+      auto* predicate_pass =
+          dynamic_cast<PredicateBasedPass*>(this->passes[i].get());
+      if (!predicate_pass) {
+        break;
+      }
+      group.push_back(predicate_pass);
+    }
+    if (group.empty()) {
+      auto& pass = this->passes[i++];
+      profileRun(*pass, graph, [&pass, &graph] { return pass->runPass(graph); });
+      continue;
+    }
+    PassDispatcher dispatcher(std::move(group));
+    // zero to hand every node to the passes
+    size_t created_since = 0;
+    bool walk_needed;
+    this->iteration = 0;
+    do {
+      PassRunProfile profile;
+      if (this->profiling) {
+        profile = startProfile(dispatcher.name(), graph);
+      }
+      dispatcher.initialize(graph);
+      const size_t stage = dispatcher.run(graph, created_since);
+      dispatcher.finalize(graph);
+      // A node created by a pass may be matched by the passes that have
+      // already been handed the node it replaces, so the nodes created by a
+      // walk are walked once more. A partially efficient pass may find more
+      // to rewrite anywhere.
+      walk_needed = dispatcher.numTransforms() > 0;
+      created_since = dispatcher.partialPassChanged() ? 0 : stage;
+      if (dispatcher.numTransforms() > 0) {
+        this->shape_inference.infer(graph, stage);
+      }
+      if (this->profiling) {
+        profile.num_predicate_calls = dispatcher.numPredicateCalls();
+        profile.num_transforms = dispatcher.numTransforms();
+        finishProfile(profile, graph);
+      }
+      this->iteration++;
+    } while (walk_needed);
+    this->iteration = 0;
+  }
+  return finishRun(graph);
 }
 } // namespace optimization
 } // namespace ONNX_NAMESPACE
@@ -6,16 +6,46 @@
 // ATTENTION: The code in this file is highly EXPERIMENTAL.
 // Adventurous users should note that the APIs will probably change.
 
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <vector>
 #include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/shape_inference.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
 // An analysis returned from the run done by a manager
-struct PassManagerAnalysis {};
+struct PassManagerAnalysis {
+  virtual ~PassManagerAnalysis() = default;
+};
 struct EmptyPassManagerAnalysis : PassManagerAnalysis {};
 
+// What a pass manager with profiling enabled records about a single run of a
+// pass.
+struct PassRunProfile {
+  std::string pass_name;
+  // The round of the pass manager the run belongs to, e.g. the fixed point
+  // iteration of FixedPointPassManager. Counts from 0. DispatchPassManager
+  // profiles every walk of a group of passes as a single run, named after all
+  // of the passes, and counts the walks of each group from 0.
+  unsigned int iteration = 0;
+  double wall_time_ms = 0;
+  // Only counted for predicate based passes.
+  unsigned int num_predicate_calls = 0;
+  unsigned int num_transforms = 0;
+  // Changes of the number of nodes and initializers, subgraphs included.
+  int64_t node_count_delta = 0;
+  int64_t initializer_count_delta = 0;
+};
+
+// The analysis returned by a pass manager with profiling enabled, with one
+// entry per run of a pass in the order they ran.
+struct ProfilePassManagerAnalysis : PassManagerAnalysis {
+  std::vector<PassRunProfile> pass_runs;
+};
+
 // Base class of all PassManager's. The class should be able to add new passes
 // as well as run the passes given a graph.
 class PassManager {
@@ -25,6 +55,15 @@ class PassManager {
 
   virtual void add(std::shared_ptr<Pass> P) = 0;
   virtual std::shared_ptr<PassManagerAnalysis> run(Graph& graph) = 0;
+
+  // Makes run profile every pass it runs and return a
+  // ProfilePassManagerAnalysis. Managers that can't profile ignore it.
+  void setProfiling(bool profiling) {
+    this->profiling = profiling;
+  }
+
+ protected:
+  bool profiling = false;
 };
 
 // The GeneralPassManager has no restriction on type of Pass and runs the passes
@@ -37,11 +76,61 @@ class GeneralPassManager : public PassManager {
   void add(std::shared_ptr<Pass> pass) override;
   std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
 
+  // Lets the predicate based passes optimize the subgraphs of the nodes of a
+  // graph concurrently on |pool| (see PredicateBasedPass::runPassInParallel),
+  // unless they don't support it
+  // (PredicateBasedPass::canOptimizeSubgraphsConcurrently).
+  // WorklistPassManager and DispatchPassManager always run them on the calling
+  // thread.
+  void setSubgraphThreadPool(std::shared_ptr<ThreadPool> pool) {
+    this->subgraph_pool = std::move(pool);
+  }
+
  protected:
+  // Runs |pass| on the subgraph thread pool if there is one, and profiles the
+  // run if profiling is enabled.
+  std::shared_ptr<PostPassAnalysis> runPass(Pass& pass, Graph& graph);
+  // Profiles |run|, which runs |pass| on |graph|, if profiling is enabled.
+  std::shared_ptr<PostPassAnalysis> profileRun(
+      Pass& pass, Graph& graph,
+      const std::function<std::shared_ptr<PostPassAnalysis>()>& run);
+  // Starts and finishes the profile of a run of passes that is not described
+  // by the analysis of a single pass. The profile holds the time and the counts
+  // at the start of the run in between, which finishProfile turns into deltas
+  // before it records the profile.
+  PassRunProfile startProfile(std::string pass_name, Graph& graph) const;
+  void finishProfile(PassRunProfile& profile, Graph& graph);
+  // Infers the shapes of the values of |graph| before the passes run, so that
+  // the passes depending on shapes fire on the values the model leaves
+  // without them too. Every run pays for this, the default optimize() one
+  // included: the schema inference function of every node is called once,
+  // which encodes its attributes and input types as protos, and the inputs
+  // of every node are remembered until finishRun.
+  void startRun(Graph& graph);
+  // Infers the shapes of the values created by a run of |pass| that may have
+  // changed the graph, i.e. of the outputs of the nodes created at stage
+  // |since| or later, of the nodes whose inputs it rewired and of the nodes
+  // downstream of them. This compares the inputs of every node with the
+  // remembered ones, but only calls the inference functions of the nodes
+  // visited.
+  void inferShapesAfterRun(
+      const Pass& pass,
+      const std::shared_ptr<PostPassAnalysis>& analysis,
+      Graph& graph,
+      size_t since);
+  // Takes the inferred shapes back from |graph| and returns the analysis of the
+  // run that ends here.
+  std::shared_ptr<PassManagerAnalysis> finishRun(Graph& graph);
+  // the round of the current run the profiles are recorded for
+  unsigned int iteration = 0;
+  std::vector<PassRunProfile> pass_runs;
+  RevertibleShapeInference shape_inference;
+
   // use vector here to ensure the order of the passes
   // for some pass, order is critical, for example,
   // split_init and split_predict should be the last in the list
   std::vector<std::shared_ptr<Pass>> passes;
+  std::shared_ptr<ThreadPool> subgraph_pool;
 };
 
 // Exhibits the same behavior as GeneralPassManager but will instead check
@@ -50,5 +139,38 @@ class FixedPointPassManager : public GeneralPassManager {
   std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
 };
 
+// Runs the passes until none of them changes the graph anymore. Only the first
+// round matches every node; afterwards a predicate based pass is only handed
+// the nodes touched by rewrites since it last ran, so converging costs time
+// proportional to the number of rewrites instead of the size of the graph.
+// Other passes are rerun whenever the graph has changed since they last ran,
+// and a change they report makes every pass look at the whole graph again. Like
+// in FixedPointPassManager, the passes only run once more as long as a
+// partially efficient pass changes the graph.
+class WorklistPassManager : public GeneralPassManager {
+  std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
+};
+
+// Runs the passes until none of them changes the graph anymore, like
+// FixedPointPassManager, but once a pass has changed the graph only the passes
+// that consume one of the node kinds it produces are run again (see
+// Pass::getProducedKinds and Pass::getConsumedKinds).
+class ScheduledPassManager : public GeneralPassManager {
+  std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
+};
+
+// Runs every group of consecutive predicate based passes in a single walk over
+// the graph instead of one walk per pass. The passes of a group are indexed by
+// the kinds returned by getRootKinds, so a node is only handed to the passes
+// that can match it, in the order they were added. The nodes created by a walk
+// are handed to the passes in another walk, so a pass sees the nodes created
+// by the passes before it, like in GeneralPassManager. Like in
+// FixedPointPassManager, the walk is repeated over all nodes as long as a
+// partially efficient pass changes the graph. Other passes run on their own in
+// between, like in GeneralPassManager.
+class DispatchPassManager : public GeneralPassManager {
+  std::shared_ptr<PassManagerAnalysis> run(Graph& graph) override;
+};
+
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
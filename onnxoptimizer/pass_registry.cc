@@ -10,10 +10,11 @@
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
-const std::vector<std::string> GlobalPassRegistry::GetFuseAndEliminationPass() {
+const std::vector<std::string> GlobalPassRegistry::GetFuseAndEliminationPass()
+    const {
   std::vector<std::string> names;
   for (const auto& name : this->pass_names) {
-    const auto pass_type = this->passes.at(name)->getPassType();
+    const auto pass_type = this->find(name)->getPassType();
     if (pass_type == PassType::Fuse || pass_type == PassType::Nop) {
       names.push_back(name);
     }
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
 #include <unordered_set>
 #include <vector>
 
@@ -16,6 +18,9 @@
 #include "onnx/proto_utils.h"
 #include "onnxoptimizer/passes/adjust_add.h"
 #include "onnxoptimizer/passes/adjust_slice_and_matmul.h"
+#include "onnxoptimizer/passes/canonicalize_view_ops.h"
+#include "onnxoptimizer/passes/constant_folding.h"
+#include "onnxoptimizer/passes/convert_layout.h"
 #include "onnxoptimizer/passes/eliminate_consecutive_idempotent_ops.h"
 #include "onnxoptimizer/passes/eliminate_deadend.h"
 #include "onnxoptimizer/passes/eliminate_duplicate_initializer.h"
@@ -37,6 +42,7 @@
 #include "onnxoptimizer/passes/eliminate_unused_initializer.h"
 #include "onnxoptimizer/passes/extract_constant_to_initializer.h"
 #include "onnxoptimizer/passes/fuse_add_bias_into_conv.h"
+#include "onnxoptimizer/passes/fuse_attention.h"
 #include "onnxoptimizer/passes/fuse_bn_into_conv.h"
 #include "onnxoptimizer/passes/fuse_concat_into_reshape.h"
 #include "onnxoptimizer/passes/fuse_consecutive_concats.h"
@@ -44,15 +50,19 @@
 #include "onnxoptimizer/passes/fuse_consecutive_reduce_unsqueeze.h"
 #include "onnxoptimizer/passes/fuse_consecutive_squeezes.h"
 #include "onnxoptimizer/passes/fuse_consecutive_transposes.h"
+#include "onnxoptimizer/passes/fuse_layer_norm.h"
 #include "onnxoptimizer/passes/fuse_matmul_add_bias_into_gemm.h"
 #include "onnxoptimizer/passes/fuse_pad_into_conv.h"
 #include "onnxoptimizer/passes/fuse_pad_into_pool.h"
+#include "onnxoptimizer/passes/fuse_shape_computation_into_reshape.h"
 #include "onnxoptimizer/passes/fuse_transpose_into_gemm.h"
+#include "onnxoptimizer/passes/hoist_loop_invariants.h"
 #include "onnxoptimizer/passes/lift_lexical_references.h"
 #include "onnxoptimizer/passes/nop.h"
 #include "onnxoptimizer/passes/rename_input_output.h"
 #include "onnxoptimizer/passes/replace_einsum_with_matmul.h"
 #include "onnxoptimizer/passes/set_unique_name_for_nodes.h"
+#include "onnxoptimizer/passes/sink_transposes.h"
 #include "onnxoptimizer/passes/split.h"
 #include "onnxoptimizer/passes/fuse_consecutive_slices.h"
 #include "onnxoptimizer/passes/eliminate_common_subexpression.h"
@@ -64,9 +74,14 @@
 namespace ONNX_NAMESPACE {
 namespace optimization {
 
-// Registry containing all passes available in ONNX.
+// Registry containing all passes available in ONNX. It only keeps a factory
+// per pass, so that every optimizer gets pass instances of its own and passes
+// may keep state while they run. The registry itself is not modified after it
+// has been constructed, so it can be read from several threads at once.
 struct GlobalPassRegistry {
-  std::map<std::string, std::shared_ptr<Pass>> passes;
+  using PassFactory = std::function<std::shared_ptr<Pass>()>;
+
+  std::map<std::string, PassFactory> factories;
   std::vector<std::string> pass_names;
 
   GlobalPassRegistry() {
@@ -113,35 +128,48 @@ struct GlobalPassRegistry {
     registerPass<EliminateDeadEnd>();
     registerPass<EliminateIdentity>();
     registerPass<EliminateShapeOp>();
+    registerPass<ConstantFolding>();
     registerPass<FuseConsecutiveSlices>();
     registerPass<EliminateUnusedInitializer>();
     registerPass<EliminateDuplicateInitializer>();
     registerPass<AdjustSliceAndMatmul>();
     registerPass<RewriteInputDtype>();
+    registerPass<HoistLoopInvariants>();
+    registerPass<SinkTransposes>();
+    registerPass<ConvertLayoutToNhwc>();
+    registerPass<ConvertLayoutToNhwcForGpu>();
+    registerPass<ConvertLayoutToNchw>();
+    registerPass<CanonicalizeViewOps>();
+    registerPass<FuseShapeComputationIntoReshape>();
+    registerPass<FuseAttention>();
+    registerPass<FuseLayerNorm>();
+    registerPass<FuseRMSNorm>();
+    registerPass<FuseSkipLayerNorm>();
   }
 
   ~GlobalPassRegistry() {
-    this->passes.clear();
+    this->factories.clear();
   }
 
-  std::shared_ptr<Pass> find(std::string pass_name) {
-    auto it = this->passes.find(pass_name);
-    ONNX_ASSERTM(it != this->passes.end(), "pass %s is unknown.",
+  // Creates a new instance of the pass named |pass_name|.
+  std::shared_ptr<Pass> find(std::string pass_name) const {
+    auto it = this->factories.find(pass_name);
+    ONNX_ASSERTM(it != this->factories.end(), "pass %s is unknown.",
                  pass_name.c_str());
-    return it->second;
+    return it->second();
   }
-  const std::vector<std::string> GetAvailablePasses() {
+  const std::vector<std::string> GetAvailablePasses() const {
     return pass_names;
   }
 
-  const std::vector<std::string> GetFuseAndEliminationPass();
+  const std::vector<std::string> GetFuseAndEliminationPass() const;
 
   template <typename T>
   void registerPass() {
     static_assert(std::is_base_of<Pass, T>::value, "T must inherit from Pass");
-    std::shared_ptr<Pass> pass(new T());
-    passes[pass->getPassName()] = pass;
-    pass_names.emplace_back(pass->getPassName());
+    const std::string pass_name = T().getPassName();
+    factories[pass_name] = [] { return std::shared_ptr<Pass>(new T()); };
+    pass_names.emplace_back(pass_name);
   }
 };
 }  // namespace optimization
@@ -44,6 +44,12 @@ struct AdjustAdd final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "adjust_add";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kAdd};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kAdd};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, kAdd) && IsConstantTensor(node, 0) &&
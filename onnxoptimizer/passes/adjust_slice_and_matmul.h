@@ -33,6 +33,15 @@ struct AdjustSliceAndMatmul final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "adjust_slice_and_matmul";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kMatMul};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kMatMul, kSlice};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kMatMul, kSlice};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     int64_t slice_axis;
@@ -28,5 +28,79 @@ inline uint32_t FP32ToBits(float value) {
   return fp32.as_bits;
 }
 
+inline float HalfBitsToFloat(uint16_t bits) {
+  const uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+  const uint32_t exponent = (bits >> 10) & 0x1f;
+  uint32_t mantissa = bits & 0x3ff;
+  if (exponent == 0x1f) {
+    // inf or nan
+    return FP32FromBits(sign | 0x7f800000 | (mantissa << 13));
+  }
+  if (exponent != 0) {
+    return FP32FromBits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+  }
+  if (mantissa == 0) {
+    return FP32FromBits(sign);
+  }
+  // subnormal, normalize it
+  uint32_t e = 113;
+  while ((mantissa & 0x400) == 0) {
+    mantissa <<= 1;
+    --e;
+  }
+  return FP32FromBits(sign | (e << 23) | ((mantissa & 0x3ff) << 13));
+}
+
+// rounds to nearest even
+inline uint16_t FloatToHalfBits(float value) {
+  const uint32_t bits = FP32ToBits(value);
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t abs_bits = bits & 0x7fffffff;
+  if (abs_bits >= 0x7f800000) {
+    // inf or nan, keep nan quiet
+    return sign | 0x7c00 | (abs_bits > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs_bits >= 0x477ff000) {
+    // rounds to a value beyond the largest half
+    return sign | 0x7c00;
+  }
+  if (abs_bits < 0x38800000) {
+    // subnormal half or zero
+    const uint32_t shift = 126 - (abs_bits >> 23);
+    if (shift > 24) {
+      return sign;
+    }
+    const uint32_t mantissa = (abs_bits & 0x7fffff) | 0x800000;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | static_cast<uint16_t>(half);
+  }
+  uint32_t half = ((abs_bits >> 13) - (112 << 10));
+  const uint32_t rest = abs_bits & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | static_cast<uint16_t>(half);
+}
+
+inline float BFloat16BitsToFloat(uint16_t bits) {
+  return FP32FromBits(static_cast<uint32_t>(bits) << 16);
+}
+
+// rounds to nearest even
+inline uint16_t FloatToBFloat16Bits(float value) {
+  const uint32_t bits = FP32ToBits(value);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    // keep nan quiet
+    return static_cast<uint16_t>((bits >> 16) | 0x40);
+  }
+  const uint32_t rounding = 0x7fff + ((bits >> 16) & 1);
+  return static_cast<uint16_t>((bits + rounding) >> 16);
+}
+
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
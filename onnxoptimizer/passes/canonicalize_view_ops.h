@@ -0,0 +1,239 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   X is a tensor with shape=[2, 3, 4]
+//   Y = Unsqueeze(X, axes=[0]) -> shape=[1, 2, 3, 4]
+//   Z = Reshape(Y, [1, 6, 4])
+//   W = Flatten(Z, axis=2) -> shape=[6, 4]
+// After:
+//   W = Reshape(X, [6, 4])
+//
+// Reshape, Squeeze, Unsqueeze and Flatten only change the shape of a tensor,
+// never the order of its elements. So a chain of them is a single Reshape
+// into the shape of its last output, if that shape is static, or nothing if
+// it is the shape of its first input. The last node of the chain is
+// replaced by it even if the other nodes have other users: they are then
+// left in place for them, and removed otherwise.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct CanonicalizeViewOps final : public PredicateBasedPass {
+  explicit CanonicalizeViewOps()
+      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "canonicalize_view_ops";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kReshape, kSqueeze, kUnsqueeze, kFlatten};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kReshape};
+  }
+
+  static bool isViewOp(const Node* node) {
+    const auto kind = node->kind();
+    return (kind == kReshape || kind == kSqueeze || kind == kUnsqueeze ||
+            kind == kFlatten) &&
+           IsDefaultDomain(node) &&
+           !node->inputs().empty() && node->outputs().size() == 1;
+  }
+
+  // The shape of the output of |node|, a view op, for an input of |shape|.
+  static bool inferShape(const Node* node, const std::vector<int64_t>& shape,
+                         std::vector<int64_t>& result) {
+    const int64_t rank = shape.size();
+    result.clear();
+    if (node->kind() == kReshape) {
+      std::vector<int64_t> new_shape;
+      if (!GetValueFromAttrOrInput(node, Symbol("shape"), 1, new_shape)) {
+        return false;
+      }
+      const bool allowzero =
+          GetValueFromAttrWithDefault(node, Symbol("allowzero"), int64_t{0});
+      int64_t size = 1;
+      for (const auto dim : shape) {
+        size *= dim;
+      }
+      int64_t known_size = 1;
+      int inferred_axis = -1;
+      for (size_t i = 0; i < new_shape.size(); ++i) {
+        int64_t dim = new_shape[i];
+        if (dim == 0 && !allowzero) {
+          if (static_cast<int64_t>(i) >= rank) {
+            return false;
+          }
+          dim = shape[i];
+        } else if (dim == -1) {
+          if (inferred_axis != -1) {
+            return false;
+          }
+          inferred_axis = i;
+        } else if (dim < 0) {
+          return false;
+        }
+        result.push_back(dim);
+        if (dim != -1) {
+          known_size *= dim;
+        }
+      }
+      if (inferred_axis != -1) {
+        if (known_size == 0 || size % known_size != 0) {
+          return false;
+        }
+        result[inferred_axis] = size / known_size;
+      }
+      return true;
+    }
+    if (node->kind() == kFlatten) {
+      const int64_t axis =
+          AddYIfNegative(GetValueFromAttrWithDefault(node, kaxis, int64_t{1}),
+                         rank);
+      if (axis < 0 || axis > rank) {
+        return false;
+      }
+      int64_t outer = 1, inner = 1;
+      for (int64_t i = 0; i < rank; ++i) {
+        (i < axis ? outer : inner) *= shape[i];
+      }
+      result = {outer, inner};
+      return true;
+    }
+
+    std::vector<int64_t> axes;
+    const bool has_axes =
+        node->hasAttribute(kaxes) ||
+        (node->inputs().size() > 1 &&
+         node->input(1)->node()->kind() != kUndefined);
+    if (has_axes && !GetValueFromAttrOrInput(node, kaxes, 1, axes)) {
+      return false;
+    }
+    if (node->kind() == kSqueeze) {
+      std::vector<bool> squeezed(rank, !has_axes);
+      for (const auto axis : axes) {
+        const int64_t normalized = AddYIfNegative(axis, rank);
+        if (normalized < 0 || normalized >= rank || shape[normalized] != 1) {
+          return false;
+        }
+        squeezed[normalized] = true;
+      }
+      for (int64_t i = 0; i < rank; ++i) {
+        if (!squeezed[i] || shape[i] != 1) {
+          result.push_back(shape[i]);
+        }
+      }
+      return true;
+    }
+    // Unsqueeze
+    const int64_t new_rank = rank + axes.size();
+    std::vector<bool> inserted(new_rank, false);
+    for (const auto axis : axes) {
+      const int64_t normalized = AddYIfNegative(axis, new_rank);
+      if (normalized < 0 || normalized >= new_rank || inserted[normalized]) {
+        return false;
+      }
+      inserted[normalized] = true;
+    }
+    auto dim = shape.begin();
+    for (int64_t i = 0; i < new_rank; ++i) {
+      result.push_back(inserted[i] ? 1 : *dim++);
+    }
+    return true;
+  }
+
+  // The static shape of |value|, inferred through the view ops computing it
+  // if it is not known.
+  static bool staticShape(const Value* value, std::vector<int64_t>& shape) {
+    if (value->has_sizes()) {
+      const auto& sizes = value->sizes();
+      if (std::all_of(sizes.begin(), sizes.end(),
+                      [](const Dimension& dim) { return dim.is_int; })) {
+        shape.clear();
+        for (const auto& dim : sizes) {
+          shape.push_back(dim.dim);
+        }
+        return true;
+      }
+    }
+    const Node* node = value->node();
+    std::vector<int64_t> input_shape;
+    return isViewOp(node) && staticShape(node->input(0), input_shape) &&
+           inferShape(node, input_shape, shape);
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return isViewOp(node) && isViewOp(node->input(0)->node()) &&
+           getOpsetVersion(*node->owningGraph()) >= 5;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    std::vector<int64_t> shape;
+    if (!staticShape(node->output(), shape) ||
+        std::find(shape.begin(), shape.end(), 0) != shape.end()) {
+      return false;
+    }
+    Value* origin = node->input(0);
+    while (isViewOp(origin->node())) {
+      origin = origin->node()->input(0);
+    }
+
+    std::vector<int64_t> origin_shape;
+    if (staticShape(origin, origin_shape) && origin_shape == shape) {
+      const auto uses = node->output()->uses();
+      if (!tryReplacingAllUsesWith(node->output(), origin)) {
+        return false;
+      }
+      for (const auto& use : uses) {
+        if (use.user->kind() != kReturn) {
+          addTouchedNode(use.user);
+        }
+      }
+    } else {
+      Tensor t;
+      t.elem_type() = TensorProto_DataType_INT64;
+      t.sizes().push_back(shape.size());
+      t.int64s() = shape;
+      Node* reshape = graph.create(kReshape, 1);
+      reshape->addInput(origin);
+      reshape->addInput(graph.addInitializerAndCreateValue(t));
+      reshape->insertBefore(node);
+      if (node->has_name()) {
+        reshape->setName(node->name());
+      }
+      reshape->output()->setElemType(node->output()->elemType());
+      if (!tryReplacingAllUsesWith(node->output(), reshape->output())) {
+        graph.eraseInitializerAndInput(reshape->input(1));
+        reshape->destroy();
+        return false;
+      }
+      addTouchedNode(reshape);
+    }
+    const std::vector<Value*> inputs(node->inputs().begin(),
+                                     node->inputs().end());
+    node->removeAllInputs();
+    DestroyUnused(graph, inputs, isViewOp);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,111 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   A, B are initializers or Constant outputs
+//   C = Add(A, B)
+// After:
+//   C is a new initializer holding the value of Add(A, B)
+//   A and B are erased if they are initializers nobody else uses
+//
+// Nodes are evaluated by the kernels of fold_kernels.h. A node is left alone
+// if its result would be larger than the limit in the environment variable
+// OPTIMIZER_CONSTANT_FOLDING_MAX_BYTES (default: 16 MiB), so that folding
+// never blows up the model, e.g. by materializing a broadcast. Only nodes of
+// the default domain are folded, and Casts of floating-point values to
+// integers are not.
+//
+// The pass is not run by default, pass it by name.
+
+#include <cstdlib>
+#include <string>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/fold_kernels.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct ConstantFolding final : public PredicateBasedPass {
+  explicit ConstantFolding()
+      : PredicateBasedPass(PassType::Replace, PassEfficiency::Complete,
+                           PassOptimizationType::ComputeMemory),
+        max_bytes_(fetchMaxBytesFromEnv()) {}
+
+  std::string getPassName() const override {
+    return "constant_folding";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return FoldableKinds();
+  }
+  // The inputs of a node become constant whatever computed them before.
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {};
+  }
+
+  static size_t fetchMaxBytesFromEnv() {
+    const char* env = std::getenv("OPTIMIZER_CONSTANT_FOLDING_MAX_BYTES");
+    if (env == nullptr || *env == '\0') {
+      return size_t{16} << 20;
+    }
+    return static_cast<size_t>(std::strtoull(env, nullptr, 10));
+  }
+
+  static bool isOmitted(const Value* v) {
+    return v->node()->kind() == kUndefined;
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return node->outputs().size() == 1 &&
+           std::all_of(node->inputs().begin(), node->inputs().end(),
+                       [](const Value* input) {
+                         return isOmitted(input) || IsConstantTensor(input);
+                       });
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    std::vector<const Tensor*> inputs;
+    for (const Value* input : node->inputs()) {
+      inputs.push_back(isOmitted(input) ? nullptr : FetchConstantTensor(input));
+    }
+    Tensor folded;
+    if (!FoldNode(node, inputs, max_bytes_, &folded)) {
+      return false;
+    }
+    Value* output = node->output();
+    if (output->elemType() != TensorProto_DataType_UNDEFINED &&
+        output->elemType() != folded.elem_type()) {
+      return false;
+    }
+    Value* value = graph.addInitializerAndCreateValue(folded);
+    if (!tryReplacingAllUsesWith(output, value)) {
+      graph.eraseInitializerAndInput(value);
+      return false;
+    }
+    for (int i = static_cast<int>(node->inputs().size()) - 1; i >= 0; --i) {
+      Value* input = node->inputs()[i];
+      if (input->uses().size() == 1 &&
+          graph.is_constant_initializer(input)) {
+        node->removeInput(i);
+        graph.eraseInitializerAndInput(input);
+      }
+    }
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+
+ private:
+  const size_t max_bytes_;
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
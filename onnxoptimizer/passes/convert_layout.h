@@ -0,0 +1,233 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Y = Conv(X, W1, B1)
+//   R = Relu(Y)
+//   Z = Conv(R, W2, B2)
+// After convert_layout_to_nhwc_gpu:
+//   X' = Transpose(X, perm=[0, 2, 3, 1])
+//   Y' = com.microsoft.NhwcConv(X', W1, B1)
+//   R' = Relu(Y')
+//   Z' = com.microsoft.NhwcConv(R', W2, B2)
+//   Z = Transpose(Z', perm=[0, 3, 1, 2])
+//
+// The nodes of the default domain that have a channels-last counterpart in
+// the com.microsoft domain are replaced by it, between a Transpose into and
+// one out of the channels-last layout. convert_layout_to_nhwc only converts
+// the nodes whose counterparts have CPU kernels in onnxruntime, i.e. MaxPool
+// of 8-bit integers. convert_layout_to_nhwc_gpu converts FLOAT and FLOAT16
+// Convs to NhwcConv too, which onnxruntime only implements for CUDA. Those Transposes are then moved by
+// sink_transposes, which cancels them out between the converted nodes and
+// the nodes it moves Transposes through, so that only the boundaries of the
+// channels-last regions are left with Transposes. convert_layout_to_nchw does
+// the opposite, for runtimes without the channels-last kernels.
+//
+// NhwcConv takes its weights in the layout of Conv, so they are not touched.
+// BatchNormalization has no channels-last counterpart: it is expected to be
+// fused into Conv by fuse_bn_into_conv beforehand.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/logging.h"
+#include "onnxoptimizer/passes/pass_util.h"
+#include "onnxoptimizer/passes/sink_transposes.h"
+#include "onnxoptimizer/passes/string_utils.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+class ConvertLayout : public FullGraphBasedPass {
+ public:
+  std::string getPassName() const override {
+    if (!to_nhwc_) {
+      return "convert_layout_to_nchw";
+    }
+    return for_gpu_ ? "convert_layout_to_nhwc_gpu" : "convert_layout_to_nhwc";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    const auto converted = convertInGraph(graph);
+    if (converted != 0) {
+      if (to_nhwc_) {
+        AddOpsetImport(graph, kMicrosoftDomain, 1);
+      }
+      SinkTransposes().sink(graph);
+    }
+    VLOG(1) << Str("converted count: ", converted);
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, converted, false, false));
+  }
+
+ protected:
+  explicit ConvertLayout(bool to_nhwc, bool for_gpu = false)
+      : FullGraphBasedPass(PassType::Separate, PassEfficiency::Complete,
+                           PassOptimizationType::Compute),
+        to_nhwc_(to_nhwc),
+        for_gpu_(for_gpu) {}
+
+ private:
+  // A node of the default domain and its channels-last counterpart, for
+  // inputs of |elem_types| with 2 spatial dims, and whether onnxruntime only
+  // has GPU kernels of the counterpart.
+  struct Counterpart {
+    const char* kind;
+    const char* nhwc_kind;
+    std::vector<int32_t> elem_types;
+    bool gpu_only;
+  };
+
+  static const std::vector<Counterpart>& counterparts() {
+    static const std::vector<Counterpart> counterparts = {
+        {"Conv",
+         "NhwcConv",
+         {TensorProto_DataType_FLOAT16, TensorProto_DataType_FLOAT},
+         true},
+        {"MaxPool",
+         "NhwcMaxPool",
+         {TensorProto_DataType_INT8, TensorProto_DataType_UINT8},
+         false},
+    };
+    return counterparts;
+  }
+
+  const Counterpart* findCounterpart(const Node* node) const {
+    const std::string domain = node->has_domain() ? node->domain() : "";
+    for (const auto& counterpart : counterparts()) {
+      if (to_nhwc_ && counterpart.gpu_only && !for_gpu_) {
+        continue;
+      }
+      const bool found =
+          to_nhwc_
+              ? node->kind() == Symbol(counterpart.kind) && domain.empty()
+              : node->kind() == Symbol(counterpart.nhwc_kind) &&
+                    domain == kMicrosoftDomain;
+      if (found) {
+        return &counterpart;
+      }
+    }
+    return nullptr;
+  }
+
+  static std::vector<Dimension> permuted(const std::vector<Dimension>& dims,
+                                         const std::vector<int64_t>& perm) {
+    std::vector<Dimension> result;
+    for (const auto axis : perm) {
+      result.push_back(dims[axis]);
+    }
+    return result;
+  }
+
+  // Puts the counterpart of |node| in the other layout, between Transposes,
+  // in place of it, if it has one. |node| is left without uses.
+  bool convert(Graph& graph, Node* node) {
+    const Counterpart* counterpart = findCounterpart(node);
+    if (counterpart == nullptr || node->outputs().size() != 1 ||
+        node->inputs().empty()) {
+      return false;
+    }
+    Value* input = node->input(0);
+    Value* output = node->output();
+    int32_t elem_type = input->elemType();
+    if (elem_type == TensorProto_DataType_UNDEFINED &&
+        node->inputs().size() > 1) {
+      // the weights of a Conv
+      elem_type = node->input(1)->elemType();
+    }
+    const auto& elem_types = counterpart->elem_types;
+    if (std::find(elem_types.begin(), elem_types.end(), elem_type) ==
+            elem_types.end() ||
+        !(HasRank(input, 4) ||
+          (node->inputs().size() > 1 && HasRank(node->input(1), 4)))) {
+      return false;
+    }
+
+    const std::vector<int64_t> to_nhwc = {0, 2, 3, 1};
+    const std::vector<int64_t> to_nchw = {0, 3, 1, 2};
+    const auto& perm_in = to_nhwc_ ? to_nhwc : to_nchw;
+    const auto& perm_out = to_nhwc_ ? to_nchw : to_nhwc;
+
+    Node* transpose_in = graph.create(kTranspose, 1);
+    transpose_in->is_(kperm, std::vector<int64_t>(perm_in));
+    transpose_in->addInput(input);
+    transpose_in->insertBefore(node);
+    transpose_in->output()->setElemType(input->elemType());
+    if (HasRank(input, 4)) {
+      transpose_in->output()->setSizes(permuted(input->sizes(), perm_in));
+    }
+
+    Node* converted = graph.create(
+        Symbol(to_nhwc_ ? counterpart->nhwc_kind : counterpart->kind), 1);
+    if (to_nhwc_) {
+      converted->setDomain(kMicrosoftDomain);
+    }
+    converted->copyAttributes(*node);
+    if (node->hasAttribute(Symbol("storage_order"))) {
+      // only the indices output of MaxPool depends on it
+      converted->removeAttribute(Symbol("storage_order"));
+    }
+    converted->addInput(transpose_in->output());
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      converted->addInput(node->inputs()[i]);
+    }
+    converted->insertBefore(node);
+    if (node->has_name()) {
+      converted->setName(node->name());
+    }
+
+    Node* transpose_out = graph.create(kTranspose, 1);
+    transpose_out->is_(kperm, std::vector<int64_t>(perm_out));
+    transpose_out->addInput(converted->output());
+    transpose_out->insertBefore(node);
+    converted->output()->setElemType(output->elemType());
+    if (HasRank(output, 4)) {
+      converted->output()->setSizes(permuted(output->sizes(), perm_in));
+    }
+    output->replaceAllUsesWith(transpose_out->output());
+    return true;
+  }
+
+  unsigned int convertInGraph(Graph& graph) {
+    unsigned int converted = 0;
+    for (auto it = graph.begin(); it != graph.end(); ++it) {
+      Node* node = *it;
+      converted += DescendOnGraphAttributesAndCount(
+          node, [this](Graph& g) { return convertInGraph(g); });
+      if (convert(graph, node)) {
+        ++converted;
+        it.destroyCurrent();
+      }
+    }
+    return converted;
+  }
+
+  const bool to_nhwc_;
+  const bool for_gpu_;
+};
+
+struct ConvertLayoutToNhwc final : public ConvertLayout {
+  explicit ConvertLayoutToNhwc() : ConvertLayout(true) {}
+};
+
+struct ConvertLayoutToNhwcForGpu final : public ConvertLayout {
+  explicit ConvertLayoutToNhwcForGpu() : ConvertLayout(true, true) {}
+};
+
+struct ConvertLayoutToNchw final : public ConvertLayout {
+  explicit ConvertLayoutToNchw() : ConvertLayout(false) {}
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -31,12 +31,6 @@ void hash_combine(std::size_t& seed, const Hasher& hasher, const T& v,
   hash_combine(seed, rest...);
 }
 
-struct SymbolCompare {
-  bool operator()(const Symbol& lhs, const Symbol& rhs) {
-    return static_cast<uint32_t>(lhs) < static_cast<uint32_t>(rhs);
-  }
-};
-
 inline bool CSETensorCompare(const Tensor* lhs, const Tensor* rhs) {
   // lhs and rhs maybe nullptr
   if (!lhs) {
@@ -49,11 +43,14 @@ inline bool CSETensorCompare(const Tensor* lhs, const Tensor* rhs) {
     return false;
   }
 
-#define DO_CASE(pb_type, cpp_type)                                        \
-  case ONNX_NAMESPACE::TensorProto_DataType_##pb_type:                    \
-    if (ParseTensorData<cpp_type>(lhs) != ParseTensorData<cpp_type>(rhs)) \
-      return false;                                                       \
-    break;
+#define DO_CASE(pb_type, cpp_type)                                      \
+  case ONNX_NAMESPACE::TensorProto_DataType_##pb_type: {                \
+    const TensorView<cpp_type> lhs_data(lhs), rhs_data(rhs);            \
+    if (!std::equal(lhs_data.begin(), lhs_data.end(), rhs_data.begin(), \
+                    rhs_data.end()))                                    \
+      return false;                                                     \
+    break;                                                              \
+  }
 
   switch (lhs->elem_type()) {
     DO_CASE(BOOL, bool)
@@ -71,13 +68,10 @@ inline bool CSETensorCompare(const Tensor* lhs, const Tensor* rhs) {
     DO_CASE(COMPLEX128, Complex128)
     DO_CASE(FLOAT16, Float16)
     DO_CASE(BFLOAT16, BFloat16)
+    DO_CASE(STRING, std::string)
 
 #undef DO_CASE
 
-    case ONNX_NAMESPACE::TensorProto_DataType_STRING:
-      if (lhs->strings() != rhs->strings())
-        return false;
-      break;
     case ONNX_NAMESPACE::TensorProto_DataType_UNDEFINED:
       // tensor is empty
       break;
@@ -107,9 +101,11 @@ inline bool IsSupportedByCSE(const Node* n) {
   return true;
 }
 
+// Hashes a std::vector<T> or a TensorView<T>.
 template <typename T>
 struct CSEContainerHash {
-  std::size_t operator()(const std::vector<T>& container) const {
+  template <typename Container>
+  std::size_t operator()(const Container& container) const {
     std::size_t seed = 0;
     hash_combine(seed, std::hash<std::string>(), std::string(typeid(T).name()),
                  std::hash<std::size_t>(), container.size());
@@ -126,7 +122,6 @@ struct CSETensorHash {
     ONNX_ASSERT(tensor && !tensor->is_segment());
     std::size_t seed = 0;
     auto int32_hasher = std::hash<int32_t>();
-    auto size_hasher = std::hash<std::size_t>();
     const auto elem_type = tensor->elem_type();
     /// dtype、dims、value
     hash_combine(seed, int32_hasher, elem_type);
@@ -135,7 +130,7 @@ struct CSETensorHash {
 #define DO_CASE(pb_type, cpp_type)                     \
   case ONNX_NAMESPACE::TensorProto_DataType_##pb_type: \
     hash_combine(seed, CSEContainerHash<cpp_type>(),   \
-                 ParseTensorData<cpp_type>(tensor));   \
+                 TensorView<cpp_type>(tensor));        \
     break;
 
     switch (elem_type) {
@@ -154,11 +149,9 @@ struct CSETensorHash {
       DO_CASE(COMPLEX128, Complex128)
       DO_CASE(FLOAT16, Float16)
       DO_CASE(BFLOAT16, BFloat16)
+      DO_CASE(STRING, std::string)
 
 #undef DO_CASE
-      case ONNX_NAMESPACE::TensorProto_DataType_STRING:
-        hash_combine(seed, CSEContainerHash<std::string>(), tensor->strings());
-        break;
       case ONNX_NAMESPACE::TensorProto_DataType_UNDEFINED:
         break;
       default:
@@ -183,91 +176,75 @@ struct CSEContainerHash<Tensor> {
   }
 };
 
-struct CSENodeHash {
+// Hashes what a node computes apart from its inputs: its kind, its attributes
+// in any order and its number of outputs.
+struct CSEAttributesHash {
   std::size_t operator()(const Node* n) const {
     ONNX_ASSERT(n);
     std::size_t seed = 0;
-    const auto inputs = n->inputs();
     auto size_t_hasher = std::hash<std::size_t>();
     auto string_hasher = std::hash<std::string>();
     auto sym_hasher = std::hash<Symbol>();
-    hash_combine(seed, std::hash<uint32_t>(), static_cast<uint32_t>(n->kind()),
-                 size_t_hasher, inputs.size());
-    for (const auto& input : inputs) {
-      hash_combine(seed, string_hasher, input->uniqueName());
-    }
-    auto attribute_names = n->attributeNames();
-    SymbolCompare cmp;
-    std::sort(attribute_names.begin(), attribute_names.end(), cmp);
-    for (const auto& name : attribute_names) {
-      hash_combine(seed, sym_hasher, name);
+    hash_combine(seed, std::hash<uint32_t>(), static_cast<uint32_t>(n->kind()));
+    // summed so that the order of the attributes does not matter
+    std::size_t attributes_seed = 0;
+    for (const auto& name : n->attributeNames()) {
+      std::size_t attribute_seed = 0;
+      hash_combine(attribute_seed, sym_hasher, name);
       auto kind = n->kindOf(name);
       switch (kind) {
         case ONNX_NAMESPACE::AttributeKind::f:
-          hash_combine(seed, std::hash<double>(), n->f(name));
+          hash_combine(attribute_seed, std::hash<double>(), n->f(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::fs:
-          hash_combine(seed, CSEContainerHash<double>(), n->fs(name));
+          hash_combine(attribute_seed, CSEContainerHash<double>(), n->fs(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::i:
-          hash_combine(seed, std::hash<int64_t>(), n->i(name));
+          hash_combine(attribute_seed, std::hash<int64_t>(), n->i(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::is:
-          hash_combine(seed, CSEContainerHash<int64_t>(), n->is(name));
+          hash_combine(attribute_seed, CSEContainerHash<int64_t>(),
+                       n->is(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::s:
-          hash_combine(seed, string_hasher, n->s(name));
+          hash_combine(attribute_seed, string_hasher, n->s(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::ss:
-          hash_combine(seed, CSEContainerHash<std::string>(), n->ss(name));
+          hash_combine(attribute_seed, CSEContainerHash<std::string>(),
+                       n->ss(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::t:
-          hash_combine(seed, CSETensorHash(), &n->t(name));
+          hash_combine(attribute_seed, CSETensorHash(), &n->t(name));
           break;
         case ONNX_NAMESPACE::AttributeKind::ts:
-          hash_combine(seed, CSEContainerHash<Tensor>(), n->ts(name));
+          hash_combine(attribute_seed, CSEContainerHash<Tensor>(), n->ts(name));
           break;
         default:
           throw std::runtime_error(
               Str("no support hash type: ", ONNX_NAMESPACE::toString(kind)));
           break;
       }
+      attributes_seed += attribute_seed;
     }
-    hash_combine(seed, size_t_hasher, n->outputs().size());
+    hash_combine(seed, size_t_hasher, attributes_seed, size_t_hasher,
+                 n->outputs().size());
     return seed;
   }
 };
 
-struct CSEEqual {
+// Whether two nodes compute the same given the same inputs.
+struct CSEAttributesEqual {
   bool operator()(const Node* lhs, const Node* rhs) const {
-    if (!lhs) {
-      return !rhs;
-    } else if (!rhs) {
-      return !lhs;
-    }
-
-    auto inputs_l = lhs->inputs();
-    auto inputs_r = rhs->inputs();
-    auto outputs_l = lhs->outputs();
-    auto outputs_r = rhs->outputs();
-    auto attr_names_l = lhs->attributeNames();
-    auto attr_names_r = rhs->attributeNames();
-    SymbolCompare cmp;
-    std::sort(attr_names_l.begin(), attr_names_l.end(), cmp);
-    std::sort(attr_names_r.begin(), attr_names_r.end(), cmp);
-    if (lhs->kind() != rhs->kind() || inputs_l.size() != inputs_r.size() ||
-        outputs_l.size() != outputs_r.size() || attr_names_l != attr_names_r) {
+    const auto attr_names = lhs->attributeNames();
+    if (lhs->kind() != rhs->kind() ||
+        lhs->outputs().size() != rhs->outputs().size() ||
+        attr_names.size() != rhs->attributeNames().size()) {
       return false;
     }
-    for (int i = 0; i < inputs_l.size(); ++i) {
-      if (inputs_l[i]->uniqueName() != inputs_r[i]->uniqueName()) {
-        return false;
-      }
-    }
 
-    for (int i = 0; i < attr_names_l.size(); ++i) {
-      const auto attr_name = attr_names_l[i];
-      if (lhs->kindOf(attr_name) != rhs->kindOf(attr_name)) {
+    for (const auto& attr_name : attr_names) {
+      if (!rhs->hasAttribute(attr_name) ||
+          lhs->kindOf(attr_name) != rhs->kindOf(attr_name)) {
         return false;
       }
       switch (lhs->kindOf(attr_name)) {
@@ -91,6 +91,41 @@ struct BFloat16 {
   uint16_t bits;
 };
 
+// How elements of type T are loaded for arithmetic and stored back. Halves
+// are computed in float.
+template <typename T>
+struct Arithmetic {
+  using type = T;
+  static T load(T v) {
+    return v;
+  }
+  static T store(T v) {
+    return v;
+  }
+};
+
+template <>
+struct Arithmetic<Float16> {
+  using type = float;
+  static float load(Float16 v) {
+    return HalfBitsToFloat(v.bits);
+  }
+  static Float16 store(float v) {
+    return Float16(FloatToHalfBits(v));
+  }
+};
+
+template <>
+struct Arithmetic<BFloat16> {
+  using type = float;
+  static float load(BFloat16 v) {
+    return BFloat16BitsToFloat(v.bits);
+  }
+  static BFloat16 store(float v) {
+    return BFloat16(FloatToBFloat16Bits(v));
+  }
+};
+
 template <typename Complex>
 std::size_t ComplexHashHelper(const Complex& complex) {
   auto hasher = std::hash<typename Complex::base_type>();
@@ -6,7 +6,34 @@
 // Adventurous users should note that the APIs will probably change.
 #pragma once
 
+// Before:
+//   Y1 = Shape(X)
+//   Z = If(cond) then {
+//     Y2 = Shape(X)
+//     S1 = Gather(Y2, I)
+//     A = Reshape(W, S1)
+//   } else {
+//     Y3 = Shape(X)
+//     S2 = Gather(Y3, I)
+//     B = Expand(V, S2)
+//   }
+// After:
+//   Y1 = Shape(X)
+//   S = Gather(Y1, I)
+//   Z = If(cond) then {
+//     A = Reshape(W, S)
+//   } else {
+//     B = Expand(V, S)
+//   }
+//
+// Nodes are also compared with the nodes of the graphs enclosing their graph,
+// that come before the node holding their graph, and replaced by them. The
+// computations on outer values that both branches of an If make are moved in
+// front of the If, as exactly one branch runs anyway. Moving the other ones
+// out of Loop bodies is left to hoist_loop_invariants.
+
 #include <unordered_map>
+#include <unordered_set>
 
 #include "onnx/defs/tensor_util.h"
 #include "onnxoptimizer/pass.h"
@@ -29,36 +56,376 @@ struct EliminateCommonSubexpression final : public FullGraphBasedPass {
     return PassAnalysisType::CountBased;
   }
 
-  unsigned int EliminateCommonSubexpressions(Graph &graph) {
-    auto node_list = graph.nodes();
+  // A node with the values its inputs refer to, captured values resolved to
+  // the values of the enclosing graphs, and its hash. The hash is computed
+  // once, when the node is visited: it depends on the kind, the attributes
+  // and the inputs of the node only, and the nodes visited later never change
+  // those.
+  struct HashedNode {
+    Node *node;
+    std::vector<const Value *> inputs;
+    std::size_t hash;
+  };
+  struct HashedNodeHash {
+    std::size_t operator()(const HashedNode &n) const {
+      return n.hash;
+    }
+  };
+  struct HashedNodeEqual {
+    bool operator()(const HashedNode &lhs, const HashedNode &rhs) const {
+      return lhs.hash == rhs.hash && lhs.inputs == rhs.inputs &&
+             CSEAttributesEqual()(lhs.node, rhs.node);
+    }
+  };
+
+  // The nodes of a graph visited so far and the values they and the graph
+  // define. The scope of a subgraph has the scope of the graph of the node
+  // holding it as parent.
+  struct Scope {
+    Graph *graph;
+    Scope *parent;
+    std::unordered_set<HashedNode, HashedNodeHash, HashedNodeEqual> nodes;
+    std::unordered_map<std::string, Value *> values;
+    // the placeholders of the values captured from the enclosing graphs
+    std::unordered_map<std::string, Value *> captured;
+
+    Scope(Graph *graph, Scope *parent) : graph(graph), parent(parent) {
+      for (Value *input : graph->inputs()) {
+        values[input->uniqueName()] = input;
+      }
+      for (Node *node : graph->nodes()) {
+        if (node->kind() == kCaptured) {
+          captured[node->output()->uniqueName()] = node->output();
+        }
+        for (Value *input : node->inputs()) {
+          if (graph->is_constant_initializer(input)) {
+            values[input->uniqueName()] = input;
+          }
+        }
+      }
+    }
+
+    // The value of an enclosing graph named |name|, or nullptr.
+    Value *resolve(const std::string &name) const {
+      for (const Scope *scope = parent; scope; scope = scope->parent) {
+        const auto it = scope->values.find(name);
+        if (it != scope->values.end()) {
+          return it->second;
+        }
+      }
+      return nullptr;
+    }
+
+    // The placeholder in this graph for |value| of an enclosing graph.
+    Value *capture(const Value *value) {
+      auto &placeholder = captured[value->uniqueName()];
+      if (placeholder == nullptr) {
+        Node *node = graph->create(kCaptured, 1);
+        graph->prependNode(node);
+        placeholder = node->output();
+        placeholder->setUniqueName(value->uniqueName());
+      }
+      return placeholder;
+    }
+
+    HashedNode hashed(Node *node) const {
+      HashedNode hashed{node, {}, CSEAttributesHash()(node)};
+      for (Value *input : node->inputs()) {
+        const Value *value = input;
+        if (input->node()->kind() == kCaptured) {
+          if (const Value *outer = resolve(input->uniqueName())) {
+            value = outer;
+          }
+        }
+        hashed.inputs.push_back(value);
+        hash_combine(hashed.hash, std::hash<const Value *>(), value);
+      }
+      return hashed;
+    }
+
+    // The node of this scope or of an enclosing one that |node| duplicates.
+    const HashedNode *find(const HashedNode &node) const {
+      for (const Scope *scope = this; scope; scope = scope->parent) {
+        const auto it = scope->nodes.find(node);
+        if (it != scope->nodes.end()) {
+          return &*it;
+        }
+      }
+      return nullptr;
+    }
+
+    void defineOutputs(Node *node) {
+      for (Value *output : node->outputs()) {
+        values[output->uniqueName()] = output;
+      }
+    }
+  };
+
+  static bool isCandidate(const Node *node) {
+    return node->kind() != kCaptured && node->kind() != kUndefined &&
+           !node->outputs().empty() && IsSupportedByCSE(node);
+  }
+
+  // The positions at which |value| is an output of its graph.
+  static std::vector<size_t> outputPositions(const Value *value) {
+    std::vector<size_t> positions;
+    const auto outputs = value->owningGraph()->outputs();
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      if (outputs[i] == value) {
+        positions.push_back(i);
+      }
+    }
+    return positions;
+  }
+
+  static bool isGraphOutput(const Value *value) {
+    return !outputPositions(value).empty();
+  }
+
+  // Moves the nodes that both branches of |if_node| compute from outer values
+  // in front of it. The outputs of the If that both branches compute this way
+  // are replaced by the moved nodes, and |*destroy| is set if none is left.
+  unsigned int hoistCommonBranchNodes(Node *if_node, Scope &scope,
+                                      bool *destroy) {
+    Graph *then_graph = if_node->g(kthen_branch).get();
+    Graph *else_graph = if_node->g(kelse_branch).get();
+    Scope then_scope(then_graph, &scope);
+    Scope else_scope(else_graph, &scope);
+
+    // then branch values of the pairs found so far, by the values of both
+    // branches
+    std::unordered_map<const Value *, Value *> paired;
+    // The outer value |input| of |branch| refers to, or the then branch value
+    // of its pair, or nullptr.
+    const auto outer_or_paired = [&paired](const Scope &branch,
+                                           const Value *input) -> Value * {
+      if (input->node()->kind() == kCaptured) {
+        return branch.resolve(input->uniqueName());
+      }
+      const auto it = paired.find(input);
+      return it == paired.end() ? nullptr : it->second;
+    };
+
+    std::unordered_multimap<std::size_t, Node *> else_nodes;
+    for (Node *node : else_graph->nodes()) {
+      if (isCandidate(node)) {
+        else_nodes.emplace(CSEAttributesHash()(node), node);
+      }
+    }
+    std::vector<std::pair<Node *, Node *>> pairs;
+    for (Node *node : then_graph->nodes()) {
+      if (!isCandidate(node)) {
+        continue;
+      }
+      std::vector<Value *> inputs;
+      for (const Value *input : node->inputs()) {
+        inputs.push_back(outer_or_paired(then_scope, input));
+      }
+      if (std::find(inputs.begin(), inputs.end(), nullptr) != inputs.end()) {
+        continue;
+      }
+      const auto range = else_nodes.equal_range(CSEAttributesHash()(node));
+      const auto match = std::find_if(range.first, range.second, [&](auto &p) {
+        const Node *other = p.second;
+        if (other->inputs().size() != inputs.size() ||
+            !CSEAttributesEqual()(node, other)) {
+          return false;
+        }
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          if (outer_or_paired(else_scope, other->inputs()[i]) != inputs[i]) {
+            return false;
+          }
+        }
+        // the branch outputs they compute must be the same outputs of the If
+        for (size_t i = 0; i < node->outputs().size(); ++i) {
+          if (outputPositions(node->outputs()[i]) !=
+              outputPositions(other->outputs()[i])) {
+            return false;
+          }
+        }
+        return true;
+      });
+      if (match == range.second) {
+        continue;
+      }
+      Node *other = match->second;
+      else_nodes.erase(match);
+      for (size_t i = 0; i < node->outputs().size(); ++i) {
+        paired[node->outputs()[i]] = node->outputs()[i];
+        paired[other->outputs()[i]] = node->outputs()[i];
+      }
+      pairs.emplace_back(node, other);
+    }
+    if (pairs.empty()) {
+      return 0;
+    }
+
+    Graph &graph = *scope.graph;
+    // the moved values by the then branch values
+    std::unordered_map<const Value *, Value *> hoisted;
+    std::vector<Node *> hoisted_nodes;
+    for (const auto &pair : pairs) {
+      Node *node = pair.first;
+      Node *new_node = graph.create(node->kind(), node->outputs().size());
+      new_node->copyAttributes(*node);
+      for (const Value *input : node->inputs()) {
+        Value *value = outer_or_paired(then_scope, input);
+        const auto it = hoisted.find(value);
+        if (it != hoisted.end()) {
+          value = it->second;
+        } else if (value->owningGraph() != &graph) {
+          value = scope.capture(value);
+        }
+        new_node->addInput(value);
+      }
+      new_node->insertBefore(if_node);
+      for (size_t i = 0; i < node->outputs().size(); ++i) {
+        const Value *output = node->outputs()[i];
+        Value *new_output = new_node->outputs()[i];
+        new_output->setElemType(output->elemType());
+        if (output->has_sizes()) {
+          new_output->setSizes(output->sizes());
+        }
+        hoisted[output] = new_output;
+      }
+      hoisted_nodes.push_back(new_node);
+    }
+
+    for (size_t i = if_node->outputs().size(); i-- > 0;) {
+      const auto it = hoisted.find(then_graph->outputs()[i]);
+      if (it == hoisted.end() ||
+          !tryReplacingAllUsesWith(if_node->outputs()[i], it->second)) {
+        continue;
+      }
+      then_graph->return_node()->removeInput(i);
+      else_graph->return_node()->removeInput(i);
+      if_node->eraseOutput(i);
+    }
+    *destroy = if_node->outputs().empty();
+
+    unsigned int removed = 0;
+    for (auto pair = pairs.rbegin(); pair != pairs.rend(); ++pair) {
+      std::vector<Value *> new_outputs;
+      for (const Value *output : pair->first->outputs()) {
+        new_outputs.push_back(hoisted.at(output));
+      }
+      bool both_removed = true;
+      for (auto branch : {std::make_pair(pair->first, &then_scope),
+                          std::make_pair(pair->second, &else_scope)}) {
+        Node *node = branch.first;
+        for (size_t i = 0; i < node->outputs().size(); ++i) {
+          Value *output = node->outputs()[i];
+          if (output->uses().empty() || isGraphOutput(output)) {
+            continue;
+          }
+          Value *placeholder = branch.second->capture(new_outputs[i]);
+          tryReplacingAllUsesWith(output, placeholder);
+        }
+        if (node->hasUses()) {
+          both_removed = false;
+        } else {
+          node->destroy();
+        }
+      }
+      removed += both_removed;
+    }
+    for (auto it = hoisted_nodes.rbegin(); it != hoisted_nodes.rend(); ++it) {
+      if (!(*it)->hasUses()) {
+        (*it)->destroy();
+        *it = nullptr;
+      }
+    }
+    for (Node *node : hoisted_nodes) {
+      if (node != nullptr) {
+        scope.nodes.insert(scope.hashed(node));
+        scope.defineOutputs(node);
+      }
+    }
+    VLOG(1) << Str("moved ", removed, " nodes out of the branches of ",
+                   if_node->name());
+    return removed;
+  }
+
+  // Eliminates the common subexpressions of the subgraphs of |node|, and of
+  // its branches if it is an If, which may leave it without any output.
+  unsigned int eliminateInSubgraphs(Node *node, Scope &scope, bool *destroy) {
+    *destroy = false;
+    unsigned int removed = 0;
+    for (const auto &name : node->attributeNames()) {
+      if (node->kindOf(name) == AttributeKind::g) {
+        Scope subgraph_scope(node->g(name).get(), &scope);
+        removed += eliminate(subgraph_scope);
+      } else if (node->kindOf(name) == AttributeKind::gs) {
+        for (const auto &subgraph : node->gs(name)) {
+          Scope subgraph_scope(subgraph.get(), &scope);
+          removed += eliminate(subgraph_scope);
+        }
+      }
+    }
+    if (node->kind() == kIf) {
+      removed += hoistCommonBranchNodes(node, scope, destroy);
+    }
+    return removed;
+  }
+
+  // The nodes are visited in topological order, and the uses of a duplicate
+  // are redirected to the node it duplicates before the users are visited,
+  // so a chain of duplicated subexpressions collapses in a single run.
+  unsigned int eliminate(Scope &scope) {
+    auto node_list = scope.graph->nodes();
     unsigned int cse_removed = 0;
-    std::unordered_map<Node *, Node *, CSENodeHash, CSEEqual> hash_map;
     for (auto it = node_list.begin(); it != node_list.end(); ++it) {
       auto node = *it;
       auto kind = node->kind();
-      if (!node->hasUses() || !IsSupportedByCSE(node)) {
+      bool destroy;
+      cse_removed += eliminateInSubgraphs(node, scope, &destroy);
+      if (destroy) {
+        it.destroyCurrent();
+        continue;
+      }
+      if (!node->hasUses() || !isCandidate(node)) {
+        scope.defineOutputs(node);
         continue;
       }
       VLOG(2) << Str("kind: ", kind.toString(), ", ", node->name(),
                      " is processing");
-      if (hash_map.find(node) == hash_map.end()) {
-        hash_map[node] = node;
-      } else {
-        auto other = hash_map.at(node);
-        auto outputs = other->outputs();
-        auto replaced_outputs = node->outputs();
-        for (int i = 0; i < outputs.size(); ++i) {
-          if (tryReplacingAllUsesWith(replaced_outputs[i], outputs[i])) {
-            VLOG(1) << Str("kind: ", kind.toString(), ", ", node->name(), " [",
-                           i, "] output has been replaced by ", other->name());
-            cse_removed++;
-          }
+      auto hashed = scope.hashed(node);
+      const HashedNode *found = scope.find(hashed);
+      if (found == nullptr) {
+        scope.nodes.insert(std::move(hashed));
+        scope.defineOutputs(node);
+        continue;
+      }
+      auto other = found->node;
+      auto outputs = other->outputs();
+      auto replaced_outputs = node->outputs();
+      for (size_t i = 0; i < outputs.size(); ++i) {
+        Value *output = other->owningGraph() == scope.graph
+                            ? outputs[i]
+                            : scope.capture(outputs[i]);
+        if (tryReplacingAllUsesWith(replaced_outputs[i], output)) {
+          VLOG(1) << Str("kind: ", kind.toString(), ", ", node->name(), " [",
+                         i, "] output has been replaced by ", other->name());
+          cse_removed++;
         }
       }
+      if (other->owningGraph() == scope.graph) {
+        // the outputs may have been renamed after graph outputs
+        scope.defineOutputs(other);
+      }
+      // dead nodes are only eliminated in the main graph by other passes
+      if (scope.parent != nullptr && !node->hasUses()) {
+        it.destroyCurrent();
+      }
     }
     return cse_removed;
   }
 
+  unsigned int EliminateCommonSubexpressions(Graph &graph) {
+    Scope scope(&graph, nullptr);
+    return eliminate(scope);
+  }
+
   std::shared_ptr<PostPassAnalysis> runPass(Graph &graph) override {
     auto cse_removed = this->EliminateCommonSubexpressions(graph);
     VLOG(1) << Str("cse_removed count: ", cse_removed);
@@ -21,13 +21,23 @@ struct EliminateConsecutiveIdempotentOps final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_consecutive_idempotent_ops";
   }
+  static const std::vector<NodeKind>& idempotentKinds() {
+    static const std::vector<NodeKind> kinds = {
+        Symbol("Ceil"), Symbol("Floor"), Symbol("Round"), Symbol("Relu"),
+        kReshape};
+    return kinds;
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return idempotentKinds();
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return idempotentKinds();
+  }
 
   bool patternMatchPredicate(Node* node) override {
-    static const std::unordered_set<std::string> idempotent_ops = {
-        "Ceil", "Floor", "Round", "Relu", "Reshape"};
-    for (const auto& op : idempotent_ops) {
+    for (const auto& kind : idempotentKinds()) {
       // TODO: support uses().size() > 1 for ops except Reshape
-      if (CheckKind(node, Symbol(op), 0, Symbol(op)) &&
+      if (CheckKind(node, kind, 0, kind) &&
           node->input(0)->uses().size() == 1) {
         return true;
       }
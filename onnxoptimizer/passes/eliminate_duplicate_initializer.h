@@ -27,12 +27,18 @@
 // we eliminate all duplicated initializers instead. That
 // may cause unexpected behavior in some rare cases.
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "onnx/defs/tensor_util.h"
 #include "onnxoptimizer/pass.h"
 #include "onnxoptimizer/passes/cse_util.h"
+#include "onnxoptimizer/passes/digest.h"
+#include "onnxoptimizer/passes/tensor_util.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
@@ -58,6 +64,54 @@ struct EliminateDuplicateInitializer final : public FullGraphBasedPass {
     return nullptr;
   }
 
+  // An initializer that others may be replaced by.
+  struct Candidate {
+    const Tensor *tensor;
+    std::string storage;
+    TensorDataSlice bytes;
+  };
+
+  // Appends to |replaced_table| the initializers of |group|, which all have
+  // the same type and shape, that are equal to an earlier one. The bytes of
+  // each initializer are digested once and only compared byte by byte with
+  // those of the same digest.
+  static void findDuplicates(
+      const std::vector<const Tensor *> &group,
+      std::vector<std::pair<std::string, std::string>> *replaced_table) {
+    // a deque so that |bytes| keeps pointing into |storage|
+    std::deque<Candidate> candidates;
+    std::unordered_multimap<uint64_t, const Candidate *> by_digest;
+    // for the initializers whose bytes are not available, e.g. strings
+    std::unordered_map<const Tensor *, std::string, CSETensorHash,
+                       CSETensorEqual>
+        by_value;
+    for (const Tensor *tensor : group) {
+      Candidate &candidate = candidates.emplace_back();
+      candidate.tensor = tensor;
+      if (!TensorBytes(tensor, &candidate.storage, &candidate.bytes)) {
+        candidates.pop_back();
+        const auto inserted = by_value.emplace(tensor, tensor->name());
+        if (!inserted.second) {
+          replaced_table->emplace_back(tensor->name(), inserted.first->second);
+        }
+        continue;
+      }
+      const uint64_t digest = Digest64(candidate.bytes.bytes());
+      const auto range = by_digest.equal_range(digest);
+      const auto equal =
+          std::find_if(range.first, range.second, [&candidate](const auto &p) {
+            return p.second->bytes.bytes() == candidate.bytes.bytes();
+          });
+      if (equal != range.second) {
+        replaced_table->emplace_back(tensor->name(),
+                                     equal->second->tensor->name());
+        candidates.pop_back();
+      } else {
+        by_digest.emplace(digest, &candidate);
+      }
+    }
+  }
+
   unsigned int EliminateInitializer(Graph &graph) {
     unsigned int initializers_removed = 0;
     const std::vector<Tensor> &initializers = graph.initializers();
@@ -76,10 +130,12 @@ struct EliminateDuplicateInitializer final : public FullGraphBasedPass {
         output_set.emplace(out->uniqueName());
       }
     }
-    std::unordered_map<const Tensor *, std::string, CSETensorHash, CSETensorEqual>
-        initializer_map;
-    std::vector<std::pair<std::string, std::string>> replaced_table;
-    for (const auto& initializer : initializers) {
+    // Group the initializers by type and shape first, so that only the bytes
+    // of those that have company are ever read.
+    std::map<std::pair<int32_t, std::vector<int64_t>>,
+             std::vector<const Tensor *>>
+        groups;
+    for (const auto &initializer : initializers) {
       if (!initializer.hasName()) {
         continue;
       }
@@ -92,11 +148,13 @@ struct EliminateDuplicateInitializer final : public FullGraphBasedPass {
       if (output_set.find(name) != output_set.end()) {
         continue;
       }
-      if (initializer_map.count(&initializer) == 0) {
-        initializer_map[&initializer] = name;
-      } else {
-        replaced_table.emplace_back(
-            std::make_pair(name, initializer_map.at(&initializer)));
+      groups[{initializer.elem_type(), initializer.sizes()}].push_back(
+          &initializer);
+    }
+    std::vector<std::pair<std::string, std::string>> replaced_table;
+    for (const auto &group : groups) {
+      if (group.second.size() > 1) {
+        findDuplicates(group.second, &replaced_table);
       }
     }
     if (replaced_table.empty()) {
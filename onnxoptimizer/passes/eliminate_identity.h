@@ -20,6 +20,9 @@ struct EliminateIdentity final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_identity";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kIdentity};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kIdentity;
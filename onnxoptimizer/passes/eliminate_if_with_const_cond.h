@@ -14,9 +14,9 @@ namespace ONNX_NAMESPACE {
 namespace optimization {
 
 // This optimization works well especially when used together with
-// constant folding (onnx-simplifier), for example, the if node
-// introduced by PyTorch squeeze op will be eliminated when the input
-// shape is known.
+// constant folding (constant_folding or onnx-simplifier), for example,
+// the if node introduced by PyTorch squeeze op will be eliminated when
+// the input shape is known.
 // Ideally eliminate_if_with_const_cond + eliminate_deadend + constant
 // folding can be replaced by the more powerful sparse conditional
 // constant propagation, which obviously cannot be implemented in
@@ -30,6 +30,9 @@ struct EliminateIfWithConstCond final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_if_with_const_cond";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kIf};
+  }
 
   // step 1: find "if" node with constant cond (i.e. const true or false)
   bool patternMatchPredicate(Node *node) override {
@@ -20,6 +20,9 @@ struct EliminateNopCast final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_cast";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kCast};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return (node->kind() == kCast && node->hasAttribute(kto) &&
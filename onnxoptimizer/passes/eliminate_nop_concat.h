@@ -20,6 +20,9 @@ struct EliminateNopConcat final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_concat";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kConcat};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kConcat && node->inputs().size() == 1;
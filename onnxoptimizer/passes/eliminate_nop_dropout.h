@@ -20,6 +20,9 @@ struct EliminateNopDropout final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_dropout";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kDropout};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     // in opset 12, ratio is an input of Dropout rather than an attribute,
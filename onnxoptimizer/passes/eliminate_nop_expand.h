@@ -21,6 +21,9 @@ struct EliminateNopExpand final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_expand";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kExpand};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kExpand && IsConstantTensor(node, 1);
@@ -21,6 +21,9 @@ struct EliminateNopFlatten final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_flatten";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("Flatten")};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     if (!CheckKind(node, "Flatten")) {
@@ -27,6 +27,15 @@ struct EliminateNopMonotoneArgmax final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_monotone_argmax";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kArgMax};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return getConsumedKinds();
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kArgMax, kLog, kExp, kSqrt, kSoftmax, kLogSoftmax};
+  }
 
   static inline bool satisfies_monotone_condition(int64_t axis, Node* node) {
     if (monotone_node_no_axis_kind.find(node->kind()) !=
@@ -25,6 +25,9 @@ struct EliminateNopPad final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_pad";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kPad};
+  }
 
   static bool is_nop_pad(Node* node, Graph& graph) {
     std::vector<int64_t> pads;
@@ -21,6 +21,9 @@ struct EliminateNopReshape final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_reshape";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kReshape};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     return node->kind() == kReshape && !node->inputs()[0]->sizes().empty() &&
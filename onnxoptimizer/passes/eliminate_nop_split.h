@@ -21,6 +21,9 @@ struct EliminateNopSplit final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_split";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("Split")};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, "Split") && node->inputs()[0]->has_sizes() &&
@@ -20,6 +20,9 @@ struct EliminateNopTranspose final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_transpose";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kTranspose};
+  }
 
   static bool is_nop_transpose(const std::vector<int64_t>& perm) {
     for (size_t i = 0; i < perm.size(); i++)
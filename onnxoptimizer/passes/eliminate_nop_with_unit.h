@@ -22,6 +22,10 @@ struct EliminateOpWithUnit final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_nop_with_unit";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kAdd, kMul, kDiv, kSub, kPow, Symbol("And"), Symbol("Or"),
+            kConcat};
+  }
 
 #define PROTO_DTYPE_LIST(_)        \
   _(TensorProto_DataType_BFLOAT16) \
@@ -40,13 +44,13 @@ struct EliminateOpWithUnit final : public PredicateBasedPass {
 
   bool isAllOf(const Tensor& tensor, int value) {
     int elem_type = tensor.elem_type();
-#define CASE_BRANCH_CONTENT(pb_dtype)                                        \
-  case pb_dtype: {                                                           \
-    using cpp_dtype = ToCppType<pb_dtype>::type;                             \
-    const std::vector<cpp_dtype> data = ParseTensorData<cpp_dtype>(&tensor); \
-    return std::all_of(                                                      \
-        data.cbegin(), data.cend(),                                          \
-        [value](const cpp_dtype& v) { return v == cpp_dtype(value); });      \
+#define CASE_BRANCH_CONTENT(pb_dtype)                                   \
+  case pb_dtype: {                                                      \
+    using cpp_dtype = ToCppType<pb_dtype>::type;                        \
+    const TensorView<cpp_dtype> data(&tensor);                          \
+    return std::all_of(                                                 \
+        data.begin(), data.end(),                                       \
+        [value](const cpp_dtype& v) { return v == cpp_dtype(value); }); \
   }
 
     switch (elem_type) { PROTO_DTYPE_LIST(CASE_BRANCH_CONTENT) }
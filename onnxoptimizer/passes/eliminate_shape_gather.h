@@ -22,6 +22,12 @@ struct EliminateShapeGather final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_shape_gather";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("Gather")};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {Symbol("Gather"), Symbol("Shape")};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     return CheckKind(node, "Gather", 0, "Shape") && IsConstantTensor(node, 1) &&
@@ -22,6 +22,9 @@ struct EliminateShapeOp final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_shape_op";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("Shape")};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     if (!CheckKind(node, "Shape") || !HasDimsOfInputOfNode(node, 0)) {
@@ -22,6 +22,12 @@ struct EliminateSliceAfterShape final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "eliminate_slice_after_shape";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kSlice};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kSlice, Symbol("Shape")};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     return CheckKind(node, kSlice, 0, "Shape") &&
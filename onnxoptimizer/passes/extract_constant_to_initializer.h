@@ -28,6 +28,9 @@ struct ExtractConstantToInitializer final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "extract_constant_to_initializer";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kConstant};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kConstant;
@@ -0,0 +1,1394 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/passes/fold_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "onnx/common/platform_helpers.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// A tensor while it is folded. |bytes| holds its elements the way raw_data
+// does, booleans taking a byte each.
+struct Array {
+  int32_t elem_type = TensorProto_DataType_UNDEFINED;
+  std::vector<int64_t> dims;
+  std::string bytes;
+
+  template <typename T>
+  T* data() {
+    return reinterpret_cast<T*>(&bytes[0]);
+  }
+  template <typename T>
+  const T* data() const {
+    return reinterpret_cast<const T*>(bytes.data());
+  }
+};
+
+size_t ElemSize(int32_t elem_type) {
+  switch (elem_type) {
+    case TensorProto_DataType_BOOL:
+    case TensorProto_DataType_INT8:
+    case TensorProto_DataType_UINT8:
+      return 1;
+    case TensorProto_DataType_INT16:
+    case TensorProto_DataType_UINT16:
+    case TensorProto_DataType_FLOAT16:
+    case TensorProto_DataType_BFLOAT16:
+      return 2;
+    case TensorProto_DataType_INT32:
+    case TensorProto_DataType_UINT32:
+    case TensorProto_DataType_FLOAT:
+      return 4;
+    case TensorProto_DataType_INT64:
+    case TensorProto_DataType_UINT64:
+    case TensorProto_DataType_DOUBLE:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+// The number of elements of a tensor of |dims|, or -1 if a dim is negative or
+// the number does not fit into int64_t.
+int64_t ElemCount(const std::vector<int64_t>& dims) {
+  if (std::any_of(dims.begin(), dims.end(), [](int64_t d) { return d < 0; })) {
+    return -1;
+  }
+  if (std::find(dims.begin(), dims.end(), 0) != dims.end()) {
+    return 0;
+  }
+  int64_t count = 1;
+  for (const auto dim : dims) {
+    if (count > std::numeric_limits<int64_t>::max() / dim) {
+      return -1;
+    }
+    count *= dim;
+  }
+  return count;
+}
+
+// Row-major strides, in elements.
+std::vector<int64_t> Strides(const std::vector<int64_t>& dims) {
+  std::vector<int64_t> strides(dims.size());
+  int64_t stride = 1;
+  for (size_t i = dims.size(); i-- > 0;) {
+    strides[i] = stride;
+    stride *= dims[i];
+  }
+  return strides;
+}
+
+// Visits every index of |dims| in row-major order and keeps track of the
+// offset of the current index in several tensors, given their strides.
+class IndexIterator {
+ public:
+  IndexIterator(std::vector<int64_t> dims,
+                std::vector<std::vector<int64_t>> strides)
+      : dims_(std::move(dims)),
+        strides_(std::move(strides)),
+        index_(dims_.size(), 0),
+        offsets_(strides_.size(), 0) {}
+
+  int64_t offset(size_t which) const {
+    return offsets_[which];
+  }
+
+  void next() {
+    for (size_t d = dims_.size(); d-- > 0;) {
+      for (size_t i = 0; i < strides_.size(); ++i) {
+        offsets_[i] += strides_[i][d];
+      }
+      if (++index_[d] < dims_[d]) {
+        return;
+      }
+      for (size_t i = 0; i < strides_.size(); ++i) {
+        offsets_[i] -= strides_[i][d] * dims_[d];
+      }
+      index_[d] = 0;
+    }
+  }
+
+ private:
+  std::vector<int64_t> dims_;
+  std::vector<std::vector<int64_t>> strides_;
+  std::vector<int64_t> index_;
+  std::vector<int64_t> offsets_;
+};
+
+struct FoldContext {
+  const Node* node;
+  size_t max_bytes;
+  std::vector<Array> inputs;
+  std::vector<bool> present;
+
+  size_t numInputs() const {
+    return inputs.size();
+  }
+
+  // nullptr if the input is omitted
+  Array* input(size_t which) {
+    return which < inputs.size() && present[which] ? &inputs[which] : nullptr;
+  }
+
+  // Makes |out| a tensor of |elem_type| and |dims| with zeroed elements,
+  // unless it would take more than max_bytes.
+  bool allocate(int32_t elem_type, std::vector<int64_t> dims,
+                Array* out) const {
+    const int64_t count = ElemCount(dims);
+    const size_t elem_size = ElemSize(elem_type);
+    if (count < 0 || elem_size == 0 ||
+        static_cast<uint64_t>(count) > max_bytes / elem_size) {
+      return false;
+    }
+    out->elem_type = elem_type;
+    out->dims = std::move(dims);
+    out->bytes.assign(static_cast<size_t>(count) * elem_size, '\0');
+    return true;
+  }
+};
+
+using Kernel = std::function<bool(FoldContext&, Array*)>;
+
+template <typename T>
+void CopyElements(const Tensor& tensor, Array* array) {
+  const TensorView<T> elements(&tensor);
+  array->bytes.assign(reinterpret_cast<const char*>(elements.data()),
+                      elements.size() * sizeof(T));
+}
+
+bool ToArray(const Tensor& tensor, Array* array) {
+  switch (tensor.elem_type()) {
+#define CASE_COPY_ELEMENTS(pb_type, cpp_type) \
+  case TensorProto_DataType_##pb_type:        \
+    CopyElements<cpp_type>(tensor, array);    \
+    break;
+
+    CASE_COPY_ELEMENTS(FLOAT, float)
+    CASE_COPY_ELEMENTS(DOUBLE, double)
+    CASE_COPY_ELEMENTS(INT8, int8_t)
+    CASE_COPY_ELEMENTS(INT16, int16_t)
+    CASE_COPY_ELEMENTS(INT32, int32_t)
+    CASE_COPY_ELEMENTS(INT64, int64_t)
+    CASE_COPY_ELEMENTS(UINT8, uint8_t)
+    CASE_COPY_ELEMENTS(UINT16, uint16_t)
+    CASE_COPY_ELEMENTS(UINT32, uint32_t)
+    CASE_COPY_ELEMENTS(UINT64, uint64_t)
+    CASE_COPY_ELEMENTS(FLOAT16, Float16)
+    CASE_COPY_ELEMENTS(BFLOAT16, BFloat16)
+#undef CASE_COPY_ELEMENTS
+
+    case TensorProto_DataType_BOOL: {
+      const auto elements = ParseTensorData<bool>(&tensor);
+      array->bytes.resize(elements.size());
+      std::transform(elements.begin(), elements.end(), array->bytes.begin(),
+                     [](bool b) { return static_cast<char>(b); });
+      break;
+    }
+    default:
+      return false;
+  }
+  array->elem_type = tensor.elem_type();
+  array->dims = tensor.sizes();
+  const int64_t count = ElemCount(array->dims);
+  return count >= 0 && static_cast<uint64_t>(count) ==
+                           array->bytes.size() / ElemSize(array->elem_type);
+}
+
+bool ToInts(const Array& array, std::vector<int64_t>* ints) {
+  const size_t count = array.bytes.size() / std::max<size_t>(
+                                                 ElemSize(array.elem_type), 1);
+  if (array.elem_type == TensorProto_DataType_INT64) {
+    ints->assign(array.data<int64_t>(), array.data<int64_t>() + count);
+  } else if (array.elem_type == TensorProto_DataType_INT32) {
+    ints->assign(array.data<int32_t>(), array.data<int32_t>() + count);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Reads the attribute |name| of the node, or its input |which| if the node
+// does not have the attribute. Returns false if neither is there.
+bool GetIntsFromAttrOrInput(FoldContext& ctx, const char* name, size_t which,
+                            std::vector<int64_t>* ints) {
+  if (ctx.node->hasAttribute(Symbol(name))) {
+    return GetValueFromAttr(ctx.node, name, *ints);
+  }
+  const Array* input = ctx.input(which);
+  return input != nullptr && ToInts(*input, ints);
+}
+
+// Same as GetIntsFromAttrOrInput for optional ints, which are left empty if
+// the node has neither the attribute nor the input.
+bool GetOptionalIntsFromAttrOrInput(FoldContext& ctx, const char* name,
+                                    size_t which, std::vector<int64_t>* ints) {
+  if (!ctx.node->hasAttribute(Symbol(name)) && ctx.input(which) == nullptr) {
+    return true;
+  }
+  return GetIntsFromAttrOrInput(ctx, name, which, ints);
+}
+
+// Makes the negative |axes| relative to the end of |rank| dims, and returns
+// false if any of them is out of range or repeated.
+bool NormalizeAxes(std::vector<int64_t>* axes, int64_t rank) {
+  for (auto& axis : *axes) {
+    axis = AddYIfNegative(axis, rank);
+    if (axis < 0 || axis >= rank) {
+      return false;
+    }
+  }
+  auto sorted = *axes;
+  std::sort(sorted.begin(), sorted.end());
+  return std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end();
+}
+
+constexpr int kFloats = 1;
+constexpr int kInts = 2;
+constexpr int kBools = 4;
+constexpr int kNumbers = kFloats | kInts;
+
+// Calls |fn| with a value of the C++ type of |elem_type| if that type is in
+// the set |kTypes|. Halves are not in any set, they are widened to float
+// before a kernel sees them.
+template <int kTypes, typename Fn>
+bool Dispatch(int32_t elem_type, const Fn& fn) {
+  switch (elem_type) {
+#define DISPATCH_CASE(pb_type, cpp_type, type_set) \
+  case TensorProto_DataType_##pb_type:             \
+    if constexpr ((kTypes & type_set) != 0) {      \
+      return fn(cpp_type{});                       \
+    }                                              \
+    break;
+
+    DISPATCH_CASE(FLOAT, float, kFloats)
+    DISPATCH_CASE(DOUBLE, double, kFloats)
+    DISPATCH_CASE(INT8, int8_t, kInts)
+    DISPATCH_CASE(INT16, int16_t, kInts)
+    DISPATCH_CASE(INT32, int32_t, kInts)
+    DISPATCH_CASE(INT64, int64_t, kInts)
+    DISPATCH_CASE(UINT8, uint8_t, kInts)
+    DISPATCH_CASE(UINT16, uint16_t, kInts)
+    DISPATCH_CASE(UINT32, uint32_t, kInts)
+    DISPATCH_CASE(UINT64, uint64_t, kInts)
+    DISPATCH_CASE(BOOL, bool, kBools)
+#undef DISPATCH_CASE
+
+    default:
+      break;
+  }
+  return false;
+}
+
+template <typename Fn>
+bool DispatchAll(int32_t elem_type, const Fn& fn) {
+  switch (elem_type) {
+    case TensorProto_DataType_FLOAT16:
+      return fn(Float16{});
+    case TensorProto_DataType_BFLOAT16:
+      return fn(BFloat16{});
+    default:
+      return Dispatch<kNumbers | kBools>(elem_type, fn);
+  }
+}
+
+bool CastArray(const Array& in, int32_t to, size_t max_bytes, Array* out) {
+  const FoldContext ctx{nullptr, max_bytes, {}, {}};
+  if (!ctx.allocate(to, in.dims, out)) {
+    return false;
+  }
+  const size_t count = in.bytes.size() / ElemSize(in.elem_type);
+  return DispatchAll(in.elem_type, [&](auto from_zero) {
+    using From = decltype(from_zero);
+    return DispatchAll(to, [&](auto to_zero) {
+      using To = decltype(to_zero);
+      using Computed = typename Arithmetic<To>::type;
+      const From* src = in.data<From>();
+      To* dst = out->data<To>();
+      for (size_t i = 0; i < count; ++i) {
+        dst[i] = Arithmetic<To>::store(
+            static_cast<Computed>(Arithmetic<From>::load(src[i])));
+      }
+      return true;
+    });
+  });
+}
+
+// Copies the elements at |offset| + sum(index * |strides|) of |in|, for every
+// index of |dims| in row-major order, into |out|. Offset and strides are in
+// elements.
+template <typename U>
+void StridedCopy(const U* src, const std::vector<int64_t>& strides,
+                 const std::vector<int64_t>& dims, U* dst) {
+  const int64_t count = ElemCount(dims);
+  if (count == 0) {
+    return;
+  }
+  if (dims.empty()) {
+    *dst = *src;
+    return;
+  }
+  const int64_t inner = dims.back();
+  const int64_t inner_stride = strides.back();
+  IndexIterator rows({dims.begin(), dims.end() - 1},
+                     {{strides.begin(), strides.end() - 1}});
+  for (int64_t row = 0; row < count / inner; ++row, rows.next()) {
+    const U* s = src + rows.offset(0);
+    if (inner_stride == 1) {
+      std::memcpy(dst, s, inner * sizeof(U));
+    } else {
+      for (int64_t i = 0; i < inner; ++i) {
+        dst[i] = s[i * inner_stride];
+      }
+    }
+    dst += inner;
+  }
+}
+
+bool StridedCopy(const Array& in, int64_t offset,
+                 const std::vector<int64_t>& strides,
+                 std::vector<int64_t> dims, const FoldContext& ctx,
+                 Array* out) {
+  if (!ctx.allocate(in.elem_type, std::move(dims), out)) {
+    return false;
+  }
+  const auto copy = [&](auto zero) {
+    using U = decltype(zero);
+    StridedCopy(in.data<U>() + offset, strides, out->dims, out->data<U>());
+    return true;
+  };
+  switch (ElemSize(in.elem_type)) {
+    case 1:
+      return copy(uint8_t{});
+    case 2:
+      return copy(uint16_t{});
+    case 4:
+      return copy(uint32_t{});
+    case 8:
+      return copy(uint64_t{});
+    default:
+      return false;
+  }
+}
+
+bool TransposeArray(const Array& in, const std::vector<int64_t>& perm,
+                    const FoldContext& ctx, Array* out) {
+  const auto in_strides = Strides(in.dims);
+  std::vector<int64_t> dims, strides;
+  for (const auto axis : perm) {
+    dims.push_back(in.dims[axis]);
+    strides.push_back(in_strides[axis]);
+  }
+  return StridedCopy(in, 0, strides, std::move(dims), ctx, out);
+}
+
+bool BroadcastDims(const std::vector<int64_t>& a,
+                   const std::vector<int64_t>& b, std::vector<int64_t>* out) {
+  const size_t rank = std::max(a.size(), b.size());
+  out->assign(rank, 1);
+  for (size_t i = 0; i < rank; ++i) {
+    const int64_t da = i + a.size() < rank ? 1 : a[i + a.size() - rank];
+    const int64_t db = i + b.size() < rank ? 1 : b[i + b.size() - rank];
+    if (da == db || db == 1) {
+      (*out)[i] = da;
+    } else if (da == 1) {
+      (*out)[i] = db;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The strides of a tensor of |dims| broadcast to |out_dims|: 0 along the dims
+// it is repeated in.
+std::vector<int64_t> BroadcastStrides(const std::vector<int64_t>& dims,
+                                      const std::vector<int64_t>& out_dims) {
+  std::vector<int64_t> strides(out_dims.size(), 0);
+  int64_t stride = 1;
+  for (size_t i = dims.size(); i-- > 0;) {
+    strides[i + out_dims.size() - dims.size()] = dims[i] == 1 ? 0 : stride;
+    stride *= dims[i];
+  }
+  return strides;
+}
+
+// out = op(a, b) with broadcasting. The innermost dim is processed in one
+// loop per combination of strides, so that each of them vectorizes.
+template <typename T, typename R, typename Op>
+void BroadcastApply(const Array& a, const Array& b, const Op& op, Array* out) {
+  const T* pa = a.data<T>();
+  const T* pb = b.data<T>();
+  R* dst = out->data<R>();
+  const int64_t count = ElemCount(out->dims);
+  if (count == 0) {
+    return;
+  }
+  if (a.dims == b.dims) {
+    for (int64_t i = 0; i < count; ++i) {
+      dst[i] = static_cast<R>(op(pa[i], pb[i]));
+    }
+    return;
+  }
+  const auto& dims = out->dims;
+  const auto sa = BroadcastStrides(a.dims, dims);
+  const auto sb = BroadcastStrides(b.dims, dims);
+  const int64_t inner = dims.empty() ? 1 : dims.back();
+  const int64_t ia = dims.empty() ? 0 : sa.back();
+  const int64_t ib = dims.empty() ? 0 : sb.back();
+  IndexIterator rows(
+      dims.empty() ? dims : std::vector<int64_t>(dims.begin(), dims.end() - 1),
+      {dims.empty() ? sa : std::vector<int64_t>(sa.begin(), sa.end() - 1),
+       dims.empty() ? sb : std::vector<int64_t>(sb.begin(), sb.end() - 1)});
+  for (int64_t row = 0; row < count / inner; ++row, rows.next()) {
+    const T* x = pa + rows.offset(0);
+    const T* y = pb + rows.offset(1);
+    if (ia != 0 && ib != 0) {
+      for (int64_t i = 0; i < inner; ++i) {
+        dst[i] = static_cast<R>(op(x[i], y[i]));
+      }
+    } else if (ib != 0) {
+      const T xv = *x;
+      for (int64_t i = 0; i < inner; ++i) {
+        dst[i] = static_cast<R>(op(xv, y[i]));
+      }
+    } else if (ia != 0) {
+      const T yv = *y;
+      for (int64_t i = 0; i < inner; ++i) {
+        dst[i] = static_cast<R>(op(x[i], yv));
+      }
+    } else {
+      std::fill(dst, dst + inner, static_cast<R>(op(*x, *y)));
+    }
+    dst += inner;
+  }
+}
+
+// The arithmetic of the kernels. An overflow of a signed integer type is
+// undefined, so it clears |*fits| instead and the node is not folded.
+// Unsigned integers wrap around, computed in unsigned int at least so that the
+// narrow types are not promoted to int.
+template <typename T>
+using WideUnsigned = std::common_type_t<T, unsigned>;
+
+template <typename T>
+T CheckedAdd(T a, T b, bool* fits) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return a + b;
+  } else if constexpr (std::is_unsigned_v<T>) {
+    return static_cast<T>(WideUnsigned<T>{a} + WideUnsigned<T>{b});
+  } else {
+    if ((b > 0 && a > std::numeric_limits<T>::max() - b) ||
+        (b < 0 && a < std::numeric_limits<T>::min() - b)) {
+      *fits = false;
+      return T{0};
+    }
+    return static_cast<T>(a + b);
+  }
+}
+
+template <typename T>
+T CheckedSub(T a, T b, bool* fits) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return a - b;
+  } else if constexpr (std::is_unsigned_v<T>) {
+    return static_cast<T>(WideUnsigned<T>{a} - WideUnsigned<T>{b});
+  } else {
+    if ((b < 0 && a > std::numeric_limits<T>::max() + b) ||
+        (b > 0 && a < std::numeric_limits<T>::min() + b)) {
+      *fits = false;
+      return T{0};
+    }
+    return static_cast<T>(a - b);
+  }
+}
+
+template <typename T>
+T CheckedMul(T a, T b, bool* fits) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return a * b;
+  } else if constexpr (std::is_unsigned_v<T>) {
+    return static_cast<T>(WideUnsigned<T>{a} * WideUnsigned<T>{b});
+  } else {
+    constexpr T kMax = std::numeric_limits<T>::max();
+    constexpr T kMin = std::numeric_limits<T>::min();
+    if (a != 0 && b != 0 &&
+        (a > 0 ? (b > 0 ? a > kMax / b : b < kMin / a)
+               : (b > 0 ? a < kMin / b : b < kMax / a))) {
+      *fits = false;
+      return T{0};
+    }
+    return static_cast<T>(a * b);
+  }
+}
+
+// Integer division by zero is undefined too.
+template <typename T>
+T CheckedDiv(T a, T b, bool* fits) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return a / b;
+  } else {
+    if (b == 0 ||
+        (std::is_signed_v<T> && a == std::numeric_limits<T>::min() &&
+         b == static_cast<T>(-1))) {
+      *fits = false;
+      return T{0};
+    }
+    return static_cast<T>(a / b);
+  }
+}
+
+// The kernel made by |make| from a flag, which is cleared if the kernel
+// computes a result that does not fit, and then fails.
+template <typename Make>
+Kernel Checked(Make make) {
+  return [make](FoldContext& ctx, Array* out) {
+    bool fits = true;
+    return make(&fits)(ctx, out) && fits;
+  };
+}
+
+template <int kTypes, typename Op>
+Kernel Unary(Op op) {
+  return [op](FoldContext& ctx, Array* out) {
+    const Array* x = ctx.input(0);
+    return x != nullptr && Dispatch<kTypes>(x->elem_type, [&](auto zero) {
+             using T = decltype(zero);
+             if (!ctx.allocate(x->elem_type, x->dims, out)) {
+               return false;
+             }
+             const T* src = x->data<T>();
+             T* dst = out->data<T>();
+             const size_t count = x->bytes.size() / sizeof(T);
+             for (size_t i = 0; i < count; ++i) {
+               dst[i] = static_cast<T>(op(src[i]));
+             }
+             return true;
+           });
+  };
+}
+
+// Elementwise |op| of all inputs, folded from the left, e.g. Add or Max. With
+// |kCompare| the node has two inputs and its output is a bool tensor.
+template <int kTypes, bool kCompare = false, typename Op>
+Kernel Elementwise(Op op) {
+  return [op](FoldContext& ctx, Array* out) {
+    if (ctx.numInputs() == 0 || (kCompare && ctx.numInputs() != 2)) {
+      return false;
+    }
+    Array result = ctx.inputs[0];
+    for (size_t i = 1; i < ctx.numInputs(); ++i) {
+      const Array* b = ctx.input(i);
+      std::vector<int64_t> dims;
+      if (b == nullptr || b->elem_type != result.elem_type ||
+          !BroadcastDims(result.dims, b->dims, &dims)) {
+        return false;
+      }
+      Array next;
+      const bool ok = Dispatch<kTypes>(result.elem_type, [&](auto zero) {
+        using T = decltype(zero);
+        using R = std::conditional_t<kCompare, bool, T>;
+        const int32_t elem_type =
+            kCompare ? TensorProto_DataType_BOOL : result.elem_type;
+        if (!ctx.allocate(elem_type, std::move(dims), &next)) {
+          return false;
+        }
+        BroadcastApply<T, R>(result, *b, op, &next);
+        return true;
+      });
+      if (!ok) {
+        return false;
+      }
+      result = std::move(next);
+    }
+    if (ctx.numInputs() == 1 && !Dispatch<kTypes>(result.elem_type,
+                                                  [](auto) { return true; })) {
+      return false;
+    }
+    *out = std::move(result);
+    return true;
+  };
+}
+
+Kernel Div() {
+  const auto div = Checked([](bool* fits) {
+    return Elementwise<kNumbers>(
+        [fits](auto a, auto b) { return CheckedDiv(a, b, fits); });
+  });
+  return [div](FoldContext& ctx, Array* out) {
+    return ctx.numInputs() == 2 && div(ctx, out);
+  };
+}
+
+// Reduces the rows of length |n| with |op|, in several lanes so that the loop
+// vectorizes without reassociating a single accumulator.
+template <typename T, typename Op>
+T ReduceRow(const T* row, int64_t n, T init, const Op& op) {
+  constexpr int64_t kLanes = 8;
+  T lanes[kLanes];
+  std::fill(lanes, lanes + kLanes, init);
+  int64_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (int64_t j = 0; j < kLanes; ++j) {
+      lanes[j] = static_cast<T>(op(lanes[j], row[i + j]));
+    }
+  }
+  T acc = init;
+  for (int64_t j = 0; j < kLanes; ++j) {
+    acc = static_cast<T>(op(acc, lanes[j]));
+  }
+  for (; i < n; ++i) {
+    acc = static_cast<T>(op(acc, row[i]));
+  }
+  return acc;
+}
+
+enum class Reduction { Sum, Mean, Prod, Max, Min };
+
+Kernel Reduce(Reduction reduction) {
+  return [reduction](FoldContext& ctx, Array* out) {
+    Array* x = ctx.input(0);
+    if (x == nullptr) {
+      return false;
+    }
+    const int64_t rank = static_cast<int64_t>(x->dims.size());
+    std::vector<int64_t> axes;
+    if (!GetOptionalIntsFromAttrOrInput(ctx, "axes", 1, &axes)) {
+      return false;
+    }
+    if (axes.empty()) {
+      if (GetValueFromAttrWithDefault(ctx.node, "noop_with_empty_axes",
+                                      int64_t{0}) != 0) {
+        *out = std::move(*x);
+        return true;
+      }
+      for (int64_t i = 0; i < rank; ++i) {
+        axes.push_back(i);
+      }
+    }
+    if (!NormalizeAxes(&axes, rank)) {
+      return false;
+    }
+    std::vector<bool> reduced(rank, false);
+    for (const auto axis : axes) {
+      reduced[axis] = true;
+    }
+    // move the reduced dims to the end, so that every output element reduces
+    // a contiguous row
+    std::vector<int64_t> perm, out_dims;
+    int64_t row_size = 1;
+    for (int64_t i = 0; i < rank; ++i) {
+      if (!reduced[i]) {
+        perm.push_back(i);
+        out_dims.push_back(x->dims[i]);
+      } else if (GetValueFromAttrWithDefault(ctx.node, "keepdims",
+                                             int64_t{1}) != 0) {
+        out_dims.push_back(1);
+      }
+    }
+    for (const auto axis : axes) {
+      row_size *= x->dims[axis];
+    }
+    std::sort(axes.begin(), axes.end());
+    perm.insert(perm.end(), axes.begin(), axes.end());
+    if (row_size == 0) {
+      return false;
+    }
+    Array transposed;
+    if (!std::is_sorted(perm.begin(), perm.end())) {
+      if (!TransposeArray(*x, perm, ctx, &transposed)) {
+        return false;
+      }
+      x = &transposed;
+    }
+    return Dispatch<kNumbers>(x->elem_type, [&](auto zero) {
+      using T = decltype(zero);
+      if (!ctx.allocate(x->elem_type, out_dims, out)) {
+        return false;
+      }
+      const T* src = x->data<T>();
+      T* dst = out->data<T>();
+      const int64_t count = static_cast<int64_t>(x->bytes.size() / sizeof(T));
+      bool fits = true;
+      for (int64_t o = 0; o < count / row_size; ++o) {
+        const T* row = src + o * row_size;
+        switch (reduction) {
+          case Reduction::Sum:
+          case Reduction::Mean:
+            dst[o] = ReduceRow(row, row_size, T{0}, [&fits](T a, T b) {
+              return CheckedAdd(a, b, &fits);
+            });
+            if (reduction == Reduction::Mean) {
+              dst[o] = static_cast<T>(dst[o] / static_cast<T>(row_size));
+            }
+            break;
+          case Reduction::Prod:
+            dst[o] = ReduceRow(row, row_size, T{1}, [&fits](T a, T b) {
+              return CheckedMul(a, b, &fits);
+            });
+            break;
+          case Reduction::Max:
+            dst[o] = ReduceRow(row, row_size, row[0],
+                               [](T a, T b) { return std::max(a, b); });
+            break;
+          case Reduction::Min:
+            dst[o] = ReduceRow(row, row_size, row[0],
+                               [](T a, T b) { return std::min(a, b); });
+            break;
+        }
+      }
+      return fits;
+    });
+  };
+}
+
+// Moves the elements of the input into |out| with the new |dims|.
+bool Reshaped(FoldContext& ctx, std::vector<int64_t> dims, Array* out) {
+  Array& x = ctx.inputs[0];
+  if (ElemCount(dims) != ElemCount(x.dims)) {
+    return false;
+  }
+  out->elem_type = x.elem_type;
+  out->dims = std::move(dims);
+  out->bytes = std::move(x.bytes);
+  return true;
+}
+
+bool Reshape(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  const Array* shape = ctx.input(1);
+  std::vector<int64_t> dims;
+  if (x == nullptr || shape == nullptr || !ToInts(*shape, &dims)) {
+    return false;
+  }
+  const bool allow_zero =
+      GetValueFromAttrWithDefault(ctx.node, "allowzero", int64_t{0}) != 0;
+  int64_t inferred = -1;
+  int64_t known = 1;
+  for (size_t i = 0; i < dims.size(); ++i) {
+    if (dims[i] == 0 && !allow_zero) {
+      if (i >= x->dims.size()) {
+        return false;
+      }
+      dims[i] = x->dims[i];
+    }
+    if (dims[i] == -1) {
+      if (inferred != -1) {
+        return false;
+      }
+      inferred = static_cast<int64_t>(i);
+    } else if (dims[i] < 0) {
+      return false;
+    } else {
+      known *= dims[i];
+    }
+  }
+  if (inferred != -1) {
+    const int64_t count = ElemCount(x->dims);
+    if (known == 0 || count % known != 0) {
+      return false;
+    }
+    dims[inferred] = count / known;
+  }
+  return Reshaped(ctx, std::move(dims), out);
+}
+
+bool Squeeze(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  if (x == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size());
+  std::vector<int64_t> axes;
+  if (!GetOptionalIntsFromAttrOrInput(ctx, "axes", 1, &axes)) {
+    return false;
+  }
+  if (axes.empty()) {
+    for (int64_t i = 0; i < rank; ++i) {
+      if (x->dims[i] == 1) {
+        axes.push_back(i);
+      }
+    }
+  }
+  if (!NormalizeAxes(&axes, rank)) {
+    return false;
+  }
+  std::vector<int64_t> dims;
+  for (int64_t i = 0; i < rank; ++i) {
+    const bool squeezed = std::find(axes.begin(), axes.end(), i) != axes.end();
+    if (squeezed && x->dims[i] != 1) {
+      return false;
+    }
+    if (!squeezed) {
+      dims.push_back(x->dims[i]);
+    }
+  }
+  return Reshaped(ctx, std::move(dims), out);
+}
+
+bool Unsqueeze(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  std::vector<int64_t> axes;
+  if (x == nullptr || !GetIntsFromAttrOrInput(ctx, "axes", 1, &axes)) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size() + axes.size());
+  if (!NormalizeAxes(&axes, rank)) {
+    return false;
+  }
+  std::vector<int64_t> dims;
+  auto next_dim = x->dims.begin();
+  for (int64_t i = 0; i < rank; ++i) {
+    if (std::find(axes.begin(), axes.end(), i) != axes.end()) {
+      dims.push_back(1);
+    } else {
+      dims.push_back(*next_dim++);
+    }
+  }
+  return Reshaped(ctx, std::move(dims), out);
+}
+
+bool Flatten(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  if (x == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size());
+  const int64_t axis = AddYIfNegative(
+      GetValueFromAttrWithDefault(ctx.node, "axis", int64_t{1}), rank);
+  if (axis < 0 || axis > rank) {
+    return false;
+  }
+  const int64_t outer = ElemCount({x->dims.begin(), x->dims.begin() + axis});
+  const int64_t inner = ElemCount({x->dims.begin() + axis, x->dims.end()});
+  return Reshaped(ctx, {outer, inner}, out);
+}
+
+bool Identity(FoldContext& ctx, Array* out) {
+  return ctx.input(0) != nullptr && Reshaped(ctx, ctx.inputs[0].dims, out);
+}
+
+bool Transpose(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  if (x == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size());
+  std::vector<int64_t> perm;
+  if (!GetValueFromAttr(ctx.node, "perm", perm)) {
+    for (int64_t i = rank - 1; i >= 0; --i) {
+      perm.push_back(i);
+    }
+  }
+  if (static_cast<int64_t>(perm.size()) != rank ||
+      !NormalizeAxes(&perm, rank)) {
+    return false;
+  }
+  return TransposeArray(*x, perm, ctx, out);
+}
+
+bool Slice(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  if (x == nullptr) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size());
+  std::vector<int64_t> starts, ends, axes, steps;
+  if (ctx.node->hasAttribute(kstarts)) {
+    if (!GetValueFromAttr(ctx.node, "starts", starts) ||
+        !GetValueFromAttr(ctx.node, "ends", ends)) {
+      return false;
+    }
+    GetValueFromAttr(ctx.node, "axes", axes);
+  } else {
+    if (ctx.input(1) == nullptr || ctx.input(2) == nullptr ||
+        !ToInts(*ctx.input(1), &starts) || !ToInts(*ctx.input(2), &ends) ||
+        (ctx.input(3) != nullptr && !ToInts(*ctx.input(3), &axes)) ||
+        (ctx.input(4) != nullptr && !ToInts(*ctx.input(4), &steps))) {
+      return false;
+    }
+  }
+  if (axes.empty()) {
+    for (size_t i = 0; i < starts.size(); ++i) {
+      axes.push_back(static_cast<int64_t>(i));
+    }
+  }
+  if (steps.empty()) {
+    steps.assign(starts.size(), 1);
+  }
+  if (ends.size() != starts.size() || axes.size() != starts.size() ||
+      steps.size() != starts.size() || !NormalizeAxes(&axes, rank)) {
+    return false;
+  }
+  const auto in_strides = Strides(x->dims);
+  std::vector<int64_t> dims = x->dims;
+  std::vector<int64_t> strides = in_strides;
+  int64_t offset = 0;
+  for (size_t i = 0; i < axes.size(); ++i) {
+    const int64_t axis = axes[i];
+    const int64_t dim = x->dims[axis];
+    const int64_t step = steps[i];
+    if (step == 0) {
+      return false;
+    }
+    int64_t start = AddYIfNegative(starts[i], dim);
+    int64_t end = AddYIfNegative(ends[i], dim);
+    int64_t count;
+    if (dim == 0) {
+      count = 0;
+    } else if (step > 0) {
+      start = std::clamp<int64_t>(start, 0, dim);
+      end = std::clamp<int64_t>(end, 0, dim);
+      count = end > start ? (end - start - 1) / step + 1 : 0;
+    } else {
+      start = std::clamp<int64_t>(start, 0, dim - 1);
+      end = std::clamp<int64_t>(end, -1, dim - 1);
+      count = start > end ? (end - start + 1) / step + 1 : 0;
+    }
+    dims[axis] = count;
+    strides[axis] = in_strides[axis] * step;
+    if (count > 0) {
+      offset += start * in_strides[axis];
+    }
+  }
+  return StridedCopy(*x, offset, strides, std::move(dims), ctx, out);
+}
+
+bool ConcatArrays(const std::vector<Array>& inputs, int64_t axis,
+                  const FoldContext& ctx, Array* out) {
+  if (inputs.empty()) {
+    return false;
+  }
+  const Array& first = inputs[0];
+  const int64_t rank = static_cast<int64_t>(first.dims.size());
+  axis = AddYIfNegative(axis, rank);
+  if (axis < 0 || axis >= rank) {
+    return false;
+  }
+  std::vector<int64_t> dims = first.dims;
+  dims[axis] = 0;
+  for (const Array& x : inputs) {
+    if (x.elem_type != first.elem_type || x.dims.size() != first.dims.size()) {
+      return false;
+    }
+    for (int64_t d = 0; d < rank; ++d) {
+      if (d != axis && x.dims[d] != first.dims[d]) {
+        return false;
+      }
+    }
+    dims[axis] += x.dims[axis];
+  }
+  const int64_t outer = ElemCount({dims.begin(), dims.begin() + axis});
+  if (!ctx.allocate(first.elem_type, std::move(dims), out)) {
+    return false;
+  }
+  char* dst = &out->bytes[0];
+  for (int64_t o = 0; o < outer; ++o) {
+    for (const Array& x : inputs) {
+      const size_t chunk = x.bytes.size() / outer;
+      std::memcpy(dst, x.bytes.data() + o * chunk, chunk);
+      dst += chunk;
+    }
+  }
+  return true;
+}
+
+bool Concat(FoldContext& ctx, Array* out) {
+  int64_t axis;
+  if (!GetValueFromAttr(ctx.node, "axis", axis)) {
+    return false;
+  }
+  for (size_t i = 0; i < ctx.numInputs(); ++i) {
+    if (ctx.input(i) == nullptr) {
+      return false;
+    }
+  }
+  return ConcatArrays(ctx.inputs, axis, ctx, out);
+}
+
+bool Gather(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  const Array* indices_array = ctx.input(1);
+  std::vector<int64_t> indices;
+  if (x == nullptr || indices_array == nullptr ||
+      !ToInts(*indices_array, &indices)) {
+    return false;
+  }
+  const int64_t rank = static_cast<int64_t>(x->dims.size());
+  const int64_t axis = AddYIfNegative(
+      GetValueFromAttrWithDefault(ctx.node, "axis", int64_t{0}), rank);
+  if (axis < 0 || axis >= rank) {
+    return false;
+  }
+  const int64_t dim = x->dims[axis];
+  for (auto& index : indices) {
+    index = AddYIfNegative(index, dim);
+    if (index < 0 || index >= dim) {
+      return false;
+    }
+  }
+  std::vector<int64_t> dims(x->dims.begin(), x->dims.begin() + axis);
+  dims.insert(dims.end(), indices_array->dims.begin(),
+              indices_array->dims.end());
+  dims.insert(dims.end(), x->dims.begin() + axis + 1, x->dims.end());
+  const int64_t outer = ElemCount({x->dims.begin(), x->dims.begin() + axis});
+  const size_t chunk =
+      ElemCount({x->dims.begin() + axis + 1, x->dims.end()}) *
+      ElemSize(x->elem_type);
+  if (!ctx.allocate(x->elem_type, std::move(dims), out)) {
+    return false;
+  }
+  char* dst = &out->bytes[0];
+  for (int64_t o = 0; o < outer; ++o) {
+    const char* src = x->bytes.data() + o * dim * chunk;
+    for (const auto index : indices) {
+      std::memcpy(dst, src + index * chunk, chunk);
+      dst += chunk;
+    }
+  }
+  return true;
+}
+
+bool IsHalf(int32_t elem_type) {
+  return elem_type == TensorProto_DataType_FLOAT16 ||
+         elem_type == TensorProto_DataType_BFLOAT16;
+}
+
+bool IsFloatingPoint(int32_t elem_type) {
+  return IsHalf(elem_type) || elem_type == TensorProto_DataType_FLOAT ||
+         elem_type == TensorProto_DataType_DOUBLE;
+}
+
+bool Cast(FoldContext& ctx, Array* out) {
+  const Array* x = ctx.input(0);
+  int64_t to;
+  if (x == nullptr || !GetValueFromAttr(ctx.node, "to", to)) {
+    return false;
+  }
+  // converting a floating-point value out of the range of an integer type is
+  // undefined, and runtimes disagree on the result
+  if (IsFloatingPoint(x->elem_type) &&
+      !IsFloatingPoint(static_cast<int32_t>(to)) &&
+      to != TensorProto_DataType_BOOL) {
+    return false;
+  }
+  return CastArray(*x, static_cast<int32_t>(to), ctx.max_bytes, out);
+}
+
+bool MatMul(FoldContext& ctx, Array* out) {
+  const Array* a = ctx.input(0);
+  const Array* b = ctx.input(1);
+  if (a == nullptr || b == nullptr || a->elem_type != b->elem_type ||
+      a->dims.empty() || b->dims.empty()) {
+    return false;
+  }
+  // 1-D operands are promoted to matrices, and the added dims are removed
+  // from the result
+  auto a_dims = a->dims;
+  auto b_dims = b->dims;
+  if (a_dims.size() == 1) {
+    a_dims.insert(a_dims.begin(), 1);
+  }
+  if (b_dims.size() == 1) {
+    b_dims.push_back(1);
+  }
+  const int64_t M = a_dims[a_dims.size() - 2];
+  const int64_t K = a_dims.back();
+  const int64_t N = b_dims.back();
+  if (b_dims[b_dims.size() - 2] != K) {
+    return false;
+  }
+  const std::vector<int64_t> a_batch(a_dims.begin(), a_dims.end() - 2);
+  const std::vector<int64_t> b_batch(b_dims.begin(), b_dims.end() - 2);
+  std::vector<int64_t> batch;
+  if (!BroadcastDims(a_batch, b_batch, &batch)) {
+    return false;
+  }
+  auto a_strides = BroadcastStrides(a_batch, batch);
+  auto b_strides = BroadcastStrides(b_batch, batch);
+  for (auto& stride : a_strides) {
+    stride *= M * K;
+  }
+  for (auto& stride : b_strides) {
+    stride *= K * N;
+  }
+  std::vector<int64_t> dims = batch;
+  if (a->dims.size() > 1) {
+    dims.push_back(M);
+  }
+  if (b->dims.size() > 1) {
+    dims.push_back(N);
+  }
+  const int64_t num_batches = ElemCount(batch);
+  return Dispatch<kNumbers>(a->elem_type, [&](auto zero) {
+    using T = decltype(zero);
+    if (!ctx.allocate(a->elem_type, dims, out)) {
+      return false;
+    }
+    T* c = out->data<T>();
+    bool fits = true;
+    IndexIterator batches(batch, {a_strides, b_strides});
+    for (int64_t i = 0; i < num_batches; ++i, batches.next()) {
+      const T* pa = a->data<T>() + batches.offset(0);
+      const T* pb = b->data<T>() + batches.offset(1);
+      // i-k-j order, the innermost loop scales a row of B into a row of C
+      for (int64_t m = 0; m < M; ++m) {
+        T* c_row = c + m * N;
+        for (int64_t k = 0; k < K; ++k) {
+          const T scale = pa[m * K + k];
+          const T* b_row = pb + k * N;
+          for (int64_t n = 0; n < N; ++n) {
+            c_row[n] = CheckedAdd(c_row[n], CheckedMul(scale, b_row[n], &fits),
+                                  &fits);
+          }
+        }
+      }
+      c += M * N;
+    }
+    return fits;
+  });
+}
+
+struct KernelInfo {
+  Kernel kernel;
+  // whether FLOAT16 and BFLOAT16 inputs are computed in float
+  bool widen_halves;
+};
+
+const std::unordered_map<NodeKind, KernelInfo>& Kernels() {
+  static const auto* kernels = [] {
+    auto* kernels = new std::unordered_map<NodeKind, KernelInfo>;
+    const auto add = [kernels](const char* kind, Kernel kernel,
+                               bool widen_halves = true) {
+      kernels->emplace(Symbol(kind), KernelInfo{std::move(kernel),
+                                                widen_halves});
+    };
+    add("Neg", Checked([](bool* fits) {
+          return Unary<kNumbers>([fits](auto x) {
+            return CheckedSub(decltype(x){0}, x, fits);
+          });
+        }));
+    add("Abs", Checked([](bool* fits) {
+          return Unary<kNumbers>([fits](auto x) {
+            if constexpr (std::is_signed_v<decltype(x)>) {
+              return x < 0 ? CheckedSub(decltype(x){0}, x, fits) : x;
+            } else {
+              return x;
+            }
+          });
+        }));
+    add("Relu", Unary<kNumbers>([](auto x) {
+          return x > 0 ? x : decltype(x){0};
+        }));
+    add("Reciprocal", Unary<kFloats>([](auto x) {
+          return decltype(x){1} / x;
+        }));
+    add("Sqrt", Unary<kFloats>([](auto x) { return std::sqrt(x); }));
+    add("Exp", Unary<kFloats>([](auto x) { return std::exp(x); }));
+    add("Log", Unary<kFloats>([](auto x) { return std::log(x); }));
+    add("Tanh", Unary<kFloats>([](auto x) { return std::tanh(x); }));
+    add("Erf", Unary<kFloats>([](auto x) { return std::erf(x); }));
+    add("Floor", Unary<kFloats>([](auto x) { return std::floor(x); }));
+    add("Ceil", Unary<kFloats>([](auto x) { return std::ceil(x); }));
+    add("Sigmoid", Unary<kFloats>([](auto x) {
+          return decltype(x){1} / (decltype(x){1} + std::exp(-x));
+        }));
+    add("Not", Unary<kBools>([](bool x) { return !x; }));
+    add("Add", Checked([](bool* fits) {
+          return Elementwise<kNumbers>(
+              [fits](auto a, auto b) { return CheckedAdd(a, b, fits); });
+        }));
+    add("Sub", Checked([](bool* fits) {
+          return Elementwise<kNumbers>(
+              [fits](auto a, auto b) { return CheckedSub(a, b, fits); });
+        }));
+    add("Mul", Checked([](bool* fits) {
+          return Elementwise<kNumbers>(
+              [fits](auto a, auto b) { return CheckedMul(a, b, fits); });
+        }));
+    add("Div", Div());
+    add("Pow", Elementwise<kFloats>(
+                   [](auto a, auto b) { return std::pow(a, b); }));
+    add("Sum", Checked([](bool* fits) {
+          return Elementwise<kNumbers>(
+              [fits](auto a, auto b) { return CheckedAdd(a, b, fits); });
+        }));
+    add("Max", Elementwise<kNumbers>(
+                   [](auto a, auto b) { return std::max(a, b); }));
+    add("Min", Elementwise<kNumbers>(
+                   [](auto a, auto b) { return std::min(a, b); }));
+    add("Equal", Elementwise<kNumbers | kBools, true>(
+                     [](auto a, auto b) { return a == b; }));
+    add("Less", Elementwise<kNumbers, true>(
+                    [](auto a, auto b) { return a < b; }));
+    add("LessOrEqual", Elementwise<kNumbers, true>(
+                           [](auto a, auto b) { return a <= b; }));
+    add("Greater", Elementwise<kNumbers, true>(
+                       [](auto a, auto b) { return a > b; }));
+    add("GreaterOrEqual", Elementwise<kNumbers, true>(
+                              [](auto a, auto b) { return a >= b; }));
+    add("And", Elementwise<kBools>([](bool a, bool b) { return a && b; }));
+    add("Or", Elementwise<kBools>([](bool a, bool b) { return a || b; }));
+    add("Xor", Elementwise<kBools>([](bool a, bool b) { return a != b; }));
+    add("ReduceSum", Reduce(Reduction::Sum));
+    add("ReduceMean", Reduce(Reduction::Mean));
+    add("ReduceProd", Reduce(Reduction::Prod));
+    add("ReduceMax", Reduce(Reduction::Max));
+    add("ReduceMin", Reduce(Reduction::Min));
+    add("MatMul", MatMul);
+    add("Cast", Cast, false);
+    add("Identity", Identity, false);
+    add("Reshape", Reshape, false);
+    add("Squeeze", Squeeze, false);
+    add("Unsqueeze", Unsqueeze, false);
+    add("Flatten", Flatten, false);
+    add("Transpose", Transpose, false);
+    add("Slice", Slice, false);
+    add("Concat", Concat, false);
+    add("Gather", Gather, false);
+    return kernels;
+  }();
+  return *kernels;
+}
+
+}  // namespace
+
+const std::vector<NodeKind>& FoldableKinds() {
+  static const auto* kinds = [] {
+    auto* kinds = new std::vector<NodeKind>;
+    for (const auto& kernel : Kernels()) {
+      kinds->push_back(kernel.first);
+    }
+    return kinds;
+  }();
+  return *kinds;
+}
+
+bool FoldNode(const Node* node, const std::vector<const Tensor*>& inputs,
+              size_t max_bytes, Tensor* output) {
+  // raw_data is little-endian, the kernels compute in the native byte order
+  if (!is_processor_little_endian() || node->outputs().size() != 1) {
+    return false;
+  }
+  // the kernels only implement the operators of the default domain
+  if (node->has_domain() && !node->domain().empty()) {
+    return false;
+  }
+  const auto kernel = Kernels().find(node->kind());
+  if (kernel == Kernels().end()) {
+    return false;
+  }
+  FoldContext ctx{node, max_bytes, {}, {}};
+  for (const Tensor* tensor : inputs) {
+    Array array;
+    if (tensor != nullptr && !ToArray(*tensor, &array)) {
+      return false;
+    }
+    ctx.inputs.push_back(std::move(array));
+    ctx.present.push_back(tensor != nullptr);
+  }
+  int32_t half_type = TensorProto_DataType_UNDEFINED;
+  if (kernel->second.widen_halves) {
+    const auto half = std::find_if(
+        ctx.inputs.begin(), ctx.inputs.end(),
+        [](const Array& array) { return IsHalf(array.elem_type); });
+    if (half != ctx.inputs.end()) {
+      half_type = half->elem_type;
+    }
+  }
+  if (half_type != TensorProto_DataType_UNDEFINED) {
+    for (auto& array : ctx.inputs) {
+      // a float result of mixed inputs could not be narrowed back
+      if (array.elem_type == TensorProto_DataType_FLOAT ||
+          (IsHalf(array.elem_type) && array.elem_type != half_type)) {
+        return false;
+      }
+      if (array.elem_type == half_type) {
+        Array widened;
+        CastArray(array, TensorProto_DataType_FLOAT,
+                  std::numeric_limits<size_t>::max(), &widened);
+        array = std::move(widened);
+      }
+    }
+  }
+  Array result;
+  if (!kernel->second.kernel(ctx, &result)) {
+    return false;
+  }
+  if (half_type != TensorProto_DataType_UNDEFINED &&
+      result.elem_type == TensorProto_DataType_FLOAT) {
+    Array narrowed;
+    if (!CastArray(result, half_type, max_bytes, &narrowed)) {
+      return false;
+    }
+    result = std::move(narrowed);
+  }
+  output->elem_type() = result.elem_type;
+  output->sizes() = std::move(result.dims);
+  output->set_raw_data(std::move(result.bytes));
+  return true;
+}
+
+bool TransposeTensor(const Tensor& input, const std::vector<int64_t>& perm,
+                     Tensor* output) {
+  Array array;
+  if (!is_processor_little_endian() || !ToArray(input, &array)) {
+    return false;
+  }
+  std::vector<int64_t> axes = perm;
+  if (axes.size() != array.dims.size() ||
+      !NormalizeAxes(&axes, static_cast<int64_t>(axes.size()))) {
+    return false;
+  }
+  const FoldContext ctx{nullptr, std::numeric_limits<size_t>::max(), {}, {}};
+  Array result;
+  if (!TransposeArray(array, axes, ctx, &result)) {
+    return false;
+  }
+  output->elem_type() = result.elem_type;
+  output->sizes() = std::move(result.dims);
+  output->set_raw_data(std::move(result.bytes));
+  return true;
+}
+
+bool ConcatTensors(const std::vector<const Tensor*>& inputs, int64_t axis,
+                   Tensor* output) {
+  if (!is_processor_little_endian()) {
+    return false;
+  }
+  std::vector<Array> arrays(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!ToArray(*inputs[i], &arrays[i])) {
+      return false;
+    }
+  }
+  const FoldContext ctx{nullptr, std::numeric_limits<size_t>::max(), {}, {}};
+  Array result;
+  if (!ConcatArrays(arrays, axis, ctx, &result)) {
+    return false;
+  }
+  output->elem_type() = result.elem_type;
+  output->sizes() = std::move(result.dims);
+  output->set_raw_data(std::move(result.bytes));
+  return true;
+}
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "onnx/common/ir.h"
+#include "onnx/common/tensor.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// CPU kernels that evaluate a node of the default domain on constant inputs,
+// used by the constant_folding pass. They cover elementwise math and
+// comparisons with broadcasting, reductions, Reshape, Squeeze, Unsqueeze,
+// Flatten, Transpose, Slice, Concat, Gather, Cast and MatMul. The inner loops
+// run over contiguous memory so that compilers vectorize them.
+
+// The kinds of nodes FoldNode may be able to evaluate.
+const std::vector<NodeKind>& FoldableKinds();
+
+// Evaluates |node|, which must have a single output, into |output|. |inputs|
+// holds the value of every input of the node, or nullptr for an omitted
+// optional input. Returns false, leaving |output| untouched, if the node, its
+// attributes or the types of its inputs are not supported, if the inputs are
+// invalid for it, or if the result would take more than |max_bytes|. Nodes of
+// other domains than the default one, and Casts of floating-point values to
+// integers, are never evaluated.
+bool FoldNode(const Node* node, const std::vector<const Tensor*>& inputs,
+              size_t max_bytes, Tensor* output);
+
+// Transposes |input| by |perm| into |output|, like the Transpose operator.
+// Returns false if the type of |input| is not supported or |perm| is not a
+// permutation of its dims.
+bool TransposeTensor(const Tensor& input, const std::vector<int64_t>& perm,
+                     Tensor* output);
+
+// Concatenates |inputs| along |axis| into |output|, like the Concat operator.
+// Returns false if their types are not supported or differ, or if their dims
+// do not match but along |axis|.
+bool ConcatTensors(const std::vector<const Tensor*>& inputs, int64_t axis,
+                   Tensor* output);
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -33,6 +33,15 @@ struct FuseAddBiasIntoConv final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_add_bias_into_conv";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kAdd};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kAdd, kConv, kSqueeze, kUnsqueeze, kConstant, kTile};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kAdd, kConv};
+  }
   bool patternMatchPredicate(Node *node) override {
     return CheckKind(node, kAdd, 0, kConv) &&
            GetInputsOfPreNode(node, 0).size() == 2;
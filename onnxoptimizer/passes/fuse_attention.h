@@ -0,0 +1,365 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Q, Kt and V are tensors with shape=[batch, heads, seq, head_size],
+//   [batch, heads, head_size, kv_seq] and [batch, heads, kv_seq, head_size]
+//   S = Div(MatMul(Q, Kt), 8)
+//   P = Softmax(Add(S, M), axis=-1)
+//   Y = MatMul(P, V)
+// After, with opset 23 or later:
+//   Y = Attention(Q, Transpose(Kt, perm=[0, 1, 3, 2]), V, M, scale=0.125)
+//
+// Before, with the heads split from and merged into the hidden dim:
+//   Q = Transpose(Reshape(Xq, [0, 0, heads, head_size]), perm=[0, 2, 1, 3])
+//   Kt = Transpose(Reshape(Xk, [0, 0, heads, head_size]), perm=[0, 2, 3, 1])
+//   V = Transpose(Reshape(Xv, [0, 0, heads, head_size]), perm=[0, 2, 1, 3])
+//   Y = MatMul(Softmax(Add(Div(MatMul(Q, Kt), 8), M)), V)
+//   Z = Reshape(Transpose(Y, perm=[0, 2, 1, 3]), [0, 0, hidden])
+// After, with an earlier opset:
+//   Z = com.microsoft.MultiHeadAttention(Xq, Xk, Xv, , , M, num_heads=heads,
+//                                        scale=0.125)
+//
+// The scale and the additive mask are optional. The Transpose of the keys
+// is merged into the Transpose computing them, if any, or else left to
+// fuse_consecutive_transposes. The shapes of Q, Kt, V and M have to be known
+// for the batch and head dims of the inputs not to be broadcast, which
+// Attention and MultiHeadAttention don't do.
+//
+// The pass may create an op of onnxruntime, so it is not run by default, pass
+// it by name.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseAttention final : public PredicateBasedPass {
+  explicit FuseAttention()
+      : PredicateBasedPass(PassType::Replace, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "fuse_attention";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kMatMul};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("Attention"), Symbol("MultiHeadAttention"), kTranspose};
+  }
+  // The predicate looks at every node of the pattern.
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return patternKinds();
+  }
+
+ private:
+  // The nodes of the pattern, from the output up.
+  struct Match {
+    Node* output = nullptr;
+    Node* softmax = nullptr;
+    Node* masking = nullptr;
+    Node* scaling = nullptr;
+    Node* scores = nullptr;
+    Value* mask = nullptr;
+    float scale = 1.0f;
+  };
+
+  // Matches MatMul(Q, Kt), scaled or not, computing |value|.
+  static bool matchScores(Value* value, Match& match) {
+    Node* node = value->node();
+    if (value->uses().size() != 1 || !IsDefaultDomain(node)) {
+      return false;
+    }
+    match.scaling = nullptr;
+    match.scale = 1.0f;
+    if (node->kind() == kMul || node->kind() == kDiv) {
+      float factor;
+      Value* scores = nullptr;
+      if (FetchScalar(node->input(1), factor)) {
+        scores = node->input(0);
+      } else if (node->kind() == kMul && FetchScalar(node->input(0), factor)) {
+        scores = node->input(1);
+      }
+      if (scores == nullptr || (node->kind() == kDiv && factor == 0.0f)) {
+        return false;
+      }
+      match.scaling = node;
+      match.scale = node->kind() == kMul ? factor : 1.0f / factor;
+      node = SoleProducer(scores, kMatMul);
+    } else if (node->kind() != kMatMul) {
+      return false;
+    }
+    if (node == nullptr || !HasRank(node->output(), 4)) {
+      return false;
+    }
+    match.scores = node;
+    return true;
+  }
+
+  static bool matchAttention(Node* node, Match& match) {
+    match.output = node;
+    match.softmax = SoleProducer(node->input(0), kSoftmax);
+    if (!CheckKind(node, kMatMul) || !IsDefaultDomain(node) ||
+        match.softmax == nullptr || !HasRank(match.softmax->output(), 4)) {
+      return false;
+    }
+    const int64_t default_axis =
+        getOpsetVersion(*node->owningGraph()) >= 13 ? -1 : 1;
+    if (AddYIfNegative(GetValueFromAttrWithDefault(match.softmax, kaxis,
+                                                   default_axis),
+                       int64_t{4}) != 3) {
+      return false;
+    }
+    Value* logits = match.softmax->input(0);
+    match.masking = SoleProducer(logits, kAdd);
+    match.mask = nullptr;
+    if (match.masking == nullptr) {
+      if (!matchScores(logits, match)) {
+        return false;
+      }
+    } else {
+      for (size_t i = 0; i < 2 && match.mask == nullptr; ++i) {
+        if (matchScores(match.masking->input(i), match)) {
+          match.mask = match.masking->input(1 - i);
+        }
+      }
+      if (match.mask == nullptr) {
+        return false;
+      }
+    }
+
+    // neither the batch nor the head dims may be broadcast
+    const Value* q = match.scores->input(0);
+    const Value* kt = match.scores->input(1);
+    const Value* v = node->input(1);
+    if (!HasRank(q, 4) || !HasRank(kt, 4) || !HasRank(v, 4)) {
+      return false;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      if (!IsSameDim(q->sizes()[i], kt->sizes()[i]) ||
+          !IsSameDim(q->sizes()[i], v->sizes()[i])) {
+        return false;
+      }
+    }
+    if (match.mask != nullptr) {
+      // the mask is broadcast to the scores, not the other way round
+      const Value* mask = match.mask;
+      const auto& scores = match.scores->output()->sizes();
+      if (!mask->has_sizes() || mask->sizes().size() > 4 ||
+          mask->elemType() != q->elemType()) {
+        return false;
+      }
+      const size_t offset = 4 - mask->sizes().size();
+      for (size_t i = 0; i < mask->sizes().size(); ++i) {
+        const Dimension& dim = mask->sizes()[i];
+        if (!(dim.is_int && dim.dim == 1) &&
+            !IsSameDim(dim, scores[offset + i])) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static std::vector<int64_t> fetchPerm(const Node* transpose) {
+    std::vector<int64_t> perm;
+    GetValueFromAttr(transpose, kperm, perm);
+    return perm;
+  }
+
+  // The keys, from their transpose |kt|, computed before |before|.
+  static Value* transposeKeys(Graph& graph, Value* kt, Node* before) {
+    std::vector<int64_t> perm = {0, 1, 3, 2};
+    Value* keys = kt;
+    Node* transpose = SoleProducer(kt, kTranspose);
+    if (transpose != nullptr && fetchPerm(transpose).size() == 4) {
+      perm = fetchPerm(transpose);
+      std::swap(perm[2], perm[3]);
+      keys = transpose->input();
+      before = transpose;
+      if (perm == std::vector<int64_t>{0, 1, 2, 3}) {
+        return keys;
+      }
+    }
+    Node* node = graph.create(kTranspose, 1);
+    node->addInput(keys);
+    node->is_(kperm, std::move(perm));
+    node->insertBefore(before);
+    node->output()->setElemType(kt->elemType());
+    return node->output();
+  }
+
+  // The input of the Reshape and Transpose by |perm| splitting |value| into
+  // heads, and the number of heads, or nullptr.
+  static Value* splitHeads(Value* value, const std::vector<int64_t>& perm,
+                           int64_t& num_heads) {
+    Node* transpose = SoleProducer(value, kTranspose);
+    if (transpose == nullptr || fetchPerm(transpose) != perm) {
+      return nullptr;
+    }
+    Node* reshape = SoleProducer(transpose->input(), kReshape);
+    if (reshape == nullptr) {
+      return nullptr;
+    }
+    Value* input = reshape->input(0);
+    const Value* split = reshape->output();
+    if (!HasRank(input, 3) || !HasRank(split, 4) ||
+        !IsSameDim(input->sizes()[0], split->sizes()[0]) ||
+        !IsSameDim(input->sizes()[1], split->sizes()[1]) ||
+        !split->sizes()[2].is_int) {
+      return nullptr;
+    }
+    num_heads = split->sizes()[2].dim;
+    return input;
+  }
+
+  // The Reshape merging the heads of |value| back after a Transpose, or
+  // nullptr.
+  static Node* mergeHeads(const Value* value) {
+    Node* transpose = SoleUser(value, kTranspose);
+    if (transpose == nullptr ||
+        fetchPerm(transpose) != std::vector<int64_t>{0, 2, 1, 3}) {
+      return nullptr;
+    }
+    Node* reshape = SoleUser(transpose->output(), kReshape);
+    if (reshape == nullptr) {
+      return nullptr;
+    }
+    const Value* input = reshape->input(0);
+    const Value* merged = reshape->output();
+    if (!HasRank(input, 4) || !HasRank(merged, 3) ||
+        !IsSameDim(input->sizes()[0], merged->sizes()[0]) ||
+        !IsSameDim(input->sizes()[1], merged->sizes()[1])) {
+      return nullptr;
+    }
+    return reshape;
+  }
+
+  // The output of an Undefined node before |before|, created there if there
+  // is none, for the omitted inputs of a node inserted before it.
+  static Value* undefinedValue(Graph& graph, Node* before) {
+    for (Node* node : graph.nodes()) {
+      if (node == before) {
+        break;
+      }
+      if (node->kind() == kUndefined) {
+        return node->output();
+      }
+    }
+    Node* node = graph.create(kUndefined, 1);
+    node->insertBefore(before);
+    node->output()->setUniqueName("");
+    return node->output();
+  }
+
+  // The nodes of the pattern that are destroyed once nothing uses them.
+  static const std::vector<NodeKind>& patternKinds() {
+    static const std::vector<NodeKind> kinds = {
+        kMatMul, kSoftmax, kAdd, kMul, kDiv, kTranspose, kReshape};
+    return kinds;
+  }
+
+  // Replaces the pattern by an Attention node, and returns it.
+  static Node* fuseIntoAttention(Graph& graph, const Match& match) {
+    Node* node = match.output;
+    Node* attention = graph.create(Symbol("Attention"), 1);
+    attention->addInput(match.scores->input(0));
+    attention->addInput(transposeKeys(graph, match.scores->input(1), node));
+    attention->addInput(node->input(1));
+    if (match.mask != nullptr) {
+      attention->addInput(match.mask);
+    }
+    attention->f_(kscale, match.scale);
+    attention->insertBefore(node);
+    attention->output()->setElemType(node->output()->elemType());
+    tryReplacingAllUsesWith(node->output(), attention->output());
+    return attention;
+  }
+
+  // Replaces the pattern and the split and merge of its heads by a
+  // MultiHeadAttention node, if they are there, and returns it.
+  static Node* fuseIntoMultiHeadAttention(Graph& graph, const Match& match) {
+    Node* node = match.output;
+    int64_t num_heads = 0, k_heads = 0, v_heads = 0;
+    Value* query = splitHeads(match.scores->input(0), {0, 2, 1, 3}, num_heads);
+    Value* key = splitHeads(match.scores->input(1), {0, 2, 3, 1}, k_heads);
+    Value* value = splitHeads(node->input(1), {0, 2, 1, 3}, v_heads);
+    Node* merge = mergeHeads(node->output());
+    if (query == nullptr || key == nullptr || value == nullptr ||
+        merge == nullptr || num_heads <= 0 || k_heads != num_heads ||
+        v_heads != num_heads ||
+        (match.mask != nullptr && !HasRank(match.mask, 4))) {
+      return nullptr;
+    }
+    Node* attention = graph.create(Symbol("MultiHeadAttention"), 1);
+    attention->setDomain(kMicrosoftDomain);
+    attention->addInput(query);
+    attention->addInput(key);
+    attention->addInput(value);
+    if (match.mask != nullptr) {
+      // no bias of the projections and no key padding mask
+      Value* undefined = undefinedValue(graph, node);
+      attention->addInput(undefined);
+      attention->addInput(undefined);
+      attention->addInput(match.mask);
+    }
+    attention->i_(Symbol("num_heads"), num_heads);
+    attention->f_(kscale, match.scale);
+    attention->insertBefore(node);
+    attention->output()->setElemType(merge->output()->elemType());
+    tryReplacingAllUsesWith(merge->output(), attention->output());
+    AddOpsetImport(graph, kMicrosoftDomain, 1);
+
+    Node* transpose = merge->input(0)->node();
+    const std::vector<Value*> inputs(merge->inputs().begin(),
+                                     merge->inputs().end());
+    merge->destroy();
+    transpose->removeAllInputs();
+    transpose->destroy();
+    DestroyUnused(graph, {inputs[1]}, patternKinds());
+    return attention;
+  }
+
+ public:
+  bool patternMatchPredicate(Node* node) override {
+    return CheckKind(node, kMatMul, 0, kSoftmax) &&
+           getOpsetVersion(*node->owningGraph()) > 0;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Match match;
+    if (!matchAttention(node, match)) {
+      return false;
+    }
+    Node* attention = getOpsetVersion(graph) >= 23
+                          ? fuseIntoAttention(graph, match)
+                          : fuseIntoMultiHeadAttention(graph, match);
+    if (attention == nullptr) {
+      return false;
+    }
+    const std::vector<Value*> inputs(node->inputs().begin(),
+                                     node->inputs().end());
+    node->removeAllInputs();
+    DestroyUnused(graph, inputs, patternKinds());
+    addTouchedNode(attention);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
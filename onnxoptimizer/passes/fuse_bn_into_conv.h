@@ -13,14 +13,15 @@
 //
 // After:
 //	 bn is deleted
-//   new inputs/initializers to conv are added to graph
+//   the weight and bias of conv are replaced by new initializers W' and b'
 //   any no longer used inputs/initializers are erased from graph
 //
 //	 this pass can handle the case satisfy all following conditions:
 //	   condition 1: Run in testing mode
 //     condition 2: Inputs 1 - 4 of bn are all initializer_size
 //     condition 3: Output of initial conv has no other uses
-//     condition 3: Currently works for only DOUBLE, FLOAT32 tensor types
+//     condition 4: Works for FLOAT, DOUBLE, FLOAT16 and BFLOAT16 tensors,
+//                  halves are computed in float
 //
 // Formula for transformation
 // $$ X_{bn} = \frac{s(X - m)}{\sqrt{\sigma + \epsilon}} + b_{bn}$$
@@ -31,13 +32,17 @@
 // $$ W' = W\frac{s}{\sqrt{\sigma + \epsilon}}$$
 // $$ b' = (b_{conv} - m)\frac{s}{\sqrt{\sigma + \epsilon}} + b_{bn}$$
 
+#include <cmath>
+#include <cstring>
+
 #include "onnx/common/assertions.h"
+#include "onnx/common/platform_helpers.h"
 #include "onnxoptimizer/pass.h"
 #include "onnxoptimizer/passes/pass_util.h"
 
 namespace ONNX_NAMESPACE {
 namespace optimization {
-// TODO: Currently broken for complex values and float16
+// TODO: Currently broken for complex values
 struct FuseBNIntoConv final : public PredicateBasedPass {
   explicit FuseBNIntoConv()
       : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
@@ -46,21 +51,79 @@ struct FuseBNIntoConv final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_bn_into_conv";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kBatchNormalization};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kBatchNormalization, kConv};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kBatchNormalization, kConv};
+  }
+
+  template <typename T>
+  static Tensor makeTensor(const Tensor& like, const std::vector<T>& data) {
+    Tensor tensor;
+    tensor.elem_type() = like.elem_type();
+    tensor.sizes() = like.sizes();
+    std::string raw_data(data.size() * sizeof(T), '\0');
+    std::memcpy(&raw_data[0], data.data(), raw_data.size());
+    tensor.set_raw_data(std::move(raw_data));
+    return tensor;
+  }
+
+  // Computes W' and b' into |new_W| and |new_b|. |conv_b| may be nullptr.
+  template <typename T>
+  static void computeFusedWeights(const Tensor& conv_W, const Tensor* conv_b,
+                                  const Tensor& bn_scale,
+                                  const Tensor& bn_bias,
+                                  const Tensor& bn_mean, const Tensor& bn_var,
+                                  float epsilon, Tensor* new_W,
+                                  Tensor* new_b) {
+    using A = Arithmetic<T>;
+    using C = typename A::type;
+    const auto scale = ParseTensorData<T>(&bn_scale);
+    const auto bias = ParseTensorData<T>(&bn_bias);
+    const auto mean = ParseTensorData<T>(&bn_mean);
+    const auto var = ParseTensorData<T>(&bn_var);
+    const TensorView<T> W(&conv_W);
+    const size_t channels = scale.size();
+    const size_t channel_size = W.size() / channels;
+
+    const auto conv_bias =
+        conv_b != nullptr ? ParseTensorData<T>(conv_b) : std::vector<T>{};
+
+    std::vector<T> fused_W(W.size());
+    std::vector<T> fused_b(channels);
+    for (size_t c = 0; c < channels; ++c) {
+      const C factor = A::load(scale[c]) /
+                       std::sqrt(A::load(var[c]) + static_cast<C>(epsilon));
+      // one contiguous loop per output channel
+      const T* src = W.data() + c * channel_size;
+      T* dst = fused_W.data() + c * channel_size;
+      for (size_t i = 0; i < channel_size; ++i) {
+        dst[i] = A::store(A::load(src[i]) * factor);
+      }
+      const C b = conv_bias.empty() ? C{0} : A::load(conv_bias[c]);
+      fused_b[c] = A::store((b - A::load(mean[c])) * factor + A::load(bias[c]));
+    }
+    *new_W = makeTensor(conv_W, fused_W);
+    *new_b = makeTensor(bn_scale, fused_b);
+  }
 
   bool modify_conv(Node* conv, Node* bn, Graph& graph) {
+    // the new initializers are written in the little-endian raw_data layout
+    if (!is_processor_little_endian()) {
+      return false;
+    }
     const auto& bn_inputs = bn->inputs();
     const auto& conv_inputs = conv->inputs();
 
-    auto bn_scale = *FetchConstantTensor(bn_inputs[1]);
-    auto bn_bais = *FetchConstantTensor(bn_inputs[2]);
-    auto bn_mean = *FetchConstantTensor(bn_inputs[3]);
-    auto bn_var = *FetchConstantTensor(bn_inputs[4]);
-    auto conv_W = *FetchConstantTensor(conv_inputs[1]);
-    bn_scale.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
-    bn_bais.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
-    bn_mean.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
-    bn_var.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
-    conv_W.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
+    const Tensor& bn_scale = *FetchConstantTensor(bn_inputs[1]);
+    const Tensor& bn_bais = *FetchConstantTensor(bn_inputs[2]);
+    const Tensor& bn_mean = *FetchConstantTensor(bn_inputs[3]);
+    const Tensor& bn_var = *FetchConstantTensor(bn_inputs[4]);
+    const Tensor& conv_W = *FetchConstantTensor(conv_inputs[1]);
 
     /// scale bais mean var must be the same shape (C)
     ONNX_ASSERT(bn_scale.sizes() == bn_bais.sizes());
@@ -76,106 +139,52 @@ struct FuseBNIntoConv final : public PredicateBasedPass {
       return false;
     }
 
-    Value* conv_bias = nullptr;
+    const Tensor* conv_b = nullptr;
     if (conv_inputs.size() == 3) {
       if (!IsConstantTensor(conv_inputs[2])) {
         return false;
       }
-      auto bc_t = *FetchConstantTensor(conv_inputs[2]);
-      bc_t.setName(ONNX_NAMESPACE::to_string(graph.getNextUnique()));
-      ONNX_ASSERT(bc_t.sizes() == bn_scale.sizes());
-      conv_bias = graph.addInitializerAndCreateValue(bc_t);
-    } else {
-      Tensor bc_t;
-      bc_t.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_FLOAT;
-      bc_t.sizes().push_back(C);
-      for (int i = 0; i < C; ++i) {
-        bc_t.floats().push_back(float{0});
+      conv_b = FetchConstantTensor(conv_inputs[2]);
+      ONNX_ASSERT(conv_b->sizes() == bn_scale.sizes());
+      if (conv_b->elem_type() != conv_W.elem_type()) {
+        return false;
       }
-      conv_bias = graph.addInitializerAndCreateValue(bc_t);
     }
 
-    /// scalar
-    Tensor eps_t;
-    eps_t.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_FLOAT;
-    eps_t.floats().push_back(GetValueFromAttrWithDefault(bn, kepsilon, 1e-5f));
-    Value* eps = graph.addInitializerAndCreateValue(eps_t);
-
-    Node* cast = graph.create(kCast, 1);
-    cast->addInput(eps);
-    cast->i_(kto, bn_var.elem_type());
-    cast->insertBefore(conv);
-
-    Node* var_add = graph.create(kAdd, 1);
-    var_add->insertAfter(cast);
-    var_add->addInput(graph.addInitializerAndCreateValue(bn_var));
-    var_add->addInput(cast->output());
-
-    Node* sqrt = graph.create(kSqrt, 1);
-    sqrt->insertAfter(var_add);
-    sqrt->addInput(var_add->output());
-
-    Node* scale = graph.create(kDiv, 1);
-    scale->insertAfter(sqrt);
-    scale->addInput(graph.addInitializerAndCreateValue(bn_scale));
-    scale->addInput(sqrt->output());
-
-    Node* unsqueeze = graph.create(kUnsqueeze, 1);
-    unsqueeze->insertAfter(scale);
-    unsqueeze->addInput(scale->output());
-    std::vector<int64_t> insert_dims;
-    for (int i = 1; i < conv_W.sizes().size(); ++i) {
-      insert_dims.push_back(i);
-    }
-    if (getOpsetVersion(graph) >= 13) {
-      Tensor shape_s_t;
-      shape_s_t.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_INT64;
-      shape_s_t.sizes().push_back(insert_dims.size());
-      shape_s_t.int64s() = insert_dims;
-      unsqueeze->addInput(graph.addInitializerAndCreateValue(shape_s_t));
-    } else {
-      unsqueeze->is_(kaxes, std::move(insert_dims));
+    const float epsilon = GetValueFromAttrWithDefault(bn, kepsilon, 1e-5f);
+    Tensor new_W, new_b;
+    switch (conv_W.elem_type()) {
+#define CASE_COMPUTE_FUSED_WEIGHTS(pb_type, cpp_type)                         \
+  case TensorProto_DataType_##pb_type:                                        \
+    computeFusedWeights<cpp_type>(conv_W, conv_b, bn_scale, bn_bais, bn_mean, \
+                                  bn_var, epsilon, &new_W, &new_b);           \
+    break;
+
+      CASE_COMPUTE_FUSED_WEIGHTS(FLOAT, float)
+      CASE_COMPUTE_FUSED_WEIGHTS(DOUBLE, double)
+      CASE_COMPUTE_FUSED_WEIGHTS(FLOAT16, Float16)
+      CASE_COMPUTE_FUSED_WEIGHTS(BFLOAT16, BFloat16)
+#undef CASE_COMPUTE_FUSED_WEIGHTS
+
+      default:
+        return false;
     }
 
-    Node* mul_w = graph.create(kMul, 1);
-    mul_w->insertAfter(unsqueeze);
-    mul_w->addInput(graph.addInitializerAndCreateValue(conv_W));
-    mul_w->addInput(unsqueeze->output());
-
-    Node* cast1 = graph.create(kCast, 1);
-    cast1->insertAfter(mul_w);
-    cast1->addInput(conv_bias);
-    cast1->i_(kto, bn_mean.elem_type());
-
-    Node* sub = graph.create(kSub, 1);
-    sub->insertAfter(cast1);
-    sub->addInput(cast1->output());
-    sub->addInput(graph.addInitializerAndCreateValue(bn_mean));
-
-    Node* mul = graph.create(kMul, 1);
-    mul->insertAfter(sub);
-    mul->addInput(sub->output());
-    mul->addInput(scale->output());
-
-    Node* bias_add = graph.create(kAdd, 1);
-    bias_add->insertAfter(mul);
-    bias_add->addInput(mul->output());
-    bias_add->addInput(graph.addInitializerAndCreateValue(bn_bais));
-
     Value* old_w_value = conv_inputs[1];
-    conv->replaceInput(1, mul_w->output());
+    conv->replaceInput(1, graph.addInitializerAndCreateValue(new_W));
     if (old_w_value->uses().size() == 0) {
       graph.eraseInitializerAndInput(old_w_value);
     }
 
+    Value* new_b_value = graph.addInitializerAndCreateValue(new_b);
     if (conv_inputs.size() == 3) {
       Value* old_b_value = conv_inputs[2];
-      conv->replaceInput(2, bias_add->output());
+      conv->replaceInput(2, new_b_value);
       if (old_b_value->uses().size() == 0) {
         graph.eraseInitializerAndInput(old_b_value);
       }
     } else {
-      conv->addInput(bias_add->output());
+      conv->addInput(new_b_value);
     }
     return true;
   }
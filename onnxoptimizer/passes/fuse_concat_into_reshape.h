@@ -31,6 +31,15 @@ struct FuseConcatIntoReshape final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_concat_into_reshape";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kReshape};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kReshape, kConcat, kCast};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kReshape, kConcat, kCast};
+  }
 
   inline bool matchConcatReshape(Node *node) {
     return CheckKind(node, kReshape, 1, kConcat) &&
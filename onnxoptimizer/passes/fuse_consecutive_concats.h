@@ -20,6 +20,12 @@ struct FuseConsecutiveConcats final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_concats";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kConcat};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kConcat};
+  }
 
   void insertInput(Node* node, size_t i, Value* value) {
     const auto input_size = node->inputs().size();
@@ -21,6 +21,15 @@ struct FuseConsecutiveLogSoftmax final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_log_softmax";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kLog};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kLog, kSoftmax, kLogSoftmax};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kLog, kSoftmax};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, kLog, 0, kSoftmax) &&
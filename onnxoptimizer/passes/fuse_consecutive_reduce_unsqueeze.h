@@ -27,6 +27,18 @@ struct FuseConsecutiveReduceUnsqueeze final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_reduce_unsqueeze";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kUnsqueeze};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return getConsumedKinds();
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    std::vector<NodeKind> kinds(reduction_operators.begin(),
+                                reduction_operators.end());
+    kinds.push_back(kUnsqueeze);
+    return kinds;
+  }
 
   bool patternMatchPredicate(Node *node) override {
     // check that the current node is of type Unsqueeze and has defined axes
@@ -23,6 +23,12 @@ struct FuseConsecutiveSlices final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_slices";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kSlice};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kSlice, kConcat};
+  }
 
   bool patternMatchPredicate(Node *node) override {
     std::vector<int64_t> slice1_axes, slice2_axes;
@@ -28,6 +28,12 @@ struct FuseConsecutiveSqueezes final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_squeezes";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kSqueeze};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kSqueeze, kConstant};
+  }
   static bool IsAxesAnAttr(const Graph &graph) {
     const int opset_version = getOpsetVersion(graph);
     return opset_version <= 12 && opset_version != 0;
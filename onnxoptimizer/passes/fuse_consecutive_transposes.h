@@ -20,6 +20,9 @@ struct FuseConsecutiveTransposes final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_transposes";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kTranspose};
+  }
 
   // returns a vector `ret` such that transposing by `ret` is equivalent
   // to transposing by `t1` and then by `t2`
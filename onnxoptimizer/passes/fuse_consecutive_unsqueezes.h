@@ -23,6 +23,12 @@ struct FuseConsecutiveUnsqueezes final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_consecutive_unsqueezes";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kUnsqueeze};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kUnsqueeze};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, kUnsqueeze, 0, kUnsqueeze) &&
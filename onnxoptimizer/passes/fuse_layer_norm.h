@@ -0,0 +1,419 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before fuse_layer_norm:
+//   X is a tensor with shape=[batch, seq, hidden]
+//   D = Sub(X, ReduceMean(X, axes=[-1]))
+//   V = ReduceMean(Pow(D, 2), axes=[-1])
+//   Y = Add(Mul(Div(D, Sqrt(Add(V, epsilon))), gamma), beta)
+// After:
+//   Y = LayerNormalization(X, gamma, beta, axis=-1, epsilon=epsilon)
+//
+// Before fuse_rms_norm:
+//   V = ReduceMean(Pow(X, 2), axes=[-1])
+//   Y = Mul(Div(X, Sqrt(Add(V, epsilon))), gamma)
+// After:
+//   Y = RMSNormalization(X, gamma, axis=-1, epsilon=epsilon)
+//
+// Before fuse_skip_layer_norm:
+//   S = Add(X, R)
+//   Y = LayerNormalization(S, gamma, beta, axis=-1)
+// After:
+//   Y, , , S = com.microsoft.SkipLayerNormalization(X, R, gamma, beta)
+//
+// The normalizations that exports for older opsets decompose are put back
+// together. The square can also be a Mul of the tensor by itself, and the
+// division by the root a Mul by its Reciprocal. The bias of a layer
+// normalization is optional, its scale is not, and both must be constants
+// of the shape of the normalized dims. LayerNormalization needs opset 17 and
+// RMSNormalization opset 23; with an earlier opset, an RMS normalization is
+// fused into the SimplifiedLayerNormalization of onnxruntime, which it
+// registers in the default domain. fuse_skip_layer_norm fuses the residual
+// Add of 3-D tensors before a normalization of their last dim into
+// SkipLayerNormalization or SkipSimplifiedLayerNormalization. The sum stays
+// available to the other users of the Add as an output of the fused node.
+//
+// fuse_rms_norm and fuse_skip_layer_norm may create ops of onnxruntime, so
+// they are not run by default, pass them by name.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// What the passes fusing normalizations share.
+class NormalizationFusion : public PredicateBasedPass {
+ public:
+  explicit NormalizationFusion(PassType pass_type)
+      : PredicateBasedPass(pass_type, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+  // The predicates look at every node of the decomposed normalizations.
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return patternKinds();
+  }
+
+ protected:
+  // Whether |value| is the square of |x|, computed for it only.
+  static bool isSquareOf(Value* value, const Value* x) {
+    float exponent;
+    if (Node* pow = SoleProducer(value, kPow)) {
+      return pow->input(0) == x && FetchScalar(pow->input(1), exponent) &&
+             exponent == 2.0f;
+    }
+    Node* mul = SoleProducer(value, kMul);
+    return mul != nullptr && mul->input(0) == x && mul->input(1) == x;
+  }
+
+  // Whether |value| is the mean of |x| over its last dims, computed for it
+  // only, and the first of those dims.
+  static bool isMeanOf(Value* value, const Value* x, int64_t& axis) {
+    Node* mean = SoleProducer(value, kReduceMean);
+    std::vector<int64_t> axes;
+    if (mean == nullptr || mean->input(0) != x || !x->has_sizes() ||
+        GetValueFromAttrWithDefault(mean, kkeepdims, int64_t{1}) != 1 ||
+        !GetValueFromAttrOrInput(mean, kaxes, 1, axes) || axes.empty()) {
+      return false;
+    }
+    const int64_t rank = x->sizes().size();
+    for (auto& a : axes) {
+      a = AddYIfNegative(a, rank);
+    }
+    std::sort(axes.begin(), axes.end());
+    axis = rank - static_cast<int64_t>(axes.size());
+    for (size_t i = 0; i < axes.size(); ++i) {
+      if (axes[i] != axis + static_cast<int64_t>(i)) {
+        return false;
+      }
+    }
+    return axis >= 0;
+  }
+
+  // Whether |value| is Sqrt(Add(V, epsilon)), computed for it only, and V
+  // and epsilon.
+  static bool isRootOf(Value* value, Value*& variance, float& epsilon) {
+    Node* sqrt = SoleProducer(value, kSqrt);
+    Node* add = sqrt == nullptr ? nullptr : SoleProducer(sqrt->input(), kAdd);
+    if (add == nullptr) {
+      return false;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      if (FetchScalar(add->input(i), epsilon)) {
+        variance = add->input(1 - i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether |value| is a constant of the shape of the dims of |x| from
+  // |axis| on, and of its elem type.
+  static bool isParameterOf(const Value* value, const Value* x,
+                            int64_t axis) {
+    const Tensor* tensor = FetchConstantTensor(value);
+    if (tensor == nullptr || !x->has_sizes() ||
+        tensor->elem_type() != x->elemType() ||
+        tensor->sizes().size() != x->sizes().size() - axis) {
+      return false;
+    }
+    for (size_t i = 0; i < tensor->sizes().size(); ++i) {
+      const Dimension& dim = x->sizes()[axis + i];
+      if (!dim.is_int || dim.dim != tensor->sizes()[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The nodes of the patterns that are destroyed once nothing uses them.
+  static const std::vector<NodeKind>& patternKinds() {
+    static const std::vector<NodeKind> kinds = {
+        kReduceMean, kSub, kPow,  kMul,
+        kAdd,        kDiv, kSqrt, Symbol("Reciprocal")};
+    return kinds;
+  }
+
+  // Makes |fused| compute the output of the last of |after|, the nodes
+  // applying the constant parameters to the output of |node| in turn, or else
+  // of |node|, in its place, after the Constants computing the parameters.
+  // Then destroys them, |node| and what computed it for it only.
+  void replace(Graph& graph, Node* node, const std::vector<Node*>& after,
+               Node* fused, NodeDestroyType& destroy_current) {
+    Node* last = after.empty() ? node : after.back();
+    Value* output = last->output();
+    fused->insertBefore(last);
+    fused->output()->setElemType(output->elemType());
+    tryReplacingAllUsesWith(output, fused->output());
+    for (auto it = after.rbegin(); it != after.rend(); ++it) {
+      (*it)->destroy();
+    }
+    const std::vector<Value*> inputs(node->inputs().begin(),
+                                     node->inputs().end());
+    node->removeAllInputs();
+    DestroyUnused(graph, inputs, patternKinds());
+    addTouchedNode(fused);
+    destroy_current = NodeDestroyType::DestroyOne;
+  }
+};
+
+struct FuseLayerNorm final : public NormalizationFusion {
+  FuseLayerNorm() : NormalizationFusion(PassType::Fuse) {}
+  std::string getPassName() const override {
+    return "fuse_layer_norm";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kDiv};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("LayerNormalization")};
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return CheckKind(node, kDiv, 0, kSub) && IsDefaultDomain(node) &&
+           getOpsetVersion(*node->owningGraph()) >= 17;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    // Div(Sub(X, mean), Sqrt(Add(ReduceMean(Pow(D, 2)), epsilon)))
+    Value* deviation = node->input(0);
+    Node* sub = deviation->node();
+    Value* x = sub->input(0);
+    Value* variance = nullptr;
+    float epsilon;
+    int64_t axis, variance_axis;
+    if (!IsDefaultDomain(sub) || !isMeanOf(sub->input(1), x, axis) ||
+        !isRootOf(node->input(1), variance, epsilon)) {
+      return false;
+    }
+    Node* mean = SoleProducer(variance, kReduceMean);
+    if (mean == nullptr || !isSquareOf(mean->input(0), deviation) ||
+        !isMeanOf(variance, mean->input(0), variance_axis) ||
+        variance_axis != axis || !deviation->has_sizes() ||
+        deviation->sizes().size() != x->sizes().size()) {
+      return false;
+    }
+    // the deviation is only used by its square and the Div
+    const Node* square = mean->input(0)->node();
+    const auto uses = deviation->uses();
+    if (std::any_of(uses.begin(), uses.end(), [&](const Use& use) {
+          return use.user != node && use.user != square;
+        })) {
+      return false;
+    }
+
+    Node* mul = SoleUser(node->output(), kMul);
+    if (mul == nullptr) {
+      return false;
+    }
+    Value* gamma = mul->input(mul->input(0) == node->output() ? 1 : 0);
+    if (!isParameterOf(gamma, x, axis)) {
+      return false;
+    }
+    std::vector<Node*> after = {mul};
+    Value* beta = nullptr;
+    if (Node* add = SoleUser(mul->output(), kAdd)) {
+      Value* bias = add->input(add->input(0) == mul->output() ? 1 : 0);
+      if (isParameterOf(bias, x, axis)) {
+        beta = bias;
+        after.push_back(add);
+      }
+    }
+
+    Node* norm = graph.create(Symbol("LayerNormalization"), 1);
+    norm->addInput(x);
+    norm->addInput(gamma);
+    if (beta != nullptr) {
+      norm->addInput(beta);
+    }
+    norm->i_(kaxis, axis);
+    norm->f_(kepsilon, epsilon);
+    replace(graph, node, after, norm, destroy_current);
+    return true;
+  }
+};
+
+struct FuseRMSNorm final : public NormalizationFusion {
+  FuseRMSNorm() : NormalizationFusion(PassType::Replace) {}
+  std::string getPassName() const override {
+    return "fuse_rms_norm";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kMul};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("RMSNormalization"),
+            Symbol("SimplifiedLayerNormalization")};
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return CheckKind(node, kMul) && IsDefaultDomain(node) &&
+           getOpsetVersion(*node->owningGraph()) > 0;
+  }
+
+  // Whether |value| is X divided by the root of the mean of its square.
+  static bool isNormalized(Value* value, Value*& x, int64_t& axis,
+                           float& epsilon) {
+    Value* root = nullptr;
+    if (Node* div = SoleProducer(value, kDiv)) {
+      x = div->input(0);
+      root = div->input(1);
+    } else if (Node* mul = SoleProducer(value, kMul)) {
+      for (size_t i = 0; i < 2 && root == nullptr; ++i) {
+        if (Node* reciprocal =
+                SoleProducer(mul->input(i), Symbol("Reciprocal"))) {
+          x = mul->input(1 - i);
+          root = reciprocal->input();
+        }
+      }
+    }
+    Value* variance = nullptr;
+    if (root == nullptr || !isRootOf(root, variance, epsilon)) {
+      return false;
+    }
+    // the mean is over the dims of X
+    Node* mean = SoleProducer(variance, kReduceMean);
+    return mean != nullptr && isSquareOf(mean->input(0), x) &&
+           isMeanOf(variance, mean->input(0), axis) && x->has_sizes() &&
+           x->sizes().size() == mean->input(0)->sizes().size();
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    for (size_t i = 0; i < 2; ++i) {
+      Value* x = nullptr;
+      int64_t axis;
+      float epsilon;
+      Value* gamma = node->input(i);
+      if (!isNormalized(node->input(1 - i), x, axis, epsilon) ||
+          !isParameterOf(gamma, x, axis)) {
+        continue;
+      }
+      const bool has_rms_norm = getOpsetVersion(graph) >= 23;
+      Node* norm = graph.create(Symbol(has_rms_norm
+                                           ? "RMSNormalization"
+                                           : "SimplifiedLayerNormalization"),
+                                1);
+      norm->addInput(x);
+      norm->addInput(gamma);
+      norm->i_(kaxis, axis);
+      norm->f_(kepsilon, epsilon);
+      replace(graph, node, {}, norm, destroy_current);
+      return true;
+    }
+    return false;
+  }
+};
+
+struct FuseSkipLayerNorm final : public NormalizationFusion {
+  FuseSkipLayerNorm() : NormalizationFusion(PassType::Replace) {}
+  std::string getPassName() const override {
+    return "fuse_skip_layer_norm";
+  }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("LayerNormalization"), Symbol("RMSNormalization"),
+            Symbol("SimplifiedLayerNormalization")};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("SkipLayerNormalization"),
+            Symbol("SkipSimplifiedLayerNormalization")};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {Symbol("LayerNormalization"), Symbol("RMSNormalization"),
+            Symbol("SimplifiedLayerNormalization"), kAdd};
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return (CheckKind(node, "LayerNormalization", 0, kAdd) ||
+            CheckKind(node, "RMSNormalization", 0, kAdd) ||
+            CheckKind(node, "SimplifiedLayerNormalization", 0, kAdd)) &&
+           IsDefaultDomain(node) && node->outputs().size() == 1 &&
+           getOpsetVersion(*node->owningGraph()) > 0;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    Node* add = node->input(0)->node();
+    Value* input = add->input(0);
+    Value* skip = add->input(1);
+    // neither is broadcast
+    if (!IsDefaultDomain(add) || !input->has_sizes() || !skip->has_sizes() ||
+        input->sizes().size() != 3 || skip->sizes().size() != 3) {
+      return false;
+    }
+    for (size_t i = 0; i < 3; ++i) {
+      if (!IsSameDim(input->sizes()[i], skip->sizes()[i])) {
+        return false;
+      }
+    }
+    if (AddYIfNegative(GetValueFromAttrWithDefault(node, kaxis, int64_t{-1}),
+                       int64_t{3}) != 2 ||
+        GetValueFromAttrWithDefault(node, Symbol("stash_type"), int64_t{1}) !=
+            1) {
+      return false;
+    }
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      if (node->input(i)->node()->kind() != kUndefined &&
+          !HasRank(node->input(i), 1)) {
+        return false;
+      }
+    }
+
+    // the other users of the sum take it from the fused node, which is then
+    // computed where the sum was, and so must its scale and bias be
+    const bool sum_is_used = add->output()->uses().size() > 1;
+    for (size_t i = 1; sum_is_used && i < node->inputs().size(); ++i) {
+      const auto kind = node->input(i)->node()->kind();
+      if (kind != kParam && kind != kUndefined) {
+        return false;
+      }
+    }
+
+    const bool is_layer_norm = node->kind() == Symbol("LayerNormalization");
+    Node* fused = graph.create(Symbol(is_layer_norm
+                                          ? "SkipLayerNormalization"
+                                          : "SkipSimplifiedLayerNormalization"),
+                               sum_is_used ? 4 : 1);
+    fused->setDomain(kMicrosoftDomain);
+    fused->addInput(input);
+    fused->addInput(skip);
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      fused->addInput(node->input(i));
+    }
+    fused->f_(kepsilon,
+              GetValueFromAttrWithDefault(node, kepsilon, 1e-5f));
+    if (sum_is_used) {
+      fused->insertAfter(add);
+    } else {
+      fused->insertBefore(node);
+    }
+    fused->outputs()[0]->setElemType(node->output()->elemType());
+    tryReplacingAllUsesWith(node->output(), fused->outputs()[0]);
+    node->removeAllInputs();
+    if (sum_is_used) {
+      fused->outputs()[3]->setElemType(add->output()->elemType());
+      tryReplacingAllUsesWith(add->output(), fused->outputs()[3]);
+    }
+    add->destroy();
+    AddOpsetImport(graph, kMicrosoftDomain, 1);
+    addTouchedNode(fused);
+    destroy_current = NodeDestroyType::DestroyOne;
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -34,6 +34,15 @@ struct FuseMatMulAddBiasIntoGemm final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_matmul_add_bias_into_gemm";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kAdd};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kAdd, kMatMul, kGemm};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kAdd, kMatMul};
+  }
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, kAdd, 0, kMatMul);
   }
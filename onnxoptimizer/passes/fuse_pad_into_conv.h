@@ -32,6 +32,15 @@ struct FusePadIntoConv final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_pad_into_conv";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kConv};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kConv, kPad};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kConv, kPad};
+  }
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, kConv, 0, kPad);
   }
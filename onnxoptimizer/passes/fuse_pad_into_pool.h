@@ -32,6 +32,15 @@ struct FusePadIntoPool final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_pad_into_pool";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("AveragePool"), Symbol("MaxPool")};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("AveragePool"), Symbol("MaxPool"), kPad};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {Symbol("AveragePool"), Symbol("MaxPool"), kPad};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, "AveragePool", 0, kPad) ||
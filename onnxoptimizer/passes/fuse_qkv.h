@@ -7,10 +7,29 @@
 
 #pragma once
 
-#include <numeric>
+// Before:
+//   X is a tensor with shape=[batch, seq, 4096]
+//   Q = Add(MatMul(X, Wq), Bq)   Wq has shape=[4096, 4096]
+//   K = Add(MatMul(X, Wk), Bk)   Wk has shape=[4096, 1024]
+//   V = Add(MatMul(X, Wv), Bv)   Wv has shape=[4096, 1024]
+// After:
+//   W = Concat(Wq, Wk, Wv, axis=-1), computed here, shape=[4096, 6144]
+//   B = Concat(Bq, Bk, Bv)
+//   Q, K, V = Split(Add(MatMul(X, W), B), [4096, 1024, 1024], axis=-1)
+//
+// The projections of a tensor by constant weights, e.g. the query, key and
+// value projections of an attention layer, are computed by a single MatMul.
+// They can be MatMuls, with or without an Add of a 1-D bias, or Gemms with
+// the same alpha, beta and transB, with or without a 1-D bias, and project
+// into different sizes, like the smaller key and value projections of
+// grouped-query attention. The weights and biases are concatenated at
+// optimization time.
+
+#include <string>
+#include <vector>
 
-#include "onnx/defs/tensor_util.h"
 #include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/fold_kernels.h"
 #include "onnxoptimizer/passes/pass_util.h"
 
 namespace ONNX_NAMESPACE {
@@ -23,71 +42,213 @@ struct FuseQKV final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_qkv";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kMatMul, kGemm};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kMatMul, kGemm, kAdd, Symbol("Split")};
+  }
+  // The uses of the input can change whenever a node anywhere is rewired.
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {};
+  }
+
+  // A MatMul or a Gemm of the input by constant weights, and its bias.
+  struct Projection {
+    Node* node = nullptr;
+    // the Add of the bias to the output of a MatMul
+    Node* add = nullptr;
+    const Tensor* weight = nullptr;
+    Value* weight_value = nullptr;
+    const Tensor* bias = nullptr;
+    Value* bias_value = nullptr;
+    int64_t transB = 0;
+    float alpha = 1.0f;
+    float beta = 1.0f;
+
+    Value* output() const {
+      return add != nullptr ? add->output() : node->output();
+    }
+    int64_t inputSize() const {
+      return weight->sizes()[transB ? 1 : 0];
+    }
+    int64_t outputSize() const {
+      return weight->sizes()[transB ? 0 : 1];
+    }
+
+    // Whether the projection can be computed together with |other|.
+    bool isCompatibleWith(const Projection& other) const {
+      return node->kind() == other.node->kind() &&
+             inputSize() == other.inputSize() &&
+             weight->elem_type() == other.weight->elem_type() &&
+             (bias == nullptr) == (other.bias == nullptr) &&
+             (bias == nullptr ||
+              bias->elem_type() == other.bias->elem_type()) &&
+             transB == other.transB && alpha == other.alpha &&
+             beta == other.beta;
+    }
+  };
+
+  // A constant 1-D bias of |size| elements, or nullptr.
+  static const Tensor* fetchBias(const Value* value, int64_t size) {
+    const Tensor* tensor = FetchConstantTensor(value);
+    if (tensor == nullptr || tensor->sizes().size() != 1 ||
+        tensor->sizes()[0] != size) {
+      return nullptr;
+    }
+    return tensor;
+  }
+
+  static bool matchProjection(Node* node, Projection& projection) {
+    if (!IsDefaultDomain(node) || node->outputs().size() != 1 ||
+        node->inputs().size() < 2) {
+      return false;
+    }
+    projection = Projection();
+    projection.node = node;
+    projection.weight_value = node->input(1);
+    projection.weight = FetchConstantTensor(node->input(1));
+    if (projection.weight == nullptr ||
+        projection.weight->sizes().size() != 2) {
+      return false;
+    }
+    if (node->kind() == kGemm) {
+      if (GetValueFromAttrWithDefault(node, ktransA, int64_t{0}) != 0) {
+        return false;
+      }
+      projection.transB =
+          GetValueFromAttrWithDefault(node, ktransB, int64_t{0});
+      projection.alpha = GetValueFromAttrWithDefault(node, kalpha, 1.0f);
+      projection.beta = GetValueFromAttrWithDefault(node, kbeta, 1.0f);
+      if (node->inputs().size() > 2 &&
+          node->input(2)->node()->kind() != kUndefined) {
+        projection.bias_value = node->input(2);
+        projection.bias =
+            fetchBias(projection.bias_value, projection.outputSize());
+        return projection.bias != nullptr;
+      }
+      return true;
+    }
+    if (node->kind() != kMatMul) {
+      return false;
+    }
+    const auto uses = node->output()->uses();
+    if (uses.size() != 1) {
+      return true;
+    }
+    Node* add = uses[0].user;
+    if (!CheckKind(add, kAdd) || !IsDefaultDomain(add)) {
+      return true;
+    }
+    Value* bias_value = add->input(1 - uses[0].offset);
+    const Tensor* bias = fetchBias(bias_value, projection.outputSize());
+    if (bias != nullptr) {
+      projection.add = add;
+      projection.bias = bias;
+      projection.bias_value = bias_value;
+    }
+    return true;
+  }
 
   bool patternMatchPredicate(Node* node) override {
-    return CheckKind(node, kMatMul) && node->input(0)->uses().size() == 3;
+    return (CheckKind(node, kMatMul) || CheckKind(node, kGemm)) &&
+           IsConstantTensor(node, 1) && node->input(0)->uses().size() >= 2;
   }
 
   bool runTransform(Node* n, Graph& graph,
                     NodeDestroyType& destroy_current) override {
     destroy_current = NodeDestroyType::DestroyZero;
-    const auto uses = n->input(0)->uses();
+    Projection root;
+    if (!matchProjection(n, root)) {
+      return false;
+    }
+    Value* input = n->input(0);
+    std::vector<Projection> projections;
+    const auto uses = input->uses();
     for (const auto& use : uses) {
-      if (use.offset != 0 || !CheckKind(use.user, kMatMul) ||
-          use.user->output()->uses().size() != 1 ||
-          !IsConstantTensor(use.user, 1)) {
-        return false;
+      Projection projection;
+      if (use.offset == 0 && (use.user == n || use.user->kind() == n->kind()) &&
+          matchProjection(use.user, projection) &&
+          projection.isCompatibleWith(root)) {
+        projections.push_back(projection);
       }
     }
-    /// q k v not a one-to-one correspondence actually
-    Node* q = uses[0].user;
-    Node* k = uses[1].user;
-    Node* v = uses[2].user;
+    if (projections.size() < 2) {
+      return false;
+    }
 
-    const Tensor* q_t = FetchConstantTensor(q->input(1));
-    const Tensor* k_t = FetchConstantTensor(k->input(1));
-    const Tensor* v_t = FetchConstantTensor(v->input(1));
-    if (q_t->sizes() != k_t->sizes() || q_t->sizes() != v_t->sizes()) {
+    std::vector<const Tensor*> weights, biases;
+    std::vector<int64_t> split_sizes;
+    for (const auto& projection : projections) {
+      weights.push_back(projection.weight);
+      biases.push_back(projection.bias);
+      split_sizes.push_back(projection.outputSize());
+    }
+    Tensor weight, bias;
+    if (!ConcatTensors(weights, root.transB ? 0 : 1, &weight) ||
+        (root.bias != nullptr && !ConcatTensors(biases, 0, &bias))) {
       return false;
     }
-    Node* prev = PrevNode(n, 0);
-    Node* cat = graph.create(kConcat, 1);
-    cat->insertAfter(prev);
-    cat->addInput(q->input(1));
-    cat->addInput(k->input(1));
-    cat->addInput(v->input(1));
-    cat->i_(kaxis, q_t->sizes().size() - 1);
-    Node* matmul = graph.create(kMatMul, 1);
-    matmul->insertAfter(cat);
-    matmul->addInput(q->input(0));
-    matmul->addInput(cat->output());
-
-    Node* split = graph.create("Split"_sym, 3);
+
+    Node* fused = graph.create(n->kind(), 1);
+    fused->copyAttributes(*n);
+    fused->addInput(input);
+    fused->addInput(graph.addInitializerAndCreateValue(weight));
+    const auto producer = input->node()->kind();
+    if (producer == kParam || producer == kCaptured) {
+      fused->insertBefore(*graph.nodes().begin());
+    } else {
+      fused->insertAfter(input->node());
+    }
+    fused->output()->setElemType(n->output()->elemType());
+    Node* last = fused;
+    if (root.bias != nullptr) {
+      Value* bias_value = graph.addInitializerAndCreateValue(bias);
+      if (n->kind() == kGemm) {
+        fused->addInput(bias_value);
+      } else {
+        Node* add = graph.create(kAdd, 1);
+        add->addInput(fused->output());
+        add->addInput(bias_value);
+        add->insertAfter(fused);
+        add->output()->setElemType(root.output()->elemType());
+        last = add;
+      }
+    }
+
+    Node* split = graph.create(Symbol("Split"), projections.size());
     split->i_(kaxis, -1);
-    split->insertAfter(matmul);
-    split->addInput(matmul->output());
-    const auto opset_version = getOpsetVersion(graph);
-    if (opset_version >= 13) {
+    split->addInput(last->output());
+    if (getOpsetVersion(graph) >= 13) {
       Tensor split_t;
-      split_t.sizes().push_back(3);
-      split_t.elem_type() = ONNX_NAMESPACE::TensorProto_DataType_INT64;
-      split_t.int64s().push_back(q_t->sizes().back());
-      split_t.int64s().push_back(k_t->sizes().back());
-      split_t.int64s().push_back(v_t->sizes().back());
+      split_t.sizes().push_back(split_sizes.size());
+      split_t.elem_type() = TensorProto_DataType_INT64;
+      split_t.int64s() = split_sizes;
       split->addInput(graph.addInitializerAndCreateValue(split_t));
     } else {
-      split->is_(ksplit,
-                 std::vector<int64_t>{q_t->sizes().back(), k_t->sizes().back(),
-                                      v_t->sizes().back()});
-    }
-    if (!tryReplacingAllUsesWith(q->output(), split->outputs()[0])) {
-      return false;
-    }
-    if (!tryReplacingAllUsesWith(k->output(), split->outputs()[1])) {
-      return false;
+      split->is_(ksplit, std::move(split_sizes));
     }
-    if (!tryReplacingAllUsesWith(v->output(), split->outputs()[2])) {
-      return false;
+    split->insertAfter(last);
+    addTouchedNode(split);
+
+    for (size_t i = 0; i < projections.size(); ++i) {
+      const Projection& projection = projections[i];
+      // |split| is never an input or an output of the graph
+      tryReplacingAllUsesWith(projection.output(), split->outputs()[i]);
+      if (projection.add != nullptr) {
+        projection.add->destroy();
+      }
+      if (projection.node == n) {
+        n->removeAllInputs();
+      } else {
+        projection.node->destroy();
+      }
+      for (Value* value : {projection.weight_value, projection.bias_value}) {
+        if (value != nullptr && value->uses().empty() &&
+            graph.is_constant_initializer(value)) {
+          graph.eraseInitializerAndInput(value);
+        }
+      }
     }
     destroy_current = NodeDestroyType::DestroyOne;
     return true;
@@ -0,0 +1,110 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   X is a tensor with shape=[batch, seq, 768]
+//   S = Shape(X)
+//   B = Unsqueeze(Gather(S, 0), [0])
+//   L = Unsqueeze(Gather(S, 1), [0])
+//   Y = Reshape(X, Concat(B, L, [12], [64]))
+// After:
+//   Y = Reshape(X, [0, 0, 12, 64])
+//
+// The shape a Reshape is computed from the shape of a tensor with dynamic
+// dims is constant if what it computes can be written with 0s, which copy the
+// dims of the input of the Reshape, and a single -1, which stands for what
+// is left of its size. The dims are evaluated symbolically, see
+// symbolic_shape.h, so a Reshape(X, [batch * seq, 768]) becomes a
+// Reshape(X, [-1, 768]) too. The shape computation is removed if nothing else
+// uses it.
+
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/pass_util.h"
+#include "onnxoptimizer/passes/symbolic_shape.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct FuseShapeComputationIntoReshape final : public PredicateBasedPass {
+  explicit FuseShapeComputationIntoReshape()
+      : PredicateBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "fuse_shape_computation_into_reshape";
+  }
+
+  bool patternMatchPredicate(Node* node) override {
+    return CheckKind(node, kReshape) && node->inputs().size() == 2 &&
+           !IsConstantTensor(node, 1) &&
+           getOpsetVersion(*node->owningGraph()) >= 5;
+  }
+
+  bool runTransform(Node* node, Graph& graph,
+                    NodeDestroyType& destroy_current) override {
+    destroy_current = NodeDestroyType::DestroyZero;
+    SymbolicTensor target;
+    SymbolicShapeEvaluator evaluator;
+    if (!evaluator.evaluate(node->input(1), target) || target.is_scalar) {
+      return false;
+    }
+    const bool allowzero =
+        GetValueFromAttrWithDefault(node, Symbol("allowzero"), int64_t{0});
+    const Value* data = node->input(0);
+    const size_t rank = data->has_sizes() ? data->sizes().size() : 0;
+
+    std::vector<int64_t> shape;
+    bool has_inferred_dim = false;
+    for (size_t i = 0; i < target.elements.size(); ++i) {
+      const auto& element = target.elements[i];
+      if (element.isConstant()) {
+        // a -1 or a 0 given by the model means the same here
+        if (element.coefficient < -1 ||
+            (element.coefficient == -1 && has_inferred_dim)) {
+          return false;
+        }
+        has_inferred_dim |= element.coefficient == -1;
+        shape.push_back(element.coefficient);
+        continue;
+      }
+      SymbolicDim input_dim;
+      if (!allowzero && i < rank && SymbolicDim::of(data, i, input_dim) &&
+          input_dim == element) {
+        shape.push_back(0);
+      } else if (!has_inferred_dim) {
+        has_inferred_dim = true;
+        shape.push_back(-1);
+      } else {
+        return false;
+      }
+    }
+    // a dim of 0 may not be inferred by a -1
+    if (has_inferred_dim && allowzero &&
+        std::find(shape.begin(), shape.end(), 0) != shape.end()) {
+      return false;
+    }
+
+    Tensor t;
+    t.elem_type() = TensorProto_DataType_INT64;
+    t.sizes().push_back(shape.size());
+    t.int64s() = shape;
+    Value* shape_value = node->input(1);
+    node->replaceInput(1, graph.addInitializerAndCreateValue(t));
+    DestroyUnused(graph, {shape_value}, [](const Node* n) {
+      return SymbolicShapeEvaluator::isShapeComputation(n->kind());
+    });
+    return true;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
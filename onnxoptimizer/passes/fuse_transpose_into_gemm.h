@@ -19,6 +19,15 @@ struct FuseTransposeIntoGemm final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "fuse_transpose_into_gemm";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {kGemm};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {kGemm, kTranspose};
+  }
+  std::vector<NodeKind> getConsumedKinds() const override {
+    return {kGemm, kTranspose};
+  }
   bool patternMatchPredicate(Node* node) override {
     return node->kind() == kGemm;
   }
@@ -0,0 +1,228 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   Y = Loop(M, cond, V) body {
+//     S = Constant()
+//     R = Reshape(W, S)
+//     v_out = MatMul(v_in, R)
+//   }
+// After:
+//   S = Constant()
+//   R = Reshape(W, S)
+//   Y = Loop(M, cond, V) body {
+//     v_out = MatMul(v_in, R)
+//   }
+//
+// A node of a Loop or Scan body is loop invariant if all its inputs are
+// values of the enclosing graphs, initializers of the body or outputs of
+// loop invariant nodes. Such a node computes the same in every iteration,
+// so it is moved in front of the loop and computed once. Nodes holding
+// subgraphs and nondeterministic nodes are left alone, and so are the nodes
+// computing outputs of the body, which have to be defined in it.
+//
+// Note that a moved node runs even if the loop runs no iteration, so a loop
+// that is skipped may fail on it, e.g. on a Reshape to a shape that only fits
+// when the loop runs, or spend time on it. The pass is not run by default,
+// pass it by name.
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/logging.h"
+#include "onnxoptimizer/passes/pass_util.h"
+#include "onnxoptimizer/passes/string_utils.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct HoistLoopInvariants final : public FullGraphBasedPass {
+  explicit HoistLoopInvariants()
+      : FullGraphBasedPass(PassType::Separate, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "hoist_loop_invariants";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  static bool isNondeterministic(const Node* node) {
+    static const std::unordered_set<std::string> kinds = {
+        "Bernoulli",         "Dropout",          "Multinomial",
+        "RandomNormal",      "RandomNormalLike", "RandomUniform",
+        "RandomUniformLike"};
+    return kinds.count(node->kind().toString()) != 0;
+  }
+
+  static bool hasSubgraphs(const Node* node) {
+    for (const auto& name : node->attributeNames()) {
+      if (node->kindOf(name) == AttributeKind::g ||
+          node->kindOf(name) == AttributeKind::gs) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool isGraphOutput(const Value* value) {
+    const auto outputs = value->owningGraph()->outputs();
+    return std::find(outputs.begin(), outputs.end(), value) != outputs.end();
+  }
+
+  // The values of a graph by name, which the values moved into it are added
+  // to.
+  struct Values {
+    Graph* graph;
+    std::unordered_map<std::string, Value*> by_name;
+
+    explicit Values(Graph* graph) : graph(graph) {
+      for (Value* input : graph->inputs()) {
+        by_name[input->uniqueName()] = input;
+      }
+      for (Node* node : graph->nodes()) {
+        for (Value* value : node->inputs()) {
+          if (graph->is_constant_initializer(value)) {
+            by_name[value->uniqueName()] = value;
+          }
+        }
+        for (Value* value : node->outputs()) {
+          by_name[value->uniqueName()] = value;
+        }
+      }
+    }
+
+    // The value named |name|, captured from an enclosing graph if it is not
+    // defined in this one.
+    Value* get(const std::string& name) {
+      auto& value = by_name[name];
+      if (value == nullptr) {
+        Node* node = graph->create(kCaptured, 1);
+        graph->prependNode(node);
+        value = node->output();
+        value->setUniqueName(name);
+      }
+      return value;
+    }
+  };
+
+  // Moves |input|, an initializer of |body|, into the graph of |values|, and
+  // returns it.
+  static Value* moveInitializer(Graph& body, Value* input, Values& values) {
+    const std::string name = input->uniqueName();
+    Tensor tensor = *body.getInitializer(name);
+    Value* moved = values.graph->addInitializerAndCreateValue(tensor);
+    values.by_name[name] = moved;
+    Node* captured = body.create(kCaptured, 1);
+    body.prependNode(captured);
+    captured->output()->setUniqueName(name);
+    input->replaceAllUsesWith(captured->output());
+    body.eraseInitializer(name);
+    return moved;
+  }
+
+  // Moves |node| of |body| in front of |loop|, with the values its inputs
+  // refer to in the graph of |values|, and has the body capture its outputs.
+  static void moveNode(Graph& body, Node* node, Node* loop, Values& values) {
+    Node* moved = values.graph->create(node->kind(), node->outputs().size());
+    moved->copyAttributes(*node);
+    for (size_t i = 0; i < node->inputs().size(); ++i) {
+      Value* input = node->inputs()[i];
+      if (body.is_constant_initializer(input)) {
+        moved->addInput(moveInitializer(body, input, values));
+      } else {
+        moved->addInput(values.get(input->uniqueName()));
+      }
+    }
+    moved->insertBefore(loop);
+    for (size_t i = 0; i < node->outputs().size(); ++i) {
+      Value* output = node->outputs()[i];
+      Value* moved_output = moved->outputs()[i];
+      const std::string name = output->uniqueName();
+      moved_output->setElemType(output->elemType());
+      if (output->has_sizes()) {
+        moved_output->setSizes(output->sizes());
+      }
+      // the moved value keeps the name, which the body captures
+      output->setUniqueName(body.getNextUniqueName());
+      moved_output->setUniqueName(name);
+      values.by_name[name] = moved_output;
+      Node* captured = body.create(kCaptured, 1);
+      body.prependNode(captured);
+      captured->output()->setUniqueName(name);
+      output->replaceAllUsesWith(captured->output());
+    }
+    node->destroy();
+  }
+
+  // Moves the loop invariant nodes of the body of |loop| in front of it.
+  unsigned int hoist(Node* loop, Values& values) {
+    Graph& body = *loop->g(kbody);
+    std::vector<Node*> invariants;
+    std::unordered_set<const Value*> invariant_values;
+    for (Node* node : body.nodes()) {
+      if (node->kind() == kCaptured || node->kind() == kUndefined ||
+          hasSubgraphs(node) || isNondeterministic(node) ||
+          std::any_of(node->outputs().begin(), node->outputs().end(),
+                      isGraphOutput)) {
+        continue;
+      }
+      const bool invariant = std::all_of(
+          node->inputs().begin(), node->inputs().end(),
+          [&](const Value* input) {
+            // placeholders of the captured values and of the omitted inputs
+            return input->node()->kind() == kCaptured ||
+                   input->node()->kind() == kUndefined ||
+                   body.is_constant_initializer(input) ||
+                   invariant_values.count(input) != 0;
+          });
+      if (invariant) {
+        invariants.push_back(node);
+        for (const Value* output : node->outputs()) {
+          invariant_values.insert(output);
+        }
+      }
+    }
+    for (Node* node : invariants) {
+      VLOG(1) << Str("moving ", node->kind().toString(), " ", node->name(),
+                     " out of the body of ", loop->name());
+      moveNode(body, node, loop, values);
+    }
+    return invariants.size();
+  }
+
+  // Loops nested in other loops are visited first, so that the nodes moved
+  // out of them can be moved further out.
+  unsigned int hoistInGraph(Graph& graph) {
+    Values values(&graph);
+    unsigned int hoisted = 0;
+    for (Node* node : graph.nodes()) {
+      hoisted += DescendOnGraphAttributesAndCount(
+          node, [this](Graph& g) { return hoistInGraph(g); });
+      if (node->kind() == kLoop || node->kind() == Symbol("Scan")) {
+        hoisted += hoist(node, values);
+      }
+    }
+    return hoisted;
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    auto hoisted = hoistInGraph(graph);
+    VLOG(1) << Str("hoisted count: ", hoisted);
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, hoisted, false, false));
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
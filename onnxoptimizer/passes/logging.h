@@ -27,34 +27,48 @@ constexpr int LOG_WARNING = 1;
 constexpr int LOG_ERROR = 2;
 constexpr int LOG_FATAL = 3;
 
-static std::once_flag read_log_threshold_flag;
-static int log_threshold = LOG_INFO;
-
-static void ReadLogThresholdFromEnv() {
+inline int ReadLogThresholdFromEnv() {
+  int log_threshold = LOG_INFO;
   char* threshold = std::getenv("LOG_THRESHOLD");
   if (!threshold) {
-    return;
+    return log_threshold;
   }
   std::stringstream ss;
   ss << threshold;
   ss >> log_threshold;
+  return log_threshold;
+}
+
+// The state below is shared by the whole program rather than copied into every
+// translation unit, and is safe to use from several threads.
+inline int LogThreshold() {
+  static const int log_threshold = ReadLogThresholdFromEnv();
+  return log_threshold;
+}
+
+// Keeps the messages logged by different threads from interleaving.
+inline std::mutex& LogMutex() {
+  static std::mutex log_mutex;
+  return log_mutex;
 }
 
 class MessageControl {
  public:
   MessageControl(const char* file, const char* function, int line, int severity)
       : severity_(severity) {
-    std::call_once(read_log_threshold_flag, ReadLogThresholdFromEnv);
     stream_ << "[" << logging_prefix[std::min<int>(4, LOG_FATAL - severity_)]
             << " " << StripFilename(file) << ":" << line << " " << function
             << "]: ";
   }
 
   ~MessageControl() {
-    if (severity_ < log_threshold) {
+    if (severity_ < LogThreshold()) {
       return;
     }
-    std::cout << stream_.rdbuf() << std::endl;
+    {
+      std::lock_guard<std::mutex> lock(LogMutex());
+      std::cout << stream_.rdbuf() << std::endl;
+    }
     if (severity_ == LOG_FATAL) {
       std::abort();
     }
@@ -8,7 +8,10 @@
 #pragma once
 
 #include <algorithm>
+#include <string>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 #include "onnx/onnx_pb.h"
 #include "onnxoptimizer/pass.h"
@@ -210,18 +213,24 @@ bool GetValueFromInput(const Value* v, Vec& value) {
   if (!tensor || tensor->elem_type() != SupportedTypeOfTensor<Vec>::elem_type) {
     return false;
   }
-  value = ParseTensorData<typename Vec::value_type>(tensor);
+  const TensorView<typename Vec::value_type> data(tensor);
+  value.assign(data.begin(), data.end());
   return true;
 }
 template <typename T, typename = std::enable_if_t<
                           SupportedTypeOfTensor<std::vector<T>>::value>>
 bool GetValueFromInput(const Value* v, T& value, size_t which_value = 0) {
-  std::vector<T> temp_;
-  if (GetValueFromInput(v, temp_) && which_value < temp_.size()) {
-    value = temp_[which_value];
-    return true;
+  const Tensor* tensor = FetchConstantTensor(v);
+  if (!tensor || tensor->elem_type() !=
+                     SupportedTypeOfTensor<std::vector<T>>::elem_type) {
+    return false;
   }
-  return false;
+  const TensorView<T> data(tensor);
+  if (which_value >= data.size()) {
+    return false;
+  }
+  value = data[which_value];
+  return true;
 }
 
 template <typename Vec,
@@ -265,7 +274,7 @@ template <typename T, typename Sym>
 bool FetchSoleValueOfAttr(const Node* node, const Sym& symbol, T& val) {
   Symbol attr_name =
       ToSymbol<typename CanonicalizeSymbolType<Sym>::type>::Call(symbol);
-  static std::unordered_set<AttributeKind> container_type{
+  static const std::unordered_set<AttributeKind> container_type{
       AttributeKind::is, AttributeKind::fs, AttributeKind::ss};
 
   if (container_type.count(node->kindOf(attr_name)) == 1) {
@@ -379,6 +388,117 @@ inline bool HasDimsOfInputOfNode(Node* n, size_t which) {
   return vs[which]->has_sizes();
 }
 
+constexpr const char* kMicrosoftDomain = "com.microsoft";
+
+// Whether |node| is an operator of the default ONNX domain.
+inline bool IsDefaultDomain(const Node* node) {
+  return !node->has_domain() || node->domain().empty();
+}
+
+// The node of |kind| of the default domain that is the only user of |value|,
+// or nullptr.
+inline Node* SoleUser(const Value* value, NodeKind kind) {
+  const auto uses = value->uses();
+  if (uses.size() != 1 || uses[0].user->kind() != kind ||
+      !IsDefaultDomain(uses[0].user)) {
+    return nullptr;
+  }
+  return uses[0].user;
+}
+
+// The node of |kind| of the default domain producing |value| for its only
+// user, or nullptr.
+inline Node* SoleProducer(Value* value, NodeKind kind) {
+  Node* node = value->node();
+  if (node->kind() != kind || !IsDefaultDomain(node) ||
+      node->outputs().size() != 1 || value->uses().size() != 1) {
+    return nullptr;
+  }
+  return node;
+}
+
+// Like FetchSoleValueOfTensor, for a float or a double tensor.
+inline bool FetchScalar(const Value* value, float& result) {
+  double d;
+  if (FetchSoleValueOfTensor(value, result)) {
+    return true;
+  }
+  if (FetchSoleValueOfTensor(value, d)) {
+    result = static_cast<float>(d);
+    return true;
+  }
+  return false;
+}
+
+inline bool HasRank(const Value* value, size_t rank) {
+  return value->has_sizes() && value->sizes().size() == rank;
+}
+
+// Whether |a| and |b| are known to be the same dim.
+inline bool IsSameDim(const Dimension& a, const Dimension& b) {
+  if (a.is_int || b.is_int) {
+    return a.is_int && b.is_int && a.dim == b.dim;
+  }
+  return !a.is_unknown && !b.is_unknown && !a.param.empty() &&
+         a.param == b.param;
+}
+
+// Destroys the nodes computing |values| as long as nothing else uses their
+// outputs, then those computing their inputs, and so on, and erases the
+// initializers left unused. Only single-output nodes of the default domain
+// that |destroyable| holds for are destroyed.
+template <typename Predicate>
+void DestroyUnused(Graph& graph, const std::vector<Value*>& values,
+                   const Predicate& destroyable) {
+  // depth first, in the order of |values| and of the inputs of the nodes
+  std::vector<Value*> pending(values.rbegin(), values.rend());
+  // a value may be pending after the node computing it has been destroyed,
+  // e.g. a shape that is used by a destroyed node up the chain too
+  std::unordered_set<const Value*> destroyed;
+  while (!pending.empty()) {
+    Value* value = pending.back();
+    pending.pop_back();
+    if (destroyed.count(value) > 0 || !value->uses().empty()) {
+      continue;
+    }
+    if (graph.is_constant_initializer(value)) {
+      destroyed.insert(value);
+      graph.eraseInitializerAndInput(value);
+      continue;
+    }
+    Node* node = value->node();
+    if (node->outputs().size() != 1 || !IsDefaultDomain(node) ||
+        !destroyable(node)) {
+      continue;
+    }
+    pending.insert(pending.end(), node->inputs().rbegin(),
+                   node->inputs().rend());
+    destroyed.insert(value);
+    node->destroy();
+  }
+}
+
+// DestroyUnused for the nodes of |kinds|.
+inline void DestroyUnused(Graph& graph, const std::vector<Value*>& values,
+                          const std::vector<NodeKind>& kinds) {
+  DestroyUnused(graph, values, [&kinds](const Node* node) {
+    return std::find(kinds.begin(), kinds.end(), node->kind()) != kinds.end();
+  });
+}
+
+// Makes the model of |graph| import |domain| at |version|, unless it already
+// imports it.
+inline void AddOpsetImport(Graph& graph, const std::string& domain,
+                           int64_t version) {
+  auto& opsets = graph.opset_versions_mutable();
+  const bool imported = std::any_of(
+      opsets.begin(), opsets.end(),
+      [&domain](const OpSetID& opset) { return opset.domain() == domain; });
+  if (!imported) {
+    opsets.emplace_back(domain, version);
+  }
+}
+
 inline std::vector<int64_t> GetIntsFromValue(const Value* v) {
   std::vector<int64_t> is64;
   std::vector<int32_t> is32;
@@ -31,6 +31,12 @@ struct ReplaceEinsumWithMatmul final : public PredicateBasedPass {
   std::string getPassName() const override {
     return "replace_einsum_with_matmul";
   }
+  std::vector<NodeKind> getRootKinds() const override {
+    return {Symbol("Einsum")};
+  }
+  std::vector<NodeKind> getProducedKinds() const override {
+    return {Symbol("Einsum"), kMatMul, kTranspose};
+  }
 
   bool patternMatchPredicate(Node* node) override {
     return CheckKind(node, "Einsum") && node->inputs().size() == 2 &&
@@ -0,0 +1,632 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#include "onnxoptimizer/passes/shape_inference.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "onnx/defs/schema.h"
+#include "onnx/defs/shape_inference.h"
+#include "onnxoptimizer/passes/pass_util.h"
+#include "onnxoptimizer/passes/tensor_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+namespace {
+
+// Constant inputs up to this many elements are handed to the inference
+// functions, which read shapes, axes and the like from them.
+constexpr int64_t kMaxInputDataSize = 1024;
+
+bool isOmitted(const Value* value) {
+  return value->node()->kind() == kUndefined;
+}
+
+bool hasType(Value* value) {
+  return value->elemType() != TensorProto_DataType_UNDEFINED ||
+         value->type() != nullptr;
+}
+
+// Whether nothing is left to learn about the type of |value|.
+bool hasCompleteType(Value* value) {
+  if (value->elemType() == TensorProto_DataType_UNDEFINED) {
+    return value->type() != nullptr;
+  }
+  return value->has_sizes() &&
+         std::none_of(value->sizes().begin(), value->sizes().end(),
+                      [](const Dimension& dim) { return dim.is_unknown; });
+}
+
+bool hasSubgraphs(const Node* node) {
+  for (const auto& name : node->attributeNames()) {
+    if (node->kindOf(name) == AttributeKind::g ||
+        node->kindOf(name) == AttributeKind::gs) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::unique_ptr<TypeProto> encodeType(Value* value) {
+  if (value->elemType() == TensorProto_DataType_UNDEFINED) {
+    return std::make_unique<TypeProto>(*value->type());
+  }
+  auto type = std::make_unique<TypeProto>();
+  auto* tensor_type = type->mutable_tensor_type();
+  tensor_type->set_elem_type(value->elemType());
+  if (value->has_sizes()) {
+    auto* shape = tensor_type->mutable_shape();
+    for (const auto& dim : value->sizes()) {
+      auto* proto_dim = shape->add_dim();
+      if (dim.is_int) {
+        proto_dim->set_dim_value(dim.dim);
+      } else if (!dim.is_unknown) {
+        proto_dim->set_dim_param(dim.param);
+      }
+    }
+  }
+  return type;
+}
+
+// Only the type and the dims of a tensor matter to the inference functions
+// reading tensor attributes, e.g. the one of Constant.
+void encodeTensorType(const Tensor& tensor, TensorProto* proto) {
+  proto->set_data_type(tensor.elem_type());
+  for (const auto dim : tensor.sizes()) {
+    proto->add_dims(dim);
+  }
+}
+
+AttributeProto encodeAttribute(const Node* node, Symbol name) {
+  AttributeProto attr;
+  attr.set_name(name.toString());
+  switch (node->kindOf(name)) {
+    case AttributeKind::f:
+      attr.set_type(AttributeProto_AttributeType_FLOAT);
+      attr.set_f(static_cast<float>(node->f(name)));
+      break;
+    case AttributeKind::fs:
+      attr.set_type(AttributeProto_AttributeType_FLOATS);
+      for (const auto v : node->fs(name)) {
+        attr.add_floats(static_cast<float>(v));
+      }
+      break;
+    case AttributeKind::i:
+      attr.set_type(AttributeProto_AttributeType_INT);
+      attr.set_i(node->i(name));
+      break;
+    case AttributeKind::is:
+      attr.set_type(AttributeProto_AttributeType_INTS);
+      for (const auto v : node->is(name)) {
+        attr.add_ints(v);
+      }
+      break;
+    case AttributeKind::s:
+      attr.set_type(AttributeProto_AttributeType_STRING);
+      attr.set_s(node->s(name));
+      break;
+    case AttributeKind::ss:
+      attr.set_type(AttributeProto_AttributeType_STRINGS);
+      for (const auto& v : node->ss(name)) {
+        attr.add_strings(v);
+      }
+      break;
+    case AttributeKind::t:
+      attr.set_type(AttributeProto_AttributeType_TENSOR);
+      encodeTensorType(node->t(name), attr.mutable_t());
+      break;
+    case AttributeKind::ts:
+      attr.set_type(AttributeProto_AttributeType_TENSORS);
+      for (const auto& v : node->ts(name)) {
+        encodeTensorType(v, attr.add_tensors());
+      }
+      break;
+    case AttributeKind::tp:
+      attr.set_type(AttributeProto_AttributeType_TYPE_PROTO);
+      *attr.mutable_tp() = node->tp(name);
+      break;
+    case AttributeKind::tps:
+      attr.set_type(AttributeProto_AttributeType_TYPE_PROTOS);
+      for (const auto& v : node->tps(name)) {
+        *attr.add_type_protos() = v;
+      }
+      break;
+    case AttributeKind::g:
+    case AttributeKind::gs:
+      // nodes holding subgraphs are not inferred
+      break;
+  }
+  return attr;
+}
+
+// The values of the integer tensor |value|, if it is a small constant.
+std::unique_ptr<TensorProto> encodeInputData(const Value* value) {
+  const Tensor* tensor = FetchConstantTensor(value);
+  if (tensor == nullptr || ElemCntOfTensor(tensor) > kMaxInputDataSize) {
+    return nullptr;
+  }
+  auto proto = std::make_unique<TensorProto>();
+  encodeTensorType(*tensor, proto.get());
+  if (tensor->elem_type() == TensorProto_DataType_INT64) {
+    for (const auto v : ParseTensorData<int64_t>(tensor)) {
+      proto->add_int64_data(v);
+    }
+  } else if (tensor->elem_type() == TensorProto_DataType_INT32) {
+    for (const auto v : ParseTensorData<int32_t>(tensor)) {
+      proto->add_int32_data(v);
+    }
+  } else {
+    return nullptr;
+  }
+  return proto;
+}
+
+class NodeInferenceContext final : public InferenceContext {
+ public:
+  explicit NodeInferenceContext(Node* node)
+      : output_types_(node->outputs().size()) {
+    for (const auto name : node->attributeNames()) {
+      attributes_.emplace(name.toString(), encodeAttribute(node, name));
+    }
+    for (Value* input : node->inputs()) {
+      if (isOmitted(input)) {
+        input_types_.emplace_back();
+        input_data_.emplace_back();
+      } else {
+        input_types_.push_back(encodeType(input));
+        input_data_.push_back(encodeInputData(input));
+      }
+    }
+  }
+
+  const AttributeProto* getAttribute(const std::string& name) const override {
+    const auto it = attributes_.find(name);
+    return it == attributes_.end() ? nullptr : &it->second;
+  }
+  size_t getNumInputs() const override {
+    return input_types_.size();
+  }
+  const TypeProto* getInputType(size_t index) const override {
+    return index < input_types_.size() ? input_types_[index].get() : nullptr;
+  }
+  const TensorProto* getInputData(size_t index) const override {
+    return index < input_data_.size() ? input_data_[index].get() : nullptr;
+  }
+  size_t getNumOutputs() const override {
+    return output_types_.size();
+  }
+  TypeProto* getOutputType(size_t index) override {
+    return index < output_types_.size() ? &output_types_[index] : nullptr;
+  }
+  GraphInferencer* getGraphAttributeInferencer(const std::string&) override {
+    return nullptr;
+  }
+  const SparseTensorProto* getInputSparseData(size_t) const override {
+    return nullptr;
+  }
+  const TensorShapeProto* getSymbolicInput(size_t) const override {
+    return nullptr;
+  }
+
+ private:
+  std::unordered_map<std::string, AttributeProto> attributes_;
+  std::vector<std::unique_ptr<TypeProto>> input_types_;
+  std::vector<std::unique_ptr<TensorProto>> input_data_;
+  std::vector<TypeProto> output_types_;
+};
+
+// Merges |inferred| into the type of |value|.
+bool mergeType(const TypeProto& inferred, Value* value) {
+  if (!inferred.has_tensor_type()) {
+    if (hasType(value) ||
+        inferred.value_case() == TypeProto::VALUE_NOT_SET) {
+      return false;
+    }
+    value->type() = std::make_unique<TypeProto>(inferred);
+    return true;
+  }
+  const auto& tensor_type = inferred.tensor_type();
+  bool changed = false;
+  if (value->elemType() == TensorProto_DataType_UNDEFINED &&
+      tensor_type.elem_type() != TensorProto_DataType_UNDEFINED) {
+    value->setElemType(tensor_type.elem_type());
+    changed = true;
+  }
+  if (!tensor_type.has_shape()) {
+    return changed;
+  }
+  const auto& dims = tensor_type.shape().dim();
+  if (!value->has_sizes()) {
+    std::vector<Dimension> sizes;
+    for (const auto& dim : dims) {
+      if (dim.has_dim_value()) {
+        sizes.emplace_back(dim.dim_value());
+      } else if (dim.has_dim_param()) {
+        sizes.emplace_back(dim.dim_param());
+      } else {
+        sizes.emplace_back();
+      }
+    }
+    value->setSizes(std::move(sizes));
+    return true;
+  }
+  auto sizes = value->sizes();
+  if (sizes.size() != static_cast<size_t>(dims.size())) {
+    return changed;
+  }
+  bool refined = false;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (sizes[i].is_int) {
+      continue;
+    }
+    if (dims[i].has_dim_value()) {
+      sizes[i] = Dimension(dims[i].dim_value());
+      refined = true;
+    } else if (sizes[i].is_unknown && dims[i].has_dim_param()) {
+      sizes[i] = Dimension(dims[i].dim_param());
+      refined = true;
+    }
+  }
+  if (refined) {
+    value->setSizes(std::move(sizes));
+  }
+  return changed || refined;
+}
+
+bool isGraphOutput(const Value* value) {
+  const auto uses = value->uses();
+  return std::any_of(uses.begin(), uses.end(), [](const Use& use) {
+    return use.user->kind() == kReturn;
+  });
+}
+
+// What a value knows about its type.
+struct ValueType {
+  int32_t elem_type;
+  bool has_sizes;
+  std::vector<Dimension> sizes;
+  std::shared_ptr<const TypeProto> type;
+
+  explicit ValueType(Value* value)
+      : elem_type(value->elemType()),
+        has_sizes(value->has_sizes()),
+        sizes(value->has_sizes() ? value->sizes()
+                                 : std::vector<Dimension>()),
+        type(value->type() == nullptr
+                 ? nullptr
+                 : std::make_shared<TypeProto>(*value->type())) {}
+
+  bool operator==(const ValueType& other) const {
+    const auto same_dim = [](const Dimension& a, const Dimension& b) {
+      return a.is_unknown == b.is_unknown && a.is_int == b.is_int &&
+             (a.is_int ? a.dim == b.dim : a.param == b.param);
+    };
+    return elem_type == other.elem_type && has_sizes == other.has_sizes &&
+           std::equal(sizes.begin(), sizes.end(), other.sizes.begin(),
+                      other.sizes.end(), same_dim) &&
+           (type == nullptr) == (other.type == nullptr);
+  }
+
+  void assignTo(Value* value) const {
+    value->setElemType(elem_type);
+    if (has_sizes) {
+      value->setSizes(sizes);
+    } else {
+      value->wipeSizes();
+    }
+    value->type() =
+        type == nullptr ? nullptr : std::make_unique<TypeProto>(*type);
+  }
+};
+
+int opsetVersion(Graph& graph, const std::string& domain) {
+  for (const OpSetID& opset : graph.opset_versions_mutable()) {
+    if (opset.domain() == domain ||
+        (domain.empty() && opset.domain() == "ai.onnx")) {
+      return static_cast<int>(opset.version());
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+struct InferredTypeRecords {
+  struct Record {
+    std::string name;
+    ValueType original;
+    ValueType inferred;
+  };
+  std::unordered_map<const Value*, Record> by_value;
+  // The inputs the nodes had when they were last visited, which tell the
+  // nodes a pass has rewired since.
+  std::unordered_map<const Node*, std::vector<const Value*>> inputs_by_node;
+
+  // Records that the type of |value| was inferred, |original| being what it
+  // knew before.
+  void record(Value* value, const ValueType& original) {
+    auto it = by_value.find(value);
+    if (it != by_value.end() && it->second.name == value->uniqueName() &&
+        it->second.inferred == original) {
+      it->second.inferred = ValueType(value);
+      return;
+    }
+    by_value.erase(value);
+    by_value.emplace(value,
+                     Record{value->uniqueName(), original, ValueType(value)});
+  }
+
+  // Takes back the inferred types of the outputs of |node| that no pass has
+  // changed since.
+  void takeBack(Node* node) {
+    for (Value* output : node->outputs()) {
+      const auto it = by_value.find(output);
+      if (it != by_value.end() && it->second.name == output->uniqueName() &&
+          ValueType(output) == it->second.inferred) {
+        it->second.original.assignTo(output);
+        by_value.erase(it);
+      }
+    }
+  }
+
+  bool rewired(const Node* node) const {
+    const auto it = inputs_by_node.find(node);
+    return it != inputs_by_node.end() &&
+           !std::equal(it->second.begin(), it->second.end(),
+                       node->inputs().begin(), node->inputs().end());
+  }
+};
+
+namespace {
+
+// The values of a graph by name, looked up from its subgraphs.
+struct Scope {
+  std::unordered_map<std::string, Value*> values;
+  const Scope* outer;
+
+  Scope(Graph& graph, const Scope* outer) : outer(outer) {
+    for (Value* input : graph.inputs()) {
+      values[input->uniqueName()] = input;
+    }
+    for (Node* node : graph.nodes()) {
+      for (Value* input : node->inputs()) {
+        values.emplace(input->uniqueName(), input);
+      }
+      for (Value* output : node->outputs()) {
+        values[output->uniqueName()] = output;
+      }
+    }
+  }
+
+  Value* find(const std::string& name) const {
+    for (const Scope* scope = this; scope != nullptr; scope = scope->outer) {
+      const auto it = scope->values.find(name);
+      if (it != scope->values.end()) {
+        return it->second;
+      }
+    }
+    return nullptr;
+  }
+};
+
+// What a run of the inference visits: the nodes created at stage |since| or
+// later, and the nodes downstream of the nodes it learns something about. When
+// the types are recorded, the older nodes a pass has rewired and the ones
+// downstream of a changed type are visited again too, see revisits.
+struct Visited {
+  size_t since = 0;
+  std::unordered_set<const Node*> downstream;
+
+  bool contains(const Node* node) const {
+    return node->stage() >= since || downstream.count(node) > 0;
+  }
+  // Whether the types inferred for the outputs of |node|, which was there
+  // before stage |since|, may be stale: its inputs were rewired, or their
+  // types changed.
+  bool revisits(const Node* node, const InferredTypeRecords& records) const {
+    return since > 0 && node->stage() < since &&
+           (downstream.count(node) > 0 || records.rewired(node));
+  }
+  void addUsers(const Node* node) {
+    if (since == 0) {
+      return;
+    }
+    for (const Value* output : node->outputs()) {
+      for (const auto& use : output->uses()) {
+        downstream.insert(use.user);
+      }
+    }
+  }
+};
+
+// Whether the types of the outputs of |node| differ from |types|.
+bool typesChanged(Node* node, const std::vector<ValueType>& types) {
+  for (size_t i = 0; i < types.size(); ++i) {
+    if (!(ValueType(node->outputs()[i]) == types[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int inferInGraph(Graph& graph, const Scope* outer,
+                          InferredTypeRecords* records, Visited& visited) {
+  unsigned int inferred = 0;
+  // the placeholders of the captured values are not necessarily in front of
+  // the nodes using them
+  for (Node* node : graph.nodes()) {
+    if (node->kind() != kCaptured || outer == nullptr ||
+        hasType(node->output())) {
+      continue;
+    }
+    Value* output = node->output();
+    Value* captured = outer->find(output->uniqueName());
+    if (captured != nullptr && hasType(captured)) {
+      const ValueType original(output);
+      output->setElemType(captured->elemType());
+      if (captured->has_sizes()) {
+        output->setSizes(captured->sizes());
+      }
+      if (captured->type() != nullptr) {
+        output->type() = std::make_unique<TypeProto>(*captured->type());
+      }
+      if (records != nullptr) {
+        records->record(output, original);
+      }
+      visited.addUsers(node);
+      ++inferred;
+    }
+  }
+  std::unique_ptr<Scope> scope;
+  for (Node* node : graph.nodes()) {
+    if (node->kind() == kCaptured || node->kind() == kUndefined) {
+      continue;
+    }
+    if (hasSubgraphs(node)) {
+      if (scope == nullptr) {
+        scope = std::make_unique<Scope>(graph, outer);
+      }
+      for (const auto& name : node->attributeNames()) {
+        if (node->kindOf(name) == AttributeKind::g) {
+          inferred +=
+              inferInGraph(*node->g(name), scope.get(), records, visited);
+        } else if (node->kindOf(name) == AttributeKind::gs) {
+          for (const auto& subgraph : node->gs(name)) {
+            inferred +=
+                inferInGraph(*subgraph, scope.get(), records, visited);
+          }
+        }
+      }
+      continue;
+    }
+    // the types of the outputs of a revisited node before they are taken
+    // back, to tell whether its users have to be revisited as well
+    std::vector<ValueType> stale;
+    const bool revisit =
+        records != nullptr && visited.revisits(node, *records);
+    if (revisit) {
+      for (Value* output : node->outputs()) {
+        stale.emplace_back(output);
+      }
+      records->takeBack(node);
+    } else if (!visited.contains(node)) {
+      continue;
+    }
+    if (records != nullptr) {
+      records->inputs_by_node[node].assign(node->inputs().begin(),
+                                           node->inputs().end());
+    }
+    if (std::all_of(node->outputs().begin(), node->outputs().end(),
+                    hasCompleteType)) {
+      continue;
+    }
+    std::vector<ValueType> originals;
+    if (records != nullptr) {
+      for (Value* output : node->outputs()) {
+        originals.emplace_back(output);
+      }
+    }
+    const bool learned = InferNodeShapes(node);
+    if (revisit ? typesChanged(node, stale) : learned) {
+      visited.addUsers(node);
+    }
+    if (!learned) {
+      continue;
+    }
+    ++inferred;
+    for (size_t i = 0; i < originals.size(); ++i) {
+      Value* output = node->outputs()[i];
+      if (!(ValueType(output) == originals[i])) {
+        records->record(output, originals[i]);
+      }
+    }
+  }
+  return inferred;
+}
+
+}  // namespace
+
+bool InferNodeShapes(Node* node) {
+  if (node->kind() == kCaptured || node->kind() == kUndefined ||
+      hasSubgraphs(node)) {
+    return false;
+  }
+  for (Value* input : node->inputs()) {
+    if (!isOmitted(input) && !hasType(input)) {
+      return false;
+    }
+  }
+  const std::string domain = node->has_domain() ? node->domain() : "";
+  const int version = opsetVersion(*node->owningGraph(), domain);
+  if (version < 0) {
+    return false;
+  }
+  const auto* schema =
+      OpSchemaRegistry::Schema(node->kind().toString(), version, domain);
+  if (schema == nullptr || !schema->has_type_and_shape_inference_function()) {
+    return false;
+  }
+  NodeInferenceContext ctx(node);
+  try {
+    schema->GetTypeAndShapeInferenceFunction()(ctx);
+  } catch (const std::exception&) {
+    return false;
+  }
+  bool changed = false;
+  for (size_t i = 0; i < node->outputs().size(); ++i) {
+    Value* output = node->outputs()[i];
+    if (!isGraphOutput(output)) {
+      changed |= mergeType(*ctx.getOutputType(i), output);
+    }
+  }
+  return changed;
+}
+
+unsigned int InferShapes(Graph& graph) {
+  Visited visited;
+  return inferInGraph(graph, nullptr, nullptr, visited);
+}
+
+RevertibleShapeInference::RevertibleShapeInference()
+    : records_(new InferredTypeRecords()) {}
+
+RevertibleShapeInference::~RevertibleShapeInference() = default;
+
+unsigned int RevertibleShapeInference::infer(Graph& graph, size_t since) {
+  Visited visited;
+  visited.since = since;
+  return inferInGraph(graph, nullptr, records_.get(), visited);
+}
+
+void RevertibleShapeInference::revert(Graph& graph) {
+  auto& by_value = records_->by_value;
+  graph.forSelfAndEachSubGraph([&by_value](Graph* g) {
+    for (Node* node : g->nodes()) {
+      for (Value* output : node->outputs()) {
+        const auto it = by_value.find(output);
+        if (it != by_value.end() &&
+            it->second.name == output->uniqueName() &&
+            ValueType(output) == it->second.inferred) {
+          it->second.original.assignTo(output);
+        }
+      }
+    }
+  });
+  by_value.clear();
+  records_->inputs_by_node.clear();
+}
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,68 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "onnx/common/ir.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// Type and shape inference on the IR, with the inference functions of the
+// operator schemas. Dims that are not static are kept symbolic, named by the
+// dim_params of the model, so that e.g. the batch dim of a dynamic-batch
+// export is known to be the same for all the values that have it.
+//
+// What is inferred is merged into what the values already know: an unknown
+// elem type, shape or dim is filled in, a known one is never changed. The
+// outputs of graphs keep the types the model declares.
+
+// Infers the types of the outputs of |node| from the types of its inputs, the
+// values of its constant shape-like inputs and its attributes. Nodes with an
+// input of unknown type, nodes holding subgraphs and nodes whose schema has
+// no inference function are left alone, and so is a node the inference
+// function fails on. Returns whether anything was learned.
+bool InferNodeShapes(Node* node);
+
+// Runs InferNodeShapes, in order, on the nodes of |graph| and of its subgraphs
+// whose outputs are not fully known yet, so that running it again after a
+// rewrite only infers the types of the nodes the rewrite created. Captured
+// values take the types of the values of the enclosing graphs. Returns the
+// number of nodes something was learned about.
+unsigned int InferShapes(Graph& graph);
+
+struct InferredTypeRecords;
+
+// Runs InferShapes and remembers the types it fills in, so that they can be
+// taken back before the graph is exported: the optimized model then describes
+// its values the way the original one did. The pass managers keep the graph
+// typed with it while they run the passes.
+class RevertibleShapeInference {
+ public:
+  RevertibleShapeInference();
+  ~RevertibleShapeInference();
+
+  // Only infers the types of the outputs of the nodes created at stage
+  // |since| or later, see Graph::setStage, i.e. by the passes run since, of
+  // the older nodes whose inputs were replaced since they were last visited,
+  // and of the nodes downstream of what changes. The types inferred before
+  // for the older nodes are taken back first, so they follow the new inputs.
+  // Zero visits every node.
+  unsigned int infer(Graph& graph, size_t since = 0);
+  // Takes the inferred types back from the values of |graph| that still have
+  // them, i.e. that no pass has changed the type of since.
+  void revert(Graph& graph);
+
+ private:
+  std::unique_ptr<InferredTypeRecords> records_;
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,585 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Before:
+//   T1 = Transpose(X, perm=[0, 2, 3, 1])
+//   R = Relu(T1)
+//   A = Add(R, B)              B has shape [C]
+//   Y = Transpose(A, perm=[0, 3, 1, 2])
+// After:
+//   R = Relu(X)
+//   A = Add(R, B')             B' has shape [1, C, 1, 1]
+//   Y = A
+//
+// A Transpose whose output is only used by one node is moved after that
+// node if the node does not care about the order of the dims, or only
+// through attributes and constant inputs that can be rewritten: elementwise
+// nodes, Concat, Pad, Resize, reductions and the Softmax family. Transposes
+// using a Transpose are merged with it, so that the Transposes of models
+// converted from the other layout cancel each other out instead of copying
+// their data around.
+//
+// The other inputs of the node must be Transposes by the same perm, whose
+// inputs are used instead, constants, which are transposed when the pass
+// runs, or values that broadcast the same whichever their order is.
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <unordered_set>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/fold_kernels.h"
+#include "onnxoptimizer/passes/logging.h"
+#include "onnxoptimizer/passes/pass_util.h"
+#include "onnxoptimizer/passes/string_utils.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct SinkTransposes final : public FullGraphBasedPass {
+  explicit SinkTransposes()
+      : FullGraphBasedPass(PassType::Fuse, PassEfficiency::Complete,
+                           PassOptimizationType::Compute) {}
+
+  std::string getPassName() const override {
+    return "sink_transposes";
+  }
+  PassAnalysisType getPassAnalysisType() const override {
+    return PassAnalysisType::CountBased;
+  }
+
+  static bool isElementwise(const Node* node) {
+    static const std::unordered_set<std::string> kinds = {
+        // unary
+        "Abs", "Acos", "Acosh", "Asin", "Asinh", "Atan", "Atanh", "BitwiseNot",
+        "Cast", "Ceil", "Celu", "Clip", "Cos", "Cosh", "Elu", "Erf", "Exp",
+        "Floor", "Gelu", "HardSigmoid", "HardSwish", "Identity", "IsInf",
+        "IsNaN", "LeakyRelu", "Log", "Mish", "Neg", "Not", "Reciprocal",
+        "Relu", "Round", "Selu", "Sigmoid", "Sign", "Sin", "Sinh", "Softplus",
+        "Softsign", "Sqrt", "Tan", "Tanh", "ThresholdedRelu",
+        // broadcasting
+        "Add", "And", "BitShift", "BitwiseAnd", "BitwiseOr", "BitwiseXor",
+        "Div", "Equal", "Greater", "GreaterOrEqual", "Less", "LessOrEqual",
+        "Max", "Mean", "Min", "Mod", "Mul", "Or", "Pow", "PRelu", "Sub", "Sum",
+        "Where", "Xor"};
+    // before opset 7, the broadcasting ones had an axis to broadcast along
+    return kinds.count(node->kind().toString()) != 0 &&
+           !node->hasAttribute(kaxis) && !node->hasAttribute(kbroadcast);
+  }
+
+  static bool isReduction(const Node* node) {
+    static const std::unordered_set<std::string> kinds = {
+        "ArgMax", "ArgMin", "ReduceL1", "ReduceL2", "ReduceLogSum",
+        "ReduceLogSumExp", "ReduceMax", "ReduceMean", "ReduceMin",
+        "ReduceProd", "ReduceSum", "ReduceSumSquare"};
+    return kinds.count(node->kind().toString()) != 0;
+  }
+
+  static bool isSoftmax(const Node* node) {
+    return node->kind() == Symbol("Softmax") ||
+           node->kind() == Symbol("LogSoftmax") ||
+           node->kind() == Symbol("Hardmax");
+  }
+
+  static bool isOmitted(const Value* value) {
+    return value->node()->kind() == kUndefined;
+  }
+
+  static bool getPerm(const Node* transpose, std::vector<int64_t>* perm) {
+    if (transpose->hasAttribute(kperm)) {
+      *perm = transpose->is(kperm);
+      return true;
+    }
+    const Value* input = transpose->input();
+    if (!input->has_sizes()) {
+      return false;
+    }
+    perm->resize(input->sizes().size());
+    std::iota(perm->rbegin(), perm->rend(), 0);
+    return true;
+  }
+
+  static std::vector<int64_t> invertPerm(const std::vector<int64_t>& perm) {
+    std::vector<int64_t> inverse(perm.size());
+    for (size_t i = 0; i < perm.size(); ++i) {
+      inverse[perm[i]] = static_cast<int64_t>(i);
+    }
+    return inverse;
+  }
+
+  static bool normalizeAxis(int64_t* axis, size_t rank) {
+    *axis = AddYIfNegative(*axis, static_cast<int64_t>(rank));
+    return *axis >= 0 && *axis < static_cast<int64_t>(rank);
+  }
+
+  static Tensor int64Tensor(const std::vector<int64_t>& ints) {
+    Tensor tensor;
+    tensor.elem_type() = TensorProto_DataType_INT64;
+    tensor.sizes() = {static_cast<int64_t>(ints.size())};
+    tensor.int64s() = ints;
+    return tensor;
+  }
+
+  static Tensor floatTensor(const std::vector<float>& floats) {
+    Tensor tensor;
+    tensor.elem_type() = TensorProto_DataType_FLOAT;
+    tensor.sizes() = {static_cast<int64_t>(floats.size())};
+    tensor.floats() = floats;
+    return tensor;
+  }
+
+  // Moves the values of every dim i in |values|, made of blocks of a value
+  // per dim like pads, to dim perm[i].
+  template <typename T>
+  static std::vector<T> permuteBlocks(const std::vector<T>& values,
+                                      const std::vector<int64_t>& perm) {
+    const size_t rank = perm.size();
+    std::vector<T> permuted(values.size());
+    for (size_t block = 0; block < values.size(); block += rank) {
+      for (size_t i = 0; i < rank; ++i) {
+        permuted[block + perm[i]] = values[block + i];
+      }
+    }
+    return permuted;
+  }
+
+  // An input of the node once the Transpose is after it: an existing value,
+  // or a constant to add if |value| is nullptr.
+  struct Input {
+    Value* value = nullptr;
+    Tensor tensor;
+  };
+
+  // How the node changes when the Transpose moves after it. The Transpose
+  // after it transposes by |perm|, or is not needed if |perm| is empty.
+  struct Rewrite {
+    std::vector<Input> inputs;
+    std::vector<int64_t> perm;
+    std::vector<std::pair<Symbol, int64_t>> ints;
+    std::vector<std::pair<Symbol, std::vector<int64_t>>> int_lists;
+  };
+
+  // Finds the input of the node to use instead of |value| when the node no
+  // longer computes on values transposed by |perm|. Values broadcast to the
+  // rank of |perm| if |broadcast| is set.
+  static bool untranspose(Value* value, const std::vector<int64_t>& perm,
+                          bool broadcast, Input* input) {
+    std::vector<int64_t> value_perm;
+    if (value->node()->kind() == kTranspose &&
+        getPerm(value->node(), &value_perm) && value_perm == perm) {
+      input->value = value->node()->input();
+      return true;
+    }
+    if (const Tensor* tensor = FetchConstantTensor(value)) {
+      const auto& dims = tensor->sizes();
+      if (dims.size() > perm.size() ||
+          (!broadcast && dims.size() != perm.size())) {
+        return false;
+      }
+      if (broadcast && ElemCntOfTensor(tensor) == 1) {
+        input->value = value;
+        return true;
+      }
+      Tensor reshaped = *tensor;
+      reshaped.sizes().insert(reshaped.sizes().begin(),
+                              perm.size() - dims.size(), 1);
+      input->value = nullptr;
+      return TransposeTensor(reshaped, invertPerm(perm), &input->tensor);
+    }
+    if (broadcast && value->has_sizes() &&
+        value->sizes().size() <= perm.size() &&
+        std::all_of(value->sizes().begin(), value->sizes().end(),
+                    [](const Dimension& dim) {
+                      return dim.is_int && dim.dim == 1;
+                    })) {
+      input->value = value;
+      return true;
+    }
+    return false;
+  }
+
+  static bool rewriteElementwise(Node* node, const std::vector<int64_t>& perm,
+                                 Rewrite* rewrite) {
+    for (size_t i = 0; i < node->inputs().size(); ++i) {
+      Value* input = node->inputs()[i];
+      if (!isOmitted(input) &&
+          !untranspose(input, perm, true, &rewrite->inputs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool rewriteConcat(Node* node, const std::vector<int64_t>& perm,
+                            Rewrite* rewrite) {
+    int64_t axis = node->i(kaxis);
+    if (!normalizeAxis(&axis, perm.size())) {
+      return false;
+    }
+    for (size_t i = 0; i < node->inputs().size(); ++i) {
+      if (!untranspose(node->inputs()[i], perm, false, &rewrite->inputs[i])) {
+        return false;
+      }
+    }
+    rewrite->ints.emplace_back(kaxis, perm[axis]);
+    return true;
+  }
+
+  static bool rewriteSoftmax(Node* node, const std::vector<int64_t>& perm,
+                             int opset_version, Rewrite* rewrite) {
+    // before opset 13, the input is coerced into 2D at the axis
+    if (opset_version < 13) {
+      return false;
+    }
+    int64_t axis = GetValueFromAttrWithDefault(node, "axis", int64_t{-1});
+    if (!normalizeAxis(&axis, perm.size()) ||
+        !untranspose(node->input(), perm, false, &rewrite->inputs[0])) {
+      return false;
+    }
+    rewrite->ints.emplace_back(kaxis, perm[axis]);
+    return true;
+  }
+
+  static bool rewritePad(Node* node, const std::vector<int64_t>& perm,
+                         Rewrite* rewrite) {
+    std::vector<int64_t> pads;
+    const bool pads_attribute = node->hasAttribute(kpads);
+    if (pads_attribute) {
+      pads = node->is(kpads);
+    } else if (node->inputs().size() < 2 ||
+               !GetValueFromInput(node->input(1), pads) ||
+               (node->inputs().size() > 3 && !isOmitted(node->input(3)))) {
+      // the pads of some axes only
+      return false;
+    }
+    const size_t rank = perm.size();
+    if (pads.size() != 2 * rank ||
+        !untranspose(node->input(0), perm, false, &rewrite->inputs[0])) {
+      return false;
+    }
+    const auto new_pads = permuteBlocks(pads, perm);
+    if (pads_attribute) {
+      rewrite->int_lists.emplace_back(kpads, new_pads);
+    } else {
+      rewrite->inputs[1].value = nullptr;
+      rewrite->inputs[1].tensor = int64Tensor(new_pads);
+    }
+    return true;
+  }
+
+  // Resize takes a scale, a size and a region of interest per dim, or per
+  // axis if it has axes.
+  static bool rewriteResize(Node* node, const std::vector<int64_t>& perm,
+                            int opset_version, Rewrite* rewrite) {
+    const size_t rank = perm.size();
+    if (opset_version < 10 ||
+        !untranspose(node->input(0), perm, false, &rewrite->inputs[0])) {
+      return false;
+    }
+    if (node->hasAttribute(kaxes)) {
+      std::vector<int64_t> axes = node->is(kaxes);
+      for (auto& axis : axes) {
+        if (!normalizeAxis(&axis, rank)) {
+          return false;
+        }
+        axis = perm[axis];
+      }
+      rewrite->int_lists.emplace_back(kaxes, axes);
+      return true;
+    }
+    for (size_t i = 1; i < node->inputs().size(); ++i) {
+      Value* input = node->inputs()[i];
+      if (isOmitted(input)) {
+        continue;
+      }
+      const Tensor* tensor = FetchConstantTensor(input);
+      if (tensor == nullptr) {
+        return false;
+      }
+      if (ElemCntOfTensor(tensor) == 0) {
+        continue;
+      }
+      if (ElemCntOfTensor(tensor) % rank != 0) {
+        return false;
+      }
+      if (tensor->elem_type() == TensorProto_DataType_FLOAT) {
+        std::vector<float> values;
+        GetValueFromInput(input, values);
+        rewrite->inputs[i].tensor = floatTensor(permuteBlocks(values, perm));
+      } else if (tensor->elem_type() == TensorProto_DataType_INT64) {
+        std::vector<int64_t> values;
+        GetValueFromInput(input, values);
+        rewrite->inputs[i].tensor = int64Tensor(permuteBlocks(values, perm));
+      } else {
+        return false;
+      }
+      rewrite->inputs[i].value = nullptr;
+    }
+    return true;
+  }
+
+  static bool rewriteReduction(Node* node, const std::vector<int64_t>& perm,
+                               Rewrite* rewrite) {
+    const size_t rank = perm.size();
+    std::vector<int64_t> axes;
+    enum { kAxis, kAxes, kAxesInput } axes_from;
+    if (node->kind() == Symbol("ArgMax") || node->kind() == Symbol("ArgMin")) {
+      axes_from = kAxis;
+      axes.push_back(GetValueFromAttrWithDefault(node, "axis", int64_t{0}));
+    } else if (node->hasAttribute(kaxes)) {
+      axes_from = kAxes;
+      axes = node->is(kaxes);
+    } else if (node->inputs().size() > 1 && !isOmitted(node->input(1))) {
+      axes_from = kAxesInput;
+      if (!GetValueFromInput(node->input(1), axes)) {
+        return false;
+      }
+    } else if (GetValueFromAttrWithDefault(node, "noop_with_empty_axes",
+                                           int64_t{0}) != 0) {
+      return untranspose(node->input(0), perm, false, &rewrite->inputs[0]);
+    } else {
+      // all the dims are reduced, the order does not matter
+      rewrite->perm.clear();
+      return untranspose(node->input(0), perm, false, &rewrite->inputs[0]);
+    }
+    std::vector<bool> reduced(rank, false);
+    for (auto& axis : axes) {
+      if (!normalizeAxis(&axis, rank)) {
+        return false;
+      }
+      reduced[axis] = true;
+      axis = perm[axis];
+    }
+    if (!untranspose(node->input(0), perm, false, &rewrite->inputs[0])) {
+      return false;
+    }
+    if (GetValueFromAttrWithDefault(node, "keepdims", int64_t{1}) == 0) {
+      // the dims left keep their order in the input
+      std::vector<int64_t> kept;
+      for (size_t i = 0; i < rank; ++i) {
+        if (!reduced[i]) {
+          kept.push_back(perm[i]);
+        }
+      }
+      std::vector<int64_t> sorted = kept;
+      std::sort(sorted.begin(), sorted.end());
+      rewrite->perm.clear();
+      for (const auto dim : kept) {
+        rewrite->perm.push_back(
+            std::lower_bound(sorted.begin(), sorted.end(), dim) -
+            sorted.begin());
+      }
+    }
+    switch (axes_from) {
+      case kAxis:
+        rewrite->ints.emplace_back(kaxis, axes[0]);
+        break;
+      case kAxes:
+        rewrite->int_lists.emplace_back(kaxes, axes);
+        break;
+      case kAxesInput:
+        rewrite->inputs[1].value = nullptr;
+        rewrite->inputs[1].tensor = int64Tensor(axes);
+        break;
+    }
+    return true;
+  }
+
+  // Merges |transpose| into |node|, another Transpose.
+  static bool mergeTransposes(Node* transpose, const std::vector<int64_t>& perm,
+                              Node* node) {
+    std::vector<int64_t> node_perm;
+    if (node->hasAttribute(kperm)) {
+      node_perm = node->is(kperm);
+    } else {
+      node_perm.resize(perm.size());
+      std::iota(node_perm.rbegin(), node_perm.rend(), 0);
+    }
+    if (node_perm.size() != perm.size()) {
+      return false;
+    }
+    std::vector<int64_t> merged;
+    for (const auto axis : node_perm) {
+      merged.push_back(perm[axis]);
+    }
+    Value* input = transpose->input();
+    bool identity = true;
+    for (size_t i = 0; i < merged.size(); ++i) {
+      identity &= merged[i] == static_cast<int64_t>(i);
+    }
+    if (identity) {
+      if (!tryReplacingAllUsesWith(node->output(), input)) {
+        return false;
+      }
+      node->destroy();
+      return true;
+    }
+    node->replaceInput(0, input);
+    node->is_(kperm, std::move(merged));
+    return true;
+  }
+
+  // Moves |transpose| after |node|, which uses its output.
+  bool sinkThrough(Graph& graph, Node* transpose,
+                   const std::vector<int64_t>& perm, Node* node) {
+    if (node->kind() == kTranspose) {
+      return mergeTransposes(transpose, perm, node);
+    }
+    if (node->outputs().size() != 1) {
+      return false;
+    }
+    Rewrite rewrite;
+    rewrite.perm = perm;
+    rewrite.inputs.resize(node->inputs().size());
+    for (size_t i = 0; i < node->inputs().size(); ++i) {
+      rewrite.inputs[i].value = node->inputs()[i];
+    }
+    bool rewritten = false;
+    if (isElementwise(node)) {
+      rewritten = rewriteElementwise(node, perm, &rewrite);
+    } else if (node->kind() == kConcat) {
+      rewritten = rewriteConcat(node, perm, &rewrite);
+    } else if (isSoftmax(node)) {
+      rewritten = rewriteSoftmax(node, perm, opset_version_, &rewrite);
+    } else if (node->kind() == kPad) {
+      rewritten = rewritePad(node, perm, &rewrite);
+    } else if (isReduction(node)) {
+      rewritten = rewriteReduction(node, perm, &rewrite);
+    } else if (node->kind() == Symbol("Resize")) {
+      rewritten = rewriteResize(node, perm, opset_version_, &rewrite);
+    }
+    if (!rewritten) {
+      return false;
+    }
+
+    const std::vector<Value*> old_inputs(node->inputs().begin(),
+                                         node->inputs().end());
+    for (size_t i = 0; i < old_inputs.size(); ++i) {
+      Input& input = rewrite.inputs[i];
+      Value* value = input.value != nullptr
+                         ? input.value
+                         : graph.addInitializerAndCreateValue(input.tensor);
+      if (value != old_inputs[i]) {
+        node->replaceInput(i, value);
+      }
+    }
+    for (const auto& attr : rewrite.ints) {
+      node->i_(attr.first, attr.second);
+    }
+    for (const auto& attr : rewrite.int_lists) {
+      node->is_(attr.first, std::vector<int64_t>(attr.second));
+    }
+    for (Value* old_input : old_inputs) {
+      if (!old_input->uses().empty()) {
+        continue;
+      }
+      if (graph.is_constant_initializer(old_input)) {
+        graph.eraseInitializerAndInput(old_input);
+      } else if (old_input->node()->kind() == kTranspose &&
+                 old_input->node() != transpose) {
+        old_input->node()->destroy();
+      }
+    }
+
+    Value* output = node->output();
+    if (rewrite.perm.empty()) {
+      return true;
+    }
+    Node* new_transpose = graph.create(kTranspose, 1);
+    new_transpose->is_(kperm, std::vector<int64_t>(rewrite.perm));
+    new_transpose->insertAfter(node);
+    output->replaceAllUsesWith(new_transpose->output());
+    new_transpose->addInput(output);
+    if (output->has_sizes()) {
+      const auto sizes = output->sizes();
+      std::vector<Dimension> new_sizes(sizes.size());
+      for (size_t i = 0; i < sizes.size(); ++i) {
+        new_sizes[rewrite.perm[i]] = sizes[i];
+      }
+      output->setSizes(new_sizes);
+    }
+    return true;
+  }
+
+  // The nodes of |graph| using |value|, or nothing if it is used elsewhere.
+  static std::vector<Node*> usersInGraph(const Value* value,
+                                         const Graph& graph) {
+    std::vector<Node*> users;
+    for (const Use& use : value->uses()) {
+      if (use.user->owningGraph() != &graph) {
+        return {};
+      }
+      if (std::find(users.begin(), users.end(), use.user) == users.end()) {
+        users.push_back(use.user);
+      }
+    }
+    return users;
+  }
+
+  // Merges |transpose| with the Transposes using it, and moves it after the
+  // node using it if there is only one other.
+  bool sinkTranspose(Graph& graph, Node* transpose) {
+    std::vector<int64_t> perm;
+    if (!getPerm(transpose, &perm)) {
+      return false;
+    }
+    bool sunk = false;
+    for (Node* user : usersInGraph(transpose->output(), graph)) {
+      if (user->kind() == kTranspose) {
+        sunk |= mergeTransposes(transpose, perm, user);
+      }
+    }
+    const auto users = usersInGraph(transpose->output(), graph);
+    if (users.size() == 1) {
+      sunk |= sinkThrough(graph, transpose, perm, users[0]);
+    }
+    return sunk;
+  }
+
+  // The Transposes are visited in topological order, and the Transpose moved
+  // after a node comes after it, so it is visited and moved further in the
+  // same run.
+  unsigned int sinkInGraph(Graph& graph) {
+    unsigned int sunk = 0;
+    for (auto it = graph.begin(); it != graph.end(); ++it) {
+      Node* node = *it;
+      sunk += DescendOnGraphAttributesAndCount(
+          node, [this](Graph& g) { return sinkInGraph(g); });
+      if (node->kind() != kTranspose || !sinkTranspose(graph, node)) {
+        continue;
+      }
+      VLOG(1) << Str("moved Transpose ", node->name());
+      ++sunk;
+      if (!node->hasUses()) {
+        it.destroyCurrent();
+      }
+    }
+    return sunk;
+  }
+
+  // Moves the Transposes of |graph| and of its subgraphs as far as they go,
+  // and returns how many moved.
+  unsigned int sink(Graph& graph) {
+    opset_version_ = PredicateBasedPass::getOpsetVersion(graph);
+    return sinkInGraph(graph);
+  }
+
+  std::shared_ptr<PostPassAnalysis> runPass(Graph& graph) override {
+    auto sunk = sink(graph);
+    return std::shared_ptr<PostPassAnalysis>(
+        new CountBasedPassAnalysis(this, sunk, false, false));
+  }
+
+ private:
+  int opset_version_ = 0;
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -0,0 +1,387 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+// Evaluation of shape computations over symbolic dims, e.g.
+//   S = Shape(X)                    X has shape=[batch, seq, 768]
+//   B = Gather(S, 0)                -> batch
+//   L = Gather(S, 1)                -> seq
+//   N = Mul(B, L)                   -> batch * seq
+//   T = Concat(Unsqueeze(N), [12], [64])  -> [batch * seq, 12, 64]
+// A dim that is not static is a symbol: its dim_param, which stands for the
+// same number wherever the model uses it, or the dim itself if it has none.
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "onnxoptimizer/pass.h"
+#include "onnxoptimizer/passes/pass_util.h"
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// |coefficient| times the product of |symbols|, each to the power it maps to.
+struct SymbolicDim {
+  int64_t coefficient = 1;
+  std::map<std::string, int> symbols;
+
+  SymbolicDim() = default;
+  explicit SymbolicDim(int64_t value) : coefficient(value) {}
+
+  // The dim |axis| of |value|, or false if it has no size.
+  static bool of(const Value* value, size_t axis, SymbolicDim& result) {
+    if (!value->has_sizes() || axis >= value->sizes().size()) {
+      return false;
+    }
+    const Dimension& dim = value->sizes()[axis];
+    result = SymbolicDim();
+    if (dim.is_int && dim.dim >= 0) {
+      result.coefficient = dim.dim;
+    } else if (!dim.is_int && !dim.is_unknown && !dim.param.empty()) {
+      result.symbols[dim.param] = 1;
+    } else {
+      // can't collide with a dim_param, which is an identifier
+      result.symbols["?" + value->uniqueName() + "#" + std::to_string(axis)] =
+          1;
+    }
+    return true;
+  }
+
+  bool isConstant() const {
+    return symbols.empty();
+  }
+
+  bool operator==(const SymbolicDim& other) const {
+    return coefficient == other.coefficient && symbols == other.symbols;
+  }
+
+  // Sets |result| to |a| * |b|, or returns false if it overflows.
+  static bool checkedMul(int64_t a, int64_t b, int64_t& result) {
+    constexpr int64_t max = std::numeric_limits<int64_t>::max();
+    constexpr int64_t min = std::numeric_limits<int64_t>::min();
+    if (a > 0 ? (b > 0 ? a > max / b : b < min / a)
+              : (b > 0 ? a < min / b : a != 0 && b < max / a)) {
+      return false;
+    }
+    result = a * b;
+    return true;
+  }
+
+  // Sets |result| to |a| + |b|, or returns false if it overflows.
+  static bool checkedAdd(int64_t a, int64_t b, int64_t& result) {
+    if (b > 0 ? a > std::numeric_limits<int64_t>::max() - b
+              : a < std::numeric_limits<int64_t>::min() - b) {
+      return false;
+    }
+    result = a + b;
+    return true;
+  }
+
+  static bool mul(const SymbolicDim& a, const SymbolicDim& b,
+                  SymbolicDim& result) {
+    int64_t coefficient;
+    if (!checkedMul(a.coefficient, b.coefficient, coefficient)) {
+      return false;
+    }
+    result = a;
+    result.coefficient = coefficient;
+    if (coefficient == 0) {
+      result.symbols.clear();
+      return true;
+    }
+    for (const auto& symbol : b.symbols) {
+      result.symbols[symbol.first] += symbol.second;
+    }
+    return true;
+  }
+
+  // Only exact divisions are known, like batch * 64 / 64 or 768 / 12.
+  // Integer division truncates, so the symbols of |b| have to divide |a|.
+  static bool div(const SymbolicDim& a, const SymbolicDim& b,
+                  SymbolicDim& result) {
+    // the quotient of the smallest int64_t by -1 overflows
+    if (b.coefficient == 0 ||
+        (b.coefficient == -1 &&
+         a.coefficient == std::numeric_limits<int64_t>::min()) ||
+        a.coefficient % b.coefficient != 0) {
+      return false;
+    }
+    if (a.coefficient == 0) {
+      result = a;
+      return true;
+    }
+    result = a;
+    result.coefficient = a.coefficient / b.coefficient;
+    for (const auto& symbol : b.symbols) {
+      auto it = result.symbols.find(symbol.first);
+      if (it == result.symbols.end() || it->second < symbol.second) {
+        return false;
+      }
+      it->second -= symbol.second;
+      if (it->second == 0) {
+        result.symbols.erase(it);
+      }
+    }
+    return true;
+  }
+
+  // Only sums of like terms are known, like 2 + 3 or seq + seq.
+  static bool add(const SymbolicDim& a, const SymbolicDim& b, int64_t sign,
+                  SymbolicDim& result) {
+    int64_t coefficient;
+    if (a.symbols != b.symbols && a.coefficient != 0 && b.coefficient != 0) {
+      return false;
+    }
+    if (!checkedMul(b.coefficient, sign, coefficient) ||
+        !checkedAdd(a.coefficient, coefficient, coefficient)) {
+      return false;
+    }
+    result = a.coefficient != 0 ? a : b;
+    result.coefficient = coefficient;
+    if (coefficient == 0) {
+      result.symbols.clear();
+    }
+    return true;
+  }
+};
+
+// The value of a scalar or 1-D integer tensor of a shape computation.
+struct SymbolicTensor {
+  bool is_scalar = false;
+  std::vector<SymbolicDim> elements;
+};
+
+// Evaluates shape computations made of Shape, Gather, Slice, Concat,
+// Unsqueeze, Squeeze, Cast, Identity, Add, Sub, Mul and Div over scalars and
+// 1-D tensors of integers.
+class SymbolicShapeEvaluator {
+ public:
+  // The value of |value|, or false if it is not known.
+  bool evaluate(const Value* value, SymbolicTensor& result) {
+    return evaluate(value, result, 0);
+  }
+
+  // Whether |kind| is one of the kinds evaluate looks through.
+  static bool isShapeComputation(NodeKind kind) {
+    static const std::vector<NodeKind> kinds = {
+        Symbol("Shape"), Symbol("Gather"), kSlice, kConcat,  kUnsqueeze,
+        kSqueeze,        kCast,            kAdd,   kSub,     kMul,
+        kDiv,            kIdentity,        kConstant};
+    return std::find(kinds.begin(), kinds.end(), kind) != kinds.end();
+  }
+
+ private:
+  static constexpr int kMaxDepth = 64;
+  static constexpr int64_t kMaxElements = 64;
+
+  static bool isInteger(int32_t elem_type) {
+    return elem_type == TensorProto_DataType_INT64 ||
+           elem_type == TensorProto_DataType_INT32;
+  }
+
+  static bool evaluateConstant(const Value* value, SymbolicTensor& result) {
+    const Tensor* tensor = FetchConstantTensor(value);
+    if (tensor == nullptr || !isInteger(tensor->elem_type()) ||
+        tensor->sizes().size() > 1 ||
+        ElemCntOfTensor(tensor) > kMaxElements) {
+      return false;
+    }
+    result.is_scalar = tensor->sizes().empty();
+    result.elements.clear();
+    if (tensor->elem_type() == TensorProto_DataType_INT64) {
+      for (const auto v : ParseTensorData<int64_t>(tensor)) {
+        result.elements.emplace_back(v);
+      }
+    } else {
+      for (const auto v : ParseTensorData<int32_t>(tensor)) {
+        result.elements.emplace_back(v);
+      }
+    }
+    return true;
+  }
+
+  static bool evaluateShape(const Node* node, SymbolicTensor& result) {
+    const Value* input = node->input();
+    if (!input->has_sizes()) {
+      return false;
+    }
+    const int64_t rank = input->sizes().size();
+    auto [start, end] = FetchStartAndEndAttrOfShape(node, rank);
+    start = std::min(std::max<int64_t>(start, 0), rank);
+    end = std::min(std::max<int64_t>(end, 0), rank);
+    result.is_scalar = false;
+    result.elements.clear();
+    for (int64_t axis = start; axis < end; ++axis) {
+      result.elements.emplace_back();
+      SymbolicDim::of(input, axis, result.elements.back());
+    }
+    return true;
+  }
+
+  bool evaluateGather(const Node* node, SymbolicTensor& result, int depth) {
+    SymbolicTensor data;
+    SymbolicTensor indices;
+    if (GetValueFromAttrWithDefault(node, kaxis, int64_t{0}) != 0 ||
+        !evaluate(node->input(0), data, depth) || data.is_scalar ||
+        !evaluateConstant(node->input(1), indices)) {
+      return false;
+    }
+    const int64_t size = data.elements.size();
+    result.is_scalar = indices.is_scalar;
+    result.elements.clear();
+    for (const auto& index : indices.elements) {
+      const int64_t i = AddYIfNegative(index.coefficient, size);
+      if (i < 0 || i >= size) {
+        return false;
+      }
+      result.elements.push_back(data.elements[i]);
+    }
+    return true;
+  }
+
+  bool evaluateSlice(const Node* node, SymbolicTensor& result, int depth) {
+    SymbolicTensor data;
+    std::vector<int64_t> starts, ends, axes, steps;
+    if (!evaluate(node->input(0), data, depth) || data.is_scalar ||
+        !GetValueFromAttrOrInput(node, "starts", 1, starts) ||
+        !GetValueFromAttrOrInput(node, "ends", 2, ends) ||
+        starts.size() != 1 || ends.size() != 1) {
+      return false;
+    }
+    const bool has_axes =
+        node->hasAttribute(kaxes) ||
+        (node->inputs().size() > 3 && !isOmitted(node->input(3)));
+    if (has_axes && (!GetValueFromAttrOrInput(node, kaxes, 3, axes) ||
+                     axes.size() != 1 || (axes[0] != 0 && axes[0] != -1))) {
+      return false;
+    }
+    if (node->inputs().size() > 4 && !isOmitted(node->input(4)) &&
+        (!GetValueFromInput(node->input(4), steps) || steps.size() != 1 ||
+         steps[0] != 1)) {
+      return false;
+    }
+    const int64_t size = data.elements.size();
+    const auto clamp = [size](int64_t i) {
+      return std::min(std::max<int64_t>(AddYIfNegative(i, size), 0), size);
+    };
+    const int64_t start = clamp(starts[0]);
+    const int64_t end = clamp(ends[0]);
+    result.is_scalar = false;
+    result.elements.assign(data.elements.begin() + start,
+                           data.elements.begin() + std::max(start, end));
+    return true;
+  }
+
+  bool evaluateConcat(const Node* node, SymbolicTensor& result, int depth) {
+    if (GetValueFromAttrWithDefault(node, kaxis, int64_t{0}) != 0 &&
+        GetValueFromAttrWithDefault(node, kaxis, int64_t{0}) != -1) {
+      return false;
+    }
+    result.is_scalar = false;
+    result.elements.clear();
+    for (const Value* input : node->inputs()) {
+      SymbolicTensor part;
+      if (!evaluate(input, part, depth) || part.is_scalar) {
+        return false;
+      }
+      result.elements.insert(result.elements.end(), part.elements.begin(),
+                             part.elements.end());
+    }
+    return true;
+  }
+
+  bool evaluateElementwise(const Node* node, SymbolicTensor& result,
+                           int depth) {
+    SymbolicTensor a, b;
+    if (node->inputs().size() != 2 || !evaluate(node->input(0), a, depth) ||
+        !evaluate(node->input(1), b, depth)) {
+      return false;
+    }
+    const size_t size = std::max(a.elements.size(), b.elements.size());
+    if ((a.elements.size() != size && a.elements.size() != 1) ||
+        (b.elements.size() != size && b.elements.size() != 1)) {
+      return false;
+    }
+    result.is_scalar = a.is_scalar && b.is_scalar;
+    result.elements.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+      const auto& x = a.elements[a.elements.size() == 1 ? 0 : i];
+      const auto& y = b.elements[b.elements.size() == 1 ? 0 : i];
+      bool known = false;
+      if (node->kind() == kMul) {
+        known = SymbolicDim::mul(x, y, result.elements[i]);
+      } else if (node->kind() == kDiv) {
+        known = SymbolicDim::div(x, y, result.elements[i]);
+      } else {
+        known = SymbolicDim::add(x, y, node->kind() == kAdd ? 1 : -1,
+                                 result.elements[i]);
+      }
+      if (!known) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool isOmitted(const Value* value) {
+    return value->node()->kind() == kUndefined;
+  }
+
+  bool evaluate(const Value* value, SymbolicTensor& result, int depth) {
+    if (++depth > kMaxDepth) {
+      return false;
+    }
+    if (IsConstantTensor(value)) {
+      return evaluateConstant(value, result);
+    }
+    const Node* node = value->node();
+    if (node->has_domain() && !node->domain().empty()) {
+      return false;
+    }
+    const auto kind = node->kind();
+    if (kind == Symbol("Shape")) {
+      return evaluateShape(node, result);
+    }
+    if (kind == Symbol("Gather")) {
+      return evaluateGather(node, result, depth);
+    }
+    if (kind == kSlice) {
+      return evaluateSlice(node, result, depth);
+    }
+    if (kind == kConcat) {
+      return evaluateConcat(node, result, depth);
+    }
+    if (kind == kAdd || kind == kSub || kind == kMul || kind == kDiv) {
+      return evaluateElementwise(node, result, depth);
+    }
+    if (kind == kCast) {
+      return isInteger(node->i(kto)) && evaluate(node->input(), result, depth);
+    }
+    if (kind == kIdentity) {
+      return evaluate(node->input(), result, depth);
+    }
+    if (kind == kUnsqueeze || kind == kSqueeze) {
+      // between a scalar and a tensor of one element
+      if (!evaluate(node->input(0), result, depth) ||
+          result.elements.size() != 1 ||
+          result.is_scalar != (kind == kUnsqueeze)) {
+        return false;
+      }
+      result.is_scalar = !result.is_scalar;
+      return true;
+    }
+    return false;
+  }
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE
@@ -24,6 +24,27 @@ int64_t ElemCntOfTensor(const Tensor& tensor) {
   return ElemCntOfTensor(&tensor);
 }
 
+bool HasRawTensorData(const Tensor* tensor) {
+  return tensor->is_raw_data() || HasTensorDataSource(*tensor);
+}
+
+TensorDataSlice RawTensorData(const Tensor* tensor) {
+  if (HasTensorDataSource(*tensor)) {
+    return TensorDataFromSource(*tensor);
+  }
+  return TensorDataSlice(tensor->raw());
+}
+
+namespace {
+// Reverses the bytes of each of the |size| / |element_size| elements at
+// |bytes|, as onnx serializes in little endian always.
+void SwapBytes(char* bytes, size_t size, size_t element_size) {
+  for (size_t i = 0; i + element_size <= size; i += element_size) {
+    std::reverse(bytes + i, bytes + i + element_size);
+  }
+}
+}  // namespace
+
 /// reference onnx/defs/tensor_util.cc
 
 #define DEFINE_PARSE_TENSOR_DATA(type, typed_data_fetch)                   \
@@ -31,42 +52,23 @@ int64_t ElemCntOfTensor(const Tensor& tensor) {
   const std::vector<type> ParseTensorData(const Tensor* tensor) {          \
     ONNX_ASSERT(tensor != nullptr);                                        \
     std::vector<type> res;                                                 \
-    if (!tensor->is_raw_data()) {                                          \
+    if (!HasRawTensorData(tensor)) {                                       \
       const auto& data = tensor->typed_data_fetch();                       \
       res.insert(res.end(), data.begin(), data.end());                     \
       return res;                                                          \
     }                                                                      \
-    /* make copy as we may have to reverse bytes */                        \
-    std::string raw_data = tensor->raw();                                  \
-    /* okay to remove const qualifier as we have already made a copy */    \
-    char* bytes = const_cast<char*>(raw_data.c_str());                     \
+    const auto slice = RawTensorData(tensor);                              \
+    const std::string_view raw_data = slice.bytes();                       \
+    const size_t elem_cnt = static_cast<size_t>(ElemCntOfTensor(tensor));  \
+    ONNX_ASSERT(elem_cnt == (raw_data.size() / sizeof(type)));             \
+    res.resize(elem_cnt);                                                  \
+    /* copy as bytes, raw_data may not be aligned for the type */          \
+    char* bytes = reinterpret_cast<char*>(res.data());                     \
+    memcpy(bytes, raw_data.data(), elem_cnt * sizeof(type));               \
     /*onnx is little endian serialized always-tweak byte order if needed*/ \
     if (!is_processor_little_endian()) {                                   \
-      const size_t element_size = sizeof(type);                            \
-      const size_t num_elements = raw_data.size() / element_size;          \
-      for (size_t i = 0; i < num_elements; ++i) {                          \
-        char* start_byte = bytes + i * element_size;                       \
-        char* end_byte = start_byte + element_size - 1;                    \
-        /* keep swapping */                                                \
-        for (size_t count = 0; count < element_size / 2; ++count) {        \
-          char temp = *start_byte;                                         \
-          *start_byte = *end_byte;                                         \
-          *end_byte = temp;                                                \
-          ++start_byte;                                                    \
-          --end_byte;                                                      \
-        }                                                                  \
-      }                                                                    \
+      SwapBytes(bytes, elem_cnt * sizeof(type), sizeof(type));             \
     }                                                                      \
-    /* raw_data.c_str()/bytes is a byte array and may not be properly  */  \
-    /* aligned for the underlying type */                                  \
-    /* We need to copy the raw_data.c_str()/bytes as byte instead of  */   \
-    /* copying as the underlying type, otherwise we may hit memory   */    \
-    /* misalignment issues on certain platforms, such as arm32-v7a */      \
-    const size_t raw_data_size = raw_data.size();                          \
-    const size_t elem_cnt = static_cast<size_t>(ElemCntOfTensor(tensor));  \
-    ONNX_ASSERT(elem_cnt == (raw_data_size / sizeof(type)));               \
-    res.resize(elem_cnt);                                                  \
-    memcpy(reinterpret_cast<char*>(res.data()), bytes, raw_data_size);     \
     return res;                                                            \
   }
 
@@ -88,13 +90,14 @@ DEFINE_PARSE_TENSOR_DATA(BFloat16, int32s)
 template <>
 const std::vector<bool> ParseTensorData<bool>(const Tensor* tensor) {
   std::vector<bool> res;
-  if (!tensor->is_raw_data()) {
+  if (!HasRawTensorData(tensor)) {
     std::transform(tensor->int32s().cbegin(), tensor->int32s().cend(),
                    std::back_inserter(res),
                    [](int32_t d) -> bool { return static_cast<bool>(d); });
     return res;
   }
-  const auto& raw_data = tensor->raw();
+  const auto slice = RawTensorData(tensor);
+  const std::string_view raw_data = slice.bytes();
   const size_t elem_cnt = static_cast<size_t>(ElemCntOfTensor(tensor));
   ONNX_ASSERT(elem_cnt == raw_data.size());
   res.reserve(elem_cnt);
@@ -124,42 +127,23 @@ const std::vector<Complex> FlattenToComplex(
   template <>                                                              \
   const std::vector<type> ParseTensorData<type>(const Tensor* tensor) {    \
     ONNX_ASSERT(tensor != nullptr);                                        \
-    if (!tensor->is_raw_data()) {                                          \
+    if (!HasRawTensorData(tensor)) {                                       \
       return FlattenToComplex<type>(tensor->typed_data_fetch());           \
     }                                                                      \
-    /* make copy as we may have to reverse bytes */                        \
-    std::string raw_data = tensor->raw();                                  \
-    /* okay to remove const qualifier as we have already made a copy */    \
-    char* bytes = const_cast<char*>(raw_data.c_str());                     \
+    const auto slice = RawTensorData(tensor);                              \
+    const std::string_view raw_data = slice.bytes();                       \
+    const size_t elem_cnt = static_cast<size_t>(ElemCntOfTensor(tensor));  \
+    ONNX_ASSERT(elem_cnt == (raw_data.size() / sizeof(type)));             \
+    std::vector<type> res(elem_cnt);                                       \
+    /* copy as bytes, raw_data may not be aligned for the type */          \
+    char* bytes = reinterpret_cast<char*>(res.data());                     \
+    memcpy(bytes, raw_data.data(), elem_cnt * sizeof(type));               \
     /*onnx is little endian serialized always-tweak byte order if needed*/ \
     if (!is_processor_little_endian()) {                                   \
-      const size_t element_size = sizeof(typename type::base_type);        \
-      const size_t num_elements = raw_data.size() / element_size;          \
-      for (size_t i = 0; i < num_elements; ++i) {                          \
-        char* start_byte = bytes + i * element_size;                       \
-        char* end_byte = start_byte + element_size - 1;                    \
-        /* keep swapping */                                                \
-        for (size_t count = 0; count < element_size / 2; ++count) {        \
-          char temp = *start_byte;                                         \
-          *start_byte = *end_byte;                                         \
-          *end_byte = temp;                                                \
-          ++start_byte;                                                    \
-          --end_byte;                                                      \
-        }                                                                  \
-      }                                                                    \
+      SwapBytes(bytes, elem_cnt * sizeof(type),                            \
+                sizeof(typename type::base_type));                         \
     }                                                                      \
-    /* raw_data.c_str()/bytes is a byte array and may not be properly  */  \
-    /* aligned for the underlying type */                                  \
-    /* We need to copy the raw_data.c_str()/bytes as byte instead of  */   \
-    /* copying as the underlying type, otherwise we may hit memory   */    \
-    /* misalignment issues on certain platforms, such as arm32-v7a */      \
-    const size_t raw_data_size = raw_data.size();                          \
-    const size_t elem_cnt = static_cast<size_t>(ElemCntOfTensor(tensor));  \
-    ONNX_ASSERT(elem_cnt == (raw_data_size / sizeof(type)));               \
-    std::vector<typename type::base_type> flatten;                         \
-    flatten.resize(elem_cnt * 2);                                          \
-    memcpy(reinterpret_cast<char*>(flatten.data()), bytes, raw_data_size); \
-    return FlattenToComplex<type>(flatten);                                \
+    return res;                                                            \
   }
 
 DEFINE_PARSE_TENSOR_DATA_WITH_COMPLEX(Complex64, floats)
@@ -178,5 +162,48 @@ const std::vector<std::string> ParseTensorData<std::string>(
   return tensor->strings();
 }
 
+bool TensorBytes(const Tensor* tensor, std::string* storage,
+                 TensorDataSlice* bytes) {
+  ONNX_ASSERT(tensor != nullptr);
+  if (HasRawTensorData(tensor)) {
+    *bytes = RawTensorData(tensor);
+    return true;
+  }
+  if (!is_processor_little_endian()) {
+    return false;
+  }
+  switch (tensor->elem_type()) {
+#define CASE_TENSOR_BYTES(pb_type, cpp_type)                    \
+  case TensorProto_DataType_##pb_type: {                        \
+    const TensorView<cpp_type> data(tensor);                    \
+    storage->assign(reinterpret_cast<const char*>(data.data()), \
+                    data.size() * sizeof(cpp_type));            \
+    break;                                                      \
+  }
+
+    CASE_TENSOR_BYTES(FLOAT, float)
+    CASE_TENSOR_BYTES(DOUBLE, double)
+    CASE_TENSOR_BYTES(INT8, int8_t)
+    CASE_TENSOR_BYTES(INT16, int16_t)
+    CASE_TENSOR_BYTES(INT32, int32_t)
+    CASE_TENSOR_BYTES(INT64, int64_t)
+    CASE_TENSOR_BYTES(UINT8, uint8_t)
+    CASE_TENSOR_BYTES(UINT16, uint16_t)
+    CASE_TENSOR_BYTES(UINT32, uint32_t)
+    CASE_TENSOR_BYTES(UINT64, uint64_t)
+    CASE_TENSOR_BYTES(BOOL, bool)
+    CASE_TENSOR_BYTES(FLOAT16, Float16)
+    CASE_TENSOR_BYTES(BFLOAT16, BFloat16)
+    CASE_TENSOR_BYTES(COMPLEX64, Complex64)
+    CASE_TENSOR_BYTES(COMPLEX128, Complex128)
+#undef CASE_TENSOR_BYTES
+
+    default:
+      return false;
+  }
+  *bytes = TensorDataSlice(*storage);
+  return true;
+}
+
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
\ No newline at end of file
@@ -7,9 +7,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "onnx/common/platform_helpers.h"
 #include "onnx/common/tensor.h"
+#include "onnxoptimizer/external_data.h"
 #include "onnxoptimizer/passes/data_type.h"
 
 namespace ONNX_NAMESPACE {
@@ -21,5 +30,125 @@ int64_t ElemCntOfTensor(const Tensor& tensor);
 template <typename T>
 const std::vector<T> ParseTensorData(const Tensor* tensor);
 
+// Whether the values of |tensor| are raw bytes, either its raw_data or the
+// bytes of the source it refers to (see external_data.h).
+bool HasRawTensorData(const Tensor* tensor);
+
+// The raw bytes of a tensor for which HasRawTensorData holds. They keep its
+// source alive, and stay valid as long as the tensor does.
+TensorDataSlice RawTensorData(const Tensor* tensor);
+
+// Sets |bytes| to the values of |tensor| in the layout of raw_data: its raw
+// bytes if it has them, or else its typed data converted into |storage|.
+// Returns false for tensors of strings or of unknown types, and for typed
+// data on big-endian hosts.
+bool TensorBytes(const Tensor* tensor, std::string* storage,
+                 TensorDataSlice* bytes);
+
+// A read-only view of the elements of a tensor that, unlike ParseTensorData,
+// does not copy them when it can alias them: raw bytes are aliased on
+// little-endian hosts when they are aligned for T, and typed data when it is
+// stored as T. The elements are copied otherwise, e.g. for FLOAT16 stored in
+// int32_data, and always for bool. The tensor must outlive the view.
+template <typename T>
+class TensorView {
+ public:
+  explicit TensorView(const Tensor* tensor) {
+    ONNX_ASSERT(tensor != nullptr);
+    size_ = static_cast<size_t>(ElemCntOfTensor(tensor));
+    if (!alias(tensor)) {
+      const auto elements = ParseTensorData<T>(tensor);
+      size_ = elements.size();
+      copy_.reset(new T[size_]);
+      std::copy(elements.begin(), elements.end(), copy_.get());
+      data_ = copy_.get();
+    }
+  }
+
+  TensorView(const TensorView&) = delete;
+  TensorView& operator=(const TensorView&) = delete;
+  TensorView(TensorView&&) = default;
+  TensorView& operator=(TensorView&&) = default;
+
+  const T* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  const T* begin() const {
+    return data_;
+  }
+  const T* end() const {
+    return data_ + size_;
+  }
+  const T& operator[](size_t i) const {
+    return data_[i];
+  }
+
+ private:
+  bool alias(const Tensor* tensor) {
+    if constexpr (std::is_same_v<T, bool>) {
+      return false;
+    } else if (HasRawTensorData(tensor)) {
+      if constexpr (std::is_same_v<T, std::string>) {
+        return false;
+      } else {
+        if (!is_processor_little_endian()) {
+          return false;
+        }
+        raw_ = RawTensorData(tensor);
+        const auto bytes = raw_.bytes();
+        ONNX_ASSERT(bytes.size() == size_ * sizeof(T));
+        if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(T) == 0) {
+          data_ = reinterpret_cast<const T*>(bytes.data());
+        } else {
+          copy_.reset(new T[size_]);
+          std::memcpy(copy_.get(), bytes.data(), bytes.size());
+          data_ = copy_.get();
+        }
+        return true;
+      }
+    } else if constexpr (std::is_same_v<T, int32_t>) {
+      return aliasTyped(tensor->int32s(), 1);
+    } else if constexpr (std::is_same_v<T, int64_t>) {
+      return aliasTyped(tensor->int64s(), 1);
+    } else if constexpr (std::is_same_v<T, uint64_t>) {
+      return aliasTyped(tensor->uint64s(), 1);
+    } else if constexpr (std::is_same_v<T, float>) {
+      return aliasTyped(tensor->floats(), 1);
+    } else if constexpr (std::is_same_v<T, double>) {
+      return aliasTyped(tensor->doubles(), 1);
+    } else if constexpr (std::is_same_v<T, Complex64>) {
+      return aliasTyped(tensor->floats(), 2);
+    } else if constexpr (std::is_same_v<T, Complex128>) {
+      return aliasTyped(tensor->doubles(), 2);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      return aliasTyped(tensor->strings(), 1);
+    }
+    return false;
+  }
+
+  // |stored| holds |per_element| values of it for each element.
+  template <typename Stored>
+  bool aliasTyped(const std::vector<Stored>& stored, size_t per_element) {
+    if (stored.size() != size_ * per_element) {
+      return false;
+    }
+    data_ = reinterpret_cast<const T*>(stored.data());
+    return true;
+  }
+
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+  // holds the elements if they could not be aliased
+  std::unique_ptr<T[]> copy_;
+  // keeps the source of the aliased raw bytes alive
+  TensorDataSlice raw_;
+};
+
 }  // namespace optimization
 }  // namespace ONNX_NAMESPACE
\ No newline at end of file
@@ -1,10 +1,12 @@
 # SPDX-License-Identifier: Apache-2.0
 
 from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
 from typing import Sequence, Text, Any, Tuple, List, Callable, Optional, Dict, Union
 import io
 import unittest
 import os
+import tempfile
 
 import numpy as np  # type: ignore
 
@@ -205,6 +207,10 @@ class TestOptimizer(unittest.TestCase):
         graph_or_model,
         opts,
         fixed_point=False,
+        worklist=False,
+        dispatch=False,
+        scheduled=False,
+        num_threads=1,
         compare_result=True,
         check=True,
         input_shapes_for_comparing=None,
@@ -228,7 +234,15 @@ class TestOptimizer(unittest.TestCase):
             )
         if check:
             checker.check_model(orig_model)
-        optimized_model = onnxoptimizer.optimize(orig_model, opts, fixed_point)
+        optimized_model = onnxoptimizer.optimize(
+            orig_model,
+            opts,
+            fixed_point,
+            worklist=worklist,
+            dispatch=dispatch,
+            scheduled=scheduled,
+            num_threads=num_threads,
+        )
         # NOTE(daquexian): Some passes (like lift_lexical_references) generate illegal model intentionally
         if check:
             checker.check_model(optimized_model)
@@ -653,6 +667,150 @@ class TestOptimizer(unittest.TestCase):
             assert len(optimized_model.graph.input) == 1
             assert optimized_model.graph.node[0].input[1] == "I_0"
 
+    def test_eliminate_duplicate_initializer_compares_bytes(self):  # type: () -> None
+        # initializers are equal if they have the same type, shape and bytes,
+        # however their values are stored
+        i = np.random.rand(2, 3).astype(np.float32)
+        zeros = np.zeros((2, 3), dtype=np.float32)
+        names = ["raw", "typed", "reshaped", "zeros", "negative_zeros"]
+        graph = helper.make_graph(
+            [helper.make_node("Identity", [name], [name + "_out"]) for name in names],
+            "test",
+            [],
+            [
+                helper.make_tensor_value_info(
+                    name + "_out", TensorProto.FLOAT, (3, 2) if name == "reshaped" else (2, 3)
+                )
+                for name in names
+            ],
+            [
+                helper.make_tensor(
+                    "raw", TensorProto.FLOAT, (2, 3), i.tobytes(), raw=True
+                ),
+                helper.make_tensor("typed", TensorProto.FLOAT, (2, 3), i.flatten()),
+                helper.make_tensor(
+                    "reshaped", TensorProto.FLOAT, (3, 2), i.tobytes(), raw=True
+                ),
+                helper.make_tensor(
+                    "zeros", TensorProto.FLOAT, (2, 3), zeros.tobytes(), raw=True
+                ),
+                helper.make_tensor(
+                    "negative_zeros",
+                    TensorProto.FLOAT,
+                    (2, 3),
+                    (-zeros).tobytes(),
+                    raw=True,
+                ),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph, ["eliminate_duplicate_initializer"], compare_result=False
+        )
+
+        assert [n.input[0] for n in optimized_model.graph.node] == [
+            "raw",
+            "raw",
+            "reshaped",
+            "zeros",
+            "negative_zeros",
+        ]
+        assert len(optimized_model.graph.initializer) == 4
+
+    def test_optimize_with_detached_initializers(self):  # type: () -> None
+        # the data of large initializers is detached from the model while the
+        # passes run, and moved into the optimized model at the end
+        w = np.random.rand(32, 32).astype(np.float32)
+        other_w = np.random.rand(32, 32).astype(np.float32)
+        graph = helper.make_graph(
+            [
+                helper.make_node("MatMul", ["X", "W_0"], ["A"]),
+                helper.make_node("MatMul", ["A", "W_1"], ["B"]),
+                helper.make_node("MatMul", ["B", "W_2"], ["Y"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (4, 32))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (4, 32))],
+            [
+                numpy_helper.from_array(w, "W_0"),
+                numpy_helper.from_array(w, "W_1"),
+                numpy_helper.from_array(other_w, "W_2"),
+            ],
+        )
+        optimized_model = self._optimized(graph, ["eliminate_duplicate_initializer"])
+
+        assert [n.input[1] for n in optimized_model.graph.node] == ["W_0", "W_0", "W_2"]
+        for tensor in optimized_model.graph.initializer:
+            assert tensor.data_location == TensorProto.DEFAULT
+            assert len(tensor.external_data) == 0
+        initializers = {t.name: to_array(t) for t in optimized_model.graph.initializer}
+        np.testing.assert_array_equal(initializers["W_0"], w)
+        np.testing.assert_array_equal(initializers["W_2"], other_w)
+
+    def test_optimize_from_path_with_external_data(self):  # type: () -> None
+        # the weights are mapped from the data file instead of being read, and
+        # eliminate_duplicate_initializer has to compare them
+        w = np.random.rand(32, 32).astype(np.float32)
+        other_w = np.random.rand(32, 32).astype(np.float32)
+        graph = helper.make_graph(
+            [
+                helper.make_node("MatMul", ["X", "W_0"], ["A"]),
+                helper.make_node("MatMul", ["A", "W_1"], ["B"]),
+                helper.make_node("MatMul", ["B", "W_2"], ["Y"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (4, 32))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (4, 32))],
+            [
+                numpy_helper.from_array(w, "W_0"),
+                numpy_helper.from_array(w, "W_1"),
+                numpy_helper.from_array(other_w, "W_2"),
+            ],
+        )
+        model = helper.make_model(graph, producer_name="onnx-test")
+        optimized_model, _ = onnxoptimizer._optimize_through_files(
+            model,
+            ["eliminate_duplicate_initializer"],
+            onnxoptimizer.C.optimize_from_path,
+        )
+
+        assert [n.input[1] for n in optimized_model.graph.node] == ["W_0", "W_0", "W_2"]
+        initializers = {t.name: to_array(t) for t in optimized_model.graph.initializer}
+        assert sorted(initializers) == ["W_0", "W_2"]
+        np.testing.assert_array_equal(initializers["W_0"], w)
+        np.testing.assert_array_equal(initializers["W_2"], other_w)
+
+    def test_optimize_from_path_aligns_external_data(self):  # type: () -> None
+        small = np.random.rand(301).astype(np.float32)
+        large = np.random.rand(64, 64).astype(np.float32)
+        graph = helper.make_graph(
+            [
+                helper.make_node("Add", ["X", "S"], ["A"]),
+                helper.make_node("MatMul", ["A", "L"], ["Y"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (64, 301))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (64, 64))],
+            [numpy_helper.from_array(small, "S"), numpy_helper.from_array(large, "L")],
+        )
+        model = helper.make_model(graph, producer_name="onnx-test")
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            file_src = os.path.join(tmp_dir, "model.onnx")
+            file_dest = os.path.join(tmp_dir, "optimized_model.onnx")
+            onnx.save(model, file_src)
+            onnxoptimizer.C.optimize_from_path(file_src, file_dest, [], "optimized_model.data")
+            optimized_model = onnx.load(file_dest, load_external_data=False)
+            offsets = {
+                t.name: int({e.key: e.value for e in t.external_data}["offset"])
+                for t in optimized_model.graph.initializer
+            }
+            onnx.load_external_data_for_model(optimized_model, tmp_dir)
+
+        assert offsets["S"] % 64 == 0
+        assert offsets["L"] % 4096 == 0
+        initializers = {t.name: to_array(t) for t in optimized_model.graph.initializer}
+        np.testing.assert_array_equal(initializers["S"], small)
+        np.testing.assert_array_equal(initializers["L"], large)
+
     def test_nop_cast(self):  # type: () -> None
         identity = helper.make_node("Identity", ["X"], ["A"])
         cast = helper.make_node("Cast", ["A"], ["B"], to=TensorProto.FLOAT)
@@ -1203,6 +1361,412 @@ class TestOptimizer(unittest.TestCase):
         assert len(list(optimized_model.graph.node)) == 4
         assert optimized_model.graph == graph
 
+    def test_worklist_matches_fixed_point(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Transpose", ["X"], ["A"], perm=[1, 0, 2]),
+            helper.make_node("Identity", ["A"], ["B"]),
+            helper.make_node("Transpose", ["B"], ["C"], perm=[1, 0, 2]),
+            helper.make_node("Identity", ["C"], ["D"]),
+            helper.make_node("Relu", ["D"], ["Y"]),
+        ]
+        nodes.extend(
+            self._make_fake_loop_op(
+                [
+                    helper.make_node("Transpose", ["_X"], ["_A"], perm=[1, 0, 2]),
+                    helper.make_node("Identity", ["_A"], ["_B"]),
+                    helper.make_node("Transpose", ["_B"], ["_C"], perm=[1, 0, 2]),
+                    helper.make_node("Relu", ["_C"], ["_Y2"]),
+                ],
+                [(TensorProto.FLOAT, (2, 3, 4), "X")],
+                [(TensorProto.FLOAT, (2, 3, 4), "Y2")],
+            )
+        )
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            [
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3, 4)),
+                helper.make_tensor_value_info("Y2", TensorProto.FLOAT, (2, 3, 4)),
+            ],
+        )
+        passes = [
+            "eliminate_identity",
+            "fuse_consecutive_transposes",
+            "eliminate_nop_transpose",
+        ]
+        fixed_point_model = self._optimized(graph, passes, fixed_point=True)
+        worklist_model = self._optimized(graph, passes, worklist=True)
+
+        assert worklist_model.graph == fixed_point_model.graph
+        # Relu, Constant (trip count), Constant (cond), Loop
+        assert len(worklist_model.graph.node) == 4
+        assert worklist_model.graph.node[0].op_type == "Relu"
+        # Relu
+        assert len(worklist_model.graph.node[3].attribute[0].g.node) == 1
+
+    def test_worklist_rounds_match_fixed_point(self):  # type: () -> None
+        # Both passes are partially efficient, so every rewrite they do is only
+        # followed up by the later rounds of the worklist
+        nodes = [
+            helper.make_node("Exp", ["X"], ["A"]),
+            helper.make_node("Exp", ["A"], ["B"]),
+            helper.make_node("Exp", ["B"], ["C"]),
+            helper.make_node("ArgMax", ["C"], ["Y"], axis=1),
+            helper.make_node("Concat", ["X", "X"], ["D"], axis=0),
+            helper.make_node("Concat", ["D", "X"], ["E"], axis=0),
+            helper.make_node("Concat", ["E", "D"], ["F"], axis=0),
+            helper.make_node("Concat", ["X", "F"], ["Z"], axis=0),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3))],
+            [
+                helper.make_tensor_value_info("Y", TensorProto.INT64, (2, 1)),
+                helper.make_tensor_value_info("Z", TensorProto.FLOAT, (14, 3)),
+            ],
+        )
+        passes = ["eliminate_nop_monotone_argmax", "fuse_consecutive_concats"]
+        fixed_point_model = self._optimized(graph, passes, fixed_point=True)
+        worklist_model = self._optimized(graph, passes, worklist=True)
+
+        assert worklist_model.graph == fixed_point_model.graph
+        # D has two uses, so it is kept
+        assert [n.op_type for n in worklist_model.graph.node] == [
+            "ArgMax",
+            "Concat",
+            "Concat",
+        ]
+        assert worklist_model.graph.node[2].input == ["X", "D", "X", "D"]
+
+    def test_scheduled_reruns_affected_passes(self):  # type: () -> None
+        transpose = helper.make_node("Transpose", ["X"], ["A"], perm=[1, 0])
+        matmul = helper.make_node("MatMul", ["A", "W"], ["B"])
+        add = helper.make_node("Add", ["B", "C"], ["Y"])
+        graph = helper.make_graph(
+            [transpose, matmul, add],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 2)),
+                helper.make_tensor_value_info("W", TensorProto.FLOAT, (3, 4)),
+                helper.make_tensor_value_info("C", TensorProto.FLOAT, (4,)),
+            ],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 4))],
+            value_info=[
+                helper.make_tensor_value_info("A", TensorProto.FLOAT, (2, 3))
+            ],
+        )
+        # fuse_matmul_add_bias_into_gemm produces a Gemm, so
+        # fuse_transpose_into_gemm has to run again
+        passes = [
+            "fuse_transpose_into_gemm",
+            "fuse_matmul_add_bias_into_gemm",
+            "eliminate_deadend",
+        ]
+        fixed_point_model = self._optimized(graph, passes, fixed_point=True)
+        scheduled_model = self._optimized(graph, passes, scheduled=True)
+
+        assert len(fixed_point_model.graph.node) == 2
+        assert len(scheduled_model.graph.node) == 1
+        assert scheduled_model.graph.node[0].op_type == "Gemm"
+        attrs = {attr.name: attr for attr in scheduled_model.graph.node[0].attribute}
+        assert attrs["transA"].i == 1
+
+    def test_dispatch_matches_fixed_point(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Identity", ["X"], ["A"]),
+            helper.make_node("Transpose", ["A"], ["B"], perm=[1, 0, 2]),
+            helper.make_node("Transpose", ["B"], ["C"], perm=[1, 0, 2]),
+            helper.make_node("Relu", ["C"], ["D"]),
+            helper.make_node("Relu", ["D"], ["E"]),
+            helper.make_node("Identity", ["E"], ["Y"]),
+        ]
+        nodes.extend(
+            self._make_fake_loop_op(
+                [
+                    helper.make_node("Transpose", ["_X"], ["_A"], perm=[1, 0, 2]),
+                    helper.make_node("Transpose", ["_A"], ["_B"], perm=[1, 0, 2]),
+                    helper.make_node("Relu", ["_B"], ["_Y2"]),
+                ],
+                [(TensorProto.FLOAT, (2, 3, 4), "X")],
+                [(TensorProto.FLOAT, (2, 3, 4), "Y2")],
+            )
+        )
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            [
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 3, 4)),
+                helper.make_tensor_value_info("Y2", TensorProto.FLOAT, (2, 3, 4)),
+            ],
+        )
+        # eliminate_deadend is not a predicate based pass, so it splits the
+        # passes into two groups
+        passes = [
+            "eliminate_consecutive_idempotent_ops",
+            "fuse_consecutive_transposes",
+            "eliminate_deadend",
+            "eliminate_nop_transpose",
+            "eliminate_identity",
+        ]
+        fixed_point_model = self._optimized(graph, passes, fixed_point=True)
+        dispatch_model = self._optimized(graph, passes, dispatch=True)
+
+        assert dispatch_model.graph == fixed_point_model.graph
+        assert [n.op_type for n in dispatch_model.graph.node].count("Relu") == 1
+        assert "Transpose" not in [n.op_type for n in dispatch_model.graph.node]
+        # Relu
+        assert len(dispatch_model.graph.node[-1].attribute[0].g.node) == 1
+
+    def test_parallel_subgraphs_match_sequential(self):  # type: () -> None
+        nodes = self._make_fake_loop_op(
+            [helper.make_node("Identity", ["_X"], ["_Y0"])],
+            [(TensorProto.FLOAT, (2, 3, 4), "X")],
+            [(TensorProto.FLOAT, (2, 3, 4), "Y0")],
+        )
+        outputs = [helper.make_tensor_value_info("Y0", TensorProto.FLOAT, (2, 3, 4))]
+        # sibling bodies that are optimized concurrently, each with a nested one
+        for i in range(1, 9):
+            inner = helper.make_graph(
+                [
+                    helper.make_node("Transpose", ["_X"], ["_A"], perm=[1, 0, 2]),
+                    helper.make_node("Transpose", ["_A"], ["_B"], perm=[1, 0, 2]),
+                    helper.make_node("Identity", ["_B"], ["_Z"]),
+                ],
+                "then_graph",
+                [],
+                [helper.make_tensor_value_info("_Z", TensorProto.FLOAT, (2, 3, 4))],
+            )
+            body = helper.make_graph(
+                [
+                    helper.make_node(
+                        "If", ["cond"], ["_Z"], then_branch=inner, else_branch=inner
+                    ),
+                    helper.make_node("Relu", ["_Z"], ["_C"]),
+                    helper.make_node("Relu", ["_C"], ["_Y{}".format(i)]),
+                ],
+                "body_graph",
+                [
+                    helper.make_tensor_value_info("i", TensorProto.INT64, ()),
+                    helper.make_tensor_value_info("cond", TensorProto.BOOL, ()),
+                    helper.make_tensor_value_info("_X", TensorProto.FLOAT, (2, 3, 4)),
+                ],
+                [
+                    helper.make_tensor_value_info("cond", TensorProto.BOOL, ()),
+                    helper.make_tensor_value_info(
+                        "_Y{}".format(i), TensorProto.FLOAT, (2, 3, 4)
+                    ),
+                ],
+            )
+            nodes.append(
+                helper.make_node(
+                    "Loop",
+                    ["trip_count", "condition", "X"],
+                    ["Y{}".format(i)],
+                    body=body,
+                )
+            )
+            outputs.append(
+                helper.make_tensor_value_info(
+                    "Y{}".format(i), TensorProto.FLOAT, (2, 3, 4)
+                )
+            )
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            outputs,
+        )
+        passes = [
+            "eliminate_consecutive_idempotent_ops",
+            "fuse_consecutive_transposes",
+            "eliminate_nop_transpose",
+            "eliminate_identity",
+        ]
+        for fixed_point in [False, True]:
+            sequential_model = self._optimized(graph, passes, fixed_point=fixed_point)
+            parallel_model = self._optimized(
+                graph, passes, fixed_point=fixed_point, num_threads=4
+            )
+
+            assert parallel_model.graph == sequential_model.graph
+        for node in parallel_model.graph.node[3:]:
+            then_branch = node.attribute[0].g.node[0].attribute[0].g
+            assert "Transpose" not in [n.op_type for n in then_branch.node]
+
+    def test_parallel_subgraphs_capturing_rewritten_values(self):  # type: () -> None
+        # the parent graph is rewritten after the branches have been optimized
+        # in parallel mode, but before them otherwise
+        branch = helper.make_graph(
+            [
+                helper.make_node("Transpose", ["A"], ["_A"], perm=[1, 0, 2]),
+                helper.make_node("Identity", ["_A"], ["_B"]),
+                helper.make_node("Transpose", ["_B"], ["_Z"], perm=[1, 0, 2]),
+            ],
+            "branch",
+            [],
+            [helper.make_tensor_value_info("_Z", TensorProto.FLOAT, (2, 3, 4))],
+        )
+        nodes = [
+            helper.make_node("Transpose", ["X"], ["T"], perm=[1, 0, 2]),
+            helper.make_node("Transpose", ["T"], ["A"], perm=[1, 0, 2]),
+        ]
+        outputs = []
+        for i in range(4):
+            nodes.append(
+                helper.make_node(
+                    "If",
+                    ["cond"],
+                    ["Y{}".format(i)],
+                    then_branch=branch,
+                    else_branch=branch,
+                )
+            )
+            outputs.append(
+                helper.make_tensor_value_info(
+                    "Y{}".format(i), TensorProto.FLOAT, (2, 3, 4)
+                )
+            )
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4)),
+                helper.make_tensor_value_info("cond", TensorProto.BOOL, ()),
+            ],
+            outputs,
+        )
+        passes = [
+            "eliminate_identity",
+            "fuse_consecutive_transposes",
+            "eliminate_nop_transpose",
+        ]
+        for fixed_point in [False, True]:
+            sequential_model = self._optimized(graph, passes, fixed_point=fixed_point)
+            parallel_model = self._optimized(
+                graph, passes, fixed_point=fixed_point, num_threads=4
+            )
+
+            assert parallel_model.graph == sequential_model.graph
+        assert [n.op_type for n in parallel_model.graph.node] == ["If"] * 4
+
+    def test_concurrent_optimize(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Identity", ["X"], ["A"]),
+            helper.make_node("Transpose", ["A"], ["B"], perm=[1, 0]),
+            helper.make_node("Transpose", ["B"], ["C"], perm=[1, 0]),
+            helper.make_node("Transpose", ["C"], ["D"], perm=[1, 0]),
+            helper.make_node("Gemm", ["D", "W", "b"], ["Y"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 2)),
+                helper.make_tensor_value_info("W", TensorProto.FLOAT, (3, 4)),
+                helper.make_tensor_value_info("b", TensorProto.FLOAT, (4,)),
+            ],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 4))],
+        )
+        model = helper.make_model(graph, producer_name="onnx-test")
+        passes = [
+            "eliminate_identity",
+            "fuse_consecutive_transposes",
+            "fuse_transpose_into_gemm",
+            "eliminate_deadend",
+        ]
+        expected = onnxoptimizer.optimize(model, passes, True)
+        assert [n.op_type for n in expected.graph.node] == ["Gemm"]
+
+        # every call uses pass instances of its own
+        with ThreadPoolExecutor(max_workers=8) as executor:
+            results = list(
+                executor.map(
+                    lambda _: onnxoptimizer.optimize(model, passes, True), range(32)
+                )
+            )
+        for result in results:
+            assert result == expected
+
+    def test_optimize_with_profile(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Identity", ["X"], ["A"]),
+            helper.make_node("Transpose", ["A"], ["B"], perm=[1, 0]),
+            helper.make_node("Transpose", ["B"], ["C"], perm=[1, 0]),
+            helper.make_node("Transpose", ["C"], ["D"], perm=[1, 0]),
+            helper.make_node("Gemm", ["D", "W", "b"], ["Y"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (3, 2)),
+                helper.make_tensor_value_info("W", TensorProto.FLOAT, (3, 4)),
+                helper.make_tensor_value_info("b", TensorProto.FLOAT, (4,)),
+            ],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 4))],
+        )
+        model = helper.make_model(graph, producer_name="onnx-test")
+        passes = [
+            "eliminate_identity",
+            "fuse_consecutive_transposes",
+            "fuse_transpose_into_gemm",
+            "eliminate_deadend",
+        ]
+        optimized_model, profile = onnxoptimizer.optimize_with_profile(
+            model, passes, fixed_point=True
+        )
+
+        assert optimized_model == onnxoptimizer.optimize(model, passes, True)
+        # all of the passes are completely efficient, so they run only once
+        assert [run["pass_name"] for run in profile] == passes
+        assert all(run["iteration"] == 0 for run in profile)
+        assert all(run["wall_time_ms"] >= 0 for run in profile)
+        identity, transposes, transpose_into_gemm, deadend = profile
+        assert identity["num_predicate_calls"] >= len(nodes)
+        assert identity["num_transforms"] == 1
+        assert identity["node_count_delta"] == -1
+        assert identity["initializer_count_delta"] == 0
+        assert transposes["node_count_delta"] == -2
+        assert transpose_into_gemm["num_transforms"] == 1
+        # not a predicate based pass
+        assert deadend["num_predicate_calls"] == 0
+
+        # the other pass managers are profiled too
+        node_count_delta = sum(run["node_count_delta"] for run in profile)
+        for mode in ["worklist", "dispatch", "scheduled"]:
+            optimized_model, profile = onnxoptimizer.optimize_with_profile(
+                model, passes, **{mode: True}
+            )
+            assert optimized_model == onnxoptimizer.optimize(
+                model, passes, **{mode: True}
+            )
+            assert sum(run["num_transforms"] for run in profile) >= 3
+            assert (
+                sum(run["node_count_delta"] for run in profile) == node_count_delta
+            )
+
+    def test_optimize_rejects_several_modes(self):  # type: () -> None
+        graph = helper.make_graph(
+            [helper.make_node("Identity", ["X"], ["Y"])],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2,))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2,))],
+        )
+        model = helper.make_model(graph, producer_name="onnx-test")
+        for modes in [
+            {"fixed_point": True, "worklist": True},
+            {"dispatch": True, "scheduled": True},
+        ]:
+            with self.assertRaises(ValueError):
+                onnxoptimizer.optimize(model, ["eliminate_identity"], **modes)
+            with self.assertRaises(ValueError):
+                onnxoptimizer.optimize_with_profile(
+                    model, ["eliminate_identity"], **modes
+                )
+
     def test_fuse_transpose_into_gemm(self):  # type: () -> None
         nodes = [
             helper.make_node("Transpose", ["X"], ["A"], perm=[1, 0]),
@@ -3103,6 +3667,67 @@ class TestOptimizer(unittest.TestCase):
             )
             optimized_model = self._optimized(graph, ["fuse_bn_into_conv"]) # noqa
 
+    def test_fuse_bn_into_conv_float16(self):  # type: () -> None
+        conv = helper.make_node("Conv", ["X", "W"], ["Y"])
+        bn = helper.make_node(
+            "BatchNormalization", ["Y", "scale", "b", "mean", "var"], ["Z"]
+        )
+
+        W = (np.random.randn(3, 2, 5, 5) + 2).astype(np.float16)
+        scale = (np.random.randn(3,) + 2).astype(np.float16)
+        b = (np.random.randn(3,) + 2).astype(np.float16)
+        mean = (np.random.randn(3,) + 2).astype(np.float16)
+        var = (np.abs(np.random.randn(3,)) + 2).astype(np.float16)
+
+        initializers = [
+            helper.make_tensor(
+                name, TensorProto.FLOAT16, npa.shape, npa.tobytes(), raw=True
+            )
+            for name, npa in [
+                ("W", W),
+                ("scale", scale),
+                ("b", b),
+                ("mean", mean),
+                ("var", var),
+            ]
+        ]
+        graph = helper.make_graph(
+            [conv, bn],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT16, (5, 2, 28, 28))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT16, (5, 3, 24, 24))],
+            initializer=initializers,
+        )
+        optimized_model = self._optimized(
+            graph, ["fuse_bn_into_conv"], compare_result=False
+        )
+
+        assert len(optimized_model.graph.node) == 1
+        assert optimized_model.graph.node[0].op_type == "Conv"
+        assert len(optimized_model.graph.initializer) == 2
+        new_W, new_b = [
+            numpy_helper.to_array(
+                next(
+                    t
+                    for t in optimized_model.graph.initializer
+                    if t.name == optimized_model.graph.node[0].input[i]
+                )
+            )
+            for i in (1, 2)
+        ]
+        factor = scale.astype(np.float32) / np.sqrt(var.astype(np.float32) + 1e-5)
+        np.testing.assert_allclose(
+            new_W.astype(np.float32),
+            W.astype(np.float32) * factor.reshape(3, 1, 1, 1),
+            rtol=1e-3,
+        )
+        np.testing.assert_allclose(
+            new_b.astype(np.float32),
+            b.astype(np.float32) - mean.astype(np.float32) * factor,
+            rtol=1e-3,
+            atol=1e-3,
+        )
+
     def _internal_test_deadend_elimination(self, fixed):  # type: (bool) -> None
         softmax = helper.make_node("Softmax", ["X"], ["Y"], axis=2)
         log = helper.make_node("Log", ["Y"], ["Z"])
@@ -3475,20 +4100,109 @@ class TestOptimizer(unittest.TestCase):
         assert len(optimized_model.graph.node) == 1
         assert optimized_model.graph.node[0].op_type == "Relu"
 
-    # Some exporters use negative dim to represent dynamic shapes.
-    def test_not_eliminate_shape_op_with_negative_dim(self):  # type: () -> None
-        X = helper.make_tensor_value_info("X", TensorProto.FLOAT, [3, -1])
-        Y = helper.make_tensor_value_info("Y", TensorProto.INT64, [2])
-        X2 = helper.make_tensor_value_info("X2", TensorProto.FLOAT, [3, -1])
-
-        node_def = helper.make_node("Relu", ["X"], ["X2"],)
+    def test_constant_folding(self):  # type: () -> None
+        a = np.random.rand(2, 3).astype(np.float32)
+        b = np.random.rand(3).astype(np.float32)
+        graph = helper.make_graph(
+            [
+                helper.make_node("Add", ["A", "B"], ["C"]),
+                helper.make_node("Transpose", ["C"], ["D"]),
+                helper.make_node("Reshape", ["D", "shape"], ["E"]),
+                helper.make_node("Mul", ["X", "E"], ["Y"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (6,))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (6,))],
+            [
+                numpy_helper.from_array(a, "A"),
+                numpy_helper.from_array(b, "B"),
+                numpy_helper.from_array(np.array([-1], dtype=np.int64), "shape"),
+            ],
+        )
+        optimized_model = self._optimized(graph, ["constant_folding"])
 
-        node_def2 = helper.make_node("Shape", ["X2"], ["Y"],)
+        assert [n.op_type for n in optimized_model.graph.node] == ["Mul"]
+        assert len(optimized_model.graph.initializer) == 1
+        folded = optimized_model.graph.initializer[0]
+        assert folded.name == optimized_model.graph.node[0].input[1]
+        np.testing.assert_allclose(to_array(folded), (a + b).T.reshape(-1))
 
+    def test_constant_folding_skips_unsafe_nodes(self):  # type: () -> None
+        a = np.array([1.5, 1e20], dtype=np.float32)
         graph = helper.make_graph(
-            [node_def, node_def2],  # nodes
-            "test",  # name
-            [X],  # inputs
+            [
+                # out of the range of INT32
+                helper.make_node("Cast", ["A"], ["B"], to=TensorProto.INT32),
+                helper.make_node("Add", ["A", "A"], ["C"], domain="custom"),
+                helper.make_node("Mul", ["X", "C"], ["Y"]),
+                # signed overflows
+                helper.make_node("Add", ["I", "I"], ["J"]),
+                helper.make_node("Div", ["I_min", "minus_one"], ["K"]),
+                # a negative step over an empty dim is folded into nothing
+                helper.make_node(
+                    "Slice", ["E", "minus_one", "minus_ten", "zero", "minus_one"],
+                    ["S"],
+                ),
+                helper.make_node("Concat", ["X", "S"], ["Z"], axis=0),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2,))],
+            [
+                helper.make_tensor_value_info("B", TensorProto.INT32, (2,)),
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2,)),
+                helper.make_tensor_value_info("J", TensorProto.INT32, (2,)),
+                helper.make_tensor_value_info("K", TensorProto.INT32, (1,)),
+                helper.make_tensor_value_info("Z", TensorProto.FLOAT, (2,)),
+            ],
+            [
+                numpy_helper.from_array(a, "A"),
+                numpy_helper.from_array(
+                    np.array([2**31 - 1, 1], dtype=np.int32), "I"
+                ),
+                numpy_helper.from_array(np.array([-(2**31)], dtype=np.int32), "I_min"),
+                numpy_helper.from_array(np.array([-1], dtype=np.int32), "minus_one"),
+                numpy_helper.from_array(np.array([-10], dtype=np.int32), "minus_ten"),
+                numpy_helper.from_array(np.array([0], dtype=np.int32), "zero"),
+                numpy_helper.from_array(np.zeros(0, dtype=np.float32), "E"),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["constant_folding"],
+            compare_result=False,
+            opset_imports=[
+                helper.make_opsetid("", LATEST_STABLE_OPSET_VERSION),
+                helper.make_opsetid("custom", 1),
+            ],
+        )
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            "Cast",
+            "Add",
+            "Mul",
+            "Add",
+            "Div",
+            "Concat",
+        ]
+        # the pass is opt-in
+        assert "constant_folding" not in (
+            onnxoptimizer.get_fuse_and_elimination_passes()
+        )
+
+    # Some exporters use negative dim to represent dynamic shapes.
+    def test_not_eliminate_shape_op_with_negative_dim(self):  # type: () -> None
+        X = helper.make_tensor_value_info("X", TensorProto.FLOAT, [3, -1])
+        Y = helper.make_tensor_value_info("Y", TensorProto.INT64, [2])
+        X2 = helper.make_tensor_value_info("X2", TensorProto.FLOAT, [3, -1])
+
+        node_def = helper.make_node("Relu", ["X"], ["X2"],)
+
+        node_def2 = helper.make_node("Shape", ["X2"], ["Y"],)
+
+        graph = helper.make_graph(
+            [node_def, node_def2],  # nodes
+            "test",  # name
+            [X],  # inputs
             [Y],  # outputs
             value_info=[X2],
         )
@@ -4481,6 +5195,464 @@ class TestOptimizer(unittest.TestCase):
 
         assert len(optimized_model.graph.node) == 6
 
+    def test_eliminate_common_subexression_chain(self):  # type: () -> None
+        # a chain of duplicates collapses in a single run, and the order of
+        # the attributes does not matter
+        graph = parser.parse_graph("""
+               agraph (float[4, 64] X) => (float[4, 1] Z)
+               {
+                  S1 = Sigmoid(X)
+                  S2 = Sigmoid(X)
+                  R1 = ReduceMean<axes=[1], keepdims=1>(S1)
+                  R2 = ReduceMean<keepdims=1, axes=[1]>(S2)
+                  T1 = Tanh(R1)
+                  T2 = Tanh(R2)
+                  Z = Add(T1, T2)
+               }
+            """)
+
+        optimized_model = self._optimized(
+            graph, ['eliminate_common_subexpression', 'eliminate_deadend'], False)
+
+        assert [n.op_type for n in optimized_model.graph.node] == [
+            'Sigmoid', 'ReduceMean', 'Tanh', 'Add']
+        assert list(optimized_model.graph.node[3].input) == ['T1', 'T1']
+
+    def test_eliminate_common_subexression_in_subgraphs(self):  # type: () -> None
+        # the Sigmoid of the Loop body is the one of the main graph, and the
+        # computations both branches of the If make move out of it
+        body = helper.make_graph(
+            [
+                helper.make_node("Sigmoid", ["X"], ["s"]),
+                helper.make_node("Add", ["v_in", "s"], ["v_out"]),
+                helper.make_node("Identity", ["cond_in"], ["cond_out"]),
+            ],
+            "body",
+            [
+                helper.make_tensor_value_info("i", TensorProto.INT64, []),
+                helper.make_tensor_value_info("cond_in", TensorProto.BOOL, []),
+                helper.make_tensor_value_info("v_in", TensorProto.FLOAT, [2, 3]),
+            ],
+            [
+                helper.make_tensor_value_info("cond_out", TensorProto.BOOL, []),
+                helper.make_tensor_value_info("v_out", TensorProto.FLOAT, [2, 3]),
+            ],
+        )
+
+        def make_branch(name, op_type):  # type: (str, str) -> GraphProto
+            return helper.make_graph(
+                [
+                    helper.make_node(
+                        "Constant",
+                        [],
+                        [name + "_i"],
+                        value=helper.make_tensor("", TensorProto.INT64, [1], [0]),
+                    ),
+                    helper.make_node("Shape", ["X"], [name + "_shape"]),
+                    helper.make_node(
+                        "Gather", [name + "_shape", name + "_i"], [name + "_dim"]
+                    ),
+                    helper.make_node(
+                        "Cast", [name + "_dim"], [name + "_f"], to=TensorProto.FLOAT
+                    ),
+                    helper.make_node(op_type, ["X", name + "_f"], [name + "_out"]),
+                ],
+                name,
+                [],
+                [helper.make_tensor_value_info(name + "_out", TensorProto.FLOAT, [2, 3])],
+            )
+
+        graph = helper.make_graph(
+            [
+                helper.make_node("Sigmoid", ["X"], ["S"]),
+                helper.make_node("Shape", ["X"], ["shape"]),
+                helper.make_node(
+                    "Loop", ["M", "cond", "S"], ["L"], body=body
+                ),
+                helper.make_node(
+                    "If",
+                    ["cond"],
+                    ["Z"],
+                    then_branch=make_branch("then", "Mul"),
+                    else_branch=make_branch("else", "Add"),
+                ),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("M", TensorProto.INT64, []),
+                helper.make_tensor_value_info("cond", TensorProto.BOOL, []),
+            ],
+            [
+                helper.make_tensor_value_info("L", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("Z", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("shape", TensorProto.INT64, [2]),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph, ["eliminate_common_subexpression"], False
+        )
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Sigmoid", "Shape", "Loop", "Constant", "Gather", "Cast", "If"]
+        assert list(nodes[4].input) == ["shape", nodes[3].output[0]]
+        assert [n.op_type for n in nodes[2].attribute[0].g.node] == ["Add", "Identity"]
+        assert list(nodes[2].attribute[0].g.node[0].input) == ["v_in", "S"]
+        branches = {a.name: a.g for a in nodes[6].attribute}
+        then_branch = branches["then_branch"]
+        else_branch = branches["else_branch"]
+        assert [n.op_type for n in then_branch.node] == ["Mul"]
+        assert [n.op_type for n in else_branch.node] == ["Add"]
+        assert then_branch.node[0].input[1] == nodes[5].output[0]
+
+    def test_eliminate_common_subexression_identical_branches(self):  # type: () -> None
+        def make_branch(name):  # type: (str) -> GraphProto
+            return helper.make_graph(
+                [
+                    helper.make_node("Mul", ["X", "X"], [name + "_sq"]),
+                    helper.make_node("Relu", [name + "_sq"], [name + "_out"]),
+                ],
+                name,
+                [],
+                [helper.make_tensor_value_info(name + "_out", TensorProto.FLOAT, [2, 3])],
+            )
+
+        graph = helper.make_graph(
+            [
+                helper.make_node(
+                    "If",
+                    ["cond"],
+                    ["Z"],
+                    then_branch=make_branch("then"),
+                    else_branch=make_branch("else"),
+                ),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("cond", TensorProto.BOOL, []),
+            ],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, [2, 3])],
+        )
+        optimized_model = self._optimized(
+            graph, ["eliminate_common_subexpression"], False
+        )
+
+        assert [n.op_type for n in optimized_model.graph.node] == ["Mul", "Relu"]
+        assert optimized_model.graph.node[1].output[0] == "Z"
+
+    def test_hoist_loop_invariants(self):  # type: () -> None
+        body = helper.make_graph(
+            [
+                helper.make_node(
+                    "Constant",
+                    [],
+                    ["shape"],
+                    value=helper.make_tensor("", TensorProto.INT64, [2], [3, 2]),
+                ),
+                helper.make_node("Reshape", ["W", "shape"], ["w"]),
+                helper.make_node("Transpose", ["w"], ["wt"]),
+                helper.make_node("Add", ["wt", "b"], ["wb"]),
+                helper.make_node("Add", ["v_in", "wb"], ["v_out"]),
+                helper.make_node("RandomUniformLike", ["v_in"], ["r"]),
+                helper.make_node("Mul", ["r", "wb"], ["scan_out"]),
+                helper.make_node("Identity", ["cond_in"], ["cond_out"]),
+            ],
+            "body",
+            [
+                helper.make_tensor_value_info("i", TensorProto.INT64, []),
+                helper.make_tensor_value_info("cond_in", TensorProto.BOOL, []),
+                helper.make_tensor_value_info("v_in", TensorProto.FLOAT, [2, 3]),
+            ],
+            [
+                helper.make_tensor_value_info("cond_out", TensorProto.BOOL, []),
+                helper.make_tensor_value_info("v_out", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("scan_out", TensorProto.FLOAT, [2, 3]),
+            ],
+            [helper.make_tensor("b", TensorProto.FLOAT, [1, 3], [1, 2, 3])],
+        )
+        graph = helper.make_graph(
+            [
+                helper.make_node(
+                    "Loop", ["M", "cond", "V"], ["Y", "R"], body=body
+                ),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("M", TensorProto.INT64, []),
+                helper.make_tensor_value_info("cond", TensorProto.BOOL, []),
+                helper.make_tensor_value_info("V", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("W", TensorProto.FLOAT, [3, 2]),
+            ],
+            [
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, [2, 3]),
+                helper.make_tensor_value_info("R", TensorProto.FLOAT, [None, 2, 3]),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph, ["hoist_loop_invariants"], False, compare_result=False
+        )
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Constant", "Reshape", "Transpose", "Add", "Loop"]
+        assert [t.name for t in optimized_model.graph.initializer] == ["b"]
+        body = nodes[4].attribute[0].g
+        assert [n.op_type for n in body.node] == [
+            "Add", "RandomUniformLike", "Mul", "Identity"]
+        assert list(body.node[0].input) == ["v_in", "wb"]
+        assert len(body.initializer) == 0
+
+        # a loop running no iteration may fail on a hoisted node
+        assert (
+            "hoist_loop_invariants"
+            not in onnxoptimizer.get_fuse_and_elimination_passes()
+        )
+
+    def test_sink_transposes(self):  # type: () -> None
+        # NHWC nodes between the Transposes of a model converted from NCHW
+        graph = helper.make_graph(
+            [
+                helper.make_node("Transpose", ["X"], ["T1"], perm=[0, 2, 3, 1]),
+                helper.make_node("Relu", ["T1"], ["R"]),
+                helper.make_node("Add", ["R", "B"], ["A"]),
+                helper.make_node("Pad", ["A", "pads"], ["P"]),
+                helper.make_node("Concat", ["P", "P"], ["C"], axis=3),
+                helper.make_node("Transpose", ["C"], ["Y"], perm=[0, 3, 1, 2]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, [2, 3, 4, 5])],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, [2, 6, 5, 8])],
+            [
+                helper.make_tensor("B", TensorProto.FLOAT, [3], [1, 2, 3]),
+                helper.make_tensor(
+                    "pads", TensorProto.INT64, [8], [0, 1, 0, 0, 0, 0, 3, 0]
+                ),
+            ],
+        )
+        optimized_model = self._optimized(graph, ["sink_transposes"], False)
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["Relu", "Add", "Pad", "Concat"]
+        assert nodes[3].attribute[0].i == 1
+        initializers = {
+            t.name: numpy_helper.to_array(t) for t in optimized_model.graph.initializer
+        }
+        assert initializers[nodes[1].input[1]].shape == (1, 3, 1, 1)
+        assert list(initializers[nodes[2].input[1]]) == [0, 0, 1, 0, 0, 0, 0, 3]
+
+    def test_sink_transposes_through_reduction(self):  # type: () -> None
+        graph = helper.make_graph(
+            [
+                helper.make_node("Transpose", ["X"], ["T1"], perm=[0, 2, 3, 1]),
+                helper.make_node("ReduceMean", ["T1"], ["M"], axes=[1], keepdims=0),
+                helper.make_node("Transpose", ["M"], ["Y"], perm=[0, 2, 1]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, [2, 3, 4, 5])],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, [2, 3, 5])],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["sink_transposes"],
+            False,
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["ReduceMean"]
+        axes = next(a for a in nodes[0].attribute if a.name == "axes")
+        assert list(axes.ints) == [2]
+
+    def test_convert_layout(self):  # type: () -> None
+        graph = helper.make_graph(
+            [
+                helper.make_node("Conv", ["X", "W1", "B1"], ["Y"], pads=[1, 1, 1, 1]),
+                helper.make_node("Relu", ["Y"], ["R"]),
+                helper.make_node("Conv", ["R", "W2"], ["C"]),
+                helper.make_node("Add", ["C", "R"], ["Z"]),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, [1, 3, 8, 8]),
+                helper.make_tensor_value_info("W1", TensorProto.FLOAT, [4, 3, 3, 3]),
+                helper.make_tensor_value_info("B1", TensorProto.FLOAT, [4]),
+                helper.make_tensor_value_info("W2", TensorProto.FLOAT, [4, 4, 1, 1]),
+            ],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, [1, 4, 8, 8])],
+        )
+        # onnxruntime has no CPU kernel of NhwcConv
+        cpu_model = self._optimized(graph, ["convert_layout_to_nhwc"], False)
+        assert [n.op_type for n in cpu_model.graph.node] == [
+            "Conv", "Relu", "Conv", "Add"]
+
+        # the runtime of the tests has no GPU kernels
+        nhwc_model = self._optimized(
+            graph, ["convert_layout_to_nhwc_gpu"], False, compare_result=False
+        )
+
+        nodes = nhwc_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Transpose", "NhwcConv", "Relu", "NhwcConv", "Add", "Transpose"]
+        assert nodes[1].domain == "com.microsoft"
+        assert list(nodes[1].input[1:]) == ["W1", "B1"]
+        assert ("com.microsoft", 1) in [
+            (opset.domain, opset.version) for opset in nhwc_model.opset_import
+        ]
+
+        nchw_model = self._optimized(
+            nhwc_model, ["convert_layout_to_nchw"], False, compare_result=False
+        )
+        assert [n.op_type for n in nchw_model.graph.node] == [
+            "Conv", "Relu", "Conv", "Add"]
+
+    def test_canonicalize_view_ops(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Unsqueeze", ["X", "axes"], ["A"]),
+            helper.make_node("Reshape", ["A", "shape"], ["B"]),
+            helper.make_node("Flatten", ["B"], ["C"], axis=2),
+            helper.make_node("Squeeze", ["A", "axes"], ["D"]),
+            helper.make_node("Relu", ["D"], ["E"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 3, 4))],
+            [
+                helper.make_tensor_value_info("C", TensorProto.FLOAT, (6, 4)),
+                helper.make_tensor_value_info("E", TensorProto.FLOAT, (2, 3, 4)),
+            ],
+            initializer=[
+                numpy_helper.from_array(np.array([0], dtype=np.int64), "axes"),
+                numpy_helper.from_array(
+                    np.array([1, -1, 4], dtype=np.int64), "shape"
+                ),
+            ],
+        )
+        optimized_model = self._optimized(graph, ["canonicalize_view_ops"])
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["Reshape", "Relu"]
+        assert nodes[0].input[0] == "X"
+        assert nodes[1].input[0] == "X"
+        shape = [
+            init for init in optimized_model.graph.initializer
+            if init.name == nodes[0].input[1]
+        ][0]
+        assert list(to_array(shape)) == [6, 4]
+        assert len(optimized_model.graph.initializer) == 1
+
+    def test_shape_inference_before_passes(self):  # type: () -> None
+        # the shape of R is only known through inference, with a symbolic
+        # batch dim
+        graph = helper.make_graph(
+            [
+                helper.make_node("Relu", ["X"], ["R"]),
+                helper.make_node("Reshape", ["R", "shape"], ["Y"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, ("N", 3, 4))],
+            [helper.make_tensor_value_info("Y", TensorProto.FLOAT, ("N", 3, 4))],
+            initializer=[
+                numpy_helper.from_array(np.array([0, 3, 4], dtype=np.int64), "shape")
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["eliminate_nop_reshape"],
+            input_shapes_for_comparing={"X": [2, 3, 4]},
+        )
+
+        assert [n.op_type for n in optimized_model.graph.node] == ["Relu"]
+        # the inferred types are not exported
+        assert len(optimized_model.graph.value_info) == 0
+
+    def test_shape_inference_after_rewired_inputs(self):  # type: () -> None
+        # the shape of Y is only known once constant_folding has replaced the
+        # input S of the first Reshape with a constant
+        graph = helper.make_graph(
+            [
+                helper.make_node("Relu", ["X"], ["R"]),
+                helper.make_node("Add", ["shape", "zeros"], ["S"]),
+                helper.make_node("Reshape", ["R", "S"], ["Y"]),
+                helper.make_node("Reshape", ["Y", "shape"], ["Z"]),
+            ],
+            "test",
+            [helper.make_tensor_value_info("X", TensorProto.FLOAT, ("N", 3, 4))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, ("N", 12))],
+            initializer=[
+                numpy_helper.from_array(np.array([0, 12], dtype=np.int64), "shape"),
+                numpy_helper.from_array(np.zeros(2, dtype=np.int64), "zeros"),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["constant_folding", "eliminate_nop_reshape"],
+            input_shapes_for_comparing={"X": [2, 3, 4]},
+        )
+
+        assert [n.op_type for n in optimized_model.graph.node] == ["Relu", "Reshape"]
+
+    def test_fuse_shape_computation_into_reshape(self):  # type: () -> None
+        nodes = [
+            helper.make_node("Shape", ["X"], ["S"]),
+            helper.make_node("Gather", ["S", "zero"], ["B"]),
+            helper.make_node("Gather", ["S", "one"], ["L"]),
+            helper.make_node("Unsqueeze", ["B", "axes"], ["B1"]),
+            helper.make_node("Unsqueeze", ["L", "axes"], ["L1"]),
+            helper.make_node("Concat", ["B1", "L1", "heads"], ["T1"], axis=0),
+            helper.make_node("Reshape", ["X", "T1"], ["Y"]),
+            helper.make_node("Mul", ["B", "L"], ["BL"]),
+            helper.make_node("Unsqueeze", ["BL", "axes"], ["BL1"]),
+            helper.make_node("Div", ["S", "S"], ["ones"]),
+            helper.make_node("Slice", ["S", "two", "three"], ["H"]),
+            helper.make_node("Concat", ["BL1", "H"], ["T2"], axis=0),
+            helper.make_node("Reshape", ["X", "T2"], ["Z"]),
+        ]
+        graph = helper.make_graph(
+            nodes,
+            "test",
+            [
+                helper.make_tensor_value_info(
+                    "X", TensorProto.FLOAT, ("batch", "seq", 768)
+                )
+            ],
+            [
+                helper.make_tensor_value_info(
+                    "Y", TensorProto.FLOAT, ("batch", "seq", 12, 64)
+                ),
+                helper.make_tensor_value_info("Z", TensorProto.FLOAT, (None, 768)),
+                helper.make_tensor_value_info("ones", TensorProto.INT64, (3,)),
+            ],
+            initializer=[
+                numpy_helper.from_array(np.array(0, dtype=np.int64), "zero"),
+                numpy_helper.from_array(np.array(1, dtype=np.int64), "one"),
+                numpy_helper.from_array(np.array([2], dtype=np.int64), "two"),
+                numpy_helper.from_array(np.array([3], dtype=np.int64), "three"),
+                numpy_helper.from_array(np.array([0], dtype=np.int64), "axes"),
+                numpy_helper.from_array(
+                    np.array([12, 64], dtype=np.int64), "heads"
+                ),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_shape_computation_into_reshape"],
+            input_shapes_for_comparing={"X": [2, 5, 768]},
+        )
+
+        # the Shape is left for the Div, which computes a graph output
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["Shape", "Reshape", "Div", "Reshape"]
+        initializers = {
+            init.name: list(to_array(init))
+            for init in optimized_model.graph.initializer
+        }
+        assert initializers[nodes[1].input[1]] == [0, 0, 12, 64]
+        assert initializers[nodes[3].input[1]] == [-1, 768]
+        assert len(initializers) == 2
+
     def _test_fuse_qkv_with_opset(self, opset_version):  # type: (int) -> None
         X = helper.make_tensor_value_info("X", TensorProto.FLOAT, [1, 4096, 320])
         Y1 = helper.make_tensor_value_info("Y1", TensorProto.FLOAT, [1, 4096, 8, 40])
@@ -4525,18 +5697,352 @@ class TestOptimizer(unittest.TestCase):
             [I0, I1, I2, I3, I4, shape],  # initializer
         )
         optimized_model = self._optimized(graph, ["fuse_qkv", "eliminate_deadend"], False, opset_imports=[helper.make_opsetid("", opset_version)])
-        assert len(optimized_model.graph.node) == 8
+        assert len(optimized_model.graph.node) == 7
         assert optimized_model.graph.node[0].op_type == "Mul"
         assert optimized_model.graph.node[1].op_type == "Add"
-        assert optimized_model.graph.node[2].op_type == "Concat"
-        assert optimized_model.graph.node[3].op_type == "MatMul"
-        assert optimized_model.graph.node[4].op_type == "Split"
+        assert optimized_model.graph.node[2].op_type == "MatMul"
+        assert optimized_model.graph.node[3].op_type == "Split"
+        weight = [
+            init for init in optimized_model.graph.initializer
+            if init.name == optimized_model.graph.node[2].input[1]
+        ][0]
+        assert list(weight.dims) == [320, 960]
 
     def test_fuse_qkv(self):  # type: () -> None
         for opset_version in [11, 15]:
             self._test_fuse_qkv_with_opset(opset_version)
         self._test_fuse_qkv_with_opset(LATEST_STABLE_OPSET_VERSION)
 
+    def test_fuse_qkv_with_bias(self):  # type: () -> None
+        # grouped-query attention: the key and value projections are smaller
+        def weight(name, *shape):
+            return numpy_helper.from_array(
+                np.random.random(shape).astype(np.float32), name
+            )
+
+        graph = helper.make_graph(
+            [
+                helper.make_node("MatMul", ["X", "Wq"], ["Q0"]),
+                helper.make_node("Add", ["Q0", "Bq"], ["Q"]),
+                helper.make_node("MatMul", ["X", "Wk"], ["K0"]),
+                helper.make_node("Add", ["Bk", "K0"], ["K"]),
+                helper.make_node("MatMul", ["X", "Wv"], ["V0"]),
+                helper.make_node("Add", ["V0", "Bv"], ["V"]),
+                helper.make_node("Gemm", ["Y", "Wa", "Ba"], ["A"], transB=1),
+                helper.make_node("Gemm", ["Y", "Wb", "Bb"], ["B"], transB=1),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 5, 32)),
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, (5, 32)),
+            ],
+            [
+                helper.make_tensor_value_info("Q", TensorProto.FLOAT, (2, 5, 32)),
+                helper.make_tensor_value_info("K", TensorProto.FLOAT, (2, 5, 8)),
+                helper.make_tensor_value_info("V", TensorProto.FLOAT, (2, 5, 8)),
+                helper.make_tensor_value_info("A", TensorProto.FLOAT, (5, 16)),
+                helper.make_tensor_value_info("B", TensorProto.FLOAT, (5, 4)),
+            ],
+            initializer=[
+                weight("Wq", 32, 32),
+                weight("Bq", 32),
+                weight("Wk", 32, 8),
+                weight("Bk", 8),
+                weight("Wv", 32, 8),
+                weight("Bv", 8),
+                weight("Wa", 16, 32),
+                weight("Ba", 16),
+                weight("Wb", 4, 32),
+                weight("Bb", 4),
+            ],
+        )
+        optimized_model = self._optimized(graph, ["fuse_qkv"])
+
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Gemm", "Split", "MatMul", "Add", "Split"
+        ]
+        initializers = {
+            init.name: list(init.dims) for init in optimized_model.graph.initializer
+        }
+        assert initializers[nodes[0].input[1]] == [20, 32]
+        assert initializers[nodes[0].input[2]] == [20]
+        assert initializers[nodes[2].input[1]] == [32, 48]
+        assert initializers[nodes[3].input[1]] == [48]
+        # the weights, the biases and the sizes of the splits
+        assert len(initializers) == 6
+
+    def test_fuse_attention(self):  # type: () -> None
+        def split_heads(name, perm):
+            return [
+                helper.make_node("Reshape", [name, "heads"], [name + "4"]),
+                helper.make_node(
+                    "Transpose", [name + "4"], [name + "t"], perm=perm
+                ),
+            ]
+
+        graph = helper.make_graph(
+            split_heads("q", [0, 2, 1, 3])
+            + split_heads("k", [0, 2, 3, 1])
+            + split_heads("v", [0, 2, 1, 3])
+            + [
+                helper.make_node("MatMul", ["qt", "kt"], ["S"]),
+                helper.make_node("Div", ["S", "sqrt_d"], ["D"]),
+                helper.make_node("Add", ["D", "M"], ["A"]),
+                helper.make_node("Softmax", ["A"], ["P"], axis=-1),
+                helper.make_node("MatMul", ["P", "vt"], ["Y"]),
+                helper.make_node("Transpose", ["Y"], ["Yt"], perm=[0, 2, 1, 3]),
+                helper.make_node("Reshape", ["Yt", "hidden"], ["Z"]),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info(name, TensorProto.FLOAT, (2, 5, 32))
+                for name in ["q", "k", "v"]
+            ]
+            + [helper.make_tensor_value_info("M", TensorProto.FLOAT, (2, 1, 5, 5))],
+            [helper.make_tensor_value_info("Z", TensorProto.FLOAT, (2, 5, 32))],
+            initializer=[
+                numpy_helper.from_array(
+                    np.array([0, 0, 4, 8], dtype=np.int64), "heads"
+                ),
+                numpy_helper.from_array(np.array([0, 0, 32], dtype=np.int64), "hidden"),
+                numpy_helper.from_array(np.array(np.sqrt(8), dtype=np.float32), "sqrt_d"),
+            ],
+        )
+
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_attention"],
+            opset_imports=[helper.make_opsetid("", 13)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["MultiHeadAttention"]
+        assert nodes[0].domain == "com.microsoft"
+        assert list(nodes[0].input) == ["q", "k", "v", "", "", "M"]
+        assert len(optimized_model.graph.initializer) == 0
+        assert "fuse_attention" not in onnxoptimizer.get_fuse_and_elimination_passes()
+
+        # the heads are left split and merged by Transposes and Reshapes
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_attention"],
+            opset_imports=[helper.make_opsetid("", 23)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Reshape", "Transpose", "Reshape", "Transpose", "Reshape",
+            "Transpose", "Attention", "Transpose", "Reshape"
+        ]
+        assert nodes[6].input[3] == "M"
+        assert list(nodes[3].attribute[0].ints) == [0, 2, 1, 3]
+
+    def test_fuse_layer_norm(self):  # type: () -> None
+        graph = helper.make_graph(
+            [
+                helper.make_node("Add", ["X", "R"], ["S"]),
+                helper.make_node("ReduceMean", ["S"], ["M"], axes=[-1]),
+                helper.make_node("Sub", ["S", "M"], ["D"]),
+                helper.make_node("Pow", ["D", "two"], ["D2"]),
+                helper.make_node("ReduceMean", ["D2"], ["V"], axes=[-1]),
+                helper.make_node("Add", ["V", "epsilon"], ["Ve"]),
+                helper.make_node("Sqrt", ["Ve"], ["Std"]),
+                helper.make_node("Div", ["D", "Std"], ["N"]),
+                helper.make_node("Mul", ["N", "gamma"], ["G"]),
+                helper.make_node("Add", ["G", "beta"], ["Y"]),
+            ],
+            "test",
+            [
+                helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 5, 16)),
+                helper.make_tensor_value_info("R", TensorProto.FLOAT, (2, 5, 16)),
+            ],
+            [
+                helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 5, 16)),
+                helper.make_tensor_value_info("S", TensorProto.FLOAT, (2, 5, 16)),
+            ],
+            initializer=[
+                numpy_helper.from_array(np.array(2, dtype=np.float32), "two"),
+                numpy_helper.from_array(np.array(1e-5, dtype=np.float32), "epsilon"),
+                numpy_helper.from_array(
+                    np.random.random(16).astype(np.float32), "gamma"
+                ),
+                numpy_helper.from_array(
+                    np.random.random(16).astype(np.float32), "beta"
+                ),
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_layer_norm"],
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["Add", "LayerNormalization"]
+        assert list(nodes[1].input) == ["S", "gamma", "beta"]
+        assert len(optimized_model.graph.initializer) == 2
+
+        # the ops of onnxruntime are only created on request
+        default_passes = onnxoptimizer.get_fuse_and_elimination_passes()
+        assert "fuse_layer_norm" in default_passes
+        assert "fuse_rms_norm" not in default_passes
+        assert "fuse_skip_layer_norm" not in default_passes
+
+        # the residual Add is fused too, and the sum is still an output
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_layer_norm", "fuse_skip_layer_norm"],
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["SkipLayerNormalization"]
+        assert list(nodes[0].input) == ["X", "R", "gamma", "beta"]
+        assert nodes[0].output[0] == "Y"
+        assert nodes[0].output[3] == "S"
+
+        # the LayerNormalization created while walking the graph is handed to
+        # fuse_skip_layer_norm too
+        passes = ["fuse_layer_norm", "fuse_skip_layer_norm"]
+        fixed_point_model = self._optimized(
+            graph,
+            passes,
+            fixed_point=True,
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        dispatch_model = self._optimized(
+            graph, passes, dispatch=True, opset_imports=[helper.make_opsetid("", 17)]
+        )
+        assert dispatch_model.graph == fixed_point_model.graph
+
+        # the LayerNormalization is handed to the worklist of
+        # fuse_skip_layer_norm, which runs on it once the partially efficient
+        # eliminate_nop_monotone_argmax has another round started
+        with_argmax = helper.make_graph(
+            list(graph.node)
+            + [
+                helper.make_node("Log", ["X"], ["L"]),
+                helper.make_node("ArgMax", ["L"], ["I"], axis=-1),
+            ],
+            "test",
+            graph.input,
+            list(graph.output)
+            + [helper.make_tensor_value_info("I", TensorProto.INT64, (2, 5, 1))],
+            initializer=graph.initializer,
+        )
+        optimized_model = self._optimized(
+            with_argmax,
+            [
+                "fuse_skip_layer_norm",
+                "fuse_layer_norm",
+                "eliminate_nop_monotone_argmax",
+            ],
+            worklist=True,
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["SkipLayerNormalization", "ArgMax"]
+
+        # the mean is only found once the Unsqueeze is fused into it
+        unsqueezed = helper.make_graph(
+            [
+                graph.node[0],
+                helper.make_node(
+                    "ReduceMean", ["S"], ["Mr"], axes=[-1], keepdims=0
+                ),
+                helper.make_node("Unsqueeze", ["Mr", "last"], ["M"]),
+            ]
+            + list(graph.node[2:]),
+            "test",
+            graph.input,
+            graph.output,
+            initializer=list(graph.initializer)
+            + [numpy_helper.from_array(np.array([-1], dtype=np.int64), "last")],
+        )
+        optimized_model = self._optimized(
+            unsqueezed,
+            ["fuse_layer_norm", "fuse_consecutive_reduce_unsqueeze"],
+            scheduled=True,
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["Add", "LayerNormalization"]
+
+        # the parameters are computed by Constants after the Div
+        constants = [
+            helper.make_node("Constant", [], [init.name], value=init)
+            for init in graph.initializer
+            if init.name in ["gamma", "beta"]
+        ]
+        graph = helper.make_graph(
+            list(graph.node[:8]) + constants + list(graph.node[8:]),
+            "test",
+            graph.input,
+            graph.output,
+            initializer=[
+                init for init in graph.initializer if init.name in ["two", "epsilon"]
+            ],
+        )
+        optimized_model = self._optimized(
+            graph,
+            ["fuse_layer_norm"],
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == [
+            "Add", "Constant", "Constant", "LayerNormalization"
+        ]
+
+    def test_fuse_rms_norm(self):  # type: () -> None
+        def make_graph(opset_version):
+            # ReduceMean takes its axes as an input since opset 18
+            if opset_version >= 18:
+                mean = helper.make_node("ReduceMean", ["X2", "axes"], ["V"])
+            else:
+                mean = helper.make_node("ReduceMean", ["X2"], ["V"], axes=[-1])
+            return helper.make_graph(
+                [
+                    helper.make_node("Mul", ["X", "X"], ["X2"]),
+                    mean,
+                    helper.make_node("Add", ["epsilon", "V"], ["Ve"]),
+                    helper.make_node("Sqrt", ["Ve"], ["Rms"]),
+                    helper.make_node("Reciprocal", ["Rms"], ["Inv"]),
+                    helper.make_node("Mul", ["X", "Inv"], ["N"]),
+                    helper.make_node("Mul", ["gamma", "N"], ["Y"]),
+                ],
+                "test",
+                [helper.make_tensor_value_info("X", TensorProto.FLOAT, (2, 5, 16))],
+                [helper.make_tensor_value_info("Y", TensorProto.FLOAT, (2, 5, 16))],
+                initializer=[
+                    numpy_helper.from_array(
+                        np.array(1e-6, dtype=np.float32), "epsilon"
+                    ),
+                    numpy_helper.from_array(
+                        np.random.random(16).astype(np.float32), "gamma"
+                    ),
+                    numpy_helper.from_array(np.array([-1], dtype=np.int64), "axes"),
+                ],
+            )
+
+        optimized_model = self._optimized(
+            make_graph(23),
+            ["fuse_rms_norm"],
+            opset_imports=[helper.make_opsetid("", 23)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["RMSNormalization"]
+        assert list(nodes[0].input) == ["X", "gamma"]
+        assert len(optimized_model.graph.initializer) == 1
+
+        # the op of onnxruntime is unknown to the checker
+        optimized_model = self._optimized(
+            make_graph(17),
+            ["fuse_rms_norm"],
+            compare_result=False,
+            check=False,
+            opset_imports=[helper.make_opsetid("", 17)],
+        )
+        nodes = optimized_model.graph.node
+        assert [n.op_type for n in nodes] == ["SimplifiedLayerNormalization"]
+        assert nodes[0].domain == ""
+
     def test_fuse_consecutive_unsqueezes_opset13(self):  # type: () -> None
         graph = parser.parse_graph("""
                agraph (float[4, 64, 160, 160] X) => (float[1, 1, 1, 4, 64, 1, 160, 160, 1, 1, 1] Z)
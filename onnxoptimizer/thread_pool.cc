@@ -0,0 +1,121 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "onnxoptimizer/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+struct ThreadPool::Batch {
+  explicit Batch(const std::vector<std::function<void()>>& tasks)
+      : tasks(tasks), size(tasks.size()), unfinished(tasks.size()) {}
+
+  // Only dereferenced for tasks that have not finished yet, i.e. while the
+  // thread that owns the tasks is still waiting for them.
+  const std::vector<std::function<void()>>& tasks;
+  const size_t size;
+  std::atomic<size_t> next{0};
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t unfinished;
+  std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  workers_.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i) {
+    workers_.emplace_back([this] { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool ThreadPool::runNextTask(Batch& batch) {
+  const size_t i = batch.next.fetch_add(1);
+  if (i >= batch.size) {
+    return false;
+  }
+  std::exception_ptr error;
+  try {
+    batch.tasks[i]();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(batch.mutex);
+  if (error && !batch.error) {
+    batch.error = error;
+  }
+  if (--batch.unfinished == 0) {
+    batch.finished.notify_all();
+  }
+  return true;
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::shared_ptr<Batch> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_available_.wait(
+          lock, [this] { return stopping_ || !batches_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      batch = batches_.front();
+      if (batch->next >= batch->size) {
+        // every task has been started, the threads running them finish it
+        batches_.pop_front();
+        continue;
+      }
+    }
+    runNextTask(*batch);
+  }
+}
+
+void ThreadPool::run(const std::vector<std::function<void()>>& tasks) {
+  if (workers_.empty() || tasks.size() <= 1) {
+    for (const auto& task : tasks) {
+      task();
+    }
+    return;
+  }
+  auto batch = std::make_shared<Batch>(tasks);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batches_.push_back(batch);
+  }
+  work_available_.notify_all();
+  while (runNextTask(*batch)) {
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batches_.erase(
+        std::remove(batches_.begin(), batches_.end(), batch), batches_.end());
+  }
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->finished.wait(lock, [&batch] { return batch->unfinished == 0; });
+  if (batch->error) {
+    std::rethrow_exception(batch->error);
+  }
+}
+
+} // namespace optimization
+} // namespace ONNX_NAMESPACE
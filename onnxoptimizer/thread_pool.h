@@ -0,0 +1,61 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// ATTENTION: The code in this file is highly EXPERIMENTAL.
+// Adventurous users should note that the APIs will probably change.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ONNX_NAMESPACE {
+namespace optimization {
+
+// A fixed set of threads that runs batches of independent tasks. The thread
+// that hands a batch to the pool works on it as well and only returns once all
+// of its tasks have finished, so a task may hand a nested batch to the same
+// pool without deadlocking it.
+class ThreadPool {
+ public:
+  // Runs the tasks on |num_threads| threads, counting the calling one. Zero
+  // means one thread per hardware thread.
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t getNumThreads() const {
+    return workers_.size() + 1;
+  }
+
+  // Runs every task of |tasks| exactly once, in no particular order. If tasks
+  // throw, the first exception is rethrown once all tasks have finished.
+  void run(const std::vector<std::function<void()>>& tasks);
+
+ private:
+  struct Batch;
+
+  void workerLoop();
+  // Runs the next task of |batch| that no thread has started yet. Returns false
+  // if there is none left.
+  static bool runNextTask(Batch& batch);
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  // batches that may still have tasks nobody has started
+  std::deque<std::shared_ptr<Batch>> batches_;
+  bool stopping_ = false;
+};
+
+}  // namespace optimization
+}  // namespace ONNX_NAMESPACE